@@ -147,13 +147,14 @@ void AppView::OnSuspending(Platform::Object^ sender, SuspendingEventArgs^ args)
 
     create_task([this, deferral] ()
     {
-        m_deviceResources->Trim();
-
+        // Resources the app lets go of are reclaimed by Trim.
         if (m_main != nullptr)
         {
             m_main->SaveAppState();
         }
 
+        m_deviceResources->Trim();
+
         //
         // TODO: Insert code here to save your app state.
         //
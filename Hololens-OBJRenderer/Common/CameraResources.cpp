@@ -11,6 +11,46 @@ using namespace Windows::Graphics::DirectX::Direct3D11;
 using namespace Windows::Graphics::Holographic;
 using namespace Windows::Perception::Spatial;
 
+namespace
+{
+    // Extracts the planes of a view frustum from a transposed view-projection matrix,
+    // normalized and facing out of the frustum as DirectXCollision expects. Each row
+    // of the transposed matrix yields one clip-space coordinate of a point.
+    void ExtractFrustumPlanes(const XMFLOAT4X4& transposedViewProjection, std::array<XMFLOAT4, 6>& planes)
+    {
+        const XMMATRIX m = XMLoadFloat4x4(&transposedViewProjection);
+        const XMVECTOR inward[6] =
+        {
+            m.r[2],                             // near:   z >= 0
+            XMVectorSubtract(m.r[3], m.r[2]),   // far:    z <= w
+            XMVectorAdd(m.r[3], m.r[0]),        // left:   x >= -w
+            XMVectorSubtract(m.r[3], m.r[0]),   // right:  x <= w
+            XMVectorSubtract(m.r[3], m.r[1]),   // top:    y <= w
+            XMVectorAdd(m.r[3], m.r[1])         // bottom: y >= -w
+        };
+        for (size_t i = 0; i < planes.size(); ++i)
+        {
+            XMStoreFloat4(&planes[i], XMPlaneNormalize(XMVectorNegate(inward[i])));
+        }
+    }
+
+    template <typename Bounds>
+    bool IsInEitherFrustum(const Bounds& bounds, const std::array<std::array<XMFLOAT4, 6>, 2>& frusta)
+    {
+        for (const auto& planes : frusta)
+        {
+            const ContainmentType containment = bounds.ContainedBy(
+                XMLoadFloat4(&planes[0]), XMLoadFloat4(&planes[1]), XMLoadFloat4(&planes[2]),
+                XMLoadFloat4(&planes[3]), XMLoadFloat4(&planes[4]), XMLoadFloat4(&planes[5]));
+            if (containment != DISJOINT)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
 DX::CameraResources::CameraResources(HolographicCamera^ camera) :
     m_holographicCamera(camera),
     m_isStereo(camera->IsStereo),
@@ -23,6 +63,17 @@ DX::CameraResources::CameraResources(HolographicCamera^ camera) :
         );
 };
 
+DX::CameraResources::CameraResources(Windows::Foundation::Size renderTargetSize) :
+    m_isStereo(true),
+    m_d3dRenderTargetSize(renderTargetSize)
+{
+    m_d3dViewport = CD3D11_VIEWPORT(
+        0.f, 0.f,
+        m_d3dRenderTargetSize.Width,
+        m_d3dRenderTargetSize.Height
+        );
+}
+
 // Updates resources associated with a holographic camera's swap chain.
 // The app does not access the swap chain directly, but it does create
 // resource views for the back buffer.
@@ -77,6 +128,8 @@ void DX::CameraResources::CreateResourcesForBackBuffer(
         m_d3dBackBuffer->GetDesc(&backBufferDesc);
         m_dxgiFormat = backBufferDesc.Format;
 
+        CreateEyeRenderTargetViews(device);
+
         // Check for render target size changes.
         Windows::Foundation::Size currentSize = m_holographicCamera->RenderTargetSize;
         if (m_d3dRenderTargetSize != currentSize)
@@ -89,6 +142,12 @@ void DX::CameraResources::CreateResourcesForBackBuffer(
         }
     }
 
+    CreateDepthStencilAndConstantBuffer(device);
+}
+
+// Creates the resources that do not depend on the back buffer itself.
+void DX::CameraResources::CreateDepthStencilAndConstantBuffer(ID3D11Device* device)
+{
     // Refresh depth stencil resources, if needed.
     if (m_d3dDepthStencilView == nullptr)
     {
@@ -121,6 +180,30 @@ void DX::CameraResources::CreateResourcesForBackBuffer(
                 &m_d3dDepthStencilView
                 )
             );
+
+        // One view per slice, for drawing each eye on its own.
+        for (UINT eye = 0; eye < m_eyeDepthStencilViews.size(); ++eye)
+        {
+            if (!m_isStereo)
+            {
+                m_eyeDepthStencilViews[eye] = m_d3dDepthStencilView;
+                continue;
+            }
+            const CD3D11_DEPTH_STENCIL_VIEW_DESC eyeViewDesc(
+                D3D11_DSV_DIMENSION_TEXTURE2DARRAY,
+                DXGI_FORMAT_D16_UNORM,
+                0,      // Mip slice.
+                eye,    // First array slice.
+                1       // Array size.
+                );
+            DX::ThrowIfFailed(
+                device->CreateDepthStencilView(
+                    depthStencil.Get(),
+                    &eyeViewDesc,
+                    &m_eyeDepthStencilViews[eye]
+                    )
+                );
+        }
     }
 
     // Create the constant buffer, if needed.
@@ -138,6 +221,72 @@ void DX::CameraResources::CreateResourcesForBackBuffer(
     }
 }
 
+// Creates an offscreen render target with one slice per eye, in the format of the
+// holographic back buffers, so that content renders the same way it does on the
+// device.
+void DX::CameraResources::CreateOffscreenResources(DX::DeviceResources* pDeviceResources)
+{
+    const auto device = pDeviceResources->GetD3DDevice();
+
+    m_dxgiFormat = DXGI_FORMAT_B8G8R8A8_UNORM;
+    if (m_d3dBackBuffer == nullptr)
+    {
+        CD3D11_TEXTURE2D_DESC renderTargetDesc(
+            m_dxgiFormat,
+            static_cast<UINT>(m_d3dRenderTargetSize.Width),
+            static_cast<UINT>(m_d3dRenderTargetSize.Height),
+            2, // One slice per eye.
+            1, // Use a single mipmap level.
+            D3D11_BIND_RENDER_TARGET
+            );
+        DX::ThrowIfFailed(
+            device->CreateTexture2D(
+                &renderTargetDesc,
+                nullptr,
+                &m_d3dBackBuffer
+                )
+            );
+
+        DX::ThrowIfFailed(
+            device->CreateRenderTargetView(
+                m_d3dBackBuffer.Get(),
+                nullptr,
+                &m_d3dRenderTargetView
+                )
+            );
+
+        CreateEyeRenderTargetViews(device);
+    }
+
+    CreateDepthStencilAndConstantBuffer(device);
+}
+
+void DX::CameraResources::CreateEyeRenderTargetViews(ID3D11Device* device)
+{
+    for (UINT eye = 0; eye < m_eyeRenderTargetViews.size(); ++eye)
+    {
+        if (!m_isStereo)
+        {
+            m_eyeRenderTargetViews[eye] = m_d3dRenderTargetView;
+            continue;
+        }
+        const CD3D11_RENDER_TARGET_VIEW_DESC eyeViewDesc(
+            D3D11_RTV_DIMENSION_TEXTURE2DARRAY,
+            m_dxgiFormat,
+            0,      // Mip slice.
+            eye,    // First array slice.
+            1       // Array size.
+            );
+        DX::ThrowIfFailed(
+            device->CreateRenderTargetView(
+                m_d3dBackBuffer.Get(),
+                &eyeViewDesc,
+                &m_eyeRenderTargetViews[eye]
+                )
+            );
+    }
+}
+
 // Releases resources associated with a back buffer.
 void DX::CameraResources::ReleaseResourcesForBackBuffer(DX::DeviceResources* pDeviceResources)
 {
@@ -147,6 +296,14 @@ void DX::CameraResources::ReleaseResourcesForBackBuffer(DX::DeviceResources* pDe
     m_d3dBackBuffer.Reset();
     m_d3dRenderTargetView.Reset();
     m_d3dDepthStencilView.Reset();
+    for (auto& view : m_eyeRenderTargetViews)
+    {
+        view.Reset();
+    }
+    for (auto& view : m_eyeDepthStencilViews)
+    {
+        view.Reset();
+    }
     m_viewProjectionConstantBuffer.Reset();
 
     // Ensure system references to the back buffer are released by clearing the render
@@ -184,31 +341,58 @@ void DX::CameraResources::UpdateViewProjectionBuffer(
     // This usually means that positional tracking is not active for the current frame, in
     // which case it is possible to use a SpatialLocatorAttachedFrameOfReference to render
     // content that is not world-locked instead.
-    DX::ViewProjectionConstantBuffer viewProjectionConstantBufferData;
-    bool viewTransformAcquired = viewTransformContainer != nullptr;
-    if (viewTransformAcquired)
+    if (viewTransformContainer == nullptr)
     {
-        // Otherwise, the set of view transforms can be retrieved.
-        HolographicStereoTransform viewCoordinateSystemTransform = viewTransformContainer->Value;
-
-        // Update the view matrices. Holographic cameras (such as Microsoft HoloLens) are
-        // constantly moving relative to the world. The view matrices need to be updated
-        // every frame.
-        XMStoreFloat4x4(
-            &viewProjectionConstantBufferData.viewProjection[0],
-            XMMatrixTranspose(XMLoadFloat4x4(&viewCoordinateSystemTransform.Left) * XMLoadFloat4x4(&cameraProjectionTransform.Left))
-            );
-        XMStoreFloat4x4(
-            &viewProjectionConstantBufferData.viewProjection[1],
-            XMMatrixTranspose(XMLoadFloat4x4(&viewCoordinateSystemTransform.Right) * XMLoadFloat4x4(&cameraProjectionTransform.Right))
-            );
+        m_framePending = false;
+        return;
     }
 
+    // Otherwise, the set of view transforms can be retrieved.
+    UpdateViewProjectionBuffer(deviceResources, viewTransformContainer->Value, cameraProjectionTransform);
+}
+
+// Updates the view/projection constant buffer from the view and projection transforms
+// of both eyes.
+void DX::CameraResources::UpdateViewProjectionBuffer(
+    std::shared_ptr<DX::DeviceResources> deviceResources,
+    const HolographicStereoTransform& viewCoordinateSystemTransform,
+    const HolographicStereoTransform& cameraProjectionTransform
+    )
+{
+    // Update the view matrices. Holographic cameras (such as Microsoft HoloLens) are
+    // constantly moving relative to the world. The view matrices need to be updated
+    // every frame.
+    DX::ViewProjectionConstantBuffer viewProjectionConstantBufferData;
+    XMStoreFloat4x4(
+        &viewProjectionConstantBufferData.viewProjection[0],
+        XMMatrixTranspose(XMLoadFloat4x4(&viewCoordinateSystemTransform.Left) * XMLoadFloat4x4(&cameraProjectionTransform.Left))
+        );
+    XMStoreFloat4x4(
+        &viewProjectionConstantBufferData.viewProjection[1],
+        XMMatrixTranspose(XMLoadFloat4x4(&viewCoordinateSystemTransform.Right) * XMLoadFloat4x4(&cameraProjectionTransform.Right))
+        );
+
+    // Each eye is at the translation of its inverse view transform.
+    const XMVECTOR leftEye = XMMatrixInverse(nullptr, XMLoadFloat4x4(&viewCoordinateSystemTransform.Left)).r[3];
+    const XMVECTOR rightEye = XMMatrixInverse(nullptr, XMLoadFloat4x4(&viewCoordinateSystemTransform.Right)).r[3];
+    XMStoreFloat3(&m_viewPosition, XMVectorScale(XMVectorAdd(leftEye, rightEye), 0.5f));
+    m_viewRadius = 0.5f * XMVectorGetX(XMVector3Length(XMVectorSubtract(rightEye, leftEye)));
+
+    // The projection scales the tangent of the view angle by _22 into the half
+    // height of the viewport, which is smaller than the target when the viewport is
+    // scaled down.
+    m_pixelsPerRadian = cameraProjectionTransform.Left.m22 * 0.5f * m_d3dViewport.Height;
+
+    // Keep the frusta of both eyes for culling. Content seen by either eye must
+    // be drawn.
+    ExtractFrustumPlanes(viewProjectionConstantBufferData.viewProjection[0], m_frustumPlanes[0]);
+    ExtractFrustumPlanes(viewProjectionConstantBufferData.viewProjection[1], m_frustumPlanes[1]);
+
     // Use the D3D device context to update Direct3D device-based resources.
     const auto context = deviceResources->GetD3DDeviceContext();
 
     // Loading is asynchronous. Resources must be created before they can be updated.
-    if (context == nullptr || m_viewProjectionConstantBuffer == nullptr || !viewTransformAcquired)
+    if (context == nullptr || m_viewProjectionConstantBuffer == nullptr)
     {
         m_framePending = false;
     }
@@ -245,15 +429,7 @@ bool DX::CameraResources::AttachViewProjectionBuffer(
         return false;
     }
 
-    // Set the viewport for this camera.
-    context->RSSetViewports(1, &m_d3dViewport);
-
-    // Send the constant buffer to the vertex shader.
-    context->VSSetConstantBuffers(
-        1,
-        1,
-        m_viewProjectionConstantBuffer.GetAddressOf()
-        );
+    BindViewProjectionBuffer(context);
 
     // The template includes a pass-through geometry shader that is used by
     // default on systems that don't support the D3D11_FEATURE_D3D11_OPTIONS3::
@@ -272,3 +448,26 @@ bool DX::CameraResources::AttachViewProjectionBuffer(
 
     return true;
 }
+
+void DX::CameraResources::BindViewProjectionBuffer(ID3D11DeviceContext* context) const
+{
+    // Set the viewport for this camera.
+    context->RSSetViewports(1, &m_d3dViewport);
+
+    // Send the constant buffer to the vertex shader.
+    context->VSSetConstantBuffers(
+        1,
+        1,
+        m_viewProjectionConstantBuffer.GetAddressOf()
+        );
+}
+
+bool DX::CameraResources::IsInView(const BoundingSphere& bounds) const
+{
+    return IsInEitherFrustum(bounds, m_frustumPlanes);
+}
+
+bool DX::CameraResources::IsInView(const BoundingOrientedBox& bounds) const
+{
+    return IsInEitherFrustum(bounds, m_frustumPlanes);
+}
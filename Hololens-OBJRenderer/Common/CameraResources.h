@@ -20,6 +20,11 @@ namespace DX
     public:
         CameraResources(Windows::Graphics::Holographic::HolographicCamera^ holographicCamera);
 
+        // Resources for a stereo render target of the given size that belongs to no
+        // holographic camera, such as the offscreen target of the render benchmark.
+        // Create them with CreateOffscreenResources.
+        CameraResources(Windows::Foundation::Size renderTargetSize);
+
         void CreateResourcesForBackBuffer(
             DX::DeviceResources* pDeviceResources,
             Windows::Graphics::Holographic::HolographicCameraRenderingParameters^ cameraParameters
@@ -28,14 +33,31 @@ namespace DX
             DX::DeviceResources* pDeviceResources
             );
 
+        // Creates a two-slice Texture2DArray to render to in place of a back buffer.
+        void CreateOffscreenResources(
+            DX::DeviceResources* pDeviceResources
+            );
+
         void UpdateViewProjectionBuffer(
             std::shared_ptr<DX::DeviceResources> deviceResources,
             Windows::Graphics::Holographic::HolographicCameraPose^ cameraPose,
             Windows::Perception::Spatial::SpatialCoordinateSystem^ coordinateSystem);
 
+        // Same, from view and projection transforms given for each eye rather than
+        // predicted by the system.
+        void UpdateViewProjectionBuffer(
+            std::shared_ptr<DX::DeviceResources> deviceResources,
+            const Windows::Graphics::Holographic::HolographicStereoTransform& viewTransform,
+            const Windows::Graphics::Holographic::HolographicStereoTransform& projectionTransform);
+
         bool AttachViewProjectionBuffer(
             std::shared_ptr<DX::DeviceResources> deviceResources);
 
+        // Sets the viewport and view/projection constant buffer of this camera on
+        // context. Used by deferred contexts, which start from the default state; the
+        // buffer must already be attached for the current frame.
+        void BindViewProjectionBuffer(ID3D11DeviceContext* context) const;
+
         // Direct3D device resources.
         ID3D11RenderTargetView* GetBackBufferRenderTargetView()     const { return m_d3dRenderTargetView.Get();     }
         ID3D11DepthStencilView* GetDepthStencilView()               const { return m_d3dDepthStencilView.Get();     }
@@ -43,18 +65,47 @@ namespace DX
         D3D11_VIEWPORT          GetViewport()                       const { return m_d3dViewport;                   }
         DXGI_FORMAT             GetBackBufferDXGIFormat()           const { return m_dxgiFormat;                    }
 
+        // Views of the slice of one eye, for drawing each eye on its own. The same as
+        // the views of the whole target for a mono camera.
+        ID3D11RenderTargetView* GetEyeRenderTargetView(size_t eye)  const { return m_eyeRenderTargetViews[eye].Get(); }
+        ID3D11DepthStencilView* GetEyeDepthStencilView(size_t eye)  const { return m_eyeDepthStencilViews[eye].Get(); }
+
         // Render target properties.
         Windows::Foundation::Size GetRenderTargetSize()             const { return m_d3dRenderTargetSize;           }
         bool                    IsRenderingStereoscopic()           const { return m_isStereo;                      }
 
-        // The holographic camera these resources are for.
+        // Position of the camera, halfway between the eyes, in the coordinate system
+        // passed to the last UpdateViewProjectionBuffer call.
+        DirectX::XMFLOAT3       GetViewPosition()                   const { return m_viewPosition;                  }
+        // Half the distance between the eyes. Every eye is within this distance of the
+        // view position.
+        float                   GetViewRadius()                     const { return m_viewRadius;                    }
+        // Vertical pixels per radian of view angle at the center of the view, for
+        // estimating how large content appears on screen.
+        float                   GetPixelsPerRadian()                const { return m_pixelsPerRadian;               }
+
+        // Tests bounds in the coordinate system passed to the last UpdateViewProjectionBuffer
+        // call against the view frusta of both eyes. Bounds seen by either eye are in view.
+        bool                    IsInView(const DirectX::BoundingSphere& bounds) const;
+        bool                    IsInView(const DirectX::BoundingOrientedBox& bounds) const;
+
+        // The holographic camera these resources are for, or nullptr for an offscreen
+        // target.
         Windows::Graphics::Holographic::HolographicCamera^ GetHolographicCamera() const { return m_holographicCamera; }
 
     private:
+        // Creates the depth buffer and view/projection constant buffer, if needed.
+        void CreateDepthStencilAndConstantBuffer(ID3D11Device* device);
+
+        // Creates the render target views of each eye, for the current back buffer.
+        void CreateEyeRenderTargetViews(ID3D11Device* device);
+
         // Direct3D rendering objects. Required for 3D.
         Microsoft::WRL::ComPtr<ID3D11RenderTargetView>      m_d3dRenderTargetView;
         Microsoft::WRL::ComPtr<ID3D11DepthStencilView>      m_d3dDepthStencilView;
         Microsoft::WRL::ComPtr<ID3D11Texture2D>             m_d3dBackBuffer;
+        std::array<Microsoft::WRL::ComPtr<ID3D11RenderTargetView>, 2> m_eyeRenderTargetViews;
+        std::array<Microsoft::WRL::ComPtr<ID3D11DepthStencilView>, 2> m_eyeDepthStencilViews;
 
         // Device resource to store view and projection matrices.
         Microsoft::WRL::ComPtr<ID3D11Buffer>                m_viewProjectionConstantBuffer;
@@ -63,6 +114,13 @@ namespace DX
         DXGI_FORMAT                                         m_dxgiFormat;
         Windows::Foundation::Size                           m_d3dRenderTargetSize;
         D3D11_VIEWPORT                                      m_d3dViewport;
+        DirectX::XMFLOAT3                                   m_viewPosition = { 0.f, 0.f, 0.f };
+        float                                               m_viewRadius = 0.f;
+        float                                               m_pixelsPerRadian = 0.f;
+
+        // Planes of the left and right eye frusta, facing outwards: near, far, left,
+        // right, top, bottom.
+        std::array<std::array<DirectX::XMFLOAT4, 6>, 2>     m_frustumPlanes = {};
 
         // Indicates whether the camera supports stereoscopic rendering.
         bool                                                m_isStereo = false;
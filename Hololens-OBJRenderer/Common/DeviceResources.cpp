@@ -221,6 +221,8 @@ void DX::DeviceResources::CreateDeviceResources()
     {
         m_supportsVprt = true;
     }
+
+    m_frameProfiler.CreateDeviceDependentResources(m_d3dDevice.Get());
 }
 
 // Validates the back buffer for each HolographicCamera and recreates
@@ -230,6 +232,8 @@ void DX::DeviceResources::EnsureCameraResources(
     HolographicFrame^ frame,
     HolographicFramePrediction^ prediction)
 {
+    FrameProfiler::ScopedCpuTimer timer(m_frameProfiler, FrameProfiler::CpuScope::EnsureCameraResources);
+
     UseHolographicCameraResources<void>([this, frame, prediction](std::map<UINT32, std::unique_ptr<CameraResources>>& cameraResourceMap)
     {
         for (HolographicCameraPose^ pose : prediction->CameraPoses)
@@ -286,6 +290,8 @@ void DX::DeviceResources::HandleDeviceLost()
         }
     });
 
+    m_frameProfiler.ReleaseDeviceDependentResources();
+
     InitializeUsingHolographicSpace();
 
     if (m_deviceNotify != nullptr)
@@ -319,7 +325,11 @@ void DX::DeviceResources::Present(HolographicFrame^ frame)
     // Holographic apps should wait for the previous frame to finish before
     // starting work on a new frame. This allows for better results from
     // holographic frame predictions.
-    HolographicFramePresentResult presentResult = frame->PresentUsingCurrentPrediction();
+    HolographicFramePresentResult presentResult;
+    {
+        FrameProfiler::ScopedCpuTimer timer(m_frameProfiler, FrameProfiler::CpuScope::Present);
+        presentResult = frame->PresentUsingCurrentPrediction();
+    }
 
     HolographicFramePrediction^ prediction = frame->CurrentPrediction;
     UseHolographicCameraResources<void>([this, prediction](std::map<UINT32, std::unique_ptr<CameraResources>>& cameraResourceMap)
@@ -340,6 +350,9 @@ void DX::DeviceResources::Present(HolographicFrame^ frame)
         }
     });
 
+    // Close the profiled frame before a lost device invalidates its queries.
+    m_frameProfiler.EndFrame(m_d3dContext.Get());
+
     // The PresentUsingCurrentPrediction API will detect when the graphics device
     // changes or becomes invalid. When this happens, it is considered a Direct3D
     // device lost scenario.
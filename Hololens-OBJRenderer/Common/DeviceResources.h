@@ -2,6 +2,7 @@
 #pragma once
 
 #include "CameraResources.h"
+#include "FrameProfiler.h"
 
 namespace DX
 {
@@ -54,6 +55,9 @@ namespace DX
         IDWriteFactory2*        GetDWriteFactory() const                { return m_dwriteFactory.Get(); }
         IWICImagingFactory2*    GetWicImagingFactory() const            { return m_wicFactory.Get();    }
 
+        // Profiler accessor. Present closes each profiled frame.
+        FrameProfiler&          GetFrameProfiler()                      { return m_frameProfiler;       }
+
     private:
         // Private methods related to the Direct3D device, and resources based on that device.
         void CreateDeviceIndependentResources();
@@ -89,6 +93,9 @@ namespace DX
         // Back buffer resources, etc. for attached holographic cameras.
         std::map<UINT32, std::unique_ptr<CameraResources>>      m_cameraResources;
         std::mutex                                              m_cameraResourcesLock;
+
+        // Frame timing, with queries on the current device.
+        FrameProfiler                                           m_frameProfiler;
     };
 }
 
@@ -1,6 +1,9 @@
 ﻿#pragma once
 
 #include <ppltasks.h>    // For create_task
+#include <map>
+#include <memory>
+#include <mutex>
 
 namespace DX
 {
@@ -29,6 +32,30 @@ namespace DX
             });
     }
 
+    // Same as ReadDataAsync, for files that are read again whenever the device is
+    // created, such as compiled shaders. Their contents stay in memory after the
+    // first read, so that later reads complete right away.
+    inline Concurrency::task<std::vector<byte>> ReadCachedDataAsync(const std::wstring& filename)
+    {
+        static std::mutex cacheMutex;
+        static std::map<std::wstring, std::shared_ptr<const std::vector<byte>>> cache;
+        {
+            std::lock_guard<std::mutex> lock(cacheMutex);
+            const auto found = cache.find(filename);
+            if (found != cache.end())
+            {
+                return Concurrency::task_from_result(*found->second);
+            }
+        }
+
+        return ReadDataAsync(filename).then([filename] (const std::vector<byte>& fileData)
+        {
+            std::lock_guard<std::mutex> lock(cacheMutex);
+            cache[filename] = std::make_shared<const std::vector<byte>>(fileData);
+            return fileData;
+        });
+    }
+
     // Converts a length in device-independent pixels (DIPs) to a length in physical pixels.
     inline float ConvertDipsToPixels(float dips, float dpi)
     {
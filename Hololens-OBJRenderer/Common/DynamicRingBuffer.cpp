@@ -0,0 +1,53 @@
+#include "pch.h"
+#include "DynamicRingBuffer.h"
+#include "DirectXHelper.h"
+
+void DX::DynamicRingBuffer::Create(ID3D11Device* device, UINT byteWidth, UINT bindFlags)
+{
+    m_buffer.Reset();
+
+    const CD3D11_BUFFER_DESC bufferDesc(byteWidth, bindFlags, D3D11_USAGE_DYNAMIC, D3D11_CPU_ACCESS_WRITE);
+    DX::ThrowIfFailed(
+        device->CreateBuffer(
+            &bufferDesc,
+            nullptr,
+            &m_buffer
+            )
+        );
+
+    m_capacity = byteWidth;
+
+    // The first map of a new buffer must discard.
+    m_position = byteWidth;
+}
+
+void DX::DynamicRingBuffer::Release()
+{
+    m_buffer.Reset();
+    m_capacity = 0;
+    m_position = 0;
+}
+
+void* DX::DynamicRingBuffer::Map(ID3D11DeviceContext* context, UINT size, UINT& offset)
+{
+    D3D11_MAP mapType = D3D11_MAP_WRITE_NO_OVERWRITE;
+    if (m_position + size > m_capacity)
+    {
+        mapType = D3D11_MAP_WRITE_DISCARD;
+        m_position = 0;
+    }
+
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    DX::ThrowIfFailed(
+        context->Map(m_buffer.Get(), 0, mapType, 0, &mapped)
+        );
+
+    offset = m_position;
+    m_position += size;
+    return static_cast<byte*>(mapped.pData) + offset;
+}
+
+void DX::DynamicRingBuffer::Unmap(ID3D11DeviceContext* context)
+{
+    context->Unmap(m_buffer.Get(), 0);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+namespace DX
+{
+    // A dynamic buffer that is written front to back, several times per frame, without
+    // stalling. Each allocation maps the buffer with D3D11_MAP_WRITE_NO_OVERWRITE
+    // after the data of earlier allocations, which the GPU may still be reading; once
+    // the end is reached, the buffer is renamed with D3D11_MAP_WRITE_DISCARD and
+    // filling starts over at the front.
+    class DynamicRingBuffer
+    {
+    public:
+        // Creates the buffer, discarding any previous one. NO_OVERWRITE maps are
+        // always allowed for vertex and index buffers; other bind flags require
+        // D3D11_FEATURE_DATA_D3D11_OPTIONS::MapNoOverwriteOnDynamicBufferSRV.
+        void Create(ID3D11Device* device, UINT byteWidth, UINT bindFlags);
+        void Release();
+
+        // Maps size bytes, at most the capacity, and returns where they start in the
+        // buffer through offset. Unmap before drawing with the data.
+        void* Map(ID3D11DeviceContext* context, UINT size, UINT& offset);
+        void Unmap(ID3D11DeviceContext* context);
+
+        ID3D11Buffer*           GetBuffer() const               { return m_buffer.Get();                    }
+        ID3D11Buffer* const*    GetAddressOf() const            { return m_buffer.GetAddressOf();           }
+        UINT                    GetCapacity() const             { return m_capacity;                        }
+
+    private:
+        Microsoft::WRL::ComPtr<ID3D11Buffer>                    m_buffer;
+        UINT                                                    m_capacity = 0;
+        UINT                                                    m_position = 0;
+    };
+}
@@ -0,0 +1,228 @@
+#include "pch.h"
+#include "FrameProfiler.h"
+#include "DirectXHelper.h"
+
+#include <algorithm>
+
+namespace
+{
+    const wchar_t* const c_cpuScopeNames[] =
+    {
+        L"Update",
+        L"EnsureCameraResources",
+        L"Render",
+        L"RenderCameras",
+        L"Present"
+    };
+
+    static_assert(_countof(c_cpuScopeNames) == static_cast<size_t>(DX::FrameProfiler::CpuScope::Count), "Every CPU scope needs a name.");
+}
+
+DX::FrameProfiler::FrameProfiler()
+{
+    m_msPerQpcTick = 1000.0 / static_cast<double>(StepTimer::GetPerformanceFrequency());
+    m_currentFrame.fill(0);
+}
+
+void DX::FrameProfiler::CreateDeviceDependentResources(ID3D11Device* device)
+{
+    const CD3D11_QUERY_DESC disjointDesc(D3D11_QUERY_TIMESTAMP_DISJOINT);
+    const CD3D11_QUERY_DESC timestampDesc(D3D11_QUERY_TIMESTAMP);
+    for (GpuQuerySet& querySet : m_gpuQueries)
+    {
+        DX::ThrowIfFailed(
+            device->CreateQuery(&disjointDesc, &querySet.disjoint)
+            );
+        for (auto& timestamp : querySet.timestamps)
+        {
+            DX::ThrowIfFailed(
+                device->CreateQuery(&timestampDesc, &timestamp)
+                );
+        }
+        querySet.scopeCount = 0;
+        querySet.open = false;
+        querySet.pending = false;
+        querySet.overflow = false;
+    }
+}
+
+void DX::FrameProfiler::ReleaseDeviceDependentResources()
+{
+    for (GpuQuerySet& querySet : m_gpuQueries)
+    {
+        querySet.disjoint.Reset();
+        for (auto& timestamp : querySet.timestamps)
+        {
+            timestamp.Reset();
+        }
+        querySet.open = false;
+        querySet.pending = false;
+    }
+}
+
+void DX::FrameProfiler::AddCpuTime(CpuScope scope, int64 qpcTicks)
+{
+    m_currentFrame[static_cast<size_t>(scope)] += qpcTicks;
+}
+
+void DX::FrameProfiler::BeginGpuScope(ID3D11DeviceContext* context)
+{
+    GpuQuerySet& querySet = m_gpuQueries[m_currentQuerySet];
+    if (querySet.disjoint == nullptr)
+    {
+        return;
+    }
+
+    // The disjoint query spans every scope of the frame.
+    if (!querySet.open)
+    {
+        context->Begin(querySet.disjoint.Get());
+        querySet.open = true;
+        querySet.scopeCount = 0;
+        querySet.overflow = false;
+    }
+
+    if (querySet.scopeCount == c_maxGpuScopes)
+    {
+        querySet.overflow = true;
+        return;
+    }
+    context->End(querySet.timestamps[2 * querySet.scopeCount].Get());
+}
+
+void DX::FrameProfiler::EndGpuScope(ID3D11DeviceContext* context)
+{
+    GpuQuerySet& querySet = m_gpuQueries[m_currentQuerySet];
+    if (!querySet.open || querySet.overflow)
+    {
+        return;
+    }
+    context->End(querySet.timestamps[2 * querySet.scopeCount + 1].Get());
+    ++querySet.scopeCount;
+}
+
+void DX::FrameProfiler::EndFrame(ID3D11DeviceContext* context)
+{
+    // Record the CPU times of the frame.
+    const size_t frame = m_cpuFrames % c_historySize;
+    for (size_t scope = 0; scope < m_currentFrame.size(); ++scope)
+    {
+        m_cpuHistory[scope][frame] = static_cast<float>(m_currentFrame[scope] * m_msPerQpcTick);
+    }
+    m_currentFrame.fill(0);
+    ++m_cpuFrames;
+
+    // Close the queries of this frame, then move on to the oldest set. Its results
+    // are usually ready by now; if they are not, that frame is not timed rather
+    // than waiting for the GPU.
+    GpuQuerySet& querySet = m_gpuQueries[m_currentQuerySet];
+    if (querySet.open)
+    {
+        context->End(querySet.disjoint.Get());
+        querySet.open = false;
+        querySet.pending = !querySet.overflow && querySet.scopeCount > 0;
+    }
+    m_currentQuerySet = (m_currentQuerySet + 1) % c_gpuQuerySets;
+    CollectGpuQueries(context, m_gpuQueries[m_currentQuerySet]);
+
+    if (m_cpuFrames % c_statsInterval == 0)
+    {
+        UpdateStats();
+    }
+    if (m_reportInterval != 0 && m_cpuFrames % m_reportInterval == 0)
+    {
+        Report();
+    }
+}
+
+void DX::FrameProfiler::CollectGpuQueries(ID3D11DeviceContext* context, GpuQuerySet& querySet)
+{
+    if (!querySet.pending)
+    {
+        return;
+    }
+    querySet.pending = false;
+
+    D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+    if (context->GetData(querySet.disjoint.Get(), &disjoint, sizeof(disjoint), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+        disjoint.Disjoint)
+    {
+        return;
+    }
+
+    uint64 ticks = 0;
+    for (size_t i = 0; i < querySet.scopeCount; ++i)
+    {
+        UINT64 begin;
+        UINT64 end;
+        if (context->GetData(querySet.timestamps[2 * i].Get(), &begin, sizeof(begin), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK ||
+            context->GetData(querySet.timestamps[2 * i + 1].Get(), &end, sizeof(end), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+        {
+            return;
+        }
+        ticks += end - begin;
+    }
+
+    m_gpuHistory[m_gpuFrames % c_historySize] = static_cast<float>(1000.0 * static_cast<double>(ticks) / static_cast<double>(disjoint.Frequency));
+    ++m_gpuFrames;
+}
+
+void DX::FrameProfiler::UpdateStats()
+{
+    const size_t historySize = c_historySize;
+    const size_t cpuCount = (std::min)(m_cpuFrames, historySize);
+    for (size_t scope = 0; scope < m_cpuHistory.size(); ++scope)
+    {
+        m_stats.cpu[scope] = ComputePercentiles(m_cpuHistory[scope].data(), cpuCount, m_scratch);
+    }
+    const size_t gpuCount = (std::min)(m_gpuFrames, historySize);
+    m_stats.gpu = ComputePercentiles(m_gpuHistory.data(), gpuCount, m_scratch);
+    m_stats.frameCount = static_cast<uint32>(cpuCount);
+    m_stats.gpuFrameCount = static_cast<uint32>(gpuCount);
+}
+
+void DX::FrameProfiler::Report() const
+{
+    wchar_t message[512];
+    int length = swprintf_s(message, L"Frame profile over %u frames, ms p50/p99:", m_stats.frameCount);
+    for (size_t scope = 0; scope < m_stats.cpu.size() && length > 0; ++scope)
+    {
+        length += swprintf_s(
+            message + length,
+            _countof(message) - length,
+            L" %s %.2f/%.2f",
+            c_cpuScopeNames[scope],
+            m_stats.cpu[scope].p50,
+            m_stats.cpu[scope].p99);
+    }
+    if (length > 0)
+    {
+        swprintf_s(
+            message + length,
+            _countof(message) - length,
+            L" GPU %.2f/%.2f (%u frames)\n",
+            m_stats.gpu.p50,
+            m_stats.gpu.p99,
+            m_stats.gpuFrameCount);
+        OutputDebugStringW(message);
+    }
+}
+
+DX::FrameProfiler::Percentiles DX::FrameProfiler::ComputePercentiles(const float* samples, size_t count, std::vector<float>& scratch)
+{
+    Percentiles percentiles;
+    if (count == 0)
+    {
+        return percentiles;
+    }
+
+    scratch.assign(samples, samples + count);
+    const auto p50 = scratch.begin() + count / 2;
+    std::nth_element(scratch.begin(), p50, scratch.end());
+    percentiles.p50 = *p50;
+
+    const auto p99 = scratch.begin() + (count * 99) / 100;
+    std::nth_element(scratch.begin(), p99, scratch.end());
+    percentiles.p99 = *p99;
+    return percentiles;
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include "StepTimer.h"
+
+#include <vector>
+
+namespace DX
+{
+    // Measures where the time of each frame goes: CPU time in a few fixed scopes of the
+    // frame loop, timed with QueryPerformanceCounter, and GPU time of the camera
+    // passes, timed with timestamp queries that are read back a few frames later
+    // without stalling. The last frames are kept in a ring buffer, and their median
+    // and 99th percentile are reported with OutputDebugString every few seconds.
+    // Everything runs on the rendering thread; recording a frame costs a few counter
+    // reads and queries, so the profiler can stay on in release builds.
+    class FrameProfiler
+    {
+    public:
+        enum class CpuScope
+        {
+            Update,
+            EnsureCameraResources,
+            Render,
+            RenderCameras,      // The part of Render that holds the camera resources lock.
+            Present,
+            Count
+        };
+
+        // Adds the time between construction and destruction to scope, for the
+        // current frame.
+        class ScopedCpuTimer
+        {
+        public:
+            ScopedCpuTimer(FrameProfiler& profiler, CpuScope scope) :
+                m_profiler(profiler),
+                m_scope(scope),
+                m_start(StepTimer::GetTicks())
+            {
+            }
+
+            ~ScopedCpuTimer()
+            {
+                m_profiler.AddCpuTime(m_scope, StepTimer::GetTicks() - m_start);
+            }
+
+        private:
+            FrameProfiler&  m_profiler;
+            CpuScope        m_scope;
+            int64           m_start;
+        };
+
+        // Median and 99th percentile over the frames in the history, in milliseconds.
+        struct Percentiles
+        {
+            float p50 = 0.f;
+            float p99 = 0.f;
+        };
+
+        struct FrameStats
+        {
+            std::array<Percentiles, static_cast<size_t>(CpuScope::Count)>   cpu;
+            Percentiles                                                     gpu;
+            uint32                                                          frameCount = 0;
+            uint32                                                          gpuFrameCount = 0;
+        };
+
+        FrameProfiler();
+
+        void CreateDeviceDependentResources(ID3D11Device* device);
+        void ReleaseDeviceDependentResources();
+
+        void AddCpuTime(CpuScope scope, int64 qpcTicks);
+
+        // Brackets GPU work, such as the draws of one camera, on the immediate
+        // context. Frames with more scopes than fit in a query set are not timed.
+        void BeginGpuScope(ID3D11DeviceContext* context);
+        void EndGpuScope(ID3D11DeviceContext* context);
+
+        // Closes the current frame. Call once per frame, after presenting.
+        void EndFrame(ID3D11DeviceContext* context);
+
+        // Frames between reports with OutputDebugString; 0 stops the reports. The
+        // statistics are still computed for GetStats.
+        void SetReportInterval(uint32 frames)                           { m_reportInterval = frames;  }
+        const FrameStats& GetStats() const                              { return m_stats;             }
+
+        // The GPU time of the newest timed frame, in milliseconds, and the number of
+        // frames timed so far, which changes when a new one arrives. GPU times lag
+        // the frame being recorded by c_gpuQuerySets - 1 frames or more.
+        float GetLatestGpuTime() const                                  { return m_gpuFrames > 0 ? m_gpuHistory[(m_gpuFrames - 1) % c_historySize] : 0.f; }
+        size_t GetGpuFrameCount() const                                 { return m_gpuFrames;         }
+
+    private:
+        static const size_t c_historySize       = 256;
+        static const size_t c_maxGpuScopes      = 4;
+        static const size_t c_gpuQuerySets      = 4;
+        static const uint32 c_statsInterval     = 60;
+
+        // The queries of one frame. They are read back c_gpuQuerySets - 1 frames after
+        // they were issued.
+        struct GpuQuerySet
+        {
+            Microsoft::WRL::ComPtr<ID3D11Query>                         disjoint;
+            std::array<Microsoft::WRL::ComPtr<ID3D11Query>, 2 * c_maxGpuScopes> timestamps;
+            size_t                                                      scopeCount = 0;
+            bool                                                        open = false;
+            bool                                                        pending = false;
+            bool                                                        overflow = false;
+        };
+
+        void CollectGpuQueries(ID3D11DeviceContext* context, GpuQuerySet& querySet);
+        void UpdateStats();
+        void Report() const;
+
+        static Percentiles ComputePercentiles(const float* samples, size_t count, std::vector<float>& scratch);
+
+        double                                                          m_msPerQpcTick;
+
+        // CPU time of each scope in the current frame, in QueryPerformanceCounter ticks.
+        std::array<int64, static_cast<size_t>(CpuScope::Count)>         m_currentFrame;
+
+        // The last c_historySize frames, in milliseconds. GPU times arrive late and
+        // have a ring buffer of their own.
+        std::array<std::array<float, c_historySize>, static_cast<size_t>(CpuScope::Count)> m_cpuHistory;
+        std::array<float, c_historySize>                                m_gpuHistory;
+        size_t                                                          m_cpuFrames = 0;
+        size_t                                                          m_gpuFrames = 0;
+
+        std::array<GpuQuerySet, c_gpuQuerySets>                         m_gpuQueries;
+        size_t                                                          m_currentQuerySet = 0;
+
+        FrameStats                                                      m_stats;
+        std::vector<float>                                              m_scratch;
+        uint32                                                          m_reportInterval = 300;
+    };
+}
@@ -0,0 +1,110 @@
+#include "pch.h"
+#include "MappedFile.h"
+
+DX::MappedFile::MappedFile(const std::wstring& fileName)
+{
+    Open(fileName);
+}
+
+DX::MappedFile::~MappedFile()
+{
+    Close();
+}
+
+DX::MappedFile::MappedFile(MappedFile&& other) :
+    m_file(other.m_file),
+    m_mapping(other.m_mapping),
+    m_data(other.m_data),
+    m_size(other.m_size)
+{
+    other.m_file = INVALID_HANDLE_VALUE;
+    other.m_mapping = nullptr;
+    other.m_data = nullptr;
+    other.m_size = 0;
+}
+
+DX::MappedFile& DX::MappedFile::operator=(MappedFile&& other)
+{
+    if (this != &other)
+    {
+        Close();
+        std::swap(m_file, other.m_file);
+        std::swap(m_mapping, other.m_mapping);
+        std::swap(m_data, other.m_data);
+        std::swap(m_size, other.m_size);
+    }
+    return *this;
+}
+
+// Opens the file and maps a read-only view of all of it. Uses the *FromApp
+// variants of the file mapping functions, which are the ones available to
+// apps running in the app container.
+bool DX::MappedFile::Open(const std::wstring& fileName)
+{
+    Close();
+
+    m_file = CreateFile2(
+        fileName.c_str(),
+        GENERIC_READ,
+        FILE_SHARE_READ,
+        OPEN_EXISTING,
+        nullptr
+        );
+    if (m_file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(m_file, &fileSize) || (static_cast<unsigned long long>(fileSize.QuadPart) > SIZE_MAX))
+    {
+        Close();
+        return false;
+    }
+
+    // Empty files cannot be mapped, but they are still valid (empty) input.
+    if (fileSize.QuadPart == 0)
+    {
+        return true;
+    }
+
+    m_mapping = CreateFileMappingFromApp(m_file, nullptr, PAGE_READONLY, 0, nullptr);
+    if (m_mapping == nullptr)
+    {
+        Close();
+        return false;
+    }
+
+    m_data = static_cast<const char*>(MapViewOfFileFromApp(m_mapping, FILE_MAP_READ, 0, 0));
+    if (m_data == nullptr)
+    {
+        Close();
+        return false;
+    }
+
+    m_size = static_cast<size_t>(fileSize.QuadPart);
+    return true;
+}
+
+void DX::MappedFile::Close()
+{
+    if (m_data != nullptr)
+    {
+        UnmapViewOfFile(m_data);
+        m_data = nullptr;
+    }
+
+    if (m_mapping != nullptr)
+    {
+        CloseHandle(m_mapping);
+        m_mapping = nullptr;
+    }
+
+    if (m_file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+    }
+
+    m_size = 0;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+namespace DX
+{
+    // Read-only memory mapping of a file. The contents are exposed as one contiguous
+    // span that stays valid for the lifetime of the object, so parsers can work on it
+    // in place without any stream or copy in between.
+    class MappedFile
+    {
+    public:
+        MappedFile() = default;
+        explicit MappedFile(const std::wstring& fileName);
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        MappedFile(MappedFile&& other);
+        MappedFile& operator=(MappedFile&& other);
+
+        // Maps the file, releasing any previous mapping. Returns false if the file
+        // could not be opened or mapped.
+        bool Open(const std::wstring& fileName);
+        void Close();
+
+        bool                    IsOpen() const                  { return m_file != INVALID_HANDLE_VALUE;    }
+        const char*             GetData() const                 { return m_data;                            }
+        const char*             GetEnd() const                  { return m_data + m_size;                   }
+        size_t                  GetSize() const                 { return m_size;                            }
+
+    private:
+        HANDLE                                                  m_file = INVALID_HANDLE_VALUE;
+        HANDLE                                                  m_mapping = nullptr;
+        const char*                                             m_data = nullptr;
+        size_t                                                  m_size = 0;
+    };
+}
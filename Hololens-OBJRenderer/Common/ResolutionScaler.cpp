@@ -0,0 +1,85 @@
+#include "pch.h"
+#include "ResolutionScaler.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace Windows::Graphics::Holographic;
+
+void DX::ResolutionScaler::AddGpuTime(float milliseconds)
+{
+    if (m_framesToSettle > 0)
+    {
+        // Drawn before the last step.
+        --m_framesToSettle;
+        return;
+    }
+
+    m_averageGpuTime += c_smoothing * (milliseconds - m_averageGpuTime);
+    if (!m_enabled || m_averageGpuTime <= 0.f)
+    {
+        return;
+    }
+
+    // Only a run of frames on one side of the thresholds counts; frames in between
+    // start the runs over.
+    const float utilization = m_averageGpuTime / m_frameBudget;
+    m_framesOver = utilization > c_downThreshold ? m_framesOver + 1 : 0;
+    m_framesUnder = utilization < c_upThreshold ? m_framesUnder + 1 : 0;
+
+    const float step = std::sqrt(c_targetUtilization / utilization);
+    if (m_framesOver >= c_framesBeforeDown)
+    {
+        SetScale(m_scale * step);
+    }
+    else if (m_framesUnder >= c_framesBeforeUp)
+    {
+        SetScale((std::min)(m_scale * step, m_scale + c_maxStepUp));
+    }
+}
+
+void DX::ResolutionScaler::SetScale(float scale)
+{
+    scale = (std::max)(m_minScale, (std::min)(scale, m_maxScale));
+    m_framesOver = 0;
+    m_framesUnder = 0;
+    if (scale == m_scale || (std::abs(scale - m_scale) < c_minStep && scale != m_minScale && scale != m_maxScale))
+    {
+        return;
+    }
+
+    // The average now mixes frames at two scales; start it from what the new scale
+    // should cost.
+    m_averageGpuTime *= (scale * scale) / (m_scale * m_scale);
+    m_scale = scale;
+    m_framesToSettle = c_settleFrames;
+}
+
+void DX::ResolutionScaler::ApplyTo(HolographicFramePrediction^ prediction) const
+{
+    for (HolographicCameraPose^ cameraPose : prediction->CameraPoses)
+    {
+        // Shrinks the viewport of the pose, which the camera resources render into.
+        HolographicCamera^ camera = cameraPose->HolographicCamera;
+        if (camera->ViewportScaleFactor != m_scale)
+        {
+            camera->ViewportScaleFactor = m_scale;
+        }
+    }
+}
+
+void DX::ResolutionScaler::SetEnabled(bool enabled)
+{
+    m_enabled = enabled;
+    if (!enabled)
+    {
+        SetScale(m_maxScale);
+    }
+}
+
+void DX::ResolutionScaler::SetScaleRange(float minScale, float maxScale)
+{
+    m_minScale = (std::max)(minScale, 0.1f);
+    m_maxScale = (std::max)(m_minScale, (std::min)(maxScale, 1.f));
+    SetScale(m_scale);
+}
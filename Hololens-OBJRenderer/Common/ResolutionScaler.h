@@ -0,0 +1,77 @@
+#pragma once
+
+namespace DX
+{
+    // Picks the fraction of each holographic camera's back buffer to render into, so
+    // that the GPU time of a frame stays within the frame budget. GPU times are
+    // smoothed; the scale drops after a few frames over budget and comes back up only
+    // after many frames well under it, so that it does not flicker between two
+    // values. Since the cost of a frame follows its pixel count, which goes with the
+    // square of the scale, each step moves the scale by the square root of the ratio
+    // between the target and the measured time. GPU times arrive a few frames late,
+    // so the scaler waits for the frames drawn at a new scale before it steps again.
+    class ResolutionScaler
+    {
+    public:
+        // Feeds the GPU time of one frame, in milliseconds. Call once for each
+        // frame timed by the profiler.
+        void AddGpuTime(float milliseconds);
+
+        // Applies the current scale to each camera of the prediction. Call after
+        // CreateNextFrame, before the camera resources are updated for rendering.
+        void ApplyTo(Windows::Graphics::Holographic::HolographicFramePrediction^ prediction) const;
+
+        // Fraction of each dimension of the back buffer rendered into.
+        float GetScale() const                          { return m_scale;                                   }
+
+        // Fraction of the frame budget the GPU leaves unused, from the smoothed GPU
+        // time. Negative while over budget.
+        float GetHeadroom() const                       { return 1.f - m_averageGpuTime / m_frameBudget;    }
+        float GetAverageGpuTime() const                 { return m_averageGpuTime;                          }
+
+        // Disabling goes back to the full resolution.
+        void SetEnabled(bool enabled);
+        bool IsEnabled() const                          { return m_enabled;                                 }
+
+        // GPU time of a frame, in milliseconds. Defaults to 60 frames per second.
+        void SetFrameBudget(float milliseconds)         { m_frameBudget = milliseconds;                     }
+
+        // Range of the scale, within (0, 1].
+        void SetScaleRange(float minScale, float maxScale);
+
+    private:
+        // Smoothing factor of the average GPU time, per frame.
+        static constexpr float  c_smoothing             = 0.15f;
+
+        // Fractions of the budget over which the scale drops, under which it rises,
+        // and which a step aims for.
+        static constexpr float  c_downThreshold         = 0.9f;
+        static constexpr float  c_upThreshold           = 0.7f;
+        static constexpr float  c_targetUtilization     = 0.8f;
+
+        // Consecutive frames over or under the thresholds before a step.
+        static constexpr uint32 c_framesBeforeDown      = 3;
+        static constexpr uint32 c_framesBeforeUp        = 45;
+
+        // Frames timed after a step that were still drawn at the previous scale, and
+        // are ignored.
+        static constexpr uint32 c_settleFrames          = 4;
+
+        // Largest step up, so that the scale rises gently; steps down are not limited.
+        // Smaller changes are not made.
+        static constexpr float  c_maxStepUp             = 0.1f;
+        static constexpr float  c_minStep               = 0.02f;
+
+        void SetScale(float scale);
+
+        float                                           m_scale             = 1.f;
+        float                                           m_minScale          = 0.5f;
+        float                                           m_maxScale          = 1.f;
+        float                                           m_frameBudget       = 1000.f / 60.f;
+        float                                           m_averageGpuTime    = 0.f;
+        uint32                                          m_framesOver        = 0;
+        uint32                                          m_framesUnder       = 0;
+        uint32                                          m_framesToSettle    = 0;
+        bool                                            m_enabled           = true;
+    };
+}
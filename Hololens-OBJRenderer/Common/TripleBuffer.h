@@ -0,0 +1,51 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+
+namespace DX
+{
+    // Hands the latest value written by one thread to one other thread, without locks
+    // and without either thread waiting for the other. The writer fills its own buffer
+    // and publishes it; the reader picks up the most recently published buffer, and
+    // keeps reading it until it asks for the next one. Values published in between
+    // are skipped.
+    template <typename T>
+    class TripleBuffer
+    {
+    public:
+        // Writer side. The buffer is not cleared; it holds whatever was published from
+        // it two or more times ago.
+        T& GetWriteBuffer()                                     { return m_buffers[m_writeIndex]; }
+
+        void Publish()
+        {
+            m_writeIndex = m_shared.exchange(m_writeIndex | c_freshFlag) & c_indexMask;
+        }
+
+        // Reader side. Returns the newest published value, or nullptr until the first
+        // one is published. The value stays valid until the next call.
+        const T* AcquireLatest()
+        {
+            if ((m_shared.load() & c_freshFlag) != 0)
+            {
+                m_readIndex = m_shared.exchange(m_readIndex) & c_indexMask;
+                m_hasValue = true;
+            }
+            return m_hasValue ? &m_buffers[m_readIndex] : nullptr;
+        }
+
+    private:
+        static const unsigned int c_indexMask = 0x3;
+        static const unsigned int c_freshFlag = 0x4;
+
+        std::array<T, 3>                                        m_buffers;
+
+        // The buffer between the two threads, and whether it was published since the
+        // reader last took it.
+        std::atomic<unsigned int>                               m_shared = { 1 };
+        unsigned int                                            m_writeIndex = 0;
+        unsigned int                                            m_readIndex = 2;
+        bool                                                    m_hasValue = false;
+    };
+}
@@ -0,0 +1,64 @@
+// First pass of normal generation: adds the normal of each triangle, weighted by
+// its area, to the normals of its three corners. See NormalGenerator.
+cbuffer NormalGenerationConstantBuffer : register(b0)
+{
+    uint elementCount;  // Triangles.
+    uint groupCountX;
+};
+
+struct Vertex
+{
+    float3 pos;
+    float3 color;
+};
+
+StructuredBuffer<Vertex> vertices : register(t0);
+ByteAddressBuffer indices : register(t1);
+
+// Three floats per vertex, zeroed before the pass.
+RWByteAddressBuffer normals : register(u0);
+
+// Direct3D 11 has no atomic float addition, so the sum is swapped in with a compare
+// and exchange, and retried if another thread got there first.
+void AtomicAdd(uint address, float value)
+{
+    uint expected = normals.Load(address);
+
+    [allow_uav_condition]
+    for (;;)
+    {
+        uint original;
+        normals.InterlockedCompareExchange(address, expected, asuint(asfloat(expected) + value), original);
+        if (original == expected)
+        {
+            break;
+        }
+        expected = original;
+    }
+}
+
+[numthreads(64, 1, 1)]
+void main(uint3 groupId : SV_GroupID, uint groupIndex : SV_GroupIndex)
+{
+    const uint face = (groupId.y * groupCountX + groupId.x) * 64 + groupIndex;
+    if (face >= elementCount)
+    {
+        return;
+    }
+
+    const uint3 corners = indices.Load3(face * 12);
+    const float3 p0 = vertices[corners.x].pos;
+
+    // The cross product of two edges is twice the area long. Front faces wind
+    // clockwise seen from outside, so this order points out of the mesh.
+    const float3 normal = cross(vertices[corners.z].pos - p0, vertices[corners.y].pos - p0);
+
+    [unroll]
+    for (uint i = 0; i < 3; ++i)
+    {
+        const uint address = corners[i] * 12;
+        AtomicAdd(address, normal.x);
+        AtomicAdd(address + 4, normal.y);
+        AtomicAdd(address + 8, normal.z);
+    }
+}
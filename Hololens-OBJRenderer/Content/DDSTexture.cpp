@@ -0,0 +1,317 @@
+#include "pch.h"
+#include "DDSTexture.h"
+
+#include <algorithm>
+#include <fstream>
+#include <math.h>
+
+using namespace Hololens_OBJRenderer;
+
+namespace
+{
+	constexpr uint32 MakeFourCC(char a, char b, char c, char d)
+	{
+		return static_cast<uint32>(a) | (static_cast<uint32>(b) << 8) | (static_cast<uint32>(c) << 16) | (static_cast<uint32>(d) << 24);
+	}
+
+	constexpr uint32 c_ddsMagic = MakeFourCC('D', 'D', 'S', ' ');
+
+	// Marks the source stamp in the reserved fields of files written by DDSTexture.
+	constexpr uint32 c_stampMagic = MakeFourCC('H', 'O', 'B', 'J');
+
+	// Flags of DDSHeader and DDSPixelFormat.
+	constexpr uint32 c_ddsdCaps = 0x1;
+	constexpr uint32 c_ddsdHeight = 0x2;
+	constexpr uint32 c_ddsdWidth = 0x4;
+	constexpr uint32 c_ddsdPixelFormat = 0x1000;
+	constexpr uint32 c_ddsdMipMapCount = 0x20000;
+	constexpr uint32 c_ddsdLinearSize = 0x80000;
+	constexpr uint32 c_ddpfFourCC = 0x4;
+	constexpr uint32 c_ddpfRGB = 0x40;
+	constexpr uint32 c_ddsCapsComplex = 0x8;
+	constexpr uint32 c_ddsCapsTexture = 0x1000;
+	constexpr uint32 c_ddsCapsMipMap = 0x400000;
+	constexpr uint32 c_ddsCaps2CubeMap = 0x200;
+	constexpr uint32 c_ddsCaps2Volume = 0x200000;
+	constexpr uint32 c_dx10MiscTextureCube = 0x4;
+	constexpr uint32 c_dx10Texture2D = 3;
+
+	struct DDSPixelFormat
+	{
+		uint32	size;
+		uint32	flags;
+		uint32	fourCC;
+		uint32	rgbBitCount;
+		uint32	rBitMask;
+		uint32	gBitMask;
+		uint32	bBitMask;
+		uint32	aBitMask;
+	};
+
+	struct DDSHeader
+	{
+		uint32			size;
+		uint32			flags;
+		uint32			height;
+		uint32			width;
+		uint32			pitchOrLinearSize;
+		uint32			depth;
+		uint32			mipMapCount;
+		uint32			reserved1[11];
+		DDSPixelFormat	pixelFormat;
+		uint32			caps;
+		uint32			caps2;
+		uint32			caps3;
+		uint32			caps4;
+		uint32			reserved2;
+	};
+
+	struct DDSHeaderDX10
+	{
+		uint32			dxgiFormat;
+		uint32			resourceDimension;
+		uint32			miscFlag;
+		uint32			arraySize;
+		uint32			miscFlags2;
+	};
+
+	static_assert(sizeof(DDSHeader) == 124, "DDSHeader must match the file format.");
+	static_assert(sizeof(DDSHeaderDX10) == 20, "DDSHeaderDX10 must match the file format.");
+
+	DXGI_FORMAT GetLegacyFormat(const DDSPixelFormat& pixelFormat)
+	{
+		if (pixelFormat.flags & c_ddpfFourCC)
+		{
+			switch (pixelFormat.fourCC)
+			{
+			case MakeFourCC('D', 'X', 'T', '1'):	return DXGI_FORMAT_BC1_UNORM;
+			case MakeFourCC('D', 'X', 'T', '2'):
+			case MakeFourCC('D', 'X', 'T', '3'):	return DXGI_FORMAT_BC2_UNORM;
+			case MakeFourCC('D', 'X', 'T', '4'):
+			case MakeFourCC('D', 'X', 'T', '5'):	return DXGI_FORMAT_BC3_UNORM;
+			case MakeFourCC('A', 'T', 'I', '1'):
+			case MakeFourCC('B', 'C', '4', 'U'):	return DXGI_FORMAT_BC4_UNORM;
+			case MakeFourCC('A', 'T', 'I', '2'):
+			case MakeFourCC('B', 'C', '5', 'U'):	return DXGI_FORMAT_BC5_UNORM;
+			default:								return DXGI_FORMAT_UNKNOWN;
+			}
+		}
+
+		if ((pixelFormat.flags & c_ddpfRGB) && pixelFormat.rgbBitCount == 32)
+		{
+			if (pixelFormat.rBitMask == 0x000000ff && pixelFormat.gBitMask == 0x0000ff00 && pixelFormat.bBitMask == 0x00ff0000)
+			{
+				return DXGI_FORMAT_R8G8B8A8_UNORM;
+			}
+			if (pixelFormat.rBitMask == 0x00ff0000 && pixelFormat.gBitMask == 0x0000ff00 && pixelFormat.bBitMask == 0x000000ff)
+			{
+				return pixelFormat.aBitMask != 0 ? DXGI_FORMAT_B8G8R8A8_UNORM : DXGI_FORMAT_B8G8R8X8_UNORM;
+			}
+		}
+		return DXGI_FORMAT_UNKNOWN;
+	}
+
+	// The formats of DX10 headers that can be read; sRGB formats become UNORM.
+	DXGI_FORMAT GetSupportedFormat(DXGI_FORMAT format)
+	{
+		switch (format)
+		{
+		case DXGI_FORMAT_BC1_UNORM_SRGB:		return DXGI_FORMAT_BC1_UNORM;
+		case DXGI_FORMAT_BC2_UNORM_SRGB:		return DXGI_FORMAT_BC2_UNORM;
+		case DXGI_FORMAT_BC3_UNORM_SRGB:		return DXGI_FORMAT_BC3_UNORM;
+		case DXGI_FORMAT_BC7_UNORM_SRGB:		return DXGI_FORMAT_BC7_UNORM;
+		case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:	return DXGI_FORMAT_R8G8B8A8_UNORM;
+		case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:	return DXGI_FORMAT_B8G8R8A8_UNORM;
+		case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB:	return DXGI_FORMAT_B8G8R8X8_UNORM;
+		case DXGI_FORMAT_BC1_UNORM:
+		case DXGI_FORMAT_BC2_UNORM:
+		case DXGI_FORMAT_BC3_UNORM:
+		case DXGI_FORMAT_BC4_UNORM:
+		case DXGI_FORMAT_BC5_UNORM:
+		case DXGI_FORMAT_BC7_UNORM:
+		case DXGI_FORMAT_R8G8B8A8_UNORM:
+		case DXGI_FORMAT_B8G8R8A8_UNORM:
+		case DXGI_FORMAT_B8G8R8X8_UNORM:		return format;
+		default:								return DXGI_FORMAT_UNKNOWN;
+		}
+	}
+}
+
+bool DDSTexture::IsBlockCompressed(DXGI_FORMAT format)
+{
+	return format >= DXGI_FORMAT_BC1_TYPELESS && format <= DXGI_FORMAT_BC5_SNORM
+		|| format >= DXGI_FORMAT_BC6H_TYPELESS && format <= DXGI_FORMAT_BC7_UNORM_SRGB;
+}
+
+void DDSTexture::GetLevelPitch(DXGI_FORMAT format, UINT width, UINT height, UINT& rowPitch, UINT& rowCount)
+{
+	if (IsBlockCompressed(format))
+	{
+		const bool eightByteBlocks = format == DXGI_FORMAT_BC1_UNORM || format == DXGI_FORMAT_BC4_UNORM;
+		rowPitch = (std::max)(1u, (width + 3) / 4) * (eightByteBlocks ? 8 : 16);
+		rowCount = (std::max)(1u, (height + 3) / 4);
+	}
+	else
+	{
+		rowPitch = width * 4;
+		rowCount = height;
+	}
+}
+
+bool DDSTexture::Open(const std::wstring& fileName)
+{
+	Close();
+	if (!m_file.Open(fileName))
+	{
+		return false;
+	}
+
+	const char* data = m_file.GetData();
+	const size_t size = m_file.GetSize();
+	size_t offset = sizeof(uint32) + sizeof(DDSHeader);
+	if (size < offset || *reinterpret_cast<const uint32*>(data) != c_ddsMagic)
+	{
+		Close();
+		return false;
+	}
+
+	const DDSHeader& header = *reinterpret_cast<const DDSHeader*>(data + sizeof(uint32));
+	if (header.size != sizeof(DDSHeader) || header.pixelFormat.size != sizeof(DDSPixelFormat) ||
+		(header.caps2 & (c_ddsCaps2CubeMap | c_ddsCaps2Volume)) != 0 ||
+		header.width == 0 || header.height == 0 || header.width > D3D11_REQ_TEXTURE2D_U_OR_V_DIMENSION || header.height > D3D11_REQ_TEXTURE2D_U_OR_V_DIMENSION)
+	{
+		Close();
+		return false;
+	}
+
+	if ((header.pixelFormat.flags & c_ddpfFourCC) && header.pixelFormat.fourCC == MakeFourCC('D', 'X', '1', '0'))
+	{
+		if (size < offset + sizeof(DDSHeaderDX10))
+		{
+			Close();
+			return false;
+		}
+		const DDSHeaderDX10& header10 = *reinterpret_cast<const DDSHeaderDX10*>(data + offset);
+		offset += sizeof(DDSHeaderDX10);
+		if (header10.resourceDimension != c_dx10Texture2D || header10.arraySize != 1 || (header10.miscFlag & c_dx10MiscTextureCube) != 0)
+		{
+			Close();
+			return false;
+		}
+		m_format = GetSupportedFormat(static_cast<DXGI_FORMAT>(header10.dxgiFormat));
+	}
+	else
+	{
+		m_format = GetLegacyFormat(header.pixelFormat);
+	}
+	if (m_format == DXGI_FORMAT_UNKNOWN)
+	{
+		Close();
+		return false;
+	}
+
+	// A mip count of 0 means there is only the top level. Chains that are longer than
+	// the size allows are cut short.
+	const UINT fullChain = 1 + static_cast<UINT>(log2((std::max)(header.width, header.height)));
+	const UINT mipCount = (header.flags & c_ddsdMipMapCount) && header.mipMapCount > 0 ? (std::min)(header.mipMapCount, fullChain) : 1;
+
+	m_levels.reserve(mipCount);
+	UINT width = header.width;
+	UINT height = header.height;
+	for (UINT level = 0; level < mipCount; ++level)
+	{
+		UINT rowPitch, rowCount;
+		GetLevelPitch(m_format, width, height, rowPitch, rowCount);
+		const size_t levelSize = static_cast<size_t>(rowPitch) * rowCount;
+		if (size - offset < levelSize)
+		{
+			Close();
+			return false;
+		}
+
+		m_levels.push_back({ data + offset, width, height, rowPitch, static_cast<UINT>(levelSize) });
+		offset += levelSize;
+		width = (std::max)(1u, width / 2);
+		height = (std::max)(1u, height / 2);
+	}
+
+	if (header.reserved1[4] == c_stampMagic)
+	{
+		m_source.size = header.reserved1[0] | (static_cast<uint64>(header.reserved1[1]) << 32);
+		m_source.lastWriteTime = header.reserved1[2] | (static_cast<uint64>(header.reserved1[3]) << 32);
+		m_stamped = true;
+	}
+	return true;
+}
+
+void DDSTexture::Close()
+{
+	m_file.Close();
+	m_format = DXGI_FORMAT_UNKNOWN;
+	m_levels.clear();
+	m_source = MeshCacheSource();
+	m_stamped = false;
+}
+
+bool DDSTexture::IsFrom(const MeshCacheSource& source) const
+{
+	return m_stamped && m_source.size == source.size && m_source.lastWriteTime == source.lastWriteTime;
+}
+
+bool DDSTexture::Write(
+	const std::wstring& fileName,
+	DXGI_FORMAT format,
+	UINT width,
+	UINT height,
+	const std::vector<std::vector<byte>>& levels,
+	const MeshCacheSource& source)
+{
+	if (format != DXGI_FORMAT_BC1_UNORM && format != DXGI_FORMAT_BC3_UNORM || levels.empty())
+	{
+		return false;
+	}
+
+	DDSHeader header = {};
+	header.size = sizeof(DDSHeader);
+	header.flags = c_ddsdCaps | c_ddsdHeight | c_ddsdWidth | c_ddsdPixelFormat | c_ddsdLinearSize;
+	header.height = height;
+	header.width = width;
+	header.pitchOrLinearSize = static_cast<uint32>(levels[0].size());
+	header.mipMapCount = static_cast<uint32>(levels.size());
+	header.reserved1[0] = static_cast<uint32>(source.size);
+	header.reserved1[1] = static_cast<uint32>(source.size >> 32);
+	header.reserved1[2] = static_cast<uint32>(source.lastWriteTime);
+	header.reserved1[3] = static_cast<uint32>(source.lastWriteTime >> 32);
+	header.reserved1[4] = c_stampMagic;
+	header.pixelFormat.size = sizeof(DDSPixelFormat);
+	header.pixelFormat.flags = c_ddpfFourCC;
+	header.pixelFormat.fourCC = format == DXGI_FORMAT_BC1_UNORM ? MakeFourCC('D', 'X', 'T', '1') : MakeFourCC('D', 'X', 'T', '5');
+	header.caps = c_ddsCapsTexture;
+	if (levels.size() > 1)
+	{
+		header.flags |= c_ddsdMipMapCount;
+		header.caps |= c_ddsCapsComplex | c_ddsCapsMipMap;
+	}
+
+	std::ofstream out(fileName, std::ios::binary | std::ios::trunc);
+	if (!out.is_open())
+	{
+		return false;
+	}
+
+	const uint32 noMagic = 0;
+	out.write(reinterpret_cast<const char*>(&noMagic), sizeof(noMagic));
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	for (const std::vector<byte>& level : levels)
+	{
+		out.write(reinterpret_cast<const char*>(level.data()), level.size());
+	}
+	out.flush();
+
+	// Only mark the file as valid once everything else is on disk.
+	out.seekp(0);
+	out.write(reinterpret_cast<const char*>(&c_ddsMagic), sizeof(c_ddsMagic));
+	out.flush();
+
+	return out.good();
+}
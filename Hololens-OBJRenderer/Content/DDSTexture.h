@@ -0,0 +1,66 @@
+#pragma once
+
+#include "..\Common\MappedFile.h"
+#include "MeshCache.h"
+
+#include <string>
+#include <vector>
+
+namespace Hololens_OBJRenderer
+{
+	// One mip level of a DDSTexture, laid out as D3D11_SUBRESOURCE_DATA expects it.
+	struct DDSLevel
+	{
+		const void*		data;
+		UINT			width;
+		UINT			height;
+		UINT			rowPitch;
+		UINT			size;
+	};
+
+	// A DDS file holding one 2D texture and its mip chain. The file is memory mapped,
+	// so that levels are uploaded straight out of it. BC1 to BC7 and 32-bit RGBA
+	// formats are read, from either a legacy or a DX10 header; sRGB formats are read
+	// as their UNORM equivalents, as the renderer does no gamma conversion.
+	class DDSTexture
+	{
+	public:
+		// Maps the file. Returns false, and leaves the texture closed, if the file is
+		// missing or malformed, or holds an array, cube map, volume or other format.
+		bool Open(const std::wstring& fileName);
+		void Close();
+
+		bool				IsOpen() const						{ return m_file.IsOpen(); }
+		DXGI_FORMAT			GetFormat() const					{ return m_format; }
+		UINT				GetWidth() const					{ return m_levels[0].width; }
+		UINT				GetHeight() const					{ return m_levels[0].height; }
+		UINT				GetMipCount() const					{ return static_cast<UINT>(m_levels.size()); }
+		const DDSLevel&		GetLevel(UINT level) const			{ return m_levels[level]; }
+
+		// Whether the file was written by Write from this version of source.
+		bool IsFrom(const MeshCacheSource& source) const;
+
+		// Writes a BC1 or BC3 texture as a DXT1 or DXT5 file, with the blocks of each
+		// mip level in levels, largest first. source is stamped in reserved header
+		// fields that other DDS readers ignore.
+		static bool Write(
+			const std::wstring& fileName,
+			DXGI_FORMAT format,
+			UINT width,
+			UINT height,
+			const std::vector<std::vector<byte>>& levels,
+			const MeshCacheSource& source);
+
+		// Bytes per row, and rows, of a level. Block compressed formats have rows of
+		// 4x4 blocks.
+		static void GetLevelPitch(DXGI_FORMAT format, UINT width, UINT height, UINT& rowPitch, UINT& rowCount);
+		static bool IsBlockCompressed(DXGI_FORMAT format);
+
+	private:
+		DX::MappedFile				m_file;
+		DXGI_FORMAT					m_format = DXGI_FORMAT_UNKNOWN;
+		std::vector<DDSLevel>		m_levels;
+		MeshCacheSource				m_source;
+		bool						m_stamped = false;
+	};
+}
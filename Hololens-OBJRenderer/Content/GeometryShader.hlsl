@@ -3,6 +3,9 @@ struct GeometryShaderInput
 {
     min16float4 pos     : SV_POSITION;
     min16float3 color   : COLOR0;
+#ifdef TEXTURED
+    min16float2 uv      : TEXCOORD1;
+#endif
     uint        instId  : TEXCOORD0;
 };
 
@@ -11,6 +14,9 @@ struct GeometryShaderOutput
 {
     min16float4 pos     : SV_POSITION;
     min16float3 color   : COLOR0;
+#ifdef TEXTURED
+    min16float2 uv      : TEXCOORD1;
+#endif
     uint        rtvId   : SV_RenderTargetArrayIndex;
 };
 
@@ -25,6 +31,9 @@ void main(triangle GeometryShaderInput input[3], inout TriangleStream<GeometrySh
     {
         output.pos   = input[i].pos;
         output.color = input[i].color;
+#ifdef TEXTURED
+        output.uv    = input[i].uv;
+#endif
         output.rtvId = input[i].instId;
         outStream.Append(output);
     }
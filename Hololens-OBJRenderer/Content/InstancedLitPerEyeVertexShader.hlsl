@@ -0,0 +1,5 @@
+// Permutation of InstancedVertexShader.hlsl that lights each vertex, and draws one
+// eye per draw call.
+#define SHADE_PER_VERTEX
+#define ONE_EYE_PER_DRAW
+#include "InstancedVertexShader.hlsl"
@@ -0,0 +1,3 @@
+// Permutation of InstancedVPRTVertexShader.hlsl that lights each vertex.
+#define SHADE_PER_VERTEX
+#include "InstancedVPRTVertexShader.hlsl"
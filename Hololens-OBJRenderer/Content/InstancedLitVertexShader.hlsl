@@ -0,0 +1,3 @@
+// Permutation of InstancedVertexShader.hlsl that lights each vertex.
+#define SHADE_PER_VERTEX
+#include "InstancedVertexShader.hlsl"
@@ -0,0 +1,4 @@
+// Permutation of InstancedVertexShader.hlsl that draws one eye per draw call, set
+// by a constant buffer, without a geometry shader.
+#define ONE_EYE_PER_DRAW
+#include "InstancedVertexShader.hlsl"
@@ -0,0 +1,6 @@
+// Permutation of InstancedVertexShader.hlsl that lights each vertex, passes texture
+// coordinates on, and draws one eye per draw call.
+#define SHADE_PER_VERTEX
+#define TEXTURED
+#define ONE_EYE_PER_DRAW
+#include "InstancedVertexShader.hlsl"
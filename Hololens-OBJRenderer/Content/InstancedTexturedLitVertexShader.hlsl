@@ -0,0 +1,5 @@
+// Permutation of InstancedVertexShader.hlsl that lights each vertex and passes
+// texture coordinates on.
+#define SHADE_PER_VERTEX
+#define TEXTURED
+#include "InstancedVertexShader.hlsl"
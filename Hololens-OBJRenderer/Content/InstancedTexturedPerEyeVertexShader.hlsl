@@ -0,0 +1,5 @@
+// Permutation of InstancedVertexShader.hlsl that passes texture coordinates on, and
+// draws one eye per draw call.
+#define TEXTURED
+#define ONE_EYE_PER_DRAW
+#include "InstancedVertexShader.hlsl"
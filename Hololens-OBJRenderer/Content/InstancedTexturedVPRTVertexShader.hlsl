@@ -0,0 +1,3 @@
+// Permutation of InstancedVPRTVertexShader.hlsl that passes texture coordinates on.
+#define TEXTURED
+#include "InstancedVPRTVertexShader.hlsl"
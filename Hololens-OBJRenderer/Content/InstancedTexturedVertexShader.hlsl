@@ -0,0 +1,3 @@
+// Permutation of InstancedVertexShader.hlsl that passes texture coordinates on.
+#define TEXTURED
+#include "InstancedVertexShader.hlsl"
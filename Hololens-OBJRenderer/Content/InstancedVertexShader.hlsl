@@ -0,0 +1,117 @@
+// The transforms of every instance in the scene. Entry 2 * i is the model
+// transform of instance i, and entry 2 * i + 1 maps a unit cube onto its bounds.
+StructuredBuffer<float4x4> instanceModels : register(t0);
+
+// A constant buffer that stores each set of view and projection matrices in column-major format.
+cbuffer ViewProjectionConstantBuffer : register(b1)
+{
+    float4x4 viewProjection[2];
+};
+
+#ifdef ONE_EYE_PER_DRAW
+// The eye drawn by the current draw calls, when each eye is drawn on its own. See
+// EyeConstantBuffer.
+cbuffer EyeConstantBuffer : register(b3)
+{
+    uint eye;
+};
+#endif
+
+#ifdef SHADE_PER_VERTEX
+// The lighting of the scene. See LightingConstantBuffer.
+cbuffer LightingConstantBuffer : register(b2)
+{
+    float4 lightDirection;
+    float4 lightColor;
+    float4 ambient[3];
+    float4 albedo;
+};
+#endif
+
+// Per-vertex data used as input to the vertex shader.
+struct VertexShaderInput
+{
+    min16float3 pos     : POSITION;
+    min16float3 color   : COLOR0;
+#ifdef TEXTURED
+    min16float2 uv      : TEXCOORD0;
+#endif
+    uint        model   : INSTANCE;     // Entry in instanceModels, one per pair of instances
+#ifndef ONE_EYE_PER_DRAW
+    uint        instId  : SV_InstanceID;
+#endif
+};
+
+// Per-vertex data passed to the geometry shader.
+// Note that the render target array index will be set by the geometry shader
+// using the value of viewId. When each eye is drawn on its own, the render
+// target is a single slice and this goes straight to the rasterizer.
+struct VertexShaderOutput
+{
+    min16float4 pos     : SV_POSITION;
+    min16float3 color   : COLOR0;
+#ifdef TEXTURED
+    min16float2 uv      : TEXCOORD1;
+#endif
+#ifndef ONE_EYE_PER_DRAW
+    uint        viewId  : TEXCOORD0;  // SV_InstanceID % 2
+#endif
+};
+
+// Simple shader to do vertex processing on the GPU.
+VertexShaderOutput main(VertexShaderInput input)
+{
+    VertexShaderOutput output;
+    float4 pos = float4(input.pos, 1.0f);
+
+    // Note which view this vertex has been sent to. Used for matrix lookup.
+    // Each model instance is drawn twice, one copy for the left view and one
+    // for the right, so the instance ID is even for the left eye and odd for
+    // the right. Both copies read the same transform index. When each eye is
+    // drawn on its own, every instance is drawn once, for that eye.
+#ifdef ONE_EYE_PER_DRAW
+    int idx = eye;
+#else
+    int idx = input.instId % 2;
+#endif
+    float4x4 model = instanceModels[input.model];
+
+    // Transform the vertex position into world space.
+    pos = mul(pos, model);
+
+    // Correct for perspective and project the vertex position onto the screen.
+    pos = mul(pos, viewProjection[idx]);
+    output.pos = (min16float4)pos;
+
+#ifdef SHADE_PER_VERTEX
+    // The color holds the normal. Normals are transformed by the cofactors of the
+    // model transform, which keep them perpendicular to the surface under the
+    // non-uniform scale of the position dequantization.
+    float3x3 basis = (float3x3)model;
+    float3x3 cofactors = float3x3(cross(basis[1], basis[2]), cross(basis[2], basis[0]), cross(basis[0], basis[1]));
+    float3 normal = mul((float3)input.color, cofactors);
+    float lengthSquared = dot(normal, normal);
+    normal = lengthSquared > 0.0f ? normal * rsqrt(lengthSquared) : normal;
+
+    // A directional light over first order spherical harmonics ambient.
+    float4 sh = float4(1.0f, normal.y, normal.z, normal.x);
+    float3 irradiance = float3(dot(ambient[0], sh), dot(ambient[1], sh), dot(ambient[2], sh));
+    irradiance += lightColor.rgb * saturate(dot(normal, lightDirection.xyz));
+    output.color = (min16float3)saturate(albedo.rgb * irradiance);
+#else
+    // Pass the color through without modification.
+    output.color = input.color;
+#endif
+
+#ifdef TEXTURED
+    output.uv = input.uv;
+#endif
+
+#ifndef ONE_EYE_PER_DRAW
+    // Set the instance ID. The pass-through geometry shader will set the
+    // render target array index to whatever value is set here.
+    output.viewId = idx;
+#endif
+
+    return output;
+}
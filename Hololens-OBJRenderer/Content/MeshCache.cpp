@@ -0,0 +1,190 @@
+#include "pch.h"
+#include "MeshCache.h"
+
+#include <algorithm>
+#include <fstream>
+
+using namespace Hololens_OBJRenderer;
+
+bool MeshCacheSource::Query(const std::wstring& fileName)
+{
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!GetFileAttributesExW(fileName.c_str(), GetFileExInfoStandard, &attributes))
+	{
+		return false;
+	}
+
+	size = (static_cast<uint64>(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+	lastWriteTime = (static_cast<uint64>(attributes.ftLastWriteTime.dwHighDateTime) << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+	return true;
+}
+
+bool MeshCache::Write(
+	const std::wstring& cacheFileName,
+	const MeshCacheSource& source,
+	const std::vector<VertexPositionColor>& vertices,
+	const std::vector<DirectX::XMFLOAT2>& texcoords,
+	const std::vector<UINT>& indices,
+	const std::vector<UINT>& lodIndexCounts,
+	const std::vector<MeshMaterialRange>& materialRanges,
+	const std::vector<std::string>& materialLibraries,
+	const std::vector<std::string>& materialNames,
+	const MeshBounds& bounds,
+	uint32 flags,
+	float acmr)
+{
+	if (lodIndexCounts.size() > c_maxMeshLods || (!texcoords.empty() && texcoords.size() != vertices.size()))
+	{
+		return false;
+	}
+
+	std::string names;
+	for (const std::string& name : materialLibraries)
+	{
+		names.append(name.c_str(), name.size() + 1);
+	}
+	for (const std::string& name : materialNames)
+	{
+		names.append(name.c_str(), name.size() + 1);
+	}
+
+	std::ofstream out(cacheFileName, std::ios::binary | std::ios::trunc);
+	if (!out.is_open())
+	{
+		return false;
+	}
+
+	MeshCacheHeader header = {};
+	header.magic = 0;
+	header.version = Version;
+	header.sourceSize = source.size;
+	header.sourceLastWriteTime = source.lastWriteTime;
+	header.vertexCount = static_cast<uint32>(vertices.size());
+	header.indexCount = static_cast<uint32>(indices.size());
+	header.bounds = bounds;
+	header.flags = flags;
+	header.acmr = acmr;
+	std::copy(lodIndexCounts.begin(), lodIndexCounts.end(), header.lodIndexCounts);
+	header.texcoordCount = static_cast<uint32>(texcoords.size());
+	header.materialRangeCount = static_cast<uint32>(materialRanges.size());
+	header.materialLibraryCount = static_cast<uint32>(materialLibraries.size());
+	header.materialCount = static_cast<uint32>(materialNames.size());
+	header.nameBytes = static_cast<uint32>(names.size());
+
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	out.write(reinterpret_cast<const char*>(vertices.data()), sizeof(VertexPositionColor) * vertices.size());
+	out.write(reinterpret_cast<const char*>(texcoords.data()), sizeof(DirectX::XMFLOAT2) * texcoords.size());
+	out.write(reinterpret_cast<const char*>(indices.data()), sizeof(UINT) * indices.size());
+	out.write(reinterpret_cast<const char*>(materialRanges.data()), sizeof(MeshMaterialRange) * materialRanges.size());
+	out.write(names.data(), names.size());
+	out.flush();
+
+	// Only mark the cache as valid once everything else is on disk.
+	header.magic = Magic;
+	out.seekp(0);
+	out.write(reinterpret_cast<const char*>(&header.magic), sizeof(header.magic));
+	out.flush();
+
+	return out.good();
+}
+
+bool MeshCache::Open(const std::wstring& cacheFileName, const MeshCacheSource& source, uint32 flags)
+{
+	Close();
+
+	if (!m_file.Open(cacheFileName) || m_file.GetSize() < sizeof(MeshCacheHeader))
+	{
+		Close();
+		return false;
+	}
+
+	const MeshCacheHeader* header = reinterpret_cast<const MeshCacheHeader*>(m_file.GetData());
+	// The counts are 32-bit, so the size is summed in 64 bits, where it cannot
+	// overflow on 32-bit targets.
+	const uint64 expectedSize =
+		sizeof(MeshCacheHeader) +
+		sizeof(VertexPositionColor) * static_cast<uint64>(header->vertexCount) +
+		sizeof(DirectX::XMFLOAT2) * static_cast<uint64>(header->texcoordCount) +
+		sizeof(UINT) * static_cast<uint64>(header->indexCount) +
+		sizeof(MeshMaterialRange) * static_cast<uint64>(header->materialRangeCount) +
+		header->nameBytes;
+
+	uint64 lodIndexTotal = 0;
+	for (const uint32 lodIndexCount : header->lodIndexCounts)
+	{
+		lodIndexTotal += lodIndexCount;
+	}
+
+	if (header->magic != Magic ||
+		header->version != Version ||
+		header->sourceSize != source.size ||
+		header->sourceLastWriteTime != source.lastWriteTime ||
+		header->flags != flags ||
+		lodIndexTotal != header->indexCount ||
+		(header->texcoordCount != 0 && header->texcoordCount != header->vertexCount) ||
+		m_file.GetSize() != expectedSize)
+	{
+		Close();
+		return false;
+	}
+
+	const VertexPositionColor* cachedVertices = reinterpret_cast<const VertexPositionColor*>(m_file.GetData() + sizeof(MeshCacheHeader));
+	const DirectX::XMFLOAT2* cachedTexcoords = reinterpret_cast<const DirectX::XMFLOAT2*>(cachedVertices + header->vertexCount);
+	const UINT* cachedIndices = reinterpret_cast<const UINT*>(cachedTexcoords + header->texcoordCount);
+	const MeshMaterialRange* cachedRanges = reinterpret_cast<const MeshMaterialRange*>(cachedIndices + header->indexCount);
+	const char* cachedNames = reinterpret_cast<const char*>(cachedRanges + header->materialRangeCount);
+
+	// Every index must name a vertex, every range be inside the index array, and
+	// every name terminated.
+	const uint32 vertexCount = header->vertexCount;
+	const bool indicesValid = std::all_of(cachedIndices, cachedIndices + header->indexCount, [vertexCount](UINT index)
+	{
+		return index < vertexCount;
+	});
+	const size_t nameCount = std::count(cachedNames, cachedNames + header->nameBytes, '\0');
+	const bool rangesValid = std::all_of(cachedRanges, cachedRanges + header->materialRangeCount, [header](const MeshMaterialRange& range)
+	{
+		return range.material < header->materialCount &&
+			static_cast<uint64>(range.indexStart) + range.indexCount <= header->indexCount;
+	});
+	if (!indicesValid ||
+		!rangesValid ||
+		nameCount != static_cast<size_t>(header->materialLibraryCount) + header->materialCount ||
+		(header->nameBytes > 0 && cachedNames[header->nameBytes - 1] != '\0'))
+	{
+		Close();
+		return false;
+	}
+
+	m_header = header;
+	m_vertices = cachedVertices;
+	m_texcoords = header->texcoordCount != 0 ? cachedTexcoords : nullptr;
+	m_indices = cachedIndices;
+	m_materialRanges = cachedRanges;
+	m_names = cachedNames;
+	return true;
+}
+
+void MeshCache::GetMaterialNames(std::vector<std::string>& materialLibraries, std::vector<std::string>& materialNames) const
+{
+	materialLibraries.clear();
+	materialNames.clear();
+	const char* name = m_names;
+	for (uint32 i = 0; i < m_header->materialLibraryCount + m_header->materialCount; ++i)
+	{
+		std::vector<std::string>& names = i < m_header->materialLibraryCount ? materialLibraries : materialNames;
+		names.push_back(name);
+		name += names.back().size() + 1;
+	}
+}
+
+void MeshCache::Close()
+{
+	m_file.Close();
+	m_header = nullptr;
+	m_vertices = nullptr;
+	m_texcoords = nullptr;
+	m_indices = nullptr;
+	m_materialRanges = nullptr;
+	m_names = nullptr;
+}
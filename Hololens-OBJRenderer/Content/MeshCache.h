@@ -0,0 +1,142 @@
+#pragma once
+
+#include "..\Common\MappedFile.h"
+#include "ShaderStructures.h"
+
+#include <string>
+#include <vector>
+
+namespace Hololens_OBJRenderer
+{
+	// Axis-aligned bounds of a mesh, in the mesh's own coordinates.
+	struct MeshBounds
+	{
+		DirectX::XMFLOAT3 min;
+		DirectX::XMFLOAT3 max;
+	};
+
+	// A run of triangles in an index buffer that is drawn with one material. Indices
+	// are grouped by material, so each level of detail has one range per material it
+	// uses, in the order the materials are first used.
+	struct MeshMaterialRange
+	{
+		uint32			material;
+		uint32			indexStart;
+		uint32			indexCount;
+	};
+
+	// Identifies the version of a source file a cache was built from. The cache is
+	// stale as soon as the source changes size or is written to.
+	struct MeshCacheSource
+	{
+		uint64 size = 0;
+		uint64 lastWriteTime = 0;
+
+		// Fills in size and lastWriteTime from the file system. Returns false if the
+		// file does not exist.
+		bool Query(const std::wstring& fileName);
+	};
+
+	// How the cached mesh was processed after parsing. A cache is only used if it
+	// was built with the options now in effect.
+	enum MeshCacheFlags : uint32
+	{
+		MeshCacheFlags_None			= 0,
+		MeshCacheFlags_Optimized	= 1 << 0,	// Reordered by OptimizeMesh.
+		MeshCacheFlags_Lods			= 1 << 1,	// Holds simplified levels of detail.
+		MeshCacheFlags_Normals		= 1 << 2,	// Normals were generated where the file had none.
+		MeshCacheFlags_Materials	= 1 << 3	// Texture coordinates and materials were read.
+	};
+
+	// Number of levels of detail a cache file can describe, including the full mesh.
+	constexpr uint32 c_maxMeshLods = 4;
+
+	// Layout of the start of a cache file. The header is followed by the vertex
+	// array, the texture coordinates of each vertex if there are any, the index
+	// array, the material ranges, and last the names of the material libraries and
+	// of the materials, each terminated by a null character. The index array holds
+	// the levels of detail back to back, starting with the full mesh; unused entries
+	// of lodIndexCounts are 0. Material libraries are read again with the cache, so
+	// that it stays valid when only they change.
+	struct MeshCacheHeader
+	{
+		uint32			magic;
+		uint32			version;
+		uint64			sourceSize;
+		uint64			sourceLastWriteTime;
+		uint32			vertexCount;
+		uint32			indexCount;
+		MeshBounds		bounds;
+		uint32			flags;
+		float			acmr;			// ACMR of the cached index order, or 0 if not measured.
+		uint32			lodIndexCounts[c_maxMeshLods];
+		uint32			texcoordCount;	// vertexCount, or 0 without texture coordinates.
+		uint32			materialRangeCount;
+		uint32			materialLibraryCount;
+		uint32			materialCount;
+		uint32			nameBytes;
+		uint32			padding;
+	};
+
+	static_assert(sizeof(MeshCacheHeader) == 104, "The mesh cache header is part of the file format; changing it requires a new version.");
+
+	// Binary cache of a parsed mesh, stored next to the source file. A valid cache is
+	// memory mapped and its arrays are handed to Direct3D without being copied.
+	class MeshCache
+	{
+	public:
+		static constexpr uint32 Magic = 0x4843534d; // "MSCH"
+		static constexpr uint32 Version = 6;
+
+		// The cache for LocalFolder\bunny.obj is LocalFolder\bunny.obj.meshcache.
+		static std::wstring GetCacheFileName(const std::wstring& sourceFileName) { return sourceFileName + L".meshcache"; }
+
+		// Writes a cache for the given mesh. The magic number is written last, so a
+		// cache that was only partly written is never accepted.
+		static bool Write(
+			const std::wstring& cacheFileName,
+			const MeshCacheSource& source,
+			const std::vector<VertexPositionColor>& vertices,
+			const std::vector<DirectX::XMFLOAT2>& texcoords,
+			const std::vector<UINT>& indices,
+			const std::vector<UINT>& lodIndexCounts,
+			const std::vector<MeshMaterialRange>& materialRanges,
+			const std::vector<std::string>& materialLibraries,
+			const std::vector<std::string>& materialNames,
+			const MeshBounds& bounds,
+			uint32 flags = MeshCacheFlags_None,
+			float acmr = 0.f);
+
+		// Maps the cache file. Returns false, and leaves the cache closed, if the file
+		// is missing, malformed, from another version, stale for source, or built with
+		// other flags.
+		bool Open(const std::wstring& cacheFileName, const MeshCacheSource& source, uint32 flags = MeshCacheFlags_None);
+		void Close();
+
+		bool						IsOpen() const			{ return m_header != nullptr; }
+		const VertexPositionColor*	GetVertices() const		{ return m_vertices; }
+		uint32						GetVertexCount() const	{ return m_header->vertexCount; }
+		const UINT*					GetIndices() const		{ return m_indices; }
+		uint32						GetIndexCount() const	{ return m_header->indexCount; }
+		const MeshBounds&			GetBounds() const		{ return m_header->bounds; }
+		float						GetACMR() const			{ return m_header->acmr; }
+		const uint32*				GetLodIndexCounts() const	{ return m_header->lodIndexCounts; }
+
+		// nullptr if the mesh has no texture coordinates.
+		const DirectX::XMFLOAT2*	GetTexcoords() const	{ return m_texcoords; }
+		const MeshMaterialRange*	GetMaterialRanges() const	{ return m_materialRanges; }
+		uint32						GetMaterialRangeCount() const	{ return m_header->materialRangeCount; }
+
+		// Copies the names stored with the mesh.
+		void GetMaterialNames(std::vector<std::string>& materialLibraries, std::vector<std::string>& materialNames) const;
+
+	private:
+		DX::MappedFile				m_file;
+		const MeshCacheHeader*		m_header = nullptr;
+		const VertexPositionColor*	m_vertices = nullptr;
+		const DirectX::XMFLOAT2*	m_texcoords = nullptr;
+		const UINT*					m_indices = nullptr;
+		const MeshMaterialRange*	m_materialRanges = nullptr;
+		const char*					m_names = nullptr;
+	};
+}
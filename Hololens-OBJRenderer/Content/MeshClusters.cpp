@@ -0,0 +1,183 @@
+#include "pch.h"
+#include "MeshClusters.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace Hololens_OBJRenderer;
+using namespace DirectX;
+
+namespace
+{
+	// Computes the bounding sphere and normal cone of the triangles of a cluster,
+	// following the cluster culling in meshoptimizer.
+	template <typename Index>
+	MeshCluster MakeCluster(const VertexPositionColor* vertices, const Index* indices, size_t begin, size_t end, UINT indexStart)
+	{
+		MeshCluster cluster;
+		cluster.indexStart = indexStart + static_cast<UINT>(begin);
+		cluster.indexCount = static_cast<UINT>(end - begin);
+
+		XMVECTOR minimum = XMLoadFloat3(&vertices[indices[begin]].pos);
+		XMVECTOR maximum = minimum;
+		XMVECTOR normalSum = XMVectorZero();
+		for (size_t i = begin; i < end; i += 3)
+		{
+			const XMVECTOR p0 = XMLoadFloat3(&vertices[indices[i]].pos);
+			const XMVECTOR p1 = XMLoadFloat3(&vertices[indices[i + 1]].pos);
+			const XMVECTOR p2 = XMLoadFloat3(&vertices[indices[i + 2]].pos);
+			minimum = XMVectorMin(minimum, XMVectorMin(p0, XMVectorMin(p1, p2)));
+			maximum = XMVectorMax(maximum, XMVectorMax(p0, XMVectorMax(p1, p2)));
+
+			// Front faces wind clockwise seen from outside the mesh, as the parser
+			// stores them, so the outward normal is (p2 - p0) x (p1 - p0).
+			const XMVECTOR normal = XMVector3Cross(XMVectorSubtract(p2, p0), XMVectorSubtract(p1, p0));
+			if (XMVectorGetX(XMVector3LengthSq(normal)) > 0.f)
+			{
+				normalSum = XMVectorAdd(normalSum, XMVector3Normalize(normal));
+			}
+		}
+
+		const XMVECTOR center = XMVectorScale(XMVectorAdd(minimum, maximum), 0.5f);
+		float radius = 0.f;
+		for (size_t i = begin; i < end; ++i)
+		{
+			const XMVECTOR offset = XMVectorSubtract(XMLoadFloat3(&vertices[indices[i]].pos), center);
+			radius = (std::max)(radius, XMVectorGetX(XMVector3Length(offset)));
+		}
+		XMStoreFloat3(&cluster.center, center);
+		cluster.radius = radius;
+
+		// The cone is only worth testing if every normal is well within 90 degrees
+		// of the axis.
+		cluster.coneAxis = XMFLOAT3(0.f, 0.f, 1.f);
+		cluster.coneCutoff = 1.f;
+		if (XMVectorGetX(XMVector3LengthSq(normalSum)) == 0.f)
+		{
+			return cluster;
+		}
+
+		const XMVECTOR axis = XMVector3Normalize(normalSum);
+		float minimumDot = 1.f;
+		for (size_t i = begin; i < end; i += 3)
+		{
+			const XMVECTOR p0 = XMLoadFloat3(&vertices[indices[i]].pos);
+			const XMVECTOR normal = XMVector3Cross(
+				XMVectorSubtract(XMLoadFloat3(&vertices[indices[i + 2]].pos), p0),
+				XMVectorSubtract(XMLoadFloat3(&vertices[indices[i + 1]].pos), p0));
+			if (XMVectorGetX(XMVector3LengthSq(normal)) > 0.f)
+			{
+				minimumDot = (std::min)(minimumDot, XMVectorGetX(XMVector3Dot(axis, XMVector3Normalize(normal))));
+			}
+		}
+
+		XMStoreFloat3(&cluster.coneAxis, axis);
+		if (minimumDot > 0.1f)
+		{
+			// Sine of the angle between the axis and the widest normal.
+			cluster.coneCutoff = sqrtf(1.f - minimumDot * minimumDot);
+		}
+		return cluster;
+	}
+
+	template <typename Index>
+	void BuildClustersFrom(
+		const VertexPositionColor* vertices,
+		const Index* indices,
+		size_t indexCount,
+		UINT indexStart,
+		std::vector<MeshCluster>& clusters)
+	{
+		indexCount -= indexCount % 3;
+		if (indexCount == 0)
+		{
+			return;
+		}
+
+		// For each vertex, the last cluster that uses it.
+		const size_t vertexCount = static_cast<size_t>(*std::max_element(indices, indices + indexCount)) + 1;
+		std::vector<UINT> vertexCluster(vertexCount, ~0u);
+		UINT clusterId = 0;
+		size_t clusterVertices = 0;
+		size_t clusterBegin = 0;
+
+		for (size_t i = 0; i < indexCount; i += 3)
+		{
+			size_t newVertices = 0;
+			for (size_t k = 0; k < 3; ++k)
+			{
+				const Index vertex = indices[i + k];
+				if (vertexCluster[vertex] != clusterId &&
+					(k < 1 || indices[i] != vertex) &&
+					(k < 2 || indices[i + 1] != vertex))
+				{
+					++newVertices;
+				}
+			}
+
+			// Close the cluster once this triangle would not fit.
+			if ((i - clusterBegin) / 3 == c_maxClusterTriangles || clusterVertices + newVertices > c_maxClusterVertices)
+			{
+				clusters.push_back(MakeCluster(vertices, indices, clusterBegin, i, indexStart));
+				clusterBegin = i;
+				++clusterId;
+				clusterVertices = 0;
+
+				newVertices = 0;
+				for (size_t k = 0; k < 3; ++k)
+				{
+					const Index vertex = indices[i + k];
+					if ((k < 1 || indices[i] != vertex) && (k < 2 || indices[i + 1] != vertex))
+					{
+						++newVertices;
+					}
+				}
+			}
+
+			for (size_t k = 0; k < 3; ++k)
+			{
+				vertexCluster[indices[i + k]] = clusterId;
+			}
+			clusterVertices += newVertices;
+		}
+
+		clusters.push_back(MakeCluster(vertices, indices, clusterBegin, indexCount, indexStart));
+	}
+}
+
+void Hololens_OBJRenderer::BuildClusters(
+	const VertexPositionColor* vertices,
+	const UINT* indices,
+	size_t indexCount,
+	UINT indexStart,
+	std::vector<MeshCluster>& clusters)
+{
+	BuildClustersFrom(vertices, indices, indexCount, indexStart, clusters);
+}
+
+void Hololens_OBJRenderer::BuildClusters(
+	const VertexPositionColor* vertices,
+	const uint16* indices,
+	size_t indexCount,
+	UINT indexStart,
+	std::vector<MeshCluster>& clusters)
+{
+	BuildClustersFrom(vertices, indices, indexCount, indexStart, clusters);
+}
+
+bool XM_CALLCONV Hololens_OBJRenderer::IsClusterBackFacing(const MeshCluster& cluster, FXMVECTOR viewPosition, float viewRadius)
+{
+	if (cluster.coneCutoff >= 1.f)
+	{
+		return false;
+	}
+
+	// Every point of the sphere, seen from every point within viewRadius of the
+	// view position, lies behind the cone. Moving the view point by viewRadius
+	// moves the dot product by as much, and the cutoff distance by |cutoff| times
+	// as much.
+	const XMVECTOR toCenter = XMVectorSubtract(XMLoadFloat3(&cluster.center), viewPosition);
+	const float distance = XMVectorGetX(XMVector3Length(toCenter));
+	const float alongAxis = XMVectorGetX(XMVector3Dot(toCenter, XMLoadFloat3(&cluster.coneAxis)));
+	return alongAxis >= cluster.coneCutoff * distance + cluster.radius + viewRadius * (1.f + fabsf(cluster.coneCutoff));
+}
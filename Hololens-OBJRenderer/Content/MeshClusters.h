@@ -0,0 +1,52 @@
+#pragma once
+
+#include "ShaderStructures.h"
+
+#include <vector>
+
+namespace Hololens_OBJRenderer
+{
+	// A run of triangles in an index buffer, small enough to be culled on its own.
+	// The bounds are in mesh space. The normal cone holds the normals of all the
+	// triangles; coneCutoff is 1 when they spread too far for the cone to be useful.
+	struct MeshCluster
+	{
+		UINT				indexStart;
+		UINT				indexCount;
+		DirectX::XMFLOAT3	center;
+		float				radius;
+		DirectX::XMFLOAT3	coneAxis;
+		float				coneCutoff;
+	};
+
+	// Limits of a single cluster. They match the meshlet sizes commonly used on GPUs,
+	// which keep both the bounding sphere and the normal cone tight.
+	constexpr size_t c_maxClusterTriangles = 124;
+	constexpr size_t c_maxClusterVertices = 64;
+
+	// Levels of detail with fewer triangles than this are not split into clusters;
+	// they are cheaper to draw instanced as a whole than to cull per instance.
+	constexpr size_t c_minClusteredTriangles = 8192;
+
+	// Splits an index range into clusters, walking the triangles in order so that a
+	// vertex cache optimized order is kept. indices are relative to vertices, and
+	// indexStart is the position of indices[0] in the index buffer the clusters refer
+	// to. Clusters are appended to clusters.
+	void BuildClusters(
+		const VertexPositionColor* vertices,
+		const UINT* indices,
+		size_t indexCount,
+		UINT indexStart,
+		std::vector<MeshCluster>& clusters);
+	void BuildClusters(
+		const VertexPositionColor* vertices,
+		const uint16* indices,
+		size_t indexCount,
+		UINT indexStart,
+		std::vector<MeshCluster>& clusters);
+
+	// True if every triangle of the cluster faces away from every point within
+	// viewRadius of viewPosition. Both are in mesh space. Triangles are front facing
+	// when they wind clockwise on screen, as with the default rasterizer state.
+	bool XM_CALLCONV IsClusterBackFacing(const MeshCluster& cluster, DirectX::FXMVECTOR viewPosition, float viewRadius);
+}
@@ -0,0 +1,338 @@
+#include "pch.h"
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <math.h>
+
+using namespace Hololens_OBJRenderer;
+
+namespace
+{
+	// Scoring parameters from the paper. The LRU cache modelled while ordering is
+	// larger than the one ACMR is measured with, which the paper found to work well
+	// across cache sizes.
+	constexpr int c_cacheSize = 32;
+	constexpr float c_cacheDecayPower = 1.5f;
+	constexpr float c_lastTriangleScore = 0.75f;
+	constexpr float c_valenceBoostScale = 2.0f;
+	constexpr float c_valenceBoostPower = 0.5f;
+	constexpr UINT c_maxTabulatedValence = 32;
+
+	class VertexScoreTable
+	{
+	public:
+		VertexScoreTable()
+		{
+			for (int i = 0; i < c_cacheSize; ++i)
+			{
+				// The three vertices of the last triangle get a fixed score, so that
+				// the next triangle does not simply reuse the same edge every time.
+				m_cacheScores[i] = i < 3 ?
+					c_lastTriangleScore :
+					powf(1.f - static_cast<float>(i - 3) / (c_cacheSize - 3), c_cacheDecayPower);
+			}
+
+			m_valenceScores[0] = 0.f;
+			for (UINT i = 1; i <= c_maxTabulatedValence; ++i)
+			{
+				m_valenceScores[i] = ValenceScore(i);
+			}
+		}
+
+		// Vertices with few triangles left score higher, so that lone triangles are
+		// not left behind to be picked up later with a cold cache.
+		float Score(int cachePosition, UINT remainingValence) const
+		{
+			if (remainingValence == 0)
+			{
+				return -1.f;
+			}
+
+			const float cacheScore = cachePosition >= 0 ? m_cacheScores[cachePosition] : 0.f;
+			const float valenceScore = remainingValence <= c_maxTabulatedValence ?
+				m_valenceScores[remainingValence] :
+				ValenceScore(remainingValence);
+			return cacheScore + valenceScore;
+		}
+
+	private:
+		static float ValenceScore(UINT valence)
+		{
+			return c_valenceBoostScale * powf(static_cast<float>(valence), -c_valenceBoostPower);
+		}
+
+		float m_cacheScores[c_cacheSize];
+		float m_valenceScores[c_maxTabulatedValence + 1];
+	};
+
+	void OptimizeTriangleOrder(const std::vector<UINT>& indices, size_t vertexCount, std::vector<UINT>& optimized)
+	{
+		static const VertexScoreTable scores;
+
+		const size_t triangleCount = indices.size() / 3;
+
+		// Triangles using each vertex, as one array sliced by vertex.
+		std::vector<UINT> valence(vertexCount, 0);
+		for (size_t i = 0; i < triangleCount * 3; ++i)
+		{
+			++valence[indices[i]];
+		}
+
+		std::vector<UINT> adjacencyStart(vertexCount + 1, 0);
+		for (size_t v = 0; v < vertexCount; ++v)
+		{
+			adjacencyStart[v + 1] = adjacencyStart[v] + valence[v];
+		}
+
+		std::vector<UINT> adjacency(triangleCount * 3);
+		{
+			std::vector<UINT> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+			for (size_t i = 0; i < triangleCount * 3; ++i)
+			{
+				adjacency[fill[indices[i]]++] = static_cast<UINT>(i / 3);
+			}
+		}
+
+		// valence now counts the triangles of each vertex that are not emitted yet.
+		std::vector<int> cachePosition(vertexCount, -1);
+		std::vector<float> vertexScore(vertexCount);
+		for (size_t v = 0; v < vertexCount; ++v)
+		{
+			vertexScore[v] = scores.Score(-1, valence[v]);
+		}
+
+		std::vector<float> triangleScore(triangleCount);
+		std::vector<bool> emitted(triangleCount, false);
+		int bestTriangle = -1;
+		float bestScore = -1.f;
+		for (size_t t = 0; t < triangleCount; ++t)
+		{
+			triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+			if (triangleScore[t] > bestScore)
+			{
+				bestScore = triangleScore[t];
+				bestTriangle = static_cast<int>(t);
+			}
+		}
+
+		// Room for the cache plus the three vertices pushed in front of it.
+		UINT cache[c_cacheSize + 3];
+		int cacheCount = 0;
+		size_t scanCursor = 0;
+
+		optimized.clear();
+		optimized.reserve(triangleCount * 3);
+
+		for (size_t n = 0; n < triangleCount; ++n)
+		{
+			// When no triangle around the cache is left, continue with the next one
+			// in the original order; that is usually close to the last one emitted.
+			if (bestTriangle < 0)
+			{
+				while (emitted[scanCursor]) { ++scanCursor; }
+				bestTriangle = static_cast<int>(scanCursor);
+			}
+
+			const UINT* triangle = &indices[bestTriangle * 3];
+			optimized.insert(optimized.end(), triangle, triangle + 3);
+			emitted[bestTriangle] = true;
+
+			// Remove the triangle from its vertices' lists of remaining triangles.
+			for (int k = 0; k < 3; ++k)
+			{
+				const UINT v = triangle[k];
+				UINT* begin = &adjacency[adjacencyStart[v]];
+				UINT* end = begin + valence[v];
+				for (UINT* p = begin; p != end; ++p)
+				{
+					if (*p == static_cast<UINT>(bestTriangle))
+					{
+						*p = *(end - 1);
+						--valence[v];
+						break;
+					}
+				}
+			}
+
+			// Move the triangle's vertices to the front of the LRU cache.
+			UINT newCache[c_cacheSize + 3];
+			int newCount = 0;
+			for (int k = 0; k < 3; ++k)
+			{
+				const UINT v = triangle[k];
+				if (std::find(newCache, newCache + newCount, v) == newCache + newCount)
+				{
+					newCache[newCount++] = v;
+				}
+			}
+			for (int i = 0; i < cacheCount; ++i)
+			{
+				const UINT v = cache[i];
+				if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+				{
+					newCache[newCount++] = v;
+				}
+			}
+
+			// Rescore the vertices whose cache position changed, including those that
+			// just fell out, and then the triangles around them.
+			for (int i = 0; i < newCount; ++i)
+			{
+				const UINT v = newCache[i];
+				cachePosition[v] = i < c_cacheSize ? i : -1;
+				vertexScore[v] = scores.Score(cachePosition[v], valence[v]);
+			}
+
+			bestTriangle = -1;
+			bestScore = -1.f;
+			for (int i = 0; i < newCount; ++i)
+			{
+				const UINT v = newCache[i];
+				const UINT* begin = &adjacency[adjacencyStart[v]];
+				const UINT* end = begin + valence[v];
+				for (const UINT* p = begin; p != end; ++p)
+				{
+					const UINT t = *p;
+					triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+					if (i < c_cacheSize && triangleScore[t] > bestScore)
+					{
+						bestScore = triangleScore[t];
+						bestTriangle = static_cast<int>(t);
+					}
+				}
+			}
+
+			cacheCount = (std::min)(newCount, c_cacheSize);
+			std::copy(newCache, newCache + cacheCount, cache);
+		}
+	}
+}
+
+float Hololens_OBJRenderer::ComputeACMR(const UINT* indices, size_t indexCount, size_t vertexCount, size_t cacheSize)
+{
+	const size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0)
+	{
+		return 0.f;
+	}
+
+	// A vertex is in the FIFO if fewer than cacheSize misses happened since it was
+	// inserted.
+	constexpr size_t notCached = ~size_t(0);
+	std::vector<size_t> insertedAt(vertexCount, notCached);
+	size_t misses = 0;
+	for (size_t i = 0; i < triangleCount * 3; ++i)
+	{
+		const UINT v = indices[i];
+		if (insertedAt[v] == notCached || misses - insertedAt[v] >= cacheSize)
+		{
+			insertedAt[v] = misses++;
+		}
+	}
+
+	return static_cast<float>(misses) / static_cast<float>(triangleCount);
+}
+
+void Hololens_OBJRenderer::OptimizeVertexCache(std::vector<UINT>& indices, size_t vertexCount)
+{
+	indices.resize(indices.size() - indices.size() % 3);
+
+	std::vector<UINT> optimized;
+	OptimizeTriangleOrder(indices, vertexCount, optimized);
+	indices.swap(optimized);
+}
+
+void Hololens_OBJRenderer::CompactVertices(
+	const UINT* indices,
+	size_t indexCount,
+	std::vector<UINT>& remap,
+	std::vector<UINT>& localIndices,
+	std::vector<UINT>& usedVertices)
+{
+	localIndices.resize(indexCount);
+	usedVertices.clear();
+	for (size_t i = 0; i < indexCount; ++i)
+	{
+		UINT& local = remap[indices[i]];
+		if (local == ~0u)
+		{
+			local = static_cast<UINT>(usedVertices.size());
+			usedVertices.push_back(indices[i]);
+		}
+		localIndices[i] = local;
+	}
+
+	for (const UINT vertex : usedVertices)
+	{
+		remap[vertex] = ~0u;
+	}
+}
+
+MeshOptimizationStats Hololens_OBJRenderer::OptimizeMesh(
+	std::vector<VertexPositionColor>& vertices,
+	std::vector<UINT>& indices,
+	std::vector<DirectX::XMFLOAT2>* texcoords,
+	const std::vector<MeshMaterialRange>* materialRanges)
+{
+	MeshOptimizationStats stats;
+	indices.resize(indices.size() - indices.size() % 3);
+	if (indices.empty())
+	{
+		return stats;
+	}
+
+	stats.acmrBefore = ComputeACMR(indices.data(), indices.size(), vertices.size());
+
+	constexpr UINT unused = ~0u;
+	std::vector<UINT> optimized;
+	if (materialRanges == nullptr || materialRanges->size() < 2)
+	{
+		OptimizeTriangleOrder(indices, vertices.size(), optimized);
+	}
+	else
+	{
+		// Each range is ordered over the vertices it uses alone.
+		optimized.resize(indices.size());
+		std::vector<UINT> rangeRemap(vertices.size(), unused);
+		std::vector<UINT> rangeIndices;
+		std::vector<UINT> rangeVertices;
+		std::vector<UINT> rangeOptimized;
+		for (const MeshMaterialRange& range : *materialRanges)
+		{
+			CompactVertices(indices.data() + range.indexStart, range.indexCount, rangeRemap, rangeIndices, rangeVertices);
+			OptimizeTriangleOrder(rangeIndices, rangeVertices.size(), rangeOptimized);
+			std::transform(rangeOptimized.begin(), rangeOptimized.end(), optimized.begin() + range.indexStart, [&](UINT index) { return rangeVertices[index]; });
+		}
+	}
+
+	// Renumber vertices in order of first use.
+	const bool reorderTexcoords = texcoords != nullptr && !texcoords->empty();
+	std::vector<UINT> remap(vertices.size(), unused);
+	std::vector<VertexPositionColor> reordered;
+	std::vector<DirectX::XMFLOAT2> reorderedTexcoords;
+	reordered.reserve(vertices.size());
+	reorderedTexcoords.reserve(reorderTexcoords ? vertices.size() : 0);
+	for (UINT& index : optimized)
+	{
+		if (remap[index] == unused)
+		{
+			remap[index] = static_cast<UINT>(reordered.size());
+			reordered.push_back(vertices[index]);
+			if (reorderTexcoords)
+			{
+				reorderedTexcoords.push_back((*texcoords)[index]);
+			}
+		}
+		index = remap[index];
+	}
+
+	vertices.swap(reordered);
+	indices.swap(optimized);
+	if (reorderTexcoords)
+	{
+		texcoords->swap(reorderedTexcoords);
+	}
+
+	stats.acmrAfter = ComputeACMR(indices.data(), indices.size(), vertices.size());
+	return stats;
+}
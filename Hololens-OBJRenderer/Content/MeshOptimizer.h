@@ -0,0 +1,55 @@
+#pragma once
+
+#include "ShaderStructures.h"
+#include "MeshCache.h"
+
+#include <vector>
+
+namespace Hololens_OBJRenderer
+{
+	// Average number of vertices transformed per triangle (ACMR) before and after
+	// optimization. 3 means no reuse at all; a regular grid approaches 0.5.
+	struct MeshOptimizationStats
+	{
+		float acmrBefore = 0.f;
+		float acmrAfter = 0.f;
+	};
+
+	// Vertex cache size assumed when measuring ACMR. It is a conservative estimate
+	// of the post-transform cache of mobile GPUs.
+	constexpr size_t c_acmrCacheSize = 16;
+
+	// Simulates a FIFO post-transform vertex cache of cacheSize entries over a
+	// triangle list and returns its ACMR.
+	float ComputeACMR(const UINT* indices, size_t indexCount, size_t vertexCount, size_t cacheSize = c_acmrCacheSize);
+
+	// Reorders triangles for post-transform vertex cache reuse, using Tom Forsyth's
+	// "Linear-Speed Vertex Cache Optimisation", then reorders the vertices into the
+	// order the triangles first use them, for vertex fetch locality. Vertices that
+	// no triangle uses are dropped. Each stereo view transforms every vertex that
+	// misses the cache, so a miss costs twice on a HoloLens.
+	//
+	// Texture coordinates, one per vertex, are reordered with the vertices. With
+	// material ranges, triangles only move within their range.
+	MeshOptimizationStats OptimizeMesh(
+		std::vector<VertexPositionColor>& vertices,
+		std::vector<UINT>& indices,
+		std::vector<DirectX::XMFLOAT2>* texcoords = nullptr,
+		const std::vector<MeshMaterialRange>* materialRanges = nullptr);
+
+	// Reorders triangles only, for index buffers that share a vertex buffer that is
+	// already in its final order, such as the levels of detail of a mesh.
+	void OptimizeVertexCache(std::vector<UINT>& indices, size_t vertexCount);
+
+	// Numbers the vertices that indexCount indices use from 0, in order of first use,
+	// so that part of a mesh can be processed without the cost of the whole vertex
+	// buffer. usedVertices receives the vertex each number stands for. remap must
+	// hold one ~0u per vertex of the mesh, and is left that way, so that it can be
+	// reused for the next part.
+	void CompactVertices(
+		const UINT* indices,
+		size_t indexCount,
+		std::vector<UINT>& remap,
+		std::vector<UINT>& localIndices,
+		std::vector<UINT>& usedVertices);
+}
@@ -0,0 +1,232 @@
+#include "pch.h"
+#include "MeshPreview.h"
+#include "VertexPostProcess.h"
+#include "Common\DirectXHelper.h"
+
+#include <algorithm>
+
+using namespace Hololens_OBJRenderer;
+using namespace DirectX;
+
+namespace
+{
+	// The buffers start with room for this many bytes, which is a few chunks of a
+	// large file, and double from there.
+	constexpr size_t c_minBufferSize = 1 << 20;
+
+	// Every buffer has to fit in the smallest resource size Direct3D 11 guarantees.
+	constexpr size_t c_maxBufferSize = size_t(D3D11_REQ_RESOURCE_SIZE_IN_MEGABYTES_EXPRESSION_A_TERM) << 20;
+}
+
+void MeshPreview::Append(const OBJPreviewChunk& chunk)
+{
+	if (m_full)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	// Without normals the preview is lit as if every face pointed up.
+	const XMFLOAT3 up(0.f, 1.f, 0.f);
+	for (size_t i = 0; i < chunk.positionCount; ++i)
+	{
+		const XMFLOAT3& pos = chunk.positions[i];
+		m_pendingVertices.push_back({ pos, chunk.normals ? chunk.normals[i] : up });
+
+		if (m_appendedVertexCount == 0)
+		{
+			m_appendedBounds.min = pos;
+			m_appendedBounds.max = pos;
+		}
+		else
+		{
+			m_appendedBounds.min.x = (std::min)(m_appendedBounds.min.x, pos.x);
+			m_appendedBounds.min.y = (std::min)(m_appendedBounds.min.y, pos.y);
+			m_appendedBounds.min.z = (std::min)(m_appendedBounds.min.z, pos.z);
+			m_appendedBounds.max.x = (std::max)(m_appendedBounds.max.x, pos.x);
+			m_appendedBounds.max.y = (std::max)(m_appendedBounds.max.y, pos.y);
+			m_appendedBounds.max.z = (std::max)(m_appendedBounds.max.z, pos.z);
+		}
+		++m_appendedVertexCount;
+	}
+
+	m_pendingIndices.insert(m_pendingIndices.end(), chunk.indices, chunk.indices + chunk.indexCount);
+}
+
+bool MeshPreview::Commit(ID3D11Device* device, ID3D11DeviceContext* context)
+{
+	if (m_full)
+	{
+		return false;
+	}
+
+	// Take what was appended, and hand back the emptied vectors of the last commit
+	// so that their storage is reused.
+	MeshBounds bounds;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_pendingIndices.empty())
+		{
+			return false;
+		}
+
+		m_committingVertices.swap(m_pendingVertices);
+		m_committingIndices.swap(m_pendingIndices);
+		bounds = m_appendedBounds;
+	}
+
+	const size_t vertexSize = m_committingVertices.size() * sizeof(VertexPositionColor);
+	const size_t indexSize = m_committingIndices.size() * sizeof(UINT);
+	const size_t usedVertexSize = m_committedVertexCount * sizeof(VertexPositionColor);
+	const size_t usedIndexSize = m_committedIndexCount * sizeof(UINT);
+	if (!EnsureCapacity(device, context, D3D11_BIND_VERTEX_BUFFER, usedVertexSize, usedVertexSize + vertexSize, m_vertexBuffer, m_vertexCapacity) ||
+		!EnsureCapacity(device, context, D3D11_BIND_INDEX_BUFFER, usedIndexSize, usedIndexSize + indexSize, m_indexBuffer, m_indexCapacity))
+	{
+		// Keep drawing what is there; the mesh itself is not bound by this limit.
+		m_full = true;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_pendingVertices = std::vector<VertexPositionColor>();
+		m_pendingIndices = std::vector<UINT>();
+		m_committingVertices = std::vector<VertexPositionColor>();
+		m_committingIndices = std::vector<UINT>();
+		return false;
+	}
+
+	if (vertexSize > 0)
+	{
+		Upload(device, context, m_vertexBuffer.Get(), usedVertexSize, m_committingVertices.data(), vertexSize);
+	}
+	Upload(device, context, m_indexBuffer.Get(), usedIndexSize, m_committingIndices.data(), indexSize);
+
+	m_committedVertexCount += m_committingVertices.size();
+	m_committedIndexCount += static_cast<UINT>(m_committingIndices.size());
+	m_committingVertices.clear();
+	m_committingIndices.clear();
+
+	// Fit the bounds so far into the cube the finished mesh is scaled to, the same
+	// way PostProcessVertices does; a flat axis is collapsed onto the center.
+	const XMVECTOR minimum = XMLoadFloat3(&bounds.min);
+	const XMVECTOR maximum = XMLoadFloat3(&bounds.max);
+	const XMVECTOR extent = XMVectorSubtract(maximum, minimum);
+	const XMVECTOR center = XMVectorScale(XMVectorAdd(maximum, minimum), 0.5f);
+	const XMVECTOR scale = XMVectorSelect(
+		XMVectorZero(),
+		XMVectorDivide(XMVectorReplicate(c_meshSize), extent),
+		XMVectorGreater(extent, XMVectorZero()));
+	const XMVECTOR offset = XMVectorNegate(XMVectorMultiply(center, scale));
+
+	XMStoreFloat4x4(&m_positionTransform, XMMatrixMultiply(XMMatrixScalingFromVector(scale), XMMatrixTranslationFromVector(offset)));
+	XMStoreFloat3(&m_bounds.min, XMVectorMultiplyAdd(minimum, scale, offset));
+	XMStoreFloat3(&m_bounds.max, XMVectorMultiplyAdd(maximum, scale, offset));
+	return true;
+}
+
+bool MeshPreview::EnsureCapacity(
+	ID3D11Device* device,
+	ID3D11DeviceContext* context,
+	UINT bindFlags,
+	size_t usedSize,
+	size_t requiredSize,
+	Microsoft::WRL::ComPtr<ID3D11Buffer>& buffer,
+	size_t& capacity)
+{
+	if (requiredSize <= capacity)
+	{
+		return true;
+	}
+	if (requiredSize > c_maxBufferSize)
+	{
+		return false;
+	}
+
+	size_t newCapacity = (std::max)(capacity, c_minBufferSize);
+	while (newCapacity < requiredSize)
+	{
+		newCapacity *= 2;
+	}
+	newCapacity = (std::min)(newCapacity, c_maxBufferSize);
+
+	const CD3D11_BUFFER_DESC bufferDesc(static_cast<UINT>(newCapacity), bindFlags);
+	Microsoft::WRL::ComPtr<ID3D11Buffer> newBuffer;
+	DX::ThrowIfFailed(
+		device->CreateBuffer(
+			&bufferDesc,
+			nullptr,
+			&newBuffer
+			)
+		);
+
+	// Carry over what is already committed, without a round trip through the CPU.
+	if (usedSize > 0)
+	{
+		const D3D11_BOX box = { 0, 0, 0, static_cast<UINT>(usedSize), 1, 1 };
+		context->CopySubresourceRegion(newBuffer.Get(), 0, 0, 0, 0, buffer.Get(), 0, &box);
+	}
+
+	buffer = newBuffer;
+	capacity = newCapacity;
+	return true;
+}
+
+void MeshPreview::Upload(
+	ID3D11Device* device,
+	ID3D11DeviceContext* context,
+	ID3D11Buffer* buffer,
+	size_t offset,
+	const void* data,
+	size_t size)
+{
+	D3D11_SUBRESOURCE_DATA bufferData = { 0 };
+	bufferData.pSysMem = data;
+	const CD3D11_BUFFER_DESC stagingDesc(static_cast<UINT>(size), 0, D3D11_USAGE_STAGING, D3D11_CPU_ACCESS_WRITE);
+	Microsoft::WRL::ComPtr<ID3D11Buffer> stagingBuffer;
+	DX::ThrowIfFailed(
+		device->CreateBuffer(
+			&stagingDesc,
+			&bufferData,
+			&stagingBuffer
+			)
+		);
+
+	const D3D11_BOX box = { 0, 0, 0, static_cast<UINT>(size), 1, 1 };
+	context->CopySubresourceRegion(buffer, 0, static_cast<UINT>(offset), 0, 0, stagingBuffer.Get(), 0, &box);
+}
+
+void MeshPreview::Attach(ID3D11DeviceContext* context) const
+{
+	// Each vertex is one instance of the VertexPositionColor struct.
+	const UINT stride = sizeof(VertexPositionColor);
+	const UINT offset = 0;
+	context->IASetVertexBuffers(
+		0,
+		1,
+		m_vertexBuffer.GetAddressOf(),
+		&stride,
+		&offset
+		);
+	context->IASetIndexBuffer(
+		m_indexBuffer.Get(),
+		DXGI_FORMAT_R32_UINT, // Each index is one 32-bit unsigned integer.
+		0
+		);
+}
+
+void MeshPreview::Draw(ID3D11DeviceContext* context, UINT instanceCount) const
+{
+	context->DrawIndexedInstanced(m_committedIndexCount, instanceCount, 0, 0, 0);
+}
+
+BoundingBox MeshPreview::GetBoundingBox() const
+{
+	BoundingBox box;
+	BoundingBox::CreateFromPoints(box, XMLoadFloat3(&m_bounds.min), XMLoadFloat3(&m_bounds.max));
+	return box;
+}
+
+BoundingSphere MeshPreview::GetBoundingSphere() const
+{
+	BoundingSphere sphere;
+	BoundingSphere::CreateFromBoundingBox(sphere, GetBoundingBox());
+	return sphere;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "ShaderStructures.h"
+#include "MeshCache.h"
+#include "OBJParser.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace Hololens_OBJRenderer
+{
+	// What has been parsed of a mesh so far, drawn until the mesh itself is ready.
+	// The loading thread appends the parser's preview chunks; the rendering thread
+	// copies them through staging buffers into DEFAULT usage buffers, and draws every
+	// triangle committed so far with one draw call. The buffers start large enough
+	// for several chunks and double when full, keeping their contents on the GPU.
+	//
+	// Vertices are in the full precision layout, and are fitted into the same cube as
+	// the finished mesh by the position transform, from the bounds committed so far.
+	class MeshPreview
+	{
+	public:
+		// Queues a chunk for the next Commit. Called on the loading thread.
+		void Append(const OBJPreviewChunk& chunk);
+
+		// Uploads what was appended since the last call. Returns true if there is
+		// more to draw, in which case the position transform and bounds may have
+		// changed. Called on the rendering thread, as is everything below.
+		bool Commit(ID3D11Device* device, ID3D11DeviceContext* context);
+
+		bool IsDrawable() const										{ return m_committedIndexCount > 0; }
+
+		void Attach(ID3D11DeviceContext* context) const;
+		void Draw(ID3D11DeviceContext* context, UINT instanceCount) const;
+
+		// Maps the committed vertices into mesh space, where they have bounds.
+		DirectX::XMMATRIX XM_CALLCONV GetPositionTransform() const	{ return DirectX::XMLoadFloat4x4(&m_positionTransform); }
+		const MeshBounds& GetBounds() const							{ return m_bounds; }
+		DirectX::BoundingBox GetBoundingBox() const;
+		DirectX::BoundingSphere GetBoundingSphere() const;
+
+	private:
+		// Grows buffer to hold requiredSize bytes, of which the first usedSize are
+		// kept. Returns false if that is more than a buffer is guaranteed to hold.
+		static bool EnsureCapacity(
+			ID3D11Device* device,
+			ID3D11DeviceContext* context,
+			UINT bindFlags,
+			size_t usedSize,
+			size_t requiredSize,
+			Microsoft::WRL::ComPtr<ID3D11Buffer>& buffer,
+			size_t& capacity);
+
+		// Copies size bytes of data to offset in buffer, through a staging buffer.
+		static void Upload(
+			ID3D11Device* device,
+			ID3D11DeviceContext* context,
+			ID3D11Buffer* buffer,
+			size_t offset,
+			const void* data,
+			size_t size);
+
+		// Appended and not yet committed, with the bounds of every position appended.
+		std::mutex											m_mutex;
+		std::vector<VertexPositionColor>					m_pendingVertices;
+		std::vector<UINT>									m_pendingIndices;
+		MeshBounds											m_appendedBounds = {};
+		size_t												m_appendedVertexCount = 0;
+
+		// Set once the preview outgrows its buffers; it then stays as it is.
+		std::atomic<bool>									m_full = { false };
+
+		// Committed to the GPU.
+		std::vector<VertexPositionColor>					m_committingVertices;
+		std::vector<UINT>									m_committingIndices;
+		Microsoft::WRL::ComPtr<ID3D11Buffer>				m_vertexBuffer;
+		Microsoft::WRL::ComPtr<ID3D11Buffer>				m_indexBuffer;
+		size_t												m_vertexCapacity = 0;
+		size_t												m_indexCapacity = 0;
+		size_t												m_committedVertexCount = 0;
+		UINT												m_committedIndexCount = 0;
+		DirectX::XMFLOAT4X4									m_positionTransform;
+		MeshBounds											m_bounds = {};
+	};
+}
@@ -0,0 +1,283 @@
+#include "pch.h"
+#include "MeshSimplifier.h"
+
+#include <algorithm>
+
+using namespace Hololens_OBJRenderer;
+using namespace DirectX;
+
+namespace
+{
+	// Sum of squared distances to a set of planes, as a symmetric 4x4 matrix.
+	struct Quadric
+	{
+		double a00, a01, a02, a11, a12, a22;
+		double b0, b1, b2;
+		double c;
+
+		static Quadric FromPlane(double nx, double ny, double nz, double d, double weight)
+		{
+			Quadric q;
+			q.a00 = nx * nx * weight; q.a01 = nx * ny * weight; q.a02 = nx * nz * weight;
+			q.a11 = ny * ny * weight; q.a12 = ny * nz * weight;
+			q.a22 = nz * nz * weight;
+			q.b0 = nx * d * weight; q.b1 = ny * d * weight; q.b2 = nz * d * weight;
+			q.c = d * d * weight;
+			return q;
+		}
+
+		void Add(const Quadric& q)
+		{
+			a00 += q.a00; a01 += q.a01; a02 += q.a02;
+			a11 += q.a11; a12 += q.a12;
+			a22 += q.a22;
+			b0 += q.b0; b1 += q.b1; b2 += q.b2;
+			c += q.c;
+		}
+
+		double Evaluate(const XMFLOAT3& p) const
+		{
+			const double x = p.x, y = p.y, z = p.z;
+			return
+				a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z +
+				a11 * y * y + 2 * a12 * y * z +
+				a22 * z * z +
+				2 * (b0 * x + b1 * y + b2 * z) + c;
+		}
+	};
+
+	struct Collapse
+	{
+		UINT	from;
+		UINT	to;
+		double	cost;
+	};
+
+	inline XMVECTOR XM_CALLCONV TriangleNormal(const XMFLOAT3& a, const XMFLOAT3& b, const XMFLOAT3& c)
+	{
+		const XMVECTOR pa = XMLoadFloat3(&a);
+		return XMVector3Cross(XMVectorSubtract(XMLoadFloat3(&b), pa), XMVectorSubtract(XMLoadFloat3(&c), pa));
+	}
+
+	// Marks vertices that must not be removed: those on open borders, and those that
+	// share their position with another vertex.
+	void FindLockedVertices(const VertexPositionColor* vertices, size_t vertexCount, const std::vector<UINT>& indices, std::vector<bool>& locked)
+	{
+		locked.assign(vertexCount, false);
+
+		// Seams: sort vertices by position and look for runs of equal positions.
+		std::vector<UINT> order(vertexCount);
+		for (size_t i = 0; i < vertexCount; ++i) { order[i] = static_cast<UINT>(i); }
+		auto less = [vertices](UINT a, UINT b)
+		{
+			const XMFLOAT3& pa = vertices[a].pos;
+			const XMFLOAT3& pb = vertices[b].pos;
+			if (pa.x != pb.x) { return pa.x < pb.x; }
+			if (pa.y != pb.y) { return pa.y < pb.y; }
+			return pa.z < pb.z;
+		};
+		std::sort(order.begin(), order.end(), less);
+		for (size_t i = 1; i < vertexCount; ++i)
+		{
+			if (!less(order[i - 1], order[i]))
+			{
+				locked[order[i - 1]] = true;
+				locked[order[i]] = true;
+			}
+		}
+
+		// Borders: edges used by only one triangle.
+		std::vector<unsigned long long> edges;
+		edges.reserve(indices.size());
+		for (size_t t = 0; t + 2 < indices.size(); t += 3)
+		{
+			for (size_t k = 0; k < 3; ++k)
+			{
+				const unsigned long long a = indices[t + k];
+				const unsigned long long b = indices[t + (k + 1) % 3];
+				edges.push_back(a < b ? (a << 32) | b : (b << 32) | a);
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+		for (size_t i = 0; i < edges.size();)
+		{
+			size_t j = i + 1;
+			while (j < edges.size() && edges[j] == edges[i]) { ++j; }
+			if (j - i == 1)
+			{
+				locked[static_cast<size_t>(edges[i] >> 32)] = true;
+				locked[static_cast<size_t>(edges[i] & 0xffffffff)] = true;
+			}
+			i = j;
+		}
+	}
+}
+
+void Hololens_OBJRenderer::SimplifyMesh(
+	const VertexPositionColor* vertices,
+	size_t vertexCount,
+	const std::vector<UINT>& indices,
+	size_t targetIndexCount,
+	std::vector<UINT>& simplified)
+{
+	simplified.assign(indices.begin(), indices.end() - indices.size() % 3);
+	targetIndexCount -= targetIndexCount % 3;
+	if (simplified.size() <= targetIndexCount)
+	{
+		return;
+	}
+
+	std::vector<bool> locked;
+	FindLockedVertices(vertices, vertexCount, simplified, locked);
+
+	// Each vertex starts with the planes of the triangles around it, weighted by
+	// area so that slivers do not dominate.
+	std::vector<Quadric> quadrics(vertexCount, Quadric{});
+	for (size_t t = 0; t < simplified.size(); t += 3)
+	{
+		const XMFLOAT3& p0 = vertices[simplified[t]].pos;
+		XMFLOAT3 normal;
+		XMStoreFloat3(&normal, TriangleNormal(p0, vertices[simplified[t + 1]].pos, vertices[simplified[t + 2]].pos));
+
+		const double length = sqrt(double(normal.x) * normal.x + double(normal.y) * normal.y + double(normal.z) * normal.z);
+		if (length == 0.0)
+		{
+			continue;
+		}
+
+		const double nx = normal.x / length, ny = normal.y / length, nz = normal.z / length;
+		const double d = -(nx * p0.x + ny * p0.y + nz * p0.z);
+		const Quadric plane = Quadric::FromPlane(nx, ny, nz, d, length * 0.5);
+		for (size_t k = 0; k < 3; ++k)
+		{
+			quadrics[simplified[t + k]].Add(plane);
+		}
+	}
+
+	std::vector<UINT> adjacencyStart(vertexCount + 1);
+	std::vector<UINT> adjacency;
+	std::vector<Collapse> collapses;
+	std::vector<UINT> remap(vertexCount);
+	std::vector<bool> touched(vertexCount);
+
+	// Each pass collapses the cheapest edges that do not interfere with each other,
+	// then rebuilds the triangle list.
+	while (simplified.size() > targetIndexCount)
+	{
+		const size_t triangleCount = simplified.size() / 3;
+
+		// Triangles around each vertex.
+		std::fill(adjacencyStart.begin(), adjacencyStart.end(), 0);
+		for (const UINT index : simplified) { ++adjacencyStart[index + 1]; }
+		for (size_t v = 0; v < vertexCount; ++v) { adjacencyStart[v + 1] += adjacencyStart[v]; }
+		adjacency.resize(simplified.size());
+		{
+			std::vector<UINT> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+			for (size_t i = 0; i < simplified.size(); ++i)
+			{
+				adjacency[fill[simplified[i]]++] = static_cast<UINT>(i / 3);
+			}
+		}
+
+		// Every half-edge offers to collapse its start into its end. The other
+		// direction comes from the triangle on the other side of the edge.
+		collapses.clear();
+		for (size_t t = 0; t < triangleCount; ++t)
+		{
+			for (size_t k = 0; k < 3; ++k)
+			{
+				const UINT from = simplified[t * 3 + k];
+				const UINT to = simplified[t * 3 + (k + 1) % 3];
+				if (locked[from])
+				{
+					continue;
+				}
+
+				Quadric q = quadrics[from];
+				q.Add(quadrics[to]);
+				collapses.push_back({ from, to, q.Evaluate(vertices[to].pos) });
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+		for (size_t v = 0; v < vertexCount; ++v) { remap[v] = static_cast<UINT>(v); }
+		std::fill(touched.begin(), touched.end(), false);
+
+		// A collapse usually removes two triangles.
+		const size_t trianglesToRemove = (simplified.size() - targetIndexCount) / 3;
+		size_t trianglesRemoved = 0;
+		for (const Collapse& collapse : collapses)
+		{
+			if (trianglesRemoved >= trianglesToRemove)
+			{
+				break;
+			}
+			if (touched[collapse.from] || touched[collapse.to])
+			{
+				continue;
+			}
+
+			// Reject the collapse if any remaining triangle around the vertex would
+			// flip over or become degenerate.
+			const XMFLOAT3& target = vertices[collapse.to].pos;
+			bool flips = false;
+			size_t removed = 0;
+			for (UINT a = adjacencyStart[collapse.from]; a < adjacencyStart[collapse.from + 1] && !flips; ++a)
+			{
+				const UINT* triangle = &simplified[adjacency[a] * 3];
+				if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+				{
+					++removed;
+					continue;
+				}
+
+				XMFLOAT3 moved[3];
+				for (size_t k = 0; k < 3; ++k)
+				{
+					moved[k] = triangle[k] == collapse.from ? target : vertices[triangle[k]].pos;
+				}
+
+				const XMVECTOR before = TriangleNormal(vertices[triangle[0]].pos, vertices[triangle[1]].pos, vertices[triangle[2]].pos);
+				const XMVECTOR after = TriangleNormal(moved[0], moved[1], moved[2]);
+				flips = XMVectorGetX(XMVector3Dot(before, after)) <= 0.f;
+			}
+			if (flips)
+			{
+				continue;
+			}
+
+			remap[collapse.from] = collapse.to;
+			quadrics[collapse.to].Add(quadrics[collapse.from]);
+			trianglesRemoved += removed;
+
+			// The flip test above assumed the neighbourhood stays as it is for the
+			// rest of this pass.
+			for (UINT a = adjacencyStart[collapse.from]; a < adjacencyStart[collapse.from + 1]; ++a)
+			{
+				const UINT* triangle = &simplified[adjacency[a] * 3];
+				touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = true;
+			}
+		}
+
+		if (trianglesRemoved == 0)
+		{
+			break;
+		}
+
+		// Apply the collapses and drop the triangles that became degenerate.
+		size_t write = 0;
+		for (size_t t = 0; t < triangleCount; ++t)
+		{
+			const UINT a = remap[simplified[t * 3]];
+			const UINT b = remap[simplified[t * 3 + 1]];
+			const UINT c = remap[simplified[t * 3 + 2]];
+			if (a != b && b != c && c != a)
+			{
+				simplified[write++] = a;
+				simplified[write++] = b;
+				simplified[write++] = c;
+			}
+		}
+		simplified.resize(write);
+	}
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "ShaderStructures.h"
+
+#include <vector>
+
+namespace Hololens_OBJRenderer
+{
+	// Reduces a triangle list to about targetIndexCount indices by quadric error
+	// metric edge collapse (Garland and Heckbert, "Surface Simplification Using
+	// Quadric Error Metrics"). Vertices are never moved or created: each collapse
+	// merges a vertex into one of its neighbours, so the result indexes the same
+	// vertex buffer and all levels of detail can share it.
+	//
+	// Vertices on open borders, and vertices that share a position with another
+	// vertex (texture or normal seams), are never removed, so the result stays free
+	// of cracks. The target may therefore not always be reached; the result is what
+	// was left when no further collapse was possible.
+	void SimplifyMesh(
+		const VertexPositionColor* vertices,
+		size_t vertexCount,
+		const std::vector<UINT>& indices,
+		size_t targetIndexCount,
+		std::vector<UINT>& simplified);
+}
@@ -0,0 +1,81 @@
+#include "pch.h"
+#include "MeshSplitter.h"
+
+using namespace Hololens_OBJRenderer;
+
+void Hololens_OBJRenderer::ConvertIndicesTo16Bit(const UINT* indices, size_t indexCount, std::vector<uint16>& indices16)
+{
+	indices16.resize(indexCount);
+	for (size_t i = 0; i < indexCount; ++i)
+	{
+		indices16[i] = static_cast<uint16>(indices[i]);
+	}
+}
+
+void Hololens_OBJRenderer::SplitMesh(
+	const UINT* indices,
+	size_t indexCount,
+	size_t vertexCount,
+	std::vector<UINT>& vertexRemap,
+	std::vector<uint16>& indices16,
+	std::vector<MeshSubset>& subsets)
+{
+	constexpr UINT noSubset = ~0u;
+
+	vertexRemap.clear();
+	vertexRemap.reserve(vertexCount);
+	indices16.resize(indexCount - indexCount % 3);
+	subsets.clear();
+
+	// For each source vertex, the last subset it was added to and its index there.
+	std::vector<UINT> vertexSubset(vertexCount, noSubset);
+	std::vector<uint16> localIndex(vertexCount);
+
+	MeshSubset subset = { 0, 0, 0, 0 };
+	UINT subsetId = 0;
+	size_t subsetVertices = 0;
+
+	for (size_t i = 0; i + 2 < indexCount; i += 3)
+	{
+		// Start a new subset if this triangle's new vertices would not fit.
+		size_t newVertices = 0;
+		for (size_t k = 0; k < 3; ++k)
+		{
+			const UINT vertex = indices[i + k];
+			if (vertexSubset[vertex] != subsetId &&
+				(k < 1 || indices[i] != vertex) &&
+				(k < 2 || indices[i + 1] != vertex))
+			{
+				++newVertices;
+			}
+		}
+
+		if (subsetVertices + newVertices > c_max16BitIndexedVertices)
+		{
+			subsets.push_back(subset);
+			subset.indexStart += subset.indexCount;
+			subset.indexCount = 0;
+			subset.baseVertex = static_cast<INT>(vertexRemap.size());
+			++subsetId;
+			subsetVertices = 0;
+		}
+
+		for (size_t k = 0; k < 3; ++k)
+		{
+			const UINT vertex = indices[i + k];
+			if (vertexSubset[vertex] != subsetId)
+			{
+				vertexSubset[vertex] = subsetId;
+				localIndex[vertex] = static_cast<uint16>(subsetVertices++);
+				vertexRemap.push_back(vertex);
+			}
+			indices16[i + k] = localIndex[vertex];
+		}
+		subset.indexCount += 3;
+	}
+
+	if (subset.indexCount > 0)
+	{
+		subsets.push_back(subset);
+	}
+}
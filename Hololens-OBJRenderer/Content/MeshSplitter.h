@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+
+namespace Hololens_OBJRenderer
+{
+	// A range of a 16-bit index buffer drawn with its own base vertex, so that each
+	// subset can address up to 65536 vertices of a larger vertex buffer. Subsets are
+	// also drawn for each material range, with the texture of material.
+	struct MeshSubset
+	{
+		UINT	indexStart;
+		UINT	indexCount;
+		INT		baseVertex;
+		UINT	material;
+	};
+
+	// Largest number of vertices a 16-bit index can address.
+	constexpr size_t c_max16BitIndexedVertices = 1 << 16;
+
+	// Narrows indices to 16 bits. Every index must be below c_max16BitIndexedVertices.
+	void ConvertIndicesTo16Bit(const UINT* indices, size_t indexCount, std::vector<uint16>& indices16);
+
+	// Splits a triangle list over more than 65536 vertices into subsets that each use
+	// at most 65536. Triangles keep their order. Every subset gets its own contiguous
+	// range of vertices, so vertices shared by two subsets are duplicated: vertexRemap
+	// receives, for each vertex of the new vertex buffer, the vertex it copies.
+	void SplitMesh(
+		const UINT* indices,
+		size_t indexCount,
+		size_t vertexCount,
+		std::vector<UINT>& vertexRemap,
+		std::vector<uint16>& indices16,
+		std::vector<MeshSubset>& subsets);
+}
@@ -0,0 +1,314 @@
+#include "pch.h"
+#include "NormalGenerator.h"
+#include "Common\DirectXHelper.h"
+
+#include <algorithm>
+#include <numeric>
+#include <ppl.h>
+#include <string.h>
+
+using namespace Hololens_OBJRenderer;
+using namespace Concurrency;
+using namespace DirectX;
+using namespace Microsoft::WRL;
+
+namespace
+{
+	// Threads per group of both compute shaders.
+	constexpr size_t c_threadGroupSize = 64;
+
+	// Vertices handed to a worker at a time by the CPU path.
+	constexpr size_t c_verticesPerTask = 4096;
+
+	inline bool HasMissingNormal(const VertexPositionColor& vertex)
+	{
+		return vertex.color.x == 0.f && vertex.color.y == 0.f && vertex.color.z == 0.f;
+	}
+
+	// Maps every vertex to the first vertex at exactly the same position. The
+	// vertices are sorted by position on all cores, then runs of equal positions
+	// are collapsed.
+	void WeldPositions(const std::vector<VertexPositionColor>& vertices, std::vector<UINT>& representatives)
+	{
+		const auto lessByPosition = [&vertices](UINT a, UINT b)
+		{
+			const int order = memcmp(&vertices[a].pos, &vertices[b].pos, sizeof(XMFLOAT3));
+			return order != 0 ? order < 0 : a < b;
+		};
+
+		std::vector<UINT> order(vertices.size());
+		std::iota(order.begin(), order.end(), 0u);
+		parallel_sort(order.begin(), order.end(), lessByPosition);
+
+		representatives.resize(vertices.size());
+		UINT representative = 0;
+		for (size_t i = 0; i < order.size(); ++i)
+		{
+			if (i == 0 || memcmp(&vertices[order[i]].pos, &vertices[representative].pos, sizeof(XMFLOAT3)) != 0)
+			{
+				representative = order[i];
+			}
+			representatives[order[i]] = representative;
+		}
+	}
+
+	// The CPU path. The triangles around each vertex are listed first, so that the
+	// vertices can then be split between the cores without two writing the same one.
+	void GenerateNormalsOnCpu(
+		const VertexPositionColor* vertices,
+		size_t vertexCount,
+		const UINT* indices,
+		size_t indexCount,
+		std::vector<XMFLOAT3>& normals)
+	{
+		const size_t cornerCount = indexCount / 3 * 3;
+
+		// The triangles around vertex v are vertexTriangles[firstTriangle[v]] up to
+		// vertexTriangles[firstTriangle[v + 1]].
+		std::vector<UINT> firstTriangle(vertexCount + 1, 0);
+		for (size_t i = 0; i < cornerCount; ++i)
+		{
+			++firstTriangle[indices[i] + 1];
+		}
+		std::partial_sum(firstTriangle.begin(), firstTriangle.end(), firstTriangle.begin());
+
+		std::vector<UINT> vertexTriangles(cornerCount);
+		std::vector<UINT> nextTriangle(firstTriangle.begin(), firstTriangle.end() - 1);
+		for (size_t i = 0; i < cornerCount; ++i)
+		{
+			vertexTriangles[nextTriangle[indices[i]]++] = static_cast<UINT>(i / 3);
+		}
+
+		normals.resize(vertexCount);
+		const size_t taskCount = (vertexCount + c_verticesPerTask - 1) / c_verticesPerTask;
+		parallel_for(size_t(0), taskCount, [&](size_t task)
+		{
+			const size_t end = (std::min)((task + 1) * c_verticesPerTask, vertexCount);
+			for (size_t v = task * c_verticesPerTask; v < end; ++v)
+			{
+				// The cross product of two edges is twice the area long, which weights
+				// each triangle by its area. Front faces wind clockwise seen from
+				// outside, as the parser stores them, so (p2 - p0) x (p1 - p0) points
+				// out of the mesh.
+				XMVECTOR sum = XMVectorZero();
+				for (UINT t = firstTriangle[v]; t < firstTriangle[v + 1]; ++t)
+				{
+					const UINT* corners = indices + 3 * vertexTriangles[t];
+					const XMVECTOR p0 = XMLoadFloat3(&vertices[corners[0]].pos);
+					const XMVECTOR p1 = XMLoadFloat3(&vertices[corners[1]].pos);
+					const XMVECTOR p2 = XMLoadFloat3(&vertices[corners[2]].pos);
+					sum = XMVectorAdd(sum, XMVector3Cross(XMVectorSubtract(p2, p0), XMVectorSubtract(p1, p0)));
+				}
+
+				const bool degenerate = XMVectorGetX(XMVector3LengthSq(sum)) == 0.f;
+				XMStoreFloat3(&normals[v], degenerate ? XMVectorZero() : XMVector3Normalize(sum));
+			}
+		});
+	}
+}
+
+bool NormalGenerator::Generate(
+	const VertexPositionColor* vertices,
+	size_t vertexCount,
+	const UINT* indices,
+	size_t indexCount,
+	std::vector<XMFLOAT3>& normals)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	// Every buffer has to fit in the smallest resource size Direct3D 11 guarantees.
+	const size_t triangleCount = indexCount / 3;
+	const size_t maxBufferSize = size_t(D3D11_REQ_RESOURCE_SIZE_IN_MEGABYTES_EXPRESSION_A_TERM) << 20;
+	if (vertexCount == 0 || triangleCount == 0 ||
+		vertexCount * sizeof(VertexPositionColor) > maxBufferSize ||
+		triangleCount * 3 * sizeof(UINT) > maxBufferSize)
+	{
+		return false;
+	}
+
+	if (m_device == nullptr && !CreateDeviceResources())
+	{
+		return false;
+	}
+
+	try
+	{
+		// The vertices as a structured buffer and the indices as a raw one. The normals
+		// are summed in a raw buffer, three floats per vertex.
+		const UINT vertexBufferSize = static_cast<UINT>(vertexCount * sizeof(VertexPositionColor));
+		const UINT indexBufferSize = static_cast<UINT>(triangleCount * 3 * sizeof(UINT));
+		const UINT normalBufferSize = static_cast<UINT>(vertexCount * sizeof(XMFLOAT3));
+
+		ComPtr<ID3D11Buffer> vertexBuffer;
+		const CD3D11_BUFFER_DESC vertexBufferDesc(vertexBufferSize, D3D11_BIND_SHADER_RESOURCE, D3D11_USAGE_DEFAULT, 0, D3D11_RESOURCE_MISC_BUFFER_STRUCTURED, sizeof(VertexPositionColor));
+		D3D11_SUBRESOURCE_DATA vertexBufferData = { vertices, 0, 0 };
+		DX::ThrowIfFailed(m_device->CreateBuffer(&vertexBufferDesc, &vertexBufferData, &vertexBuffer));
+
+		ComPtr<ID3D11Buffer> indexBuffer;
+		const CD3D11_BUFFER_DESC indexBufferDesc(indexBufferSize, D3D11_BIND_SHADER_RESOURCE, D3D11_USAGE_DEFAULT, 0, D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS);
+		D3D11_SUBRESOURCE_DATA indexBufferData = { indices, 0, 0 };
+		DX::ThrowIfFailed(m_device->CreateBuffer(&indexBufferDesc, &indexBufferData, &indexBuffer));
+
+		ComPtr<ID3D11Buffer> normalBuffer;
+		const CD3D11_BUFFER_DESC normalBufferDesc(normalBufferSize, D3D11_BIND_UNORDERED_ACCESS, D3D11_USAGE_DEFAULT, 0, D3D11_RESOURCE_MISC_BUFFER_ALLOW_RAW_VIEWS);
+		DX::ThrowIfFailed(m_device->CreateBuffer(&normalBufferDesc, nullptr, &normalBuffer));
+
+		ComPtr<ID3D11Buffer> readbackBuffer;
+		const CD3D11_BUFFER_DESC readbackBufferDesc(normalBufferSize, 0, D3D11_USAGE_STAGING, D3D11_CPU_ACCESS_READ);
+		DX::ThrowIfFailed(m_device->CreateBuffer(&readbackBufferDesc, nullptr, &readbackBuffer));
+
+		ComPtr<ID3D11ShaderResourceView> shaderResourceViews[2];
+		const CD3D11_SHADER_RESOURCE_VIEW_DESC vertexViewDesc(vertexBuffer.Get(), DXGI_FORMAT_UNKNOWN, 0, static_cast<UINT>(vertexCount));
+		DX::ThrowIfFailed(m_device->CreateShaderResourceView(vertexBuffer.Get(), &vertexViewDesc, &shaderResourceViews[0]));
+		const CD3D11_SHADER_RESOURCE_VIEW_DESC indexViewDesc(indexBuffer.Get(), DXGI_FORMAT_R32_TYPELESS, 0, static_cast<UINT>(triangleCount * 3), D3D11_BUFFEREX_SRV_FLAG_RAW);
+		DX::ThrowIfFailed(m_device->CreateShaderResourceView(indexBuffer.Get(), &indexViewDesc, &shaderResourceViews[1]));
+
+		ComPtr<ID3D11UnorderedAccessView> normalView;
+		const CD3D11_UNORDERED_ACCESS_VIEW_DESC normalViewDesc(normalBuffer.Get(), DXGI_FORMAT_R32_TYPELESS, 0, static_cast<UINT>(vertexCount * 3), D3D11_BUFFER_UAV_FLAG_RAW);
+		DX::ThrowIfFailed(m_device->CreateUnorderedAccessView(normalBuffer.Get(), &normalViewDesc, &normalView));
+
+		const UINT zeros[4] = { 0, 0, 0, 0 };
+		m_context->ClearUnorderedAccessViewUint(normalView.Get(), zeros);
+
+		ID3D11ShaderResourceView* views[2] = { shaderResourceViews[0].Get(), shaderResourceViews[1].Get() };
+		m_context->CSSetShaderResources(0, 2, views);
+		m_context->CSSetUnorderedAccessViews(0, 1, normalView.GetAddressOf(), nullptr);
+		m_context->CSSetConstantBuffers(0, 1, m_constantBuffer.GetAddressOf());
+
+		Dispatch(m_accumulateShader.Get(), triangleCount);
+		Dispatch(m_normalizeShader.Get(), vertexCount);
+
+		ID3D11ShaderResourceView* nullViews[2] = { nullptr, nullptr };
+		ID3D11UnorderedAccessView* nullUnorderedView = nullptr;
+		m_context->CSSetShaderResources(0, 2, nullViews);
+		m_context->CSSetUnorderedAccessViews(0, 1, &nullUnorderedView, nullptr);
+
+		// Waits for the GPU. We are on a worker thread, and the device is ours alone.
+		m_context->CopyResource(readbackBuffer.Get(), normalBuffer.Get());
+		D3D11_MAPPED_SUBRESOURCE mapped;
+		DX::ThrowIfFailed(m_context->Map(readbackBuffer.Get(), 0, D3D11_MAP_READ, 0, &mapped));
+		normals.resize(vertexCount);
+		memcpy(normals.data(), mapped.pData, normalBufferSize);
+		m_context->Unmap(readbackBuffer.Get(), 0);
+	}
+	catch (Platform::Exception^)
+	{
+		// Out of memory, or the device was removed. The device is created again
+		// next time.
+		ReleaseDeviceResources();
+		return false;
+	}
+
+	return true;
+}
+
+bool NormalGenerator::CreateDeviceResources()
+{
+	if (m_deviceUnavailable)
+	{
+		return false;
+	}
+
+	// Compute shader 5.0 needs feature level 11.
+	const D3D_FEATURE_LEVEL featureLevels[] =
+	{
+		D3D_FEATURE_LEVEL_11_1,
+		D3D_FEATURE_LEVEL_11_0
+	};
+
+	if (FAILED(D3D11CreateDevice(
+		nullptr,
+		D3D_DRIVER_TYPE_HARDWARE,
+		0,
+		0,
+		featureLevels,
+		ARRAYSIZE(featureLevels),
+		D3D11_SDK_VERSION,
+		&m_device,
+		nullptr,
+		&m_context
+		)))
+	{
+		// No hardware for it; the CPU does it every time.
+		m_deviceUnavailable = true;
+		return false;
+	}
+
+	try
+	{
+		const std::vector<byte> accumulateShaderData = DX::ReadCachedDataAsync(L"ms-appx:///AccumulateNormalsComputeShader.cso").get();
+		DX::ThrowIfFailed(m_device->CreateComputeShader(accumulateShaderData.data(), accumulateShaderData.size(), nullptr, &m_accumulateShader));
+
+		const std::vector<byte> normalizeShaderData = DX::ReadCachedDataAsync(L"ms-appx:///NormalizeNormalsComputeShader.cso").get();
+		DX::ThrowIfFailed(m_device->CreateComputeShader(normalizeShaderData.data(), normalizeShaderData.size(), nullptr, &m_normalizeShader));
+
+		const CD3D11_BUFFER_DESC constantBufferDesc(sizeof(NormalGenerationConstantBuffer), D3D11_BIND_CONSTANT_BUFFER);
+		DX::ThrowIfFailed(m_device->CreateBuffer(&constantBufferDesc, nullptr, &m_constantBuffer));
+	}
+	catch (Platform::Exception^)
+	{
+		ReleaseDeviceResources();
+		return false;
+	}
+
+	return true;
+}
+
+void NormalGenerator::ReleaseDeviceResources()
+{
+	m_accumulateShader.Reset();
+	m_normalizeShader.Reset();
+	m_constantBuffer.Reset();
+	m_context.Reset();
+	m_device.Reset();
+}
+
+// Large passes spread their groups over a second dimension, as a dimension holds
+// at most D3D11_CS_DISPATCH_MAX_THREAD_GROUPS_PER_DIMENSION of them.
+void NormalGenerator::Dispatch(ID3D11ComputeShader* shader, size_t elementCount)
+{
+	const UINT groupCount = static_cast<UINT>((elementCount + c_threadGroupSize - 1) / c_threadGroupSize);
+	const UINT groupCountX = (std::min)(groupCount, static_cast<UINT>(D3D11_CS_DISPATCH_MAX_THREAD_GROUPS_PER_DIMENSION));
+	const UINT groupCountY = (groupCount + groupCountX - 1) / groupCountX;
+
+	const NormalGenerationConstantBuffer constants = { static_cast<uint32>(elementCount), groupCountX, { 0, 0 } };
+	m_context->UpdateSubresource(m_constantBuffer.Get(), 0, nullptr, &constants, 0, 0);
+	m_context->CSSetShader(shader, nullptr, 0);
+	m_context->Dispatch(groupCountX, groupCountY, 1);
+}
+
+void Hololens_OBJRenderer::GenerateMissingNormals(
+	std::vector<VertexPositionColor>& vertices,
+	const std::vector<UINT>& indices,
+	NormalGenerator* gpuGenerator)
+{
+	if (indices.size() < 3 || std::none_of(vertices.begin(), vertices.end(), HasMissingNormal))
+	{
+		return;
+	}
+
+	// Normals are generated for the first vertex at each position, from the
+	// triangles of all of them.
+	std::vector<UINT> representatives;
+	WeldPositions(vertices, representatives);
+
+	std::vector<UINT> weldedIndices(indices.size());
+	for (size_t i = 0; i < indices.size(); ++i)
+	{
+		weldedIndices[i] = representatives[indices[i]];
+	}
+
+	std::vector<XMFLOAT3> normals;
+	if (gpuGenerator == nullptr || !gpuGenerator->Generate(vertices.data(), vertices.size(), weldedIndices.data(), weldedIndices.size(), normals))
+	{
+		GenerateNormalsOnCpu(vertices.data(), vertices.size(), weldedIndices.data(), weldedIndices.size(), normals);
+	}
+
+	for (size_t i = 0; i < vertices.size(); ++i)
+	{
+		if (HasMissingNormal(vertices[i]))
+		{
+			vertices[i].color = normals[representatives[i]];
+		}
+	}
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "ShaderStructures.h"
+
+#include <mutex>
+#include <vector>
+
+namespace Hololens_OBJRenderer
+{
+	// Generates smooth vertex normals with compute shaders. The shaders run on a
+	// Direct3D device of their own, created on first use, so that meshes loading on
+	// worker threads never touch the immediate context of the rendering device. One
+	// generator can be shared by every mesh; calls are serialized.
+	class NormalGenerator
+	{
+	public:
+		// Computes the unit normal of each vertex from the area weighted normals of
+		// the triangles around it. Normals are not read from the vertex colors.
+		// Returns false, leaving the work to the CPU, if the GPU cannot do it. Call
+		// from a worker thread: the shaders are loaded on first use.
+		bool Generate(
+			const VertexPositionColor* vertices,
+			size_t vertexCount,
+			const UINT* indices,
+			size_t indexCount,
+			std::vector<DirectX::XMFLOAT3>& normals);
+
+	private:
+		bool CreateDeviceResources();
+		void ReleaseDeviceResources();
+
+		// Runs one pass over elementCount triangles or vertices.
+		void Dispatch(ID3D11ComputeShader* shader, size_t elementCount);
+
+		std::mutex											m_mutex;
+		bool												m_deviceUnavailable = false;
+
+		Microsoft::WRL::ComPtr<ID3D11Device>				m_device;
+		Microsoft::WRL::ComPtr<ID3D11DeviceContext>			m_context;
+		Microsoft::WRL::ComPtr<ID3D11ComputeShader>			m_accumulateShader;
+		Microsoft::WRL::ComPtr<ID3D11ComputeShader>			m_normalizeShader;
+		Microsoft::WRL::ComPtr<ID3D11Buffer>				m_constantBuffer;
+	};
+
+	// Replaces the normal of every vertex whose color is zero, as parsed from a file
+	// without vn records, by one generated from the triangles. Vertices at the same
+	// position share the normal, so that lighting is smooth across texture seams.
+	// Normals are generated with gpuGenerator if it is not nullptr, and on all cores
+	// if it is or cannot do it.
+	void GenerateMissingNormals(
+		std::vector<VertexPositionColor>& vertices,
+		const std::vector<UINT>& indices,
+		NormalGenerator* gpuGenerator);
+}
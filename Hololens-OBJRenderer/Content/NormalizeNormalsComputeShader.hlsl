@@ -0,0 +1,23 @@
+// Second pass of normal generation: turns the sums of the first pass into unit
+// normals. Vertices without a triangle keep a zero normal.
+cbuffer NormalGenerationConstantBuffer : register(b0)
+{
+    uint elementCount;  // Vertices.
+    uint groupCountX;
+};
+
+RWByteAddressBuffer normals : register(u0);
+
+[numthreads(64, 1, 1)]
+void main(uint3 groupId : SV_GroupID, uint groupIndex : SV_GroupIndex)
+{
+    const uint vertex = (groupId.y * groupCountX + groupId.x) * 64 + groupIndex;
+    if (vertex >= elementCount)
+    {
+        return;
+    }
+
+    const float3 normal = asfloat(normals.Load3(vertex * 12));
+    const float lengthSq = dot(normal, normal);
+    normals.Store3(vertex * 12, asuint(lengthSq > 0.f ? normal * rsqrt(lengthSq) : float3(0.f, 0.f, 0.f)));
+}
@@ -0,0 +1,499 @@
+#include "pch.h"
+#include "OBJBenchmark.h"
+#include "Common\DirectXHelper.h"
+
+// For RUN_BENCHMARKS and RECORD_WITH_DEFERRED_CONTEXTS.
+#include "Hololens_OBJRendererMain.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <fstream>
+#include <new>
+#include <thread>
+
+using namespace Hololens_OBJRenderer;
+using namespace concurrency;
+using namespace DirectX;
+using namespace Windows::Foundation::Numerics;
+using namespace Windows::Graphics::Holographic;
+
+namespace
+{
+	// Side of each generated grid, in vertices. A grid has about twice as many
+	// triangles as vertices.
+	constexpr std::array<uint32, 3> c_gridSizes = {{ 64, 256, 1024 }};
+
+	// Each load is repeated this many times and the fastest one is reported; the
+	// slower ones mostly measure whatever else the system was doing.
+	constexpr int c_loadRepetitions = 3;
+
+	// The render benchmark draws a square of instances, c_renderGridSide on a side
+	// and c_renderSpacing meters apart, from a camera circling them once over
+	// c_renderFrames frames. The first c_warmupFrames are left out of the results.
+	constexpr uint32 c_renderGridSide = 8;
+	constexpr float c_renderSpacing = 0.3f;
+	constexpr uint32 c_renderFrames = 600;
+	constexpr uint32 c_warmupFrames = 30;
+
+	// The offscreen camera matches the displays of HoloLens.
+	constexpr float c_renderTargetWidth = 1280.f;
+	constexpr float c_renderTargetHeight = 720.f;
+	constexpr float c_verticalFieldOfViewDegrees = 17.5f;
+	constexpr float c_eyeSeparation = 0.064f;
+	constexpr float c_cameraDistance = 2.f;
+	constexpr float c_cameraHeight = 0.5f;
+
+	constexpr double c_bytesPerMegabyte = 1024.0 * 1024.0;
+
+#ifdef RUN_BENCHMARKS
+	std::atomic<uint64> g_allocationCount = { 0 };
+#endif
+
+	// Writes a height field of side by side vertices over a unit square, two
+	// triangles per cell, in the layout of the files Meshlab writes: a header
+	// comment with the counts, then a position and a color on each 'v' record. The
+	// file is written under a temporary name first, so that an interrupted run does
+	// not leave a truncated file behind.
+	void WriteGridFile(const std::wstring& fileName, uint32 side)
+	{
+		const std::wstring temporaryFileName = fileName + L".tmp";
+		std::ofstream out(temporaryFileName, std::ios::binary | std::ios::trunc);
+
+		const uint32 faceCount = 2 * (side - 1) * (side - 1);
+		std::string text = "# Generated by the OBJ benchmark\n#\n# Vertices: " + std::to_string(side * side) +
+			"\n# Faces: " + std::to_string(faceCount) + "\n#\n";
+
+		constexpr size_t flushSize = 1 << 20;
+		char line[128];
+		for (uint32 y = 0; y < side; ++y)
+		{
+			for (uint32 x = 0; x < side; ++x)
+			{
+				const float u = static_cast<float>(x) / static_cast<float>(side - 1);
+				const float v = static_cast<float>(y) / static_cast<float>(side - 1);
+				const float height = 0.05f * sinf(12.f * u) * cosf(12.f * v);
+				const int length = sprintf_s(line, "v %.6f %.6f %.6f %.6f %.6f %.6f\n", u - 0.5f, height, v - 0.5f, u, 0.5f, v);
+				text.append(line, length);
+			}
+			if (text.size() > flushSize)
+			{
+				out.write(text.data(), text.size());
+				text.clear();
+			}
+		}
+
+		for (uint32 y = 0; y + 1 < side; ++y)
+		{
+			for (uint32 x = 0; x + 1 < side; ++x)
+			{
+				// OBJ indices start at 1.
+				const uint32 corner = y * side + x + 1;
+				const int length = sprintf_s(line, "f %u %u %u\nf %u %u %u\n",
+					corner, corner + side, corner + 1,
+					corner + 1, corner + side, corner + side + 1);
+				text.append(line, length);
+			}
+			if (text.size() > flushSize)
+			{
+				out.write(text.data(), text.size());
+				text.clear();
+			}
+		}
+		out.write(text.data(), text.size());
+		out.close();
+
+		if (!out || !MoveFileExW(temporaryFileName.c_str(), fileName.c_str(), MOVEFILE_REPLACE_EXISTING))
+		{
+			throw ref new Platform::FailureException(L"The benchmark files could not be written.");
+		}
+	}
+
+	// The size of a file, or 0 if it cannot be found.
+	uint64 QueryFileSize(const std::wstring& fileName)
+	{
+		WIN32_FILE_ATTRIBUTE_DATA attributes;
+		if (!GetFileAttributesExW(fileName.c_str(), GetFileExInfoStandard, &attributes))
+		{
+			return 0;
+		}
+		return (static_cast<uint64>(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+	}
+
+	// The sample that percent percent of sortedSamples are below.
+	float Percentile(const std::vector<float>& sortedSamples, size_t percent)
+	{
+		return sortedSamples.empty() ? 0.f : sortedSamples[(sortedSamples.size() * percent) / 100];
+	}
+}
+
+#ifdef RUN_BENCHMARKS
+// Every allocation is counted, so that the load benchmark can tell how many a load
+// made. Array forms and the nothrow forms of the CRT forward to these.
+void* operator new(size_t size)
+{
+	g_allocationCount.fetch_add(1, std::memory_order_relaxed);
+	void* memory = malloc(size != 0 ? size : 1);
+	if (memory == nullptr)
+	{
+		throw std::bad_alloc();
+	}
+	return memory;
+}
+
+void operator delete(void* memory) noexcept
+{
+	free(memory);
+}
+#endif
+
+OBJBenchmark::OBJBenchmark(const std::shared_ptr<DX::DeviceResources>& deviceResources) :
+	m_deviceResources(deviceResources)
+{
+	// The scene is static, so every frame of a run draws exactly the same as the
+	// same frame of the next run.
+	m_renderer = std::make_unique<OBJRenderer>(m_deviceResources);
+	m_renderer->SetPosition({ 0.f, 0.f, 0.f });
+	m_renderer->SetRotationSpeed(0.f);
+#ifdef RECORD_WITH_DEFERRED_CONTEXTS
+	m_renderer->SetDeferredRecordingEnabled(true);
+#endif
+
+	m_cameraResources = std::make_unique<DX::CameraResources>(Windows::Foundation::Size(c_renderTargetWidth, c_renderTargetHeight));
+	CreateOffscreenResources();
+}
+
+uint64 OBJBenchmark::GetAllocationCount()
+{
+#ifdef RUN_BENCHMARKS
+	return g_allocationCount.load(std::memory_order_relaxed);
+#else
+	return 0;
+#endif
+}
+
+task<void> OBJBenchmark::RunAsync()
+{
+	// Parsing the largest files takes seconds; it happens on the thread pool while
+	// frames keep being presented.
+	return create_task([this]()
+	{
+		GenerateCorpus();
+		RunLoadBenchmarks();
+		return LoadRenderScene();
+	}).then([this]()
+	{
+		m_sceneReady = true;
+	});
+}
+
+// Generates the grids that are missing from LocalFolder\benchmark, then lists the
+// corpus from the smallest file to the largest.
+void OBJBenchmark::GenerateCorpus()
+{
+	const std::wstring localFolder(Windows::Storage::ApplicationData::Current->LocalFolder->Path->Data());
+	const std::wstring benchmarkFolder = localFolder + L"\\benchmark";
+	CreateDirectoryW(benchmarkFolder.c_str(), nullptr);
+	m_resultsFileName = benchmarkFolder + L"\\results.csv";
+
+	// The grids only depend on their size, so those of an earlier run are reused.
+	m_corpus.clear();
+	for (const uint32 side : c_gridSizes)
+	{
+		const std::string fileName = "benchmark\\grid_" + std::to_string(side) + ".obj";
+		const std::wstring path = localFolder + L"\\" + std::wstring(fileName.begin(), fileName.end());
+		uint64 bytes = QueryFileSize(path);
+		if (bytes == 0)
+		{
+			WriteGridFile(path, side);
+			bytes = QueryFileSize(path);
+		}
+		m_corpus.push_back({ fileName, bytes });
+	}
+
+	// Real models are the OBJ files deployed to LocalFolder, such as bunny.obj.
+	WIN32_FIND_DATAW findData;
+	const HANDLE find = FindFirstFileExW((localFolder + L"\\*.obj").c_str(), FindExInfoBasic, &findData, FindExSearchNameMatch, nullptr, 0);
+	if (find != INVALID_HANDLE_VALUE)
+	{
+		do
+		{
+			if ((findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0)
+			{
+				const std::wstring nameW(findData.cFileName);
+				const uint64 bytes = (static_cast<uint64>(findData.nFileSizeHigh) << 32) | findData.nFileSizeLow;
+				m_corpus.push_back({ std::string(nameW.begin(), nameW.end()), bytes });
+			}
+		} while (FindNextFileW(find, &findData));
+		FindClose(find);
+	}
+
+	std::sort(m_corpus.begin(), m_corpus.end(), [](const CorpusFile& a, const CorpusFile& b) { return a.bytes < b.bytes; });
+}
+
+// Loads every file of the corpus in every way it can be loaded. Parsing is timed on
+// its own: the parse variants skip the cache, optimization and levels of detail. The
+// cache variant uses the default options, and is timed once the cache is written.
+void OBJBenchmark::RunLoadBenchmarks()
+{
+	struct LoadVariant
+	{
+		const char*		name;
+		OBJLoadMode		loadMode;
+		bool			cached;
+	};
+	const LoadVariant variants[] =
+	{
+		{ "serial stream",		OBJLoadMode::Stream,				false },
+		{ "serial mapped",		OBJLoadMode::MemoryMapped,			false },
+		{ "parallel mapped",	OBJLoadMode::MemoryMappedParallel,	false },
+		{ "binary cache",		OBJLoadMode::MemoryMappedParallel,	true }
+	};
+
+	std::ofstream(m_resultsFileName, std::ios::trunc);
+	WriteResult("file,variant,bytes,vertices,seconds,MB/s,vertices/s,peak commit MB,allocations");
+
+	const double ticksPerSecond = static_cast<double>(DX::StepTimer::GetPerformanceFrequency());
+	for (const CorpusFile& file : m_corpus)
+	{
+		for (const LoadVariant& variant : variants)
+		{
+			OBJMeshOptions options;
+			if (variant.cached)
+			{
+				// Writes the cache, unless it is already up to date.
+				OBJMesh(file.fileName, options).Load(variant.loadMode, nullptr);
+			}
+			else
+			{
+				options.useMeshCache = false;
+				options.optimize = false;
+				options.generateLods = false;
+			}
+
+			double seconds = DBL_MAX;
+			size_t vertexCount = 0;
+			uint64 allocations = 0;
+			for (int repetition = 0; repetition < c_loadRepetitions; ++repetition)
+			{
+				OBJMesh mesh(file.fileName, options);
+				const uint64 allocationsBefore = GetAllocationCount();
+				const int64 start = DX::StepTimer::GetTicks();
+				mesh.Load(variant.loadMode, nullptr);
+				seconds = (std::min)(seconds, static_cast<double>(DX::StepTimer::GetTicks() - start) / ticksPerSecond);
+				allocations = GetAllocationCount() - allocationsBefore;
+				vertexCount = mesh.GetVertexCount();
+			}
+
+			// The peak is over the whole process. The corpus is loaded from the
+			// smallest file up, so it grows with each file whose load needs more.
+			const double peakCommitMegabytes = static_cast<double>(Windows::System::MemoryManager::GetAppMemoryReport()->PeakPrivateCommitUsage) / c_bytesPerMegabyte;
+
+			// The cache variant reads much less than the source file; its MB/s are
+			// those of the source it stands in for.
+			const double megabytesPerSecond = static_cast<double>(file.bytes) / c_bytesPerMegabyte / seconds;
+			const double verticesPerSecond = static_cast<double>(vertexCount) / seconds;
+
+			char result[512];
+			sprintf_s(result, "%s,%s,%llu,%zu,%.6f,%.1f,%.0f,%.1f,%llu",
+				file.fileName.c_str(), variant.name, file.bytes, vertexCount, seconds,
+				megabytesPerSecond, verticesPerSecond, peakCommitMegabytes, allocations);
+			WriteResult(result);
+
+			wchar_t message[512];
+			swprintf_s(message, L"Benchmark %S, %S: %.1f MB/s, %.0f vertices/s, %.1f ms, peak commit %.1f MB, %llu allocations.\n",
+				file.fileName.c_str(), variant.name, megabytesPerSecond, verticesPerSecond, 1000.0 * seconds, peakCommitMegabytes, allocations);
+			OutputDebugStringW(message);
+		}
+	}
+}
+
+// Spreads the instances over every file of the corpus but the largest, which would
+// take up most of each frame on its own.
+task<void> OBJBenchmark::LoadRenderScene()
+{
+	const size_t fileCount = m_corpus.size() > 1 ? m_corpus.size() - 1 : m_corpus.size();
+	std::vector<task<void>> loadTasks;
+	for (size_t file = 0; file < fileCount; ++file)
+	{
+		loadTasks.push_back(m_renderer->LoadAsync(m_corpus[file].fileName));
+	}
+
+	const float center = 0.5f * static_cast<float>(c_renderGridSide - 1);
+	for (uint32 row = 0; row < c_renderGridSide && fileCount != 0; ++row)
+	{
+		for (uint32 column = 0; column < c_renderGridSide; ++column)
+		{
+			const size_t file = (row * c_renderGridSide + column) % fileCount;
+			const float3 offset =
+			{
+				c_renderSpacing * (static_cast<float>(column) - center),
+				0.f,
+				c_renderSpacing * (static_cast<float>(row) - center)
+			};
+			m_renderer->AddInstance(m_corpus[file].fileName, offset);
+		}
+	}
+
+	return when_all(loadTasks.begin(), loadTasks.end());
+}
+
+void OBJBenchmark::CreateDeviceDependentResources()
+{
+	m_renderer->CreateDeviceDependentResources();
+	CreateOffscreenResources();
+}
+
+void OBJBenchmark::ReleaseDeviceDependentResources()
+{
+	m_renderer->ReleaseDeviceDependentResources();
+	m_cameraResources->ReleaseResourcesForBackBuffer(m_deviceResources.get());
+	m_frameQueries.clear();
+}
+
+void OBJBenchmark::CreateOffscreenResources()
+{
+	const auto device = m_deviceResources->GetD3DDevice();
+	m_cameraResources->CreateOffscreenResources(m_deviceResources.get());
+
+	// Every frame keeps queries of its own, so that none has to be read back before
+	// the end of the benchmark.
+	const CD3D11_QUERY_DESC disjointDesc(D3D11_QUERY_TIMESTAMP_DISJOINT);
+	const CD3D11_QUERY_DESC timestampDesc(D3D11_QUERY_TIMESTAMP);
+	m_frameQueries.resize(c_renderFrames);
+	for (FrameQueries& queries : m_frameQueries)
+	{
+		DX::ThrowIfFailed(
+			device->CreateQuery(&disjointDesc, &queries.disjoint)
+			);
+		DX::ThrowIfFailed(
+			device->CreateQuery(&timestampDesc, &queries.begin)
+			);
+		DX::ThrowIfFailed(
+			device->CreateQuery(&timestampDesc, &queries.end)
+			);
+	}
+	m_cpuFrameTimes.resize(c_renderFrames);
+
+	// Frames drawn on a lost device cannot be compared with the others.
+	if (!m_renderComplete)
+	{
+		m_renderedFrames = 0;
+	}
+}
+
+void OBJBenchmark::Render()
+{
+	if (m_renderComplete || !m_sceneReady || m_frameQueries.empty())
+	{
+		return;
+	}
+
+	const auto context = m_deviceResources->GetD3DDeviceContext();
+	const FrameQueries& queries = m_frameQueries[m_renderedFrames];
+	const int64 start = DX::StepTimer::GetTicks();
+
+	m_timer.Tick([]() {});
+	m_renderer->Update(m_timer);
+	UpdateCamera(m_renderedFrames);
+
+	context->Begin(queries.disjoint.Get());
+	context->End(queries.begin.Get());
+
+	ID3D11RenderTargetView* const targets[1] = { m_cameraResources->GetBackBufferRenderTargetView() };
+	ID3D11DepthStencilView* const depthStencilView = m_cameraResources->GetDepthStencilView();
+	context->OMSetRenderTargets(1, targets, depthStencilView);
+	context->ClearRenderTargetView(targets[0], DirectX::Colors::Transparent);
+	context->ClearDepthStencilView(depthStencilView, D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1.0f, 0);
+	if (m_cameraResources->AttachViewProjectionBuffer(m_deviceResources))
+	{
+		m_renderer->Render(m_cameraResources.get());
+	}
+
+	context->End(queries.end.Get());
+	context->End(queries.disjoint.Get());
+
+	m_cpuFrameTimes[m_renderedFrames] = static_cast<float>(
+		1000.0 * static_cast<double>(DX::StepTimer::GetTicks() - start) / static_cast<double>(DX::StepTimer::GetPerformanceFrequency()));
+
+	if (++m_renderedFrames == c_renderFrames)
+	{
+		ReportRenderBenchmark();
+		m_renderComplete = true;
+	}
+}
+
+// The camera circles the scene at eye height above it, looking at its center. Both
+// eyes look the same way, like the displays of the device.
+void OBJBenchmark::UpdateCamera(uint32 frame)
+{
+	const float angle = XM_2PI * static_cast<float>(frame) / static_cast<float>(c_renderFrames);
+	const XMVECTOR position = XMVectorSet(c_cameraDistance * sinf(angle), c_cameraHeight, c_cameraDistance * cosf(angle), 1.f);
+	const XMVECTOR up = XMVectorSet(0.f, 1.f, 0.f, 0.f);
+	const XMVECTOR forward = XMVector3Normalize(XMVectorNegate(XMVectorSetW(position, 0.f)));
+	const XMVECTOR halfSeparation = XMVectorScale(XMVector3Normalize(XMVector3Cross(forward, up)), 0.5f * c_eyeSeparation);
+
+	HolographicStereoTransform viewTransform;
+	XMStoreFloat4x4(&viewTransform.Left, XMMatrixLookToRH(XMVectorSubtract(position, halfSeparation), forward, up));
+	XMStoreFloat4x4(&viewTransform.Right, XMMatrixLookToRH(XMVectorAdd(position, halfSeparation), forward, up));
+
+	HolographicStereoTransform projectionTransform;
+	XMStoreFloat4x4(
+		&projectionTransform.Left,
+		XMMatrixPerspectiveFovRH(XMConvertToRadians(c_verticalFieldOfViewDegrees), c_renderTargetWidth / c_renderTargetHeight, 0.1f, 20.f));
+	projectionTransform.Right = projectionTransform.Left;
+
+	m_cameraResources->UpdateViewProjectionBuffer(m_deviceResources, viewTransform, projectionTransform);
+}
+
+void OBJBenchmark::ReportRenderBenchmark()
+{
+	// Waiting is fine here: the benchmark is over, and the results are needed now.
+	const auto context = m_deviceResources->GetD3DDeviceContext();
+	context->Flush();
+
+	std::vector<float> gpuFrameTimes;
+	for (uint32 frame = c_warmupFrames; frame < c_renderFrames; ++frame)
+	{
+		const FrameQueries& queries = m_frameQueries[frame];
+		D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+		UINT64 begin;
+		UINT64 end;
+		HRESULT hr;
+		while ((hr = context->GetData(queries.disjoint.Get(), &disjoint, sizeof(disjoint), 0)) == S_FALSE)
+		{
+			std::this_thread::yield();
+		}
+		if (hr != S_OK || disjoint.Disjoint ||
+			context->GetData(queries.begin.Get(), &begin, sizeof(begin), 0) != S_OK ||
+			context->GetData(queries.end.Get(), &end, sizeof(end), 0) != S_OK)
+		{
+			continue;
+		}
+		gpuFrameTimes.push_back(static_cast<float>(1000.0 * static_cast<double>(end - begin) / static_cast<double>(disjoint.Frequency)));
+	}
+
+	std::vector<float> cpuFrameTimes(m_cpuFrameTimes.begin() + c_warmupFrames, m_cpuFrameTimes.end());
+	std::sort(cpuFrameTimes.begin(), cpuFrameTimes.end());
+	std::sort(gpuFrameTimes.begin(), gpuFrameTimes.end());
+
+	const size_t instanceCount = m_renderer->GetInstanceCount();
+	char result[256];
+	sprintf_s(result, "render,%zu instances,%u frames,CPU ms p50 %.3f,p99 %.3f,GPU ms p50 %.3f,p99 %.3f",
+		instanceCount, c_renderFrames - c_warmupFrames,
+		Percentile(cpuFrameTimes, 50), Percentile(cpuFrameTimes, 99),
+		Percentile(gpuFrameTimes, 50), Percentile(gpuFrameTimes, 99));
+	WriteResult(result);
+
+	wchar_t message[256];
+	swprintf_s(message, L"Render benchmark, %zu instances over %zu frames, ms p50/p99: CPU %.3f/%.3f GPU %.3f/%.3f.\n",
+		instanceCount, gpuFrameTimes.size(),
+		Percentile(cpuFrameTimes, 50), Percentile(cpuFrameTimes, 99),
+		Percentile(gpuFrameTimes, 50), Percentile(gpuFrameTimes, 99));
+	OutputDebugStringW(message);
+}
+
+void OBJBenchmark::WriteResult(const std::string& line)
+{
+	std::ofstream out(m_resultsFileName, std::ios::app);
+	out << line << '\n';
+}
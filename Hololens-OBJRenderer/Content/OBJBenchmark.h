@@ -0,0 +1,99 @@
+#pragma once
+
+#include "..\Common\DeviceResources.h"
+#include "..\Common\CameraResources.h"
+#include "..\Common\StepTimer.h"
+#include "OBJRenderer.h"
+
+#include <ppltasks.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Hololens_OBJRenderer
+{
+	// Measures how fast OBJ files load and draw, with the same inputs on every run, so
+	// that results can be compared between builds. The corpus is made of generated
+	// grids of increasing size in LocalFolder\benchmark, plus every OBJ file found in
+	// LocalFolder itself, such as bunny.obj.
+	//
+	// The load benchmark parses each file with every OBJLoadMode and reads it back
+	// from the mesh cache, and reports MB/s, vertices/s, peak memory and the number of
+	// allocations. The render benchmark then draws a grid of instances offscreen along
+	// a fixed camera path, and reports CPU and GPU frame times. Results go to the
+	// debugger output and to LocalFolder\benchmark\results.csv.
+	class OBJBenchmark
+	{
+	public:
+		OBJBenchmark(const std::shared_ptr<DX::DeviceResources>& deviceResources);
+
+		// Writes the generated files, then runs the load benchmark on the thread pool,
+		// then loads the scene of the render benchmark. The render benchmark starts
+		// with the next call to Render once the returned task has completed.
+		concurrency::task<void> RunAsync();
+
+		void CreateDeviceDependentResources();
+		void ReleaseDeviceDependentResources();
+
+		// Draws the next frame of the render benchmark into the offscreen target. Call
+		// once per frame on the rendering thread; does nothing once the benchmark is
+		// complete.
+		void Render();
+
+		bool IsComplete() const										{ return m_renderComplete; }
+
+		// Allocations made through operator new since the process started. Only
+		// counted when RUN_BENCHMARKS is defined.
+		static uint64 GetAllocationCount();
+
+	private:
+		// One file of the corpus.
+		struct CorpusFile
+		{
+			std::string		fileName;	// Relative to LocalFolder.
+			uint64			bytes;
+		};
+
+		// The queries that time one frame of the render benchmark.
+		struct FrameQueries
+		{
+			Microsoft::WRL::ComPtr<ID3D11Query>	disjoint;
+			Microsoft::WRL::ComPtr<ID3D11Query>	begin;
+			Microsoft::WRL::ComPtr<ID3D11Query>	end;
+		};
+
+		// Creates the offscreen target and the timing queries, and starts the render
+		// benchmark over unless it is complete.
+		void CreateOffscreenResources();
+
+		void GenerateCorpus();
+		void RunLoadBenchmarks();
+		concurrency::task<void> LoadRenderScene();
+
+		// Points the offscreen camera at the scene from its place along the path.
+		void UpdateCamera(uint32 frame);
+
+		// Waits for the GPU times of every frame, then reports them.
+		void ReportRenderBenchmark();
+
+		// Appends a line to the results file.
+		void WriteResult(const std::string& line);
+
+		// Cached pointer to device resources.
+		std::shared_ptr<DX::DeviceResources>				m_deviceResources;
+
+		std::vector<CorpusFile>								m_corpus;
+		std::wstring										m_resultsFileName;
+
+		// Render benchmark: a renderer of its own, drawing into an offscreen target.
+		std::unique_ptr<OBJRenderer>						m_renderer;
+		std::unique_ptr<DX::CameraResources>				m_cameraResources;
+		std::vector<FrameQueries>							m_frameQueries;
+		std::vector<float>									m_cpuFrameTimes;
+		DX::StepTimer										m_timer;
+		uint32												m_renderedFrames = 0;
+		std::atomic<bool>									m_sceneReady = { false };
+		bool												m_renderComplete = false;
+	};
+}
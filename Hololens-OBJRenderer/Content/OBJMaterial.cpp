@@ -0,0 +1,115 @@
+#include "pch.h"
+#include "OBJMaterial.h"
+#include "OBJParser.h"
+
+#include <string.h>
+
+using namespace Hololens_OBJRenderer;
+using namespace DirectX;
+
+namespace
+{
+	inline bool IsSeparator(char c)
+	{
+		return c == ' ' || c == '\t';
+	}
+
+	inline bool NextToken(const char*& p, const char* end, OBJToken& token)
+	{
+		while (p != end && IsSeparator(*p)) { ++p; }
+		if (p == end) { return false; }
+
+		token.begin = p;
+		while (p != end && !IsSeparator(*p)) { ++p; }
+		token.end = p;
+		return true;
+	}
+
+	inline bool TokenToFloat(const OBJToken& token, float& value)
+	{
+		return !token.Empty() && ParseFloat(token.begin, token.end, value) == token.end;
+	}
+
+	// The rest of the line from p, without surrounding separators.
+	inline std::string RestOfLine(const char* p, const char* end)
+	{
+		while (p != end && IsSeparator(*p)) { ++p; }
+		while (end != p && IsSeparator(*(end - 1))) { --end; }
+		return std::string(p, end);
+	}
+}
+
+void Hololens_OBJRenderer::ParseMaterialLibrary(const char* begin, const char* end, std::vector<OBJMaterial>& materials)
+{
+	OBJMaterial* material = nullptr;
+
+	const char* lineBegin = begin;
+	while (lineBegin != end)
+	{
+		const char* lineEnd = static_cast<const char*>(memchr(lineBegin, '\n', end - lineBegin));
+		const char* next = lineEnd != nullptr ? lineEnd + 1 : end;
+		if (lineEnd == nullptr)
+		{
+			lineEnd = end;
+		}
+		if (lineEnd != lineBegin && *(lineEnd - 1) == '\r')
+		{
+			--lineEnd;
+		}
+		const char* comment = static_cast<const char*>(memchr(lineBegin, '#', lineEnd - lineBegin));
+		if (comment != nullptr)
+		{
+			lineEnd = comment;
+		}
+
+		const char* p = lineBegin;
+		lineBegin = next;
+
+		OBJToken keyword;
+		if (!NextToken(p, lineEnd, keyword))
+		{
+			continue;
+		}
+
+		if (keyword.Is("newmtl"))
+		{
+			materials.emplace_back();
+			material = &materials.back();
+			material->name = RestOfLine(p, lineEnd);
+		}
+		else if (material == nullptr)
+		{
+			continue;
+		}
+		else if (keyword.Is("Kd"))
+		{
+			// Only RGB colors are read; 'spectral' and 'xyz' forms are skipped.
+			OBJToken r, g, b;
+			float kd[3];
+			if (!NextToken(p, lineEnd, r) || !TokenToFloat(r, kd[0])) { continue; }
+			kd[1] = kd[2] = kd[0];
+			if (NextToken(p, lineEnd, g) && (!TokenToFloat(g, kd[1]) || !NextToken(p, lineEnd, b) || !TokenToFloat(b, kd[2]))) { continue; }
+			material->diffuse = XMFLOAT3(kd[0], kd[1], kd[2]);
+		}
+		else if (keyword.Is("d") || keyword.Is("Tr"))
+		{
+			// '-halo' and other options come before the value.
+			OBJToken token, value;
+			while (NextToken(p, lineEnd, token)) { value = token; }
+			float amount;
+			if (!TokenToFloat(value, amount)) { continue; }
+			material->dissolve = keyword.Is("d") ? amount : 1.f - amount;
+		}
+		else if (keyword.Is("map_Kd"))
+		{
+			// Options such as '-s 1 1 1' come before the file name, which is the last
+			// field on the line.
+			OBJToken token, fileName;
+			while (NextToken(p, lineEnd, token)) { fileName = token; }
+			if (!fileName.Empty())
+			{
+				material->diffuseMap.assign(fileName.begin, fileName.end);
+			}
+		}
+	}
+}
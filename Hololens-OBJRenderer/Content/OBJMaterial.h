@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace Hololens_OBJRenderer
+{
+	// The parts of an MTL material that the renderer draws with: a diffuse color or
+	// texture, and an opacity. Other records, such as specular terms and
+	// illumination models, are read past.
+	struct OBJMaterial
+	{
+		std::string			name;
+		DirectX::XMFLOAT3	diffuse = DirectX::XMFLOAT3(1.f, 1.f, 1.f);	// Kd
+		float				dissolve = 1.f;								// d, or 1 - Tr
+		std::string			diffuseMap;									// map_Kd, relative to the library
+	};
+
+	// Appends the materials declared with 'newmtl' in the MTL text [begin, end) to
+	// materials. Records before the first 'newmtl' and malformed records are skipped.
+	void ParseMaterialLibrary(const char* begin, const char* end, std::vector<OBJMaterial>& materials);
+}
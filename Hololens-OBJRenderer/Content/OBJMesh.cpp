@@ -0,0 +1,914 @@
+#include "pch.h"
+#include "OBJMesh.h"
+#include "Common\DirectXHelper.h"
+#include "Common\MappedFile.h"
+
+#include <DirectXPackedVector.h>
+
+using namespace Hololens_OBJRenderer;
+using namespace DirectX;
+
+OBJMesh::OBJMesh(const std::string& fileName, const OBJMeshOptions& options) :
+	m_fileName(fileName),
+	m_options(options)
+{
+	XMStoreFloat4x4(&m_positionDequantization, XMMatrixIdentity());
+}
+
+// Loads the obj geometry. Called on a worker thread, so the holographic frame loop
+// keeps presenting while the model loads.
+void OBJMesh::Load(OBJLoadMode loadMode, OBJProgressCallback progressCallback, OBJPreviewCallback previewCallback)
+{
+	Platform::String^ localfolder = Windows::Storage::ApplicationData::Current->LocalFolder->Path;	//for local saving for future
+
+	std::wstring folderNameW(localfolder->Begin());
+	std::wstring nameW = folderNameW + L"\\" + std::wstring(m_fileName.begin(), m_fileName.end());
+
+	m_loadMode = loadMode;
+	m_cpuDataReleased = false;
+	m_hasMeshCache = false;
+	vertices.clear();
+	indices.clear();
+	texcoords.clear();
+	m_lodIndexCounts.clear();
+	m_materialRanges.clear();
+	m_materialLibraries.clear();
+	m_materialNames.clear();
+	m_meshCache.Close();
+
+	// Material libraries and textures are named relative to the OBJ file.
+	const std::wstring folderW = nameW.substr(0, nameW.find_last_of(L"\\/"));
+
+	// A binary cache written by an earlier launch skips parsing entirely, as long
+	// as the source file has not changed since.
+	MeshCacheSource source;
+	const bool sourceFound = source.Query(nameW);
+	const std::wstring cacheFileName = MeshCache::GetCacheFileName(nameW);
+	const uint32 cacheFlags =
+		(m_options.optimize ? MeshCacheFlags_Optimized : MeshCacheFlags_None) |
+		(m_options.generateLods ? MeshCacheFlags_Lods : MeshCacheFlags_None) |
+		(m_options.generateNormals ? MeshCacheFlags_Normals : MeshCacheFlags_None) |
+		(UsesMaterials() ? MeshCacheFlags_Materials : MeshCacheFlags_None);
+	m_optimizationStats = MeshOptimizationStats();
+	if (m_options.useMeshCache && sourceFound && m_meshCache.Open(cacheFileName, source, cacheFlags))
+	{
+		m_hasMeshCache = true;
+		SetBounds(m_meshCache.GetBounds());
+		m_optimizationStats.acmrAfter = m_meshCache.GetACMR();
+
+		// The libraries are read again, as they may have changed since.
+		m_meshCache.GetMaterialNames(m_materialLibraries, m_materialNames);
+		LoadMaterials(folderW);
+		if (previewCallback)
+		{
+			PreviewCoarsestLod(previewCallback);
+		}
+		if (progressCallback)
+		{
+			progressCallback(1.f);
+		}
+		return;
+	}
+
+	// Map the whole file and parse it in place. If the file cannot be mapped,
+	// fall back to reading it through a stream.
+	DX::MappedFile file;
+	if (loadMode != OBJLoadMode::Stream && file.Open(nameW))
+	{
+		parseOBJ(file.GetData(), file.GetEnd(), loadMode == OBJLoadMode::MemoryMappedParallel, progressCallback, previewCallback);
+	}
+	else
+	{
+		//convert folder name from wchar to ascii
+		std::string folderNameA(folderNameW.begin(), folderNameW.end());
+		std::string name = folderNameA + "\\" + m_fileName;
+
+		std::ifstream in(name);
+		parseOBJ(in, progressCallback, previewCallback);
+	}
+
+	// Faces without vn references leave the vertex colors zero.
+	if (m_options.generateNormals)
+	{
+		GenerateMissingNormals(vertices, indices, m_options.normalGenerator.get());
+	}
+
+	// Reorder the mesh for the vertex cache before it is cached, so that the
+	// cost is only paid once per source file.
+	if (m_options.optimize)
+	{
+		m_optimizationStats = OptimizeMesh(vertices, indices, &texcoords, &m_materialRanges);
+	}
+
+	m_lodIndexCounts.push_back(static_cast<UINT>(indices.size()));
+	if (m_options.generateLods)
+	{
+		GenerateLods();
+	}
+
+	// Convert the parsed mesh for the next launch.
+	if (m_options.useMeshCache && sourceFound && !vertices.empty())
+	{
+		m_hasMeshCache = MeshCache::Write(
+			cacheFileName,
+			source,
+			vertices,
+			texcoords,
+			indices,
+			m_lodIndexCounts,
+			m_materialRanges,
+			m_materialLibraries,
+			m_materialNames,
+			m_bounds,
+			cacheFlags,
+			m_optimizationStats.acmrAfter);
+	}
+
+	LoadMaterials(folderW);
+}
+
+void OBJMesh::LoadMaterials(const std::wstring& folder)
+{
+	m_materialTextures.clear();
+	m_textured = false;
+	if (!UsesMaterials() || m_materialNames.empty())
+	{
+		return;
+	}
+
+	std::vector<OBJMaterial> materials;
+	for (const std::string& library : m_materialLibraries)
+	{
+		DX::MappedFile file;
+		if (file.Open(folder + L"\\" + std::wstring(library.begin(), library.end())))
+		{
+			ParseMaterialLibrary(file.GetData(), file.GetEnd(), materials);
+			m_textured = true;
+		}
+	}
+	if (!m_textured)
+	{
+		return;
+	}
+
+	// Materials that are not declared, or whose texture cannot be read, are drawn
+	// in their diffuse color. Of materials declared twice, the last one is used.
+	for (const std::string& name : m_materialNames)
+	{
+		const auto material = std::find_if(materials.rbegin(), materials.rend(), [&](const OBJMaterial& m) { return m.name == name; });
+		std::shared_ptr<StreamedTexture> texture;
+		if (material != materials.rend() && !material->diffuseMap.empty())
+		{
+			texture = m_options.textureStreamer->GetTexture(folder + L"\\" + std::wstring(material->diffuseMap.begin(), material->diffuseMap.end()));
+		}
+		if (!texture)
+		{
+			const OBJMaterial fallback = material != materials.rend() ? *material : OBJMaterial();
+			texture = m_options.textureStreamer->GetSolidTexture(XMFLOAT4(fallback.diffuse.x, fallback.diffuse.y, fallback.diffuse.z, fallback.dissolve));
+		}
+		m_materialTextures.push_back(texture);
+	}
+}
+
+bool OBJMesh::IsTextured() const
+{
+	if (!m_ready || !m_textured || !m_texcoordBuffer)
+	{
+		return false;
+	}
+	return std::all_of(m_materialTextures.begin(), m_materialTextures.end(), [](const std::shared_ptr<StreamedTexture>& texture)
+	{
+		return texture->GetShaderResourceView() != nullptr;
+	});
+}
+
+void OBJMesh::RequestTextureDetail(float pixels) const
+{
+	// The materials are loaded again when the mesh is rebuilt.
+	if (!m_ready)
+	{
+		return;
+	}
+	for (const std::shared_ptr<StreamedTexture>& texture : m_materialTextures)
+	{
+		texture->RequestDetail(pixels);
+	}
+}
+
+void OBJMesh::CreateDeviceResources(ID3D11Device* device, OBJVertexFormat vertexFormat, const LightingConstantBuffer* bakedLighting)
+{
+	m_ready = false;
+	if (RestoreDeviceResources(device, vertexFormat, bakedLighting))
+	{
+		return;
+	}
+	m_retained = RetainedBuffers();
+
+	// Buffers were made before, and the CPU copy they came from is gone. Mapping the
+	// cache again is cheap; only meshes without one are parsed again.
+	if (m_cpuDataReleased)
+	{
+		Load(m_loadMode, nullptr);
+	}
+
+	// Meshes that cannot be read back from a mesh cache keep a copy of their
+	// buffers, so that a lost device does not parse them again.
+	const bool retain = m_options.retainDeviceData || !m_hasMeshCache;
+
+	// The mesh comes either straight from the mapped cache file or from the
+	// vectors the parser filled.
+	const bool fromCache = m_meshCache.IsOpen();
+	const VertexPositionColor* vertexData = fromCache ? m_meshCache.GetVertices() : vertices.data();
+	size_t vertexCount = fromCache ? m_meshCache.GetVertexCount() : vertices.size();
+	const UINT* indexData = fromCache ? m_meshCache.GetIndices() : indices.data();
+	const size_t indexCount = fromCache ? m_meshCache.GetIndexCount() : indices.size();
+
+	std::vector<UINT> lodIndexCounts = m_lodIndexCounts;
+	std::vector<MeshMaterialRange> materialRanges = m_materialRanges;
+	const XMFLOAT2* texcoordData = texcoords.empty() ? nullptr : texcoords.data();
+	if (fromCache)
+	{
+		const uint32* cachedCounts = m_meshCache.GetLodIndexCounts();
+		lodIndexCounts.assign(cachedCounts, std::find(cachedCounts, cachedCounts + c_maxMeshLods, 0u));
+		materialRanges.assign(m_meshCache.GetMaterialRanges(), m_meshCache.GetMaterialRanges() + m_meshCache.GetMaterialRangeCount());
+		texcoordData = m_meshCache.GetTexcoords();
+	}
+
+	// Nothing to upload if the file was missing or held no faces.
+	m_indexCount = 0;
+	if (vertexCount == 0 || indexCount == 0)
+	{
+		return;
+	}
+
+	// Use 16-bit indices whenever the vertices fit. Larger meshes are split into
+	// subsets of at most 65536 vertices, each drawn with its own base vertex,
+	// unless splitting is disabled. Each level of detail is split on its own.
+	const bool use16BitIndices = vertexCount <= c_max16BitIndexedVertices;
+	const bool splitMesh = !use16BitIndices && m_options.splitLargeMeshes;
+	std::vector<uint16> indices16;
+	std::vector<VertexPositionColor> splitVertices;
+	std::vector<XMFLOAT2> splitTexcoords;
+	if (use16BitIndices)
+	{
+		ConvertIndicesTo16Bit(indexData, indexCount, indices16);
+	}
+
+	// Each level of detail is drawn in one subset per material range, or more if
+	// it is split. Meshes without materials have one range per level.
+	const bool textured = m_textured && m_materialTextures.size() == m_materialNames.size();
+	m_subsets.clear();
+	m_lods.clear();
+	UINT lodIndexStart = 0;
+	size_t nextRange = 0;
+	std::vector<MeshMaterialRange> lodRanges;
+	for (const UINT lodIndexCount : lodIndexCounts)
+	{
+		lodRanges.clear();
+		while (nextRange < materialRanges.size() && materialRanges[nextRange].indexStart < lodIndexStart + lodIndexCount)
+		{
+			if (materialRanges[nextRange].indexCount > 0)
+			{
+				lodRanges.push_back(materialRanges[nextRange]);
+			}
+			++nextRange;
+		}
+		if (lodRanges.empty())
+		{
+			lodRanges.push_back({ 0, lodIndexStart, lodIndexCount });
+		}
+
+		// Materials that share a texture are drawn one after the other, so that it is
+		// only bound once.
+		if (textured)
+		{
+			std::stable_sort(lodRanges.begin(), lodRanges.end(), [&](const MeshMaterialRange& a, const MeshMaterialRange& b)
+			{
+				return m_materialTextures[a.material].get() < m_materialTextures[b.material].get();
+			});
+		}
+
+		MeshLod lod = { static_cast<UINT>(m_subsets.size()), 0 };
+		for (const MeshMaterialRange& range : lodRanges)
+		{
+			if (splitMesh)
+			{
+				std::vector<UINT> vertexRemap;
+				std::vector<uint16> rangeIndices16;
+				std::vector<MeshSubset> rangeSubsets;
+				SplitMesh(indexData + range.indexStart, range.indexCount, vertexCount, vertexRemap, rangeIndices16, rangeSubsets);
+
+				for (MeshSubset& subset : rangeSubsets)
+				{
+					subset.indexStart += static_cast<UINT>(indices16.size());
+					subset.baseVertex += static_cast<INT>(splitVertices.size());
+					subset.material = range.material;
+					m_subsets.push_back(subset);
+				}
+				for (const UINT vertex : vertexRemap)
+				{
+					splitVertices.push_back(vertexData[vertex]);
+					if (texcoordData != nullptr)
+					{
+						splitTexcoords.push_back(texcoordData[vertex]);
+					}
+				}
+				indices16.insert(indices16.end(), rangeIndices16.begin(), rangeIndices16.end());
+			}
+			else
+			{
+				m_subsets.push_back({ range.indexStart, range.indexCount, 0, range.material });
+			}
+		}
+
+		lod.subsetCount = static_cast<UINT>(m_subsets.size()) - lod.firstSubset;
+		m_lods.push_back(lod);
+		lodIndexStart += lodIndexCount;
+	}
+
+	if (splitMesh)
+	{
+		vertexData = splitVertices.data();
+		vertexCount = splitVertices.size();
+		texcoordData = splitTexcoords.empty() ? nullptr : splitTexcoords.data();
+	}
+	m_indexFormat = indices16.empty() ? DXGI_FORMAT_R32_UINT : DXGI_FORMAT_R16_UINT;
+
+	// Split the larger levels of detail into clusters. The index order is kept, so
+	// a vertex cache optimized mesh yields compact clusters.
+	m_clusters.clear();
+	m_subsetClusters.assign(1, 0);
+	for (const MeshLod& lod : m_lods)
+	{
+		size_t lodIndexCount = 0;
+		for (UINT i = lod.firstSubset; i < lod.firstSubset + lod.subsetCount; ++i)
+		{
+			lodIndexCount += m_subsets[i].indexCount;
+		}
+
+		const bool buildClusters = m_options.buildClusters && lodIndexCount / 3 >= c_minClusteredTriangles;
+		for (UINT i = lod.firstSubset; i < lod.firstSubset + lod.subsetCount; ++i)
+		{
+			const MeshSubset& subset = m_subsets[i];
+			if (buildClusters && indices16.empty())
+			{
+				BuildClusters(vertexData + subset.baseVertex, indexData + subset.indexStart, subset.indexCount, subset.indexStart, m_clusters);
+			}
+			else if (buildClusters)
+			{
+				BuildClusters(vertexData + subset.baseVertex, indices16.data() + subset.indexStart, subset.indexCount, subset.indexStart, m_clusters);
+			}
+			m_subsetClusters.push_back(static_cast<UINT>(m_clusters.size()));
+		}
+	}
+
+	// The lighting is baked last, as nothing before needs the vertex colors.
+	std::vector<VertexPositionColor> litVertices;
+	if (bakedLighting != nullptr)
+	{
+		BakeVertexLighting(vertexData, vertexCount, *bakedLighting, litVertices);
+		vertexData = litVertices.data();
+	}
+
+	// Quantize the vertices into the compact layout. Both stereo views fetch every
+	// vertex, so halving its size halves the vertex fetch bandwidth.
+	std::vector<VertexPositionColorCompact> compactVertices;
+	XMMATRIX positionDequantization = XMMatrixIdentity();
+	m_vertexStride = sizeof(VertexPositionColor);
+	if (vertexFormat == OBJVertexFormat::Compact)
+	{
+		QuantizeVertices(vertexData, vertexCount, m_bounds, compactVertices);
+		positionDequantization = GetDequantizationTransform(m_bounds);
+		m_vertexStride = sizeof(VertexPositionColorCompact);
+	}
+	if (!m_positionTransformSet)
+	{
+		XMStoreFloat4x4(&m_positionDequantization, positionDequantization);
+		m_positionTransformSet = true;
+	}
+
+	// Load mesh vertices. Each vertex has a positiin and a color.
+	// Note that the obj size has changed from the default DirectX app
+	// template. Windows Holographic is scaled in meteres, so to draw the 
+	// obj at a comfortable size we made the cube width 0.2 m (20 cm).
+	D3D11_SUBRESOURCE_DATA vertexBufferData = { 0 };
+	vertexBufferData.pSysMem = compactVertices.empty() ? static_cast<const void*>(vertexData) : compactVertices.data();
+	vertexBufferData.SysMemPitch = 0;
+	vertexBufferData.SysMemSlicePitch = 0;
+	const CD3D11_BUFFER_DESC vertexBufferDesc(m_vertexStride * vertexCount, D3D11_BIND_VERTEX_BUFFER);
+	DX::ThrowIfFailed(
+		device->CreateBuffer(
+			&vertexBufferDesc,
+			&vertexBufferData,
+			&m_vertexBuffer
+			)
+		);
+	m_deviceBytes = vertexBufferDesc.ByteWidth;
+	if (retain)
+	{
+		const byte* vertexBytes = static_cast<const byte*>(vertexBufferData.pSysMem);
+		m_retained.vertices.assign(vertexBytes, vertexBytes + vertexBufferDesc.ByteWidth);
+	}
+
+	// Load mesh indices. Each trio of indices represents
+	// a triangle to be rendered on the screen.
+	// For example: 2,1,0 means that the vertices with indexes
+	// 2, 1, and 0 from the vertex buffer compose the first traingle of this mesh.
+	// Note that the winding order is clockwise by default
+	m_indexCount = indices16.empty() ? indexCount : indices16.size();
+	D3D11_SUBRESOURCE_DATA indexBufferData = { 0 };
+	indexBufferData.pSysMem = indices16.empty() ? static_cast<const void*>(indexData) : indices16.data();
+	indexBufferData.SysMemPitch = 0;
+	indexBufferData.SysMemSlicePitch = 0;
+	CD3D11_BUFFER_DESC indexBufferDesc((indices16.empty() ? sizeof(UINT) : sizeof(uint16)) * m_indexCount, D3D11_BIND_INDEX_BUFFER);
+	DX::ThrowIfFailed(
+		device->CreateBuffer(
+			&indexBufferDesc,
+			&indexBufferData,
+			&m_indexBuffer
+			)
+		);
+	m_deviceBytes += indexBufferDesc.ByteWidth;
+	if (retain)
+	{
+		const byte* indexBytes = static_cast<const byte*>(indexBufferData.pSysMem);
+		m_retained.indices.assign(indexBytes, indexBytes + indexBufferDesc.ByteWidth);
+	}
+
+	// Texture coordinates are half floats in the compact layout. Files without vt
+	// records sample the first texel everywhere, which is the color of a solid
+	// texture.
+	m_texcoordBuffer.Reset();
+	if (textured)
+	{
+		std::vector<XMFLOAT2> zeroTexcoords;
+		if (texcoordData == nullptr)
+		{
+			zeroTexcoords.assign(vertexCount, XMFLOAT2(0.f, 0.f));
+			texcoordData = zeroTexcoords.data();
+		}
+
+		std::vector<PackedVector::XMHALF2> compactTexcoords;
+		m_texcoordStride = sizeof(XMFLOAT2);
+		if (vertexFormat == OBJVertexFormat::Compact)
+		{
+			compactTexcoords.resize(vertexCount);
+			std::transform(texcoordData, texcoordData + vertexCount, compactTexcoords.begin(), [](const XMFLOAT2& uv) { return PackedVector::XMHALF2(uv.x, uv.y); });
+			m_texcoordStride = sizeof(PackedVector::XMHALF2);
+		}
+
+		D3D11_SUBRESOURCE_DATA texcoordBufferData = { 0 };
+		texcoordBufferData.pSysMem = compactTexcoords.empty() ? static_cast<const void*>(texcoordData) : compactTexcoords.data();
+		const CD3D11_BUFFER_DESC texcoordBufferDesc(m_texcoordStride * static_cast<UINT>(vertexCount), D3D11_BIND_VERTEX_BUFFER);
+		DX::ThrowIfFailed(
+			device->CreateBuffer(
+				&texcoordBufferDesc,
+				&texcoordBufferData,
+				&m_texcoordBuffer
+				)
+			);
+		m_deviceBytes += texcoordBufferDesc.ByteWidth;
+		if (retain)
+		{
+			const byte* texcoordBytes = static_cast<const byte*>(texcoordBufferData.pSysMem);
+			m_retained.texcoords.assign(texcoordBytes, texcoordBytes + texcoordBufferDesc.ByteWidth);
+		}
+	}
+
+	if (retain)
+	{
+		m_retained.valid = true;
+		m_retained.vertexFormat = vertexFormat;
+		m_retained.bakedLighting = bakedLighting != nullptr;
+		if (bakedLighting != nullptr)
+		{
+			m_retained.lighting = *bakedLighting;
+		}
+	}
+
+	m_ready = true;
+
+	// The buffers are immutable, so the GPU keeps its own copy of the mesh from now
+	// on.
+	if (m_options.releaseCpuData)
+	{
+		ReleaseCpuData();
+	}
+}
+
+bool OBJMesh::RestoreDeviceResources(ID3D11Device* device, OBJVertexFormat vertexFormat, const LightingConstantBuffer* bakedLighting)
+{
+	// The subsets, clusters and levels of detail are still those of the retained
+	// buffers, as long as they were made the same way.
+	if (!m_retained.valid ||
+		m_retained.vertexFormat != vertexFormat ||
+		m_retained.bakedLighting != (bakedLighting != nullptr) ||
+		(bakedLighting != nullptr && memcmp(&m_retained.lighting, bakedLighting, sizeof(LightingConstantBuffer)) != 0))
+	{
+		return false;
+	}
+
+	const auto createBuffer = [device](const std::vector<byte>& data, Microsoft::WRL::ComPtr<ID3D11Buffer>& buffer, UINT bindFlags)
+	{
+		D3D11_SUBRESOURCE_DATA bufferData = { data.data(), 0, 0 };
+		const CD3D11_BUFFER_DESC bufferDesc(static_cast<UINT>(data.size()), bindFlags);
+		DX::ThrowIfFailed(
+			device->CreateBuffer(
+				&bufferDesc,
+				&bufferData,
+				&buffer
+				)
+			);
+	};
+	createBuffer(m_retained.vertices, m_vertexBuffer, D3D11_BIND_VERTEX_BUFFER);
+	createBuffer(m_retained.indices, m_indexBuffer, D3D11_BIND_INDEX_BUFFER);
+	m_deviceBytes = m_retained.vertices.size() + m_retained.indices.size();
+	m_texcoordBuffer.Reset();
+	if (!m_retained.texcoords.empty())
+	{
+		createBuffer(m_retained.texcoords, m_texcoordBuffer, D3D11_BIND_VERTEX_BUFFER);
+		m_deviceBytes += m_retained.texcoords.size();
+	}
+
+	m_ready = true;
+	return true;
+}
+
+void OBJMesh::ReleaseRetainedData()
+{
+	m_retained = RetainedBuffers();
+}
+
+uint64 OBJMesh::GetRetainedBytes() const
+{
+	return m_retained.vertices.size() + m_retained.indices.size() + m_retained.texcoords.size();
+}
+
+void OBJMesh::ReleaseCpuData()
+{
+	// Swapping with empty vectors frees the memory; clear would keep it.
+	std::vector<VertexPositionColor>().swap(vertices);
+	std::vector<UINT>().swap(indices);
+	std::vector<XMFLOAT2>().swap(texcoords);
+	std::vector<MeshMaterialRange>().swap(m_materialRanges);
+	m_meshCache.Close();
+	m_cpuDataReleased = true;
+}
+
+bool OBJMesh::HasClusters(size_t lodIndex) const
+{
+	const UINT firstSubset = m_lods[lodIndex].firstSubset;
+	return m_subsetClusters[firstSubset + 1] > m_subsetClusters[firstSubset];
+}
+
+void XM_CALLCONV OBJMesh::DrawVisibleClusters(
+	ID3D11DeviceContext* context,
+	size_t lodIndex,
+	FXMMATRIX meshToWorld,
+	const DX::CameraResources& camera,
+	UINT instanceCount,
+	ID3D11ShaderResourceView** boundTexture) const
+{
+	// Back-face tests are done in mesh space. The model transform is rigid, so the
+	// distance between the eyes does not change.
+	const XMFLOAT3 cameraPosition = camera.GetViewPosition();
+	const XMVECTOR viewPosition = XMVector3TransformCoord(XMLoadFloat3(&cameraPosition), XMMatrixInverse(nullptr, meshToWorld));
+	const float viewRadius = camera.GetViewRadius();
+
+	const MeshLod& lod = m_lods[lodIndex];
+	for (UINT i = lod.firstSubset; i < lod.firstSubset + lod.subsetCount; ++i)
+	{
+		const MeshSubset& subset = m_subsets[i];
+		auto drawRun = [&](UINT start, UINT count)
+		{
+			if (boundTexture != nullptr)
+			{
+				BindMaterialTexture(context, subset.material, boundTexture);
+			}
+			context->DrawIndexedInstanced(count, instanceCount, start, subset.baseVertex, 0);
+		};
+
+		UINT runStart = 0;
+		UINT runCount = 0;
+		for (UINT c = m_subsetClusters[i]; c < m_subsetClusters[i + 1]; ++c)
+		{
+			const MeshCluster& cluster = m_clusters[c];
+			if (IsClusterBackFacing(cluster, viewPosition, viewRadius))
+			{
+				continue;
+			}
+
+			BoundingSphere sphere(cluster.center, cluster.radius);
+			sphere.Transform(sphere, meshToWorld);
+			if (!camera.IsInView(sphere))
+			{
+				continue;
+			}
+
+			if (runCount > 0 && runStart + runCount == cluster.indexStart)
+			{
+				runCount += cluster.indexCount;
+				continue;
+			}
+
+			if (runCount > 0)
+			{
+				drawRun(runStart, runCount);
+			}
+			runStart = cluster.indexStart;
+			runCount = cluster.indexCount;
+		}
+
+		if (runCount > 0)
+		{
+			drawRun(runStart, runCount);
+		}
+	}
+}
+
+BoundingBox OBJMesh::GetBoundingBox() const
+{
+	BoundingBox box;
+	const MeshBounds& bounds = GetBounds();
+	BoundingBox::CreateFromPoints(box, XMLoadFloat3(&bounds.min), XMLoadFloat3(&bounds.max));
+	return box;
+}
+
+BoundingSphere OBJMesh::GetBoundingSphere() const
+{
+	BoundingSphere sphere;
+	BoundingSphere::CreateFromBoundingBox(sphere, GetBoundingBox());
+	return sphere;
+}
+
+void OBJMesh::ReleaseDeviceResources()
+{
+	m_ready = false;
+	m_vertexBuffer.Reset();
+	m_indexBuffer.Reset();
+	m_texcoordBuffer.Reset();
+	m_deviceBytes = 0;
+}
+
+void OBJMesh::Attach(ID3D11DeviceContext* context) const
+{
+	// Each vertex is one instance of the VertexPositionColor or VertexPositionColorCompact struct.
+	const UINT stride = m_vertexStride;
+	const UINT offset = 0;
+	context->IASetVertexBuffers(
+		0,
+		1,
+		m_vertexBuffer.GetAddressOf(),
+		&stride,
+		&offset
+		);
+	context->IASetIndexBuffer(
+		m_indexBuffer.Get(),
+		m_indexFormat, // Each index is one 16-bit or 32-bit unsigned integer.
+		0
+		);
+
+	if (m_texcoordBuffer)
+	{
+		const UINT texcoordStride = m_texcoordStride;
+		context->IASetVertexBuffers(
+			2,
+			1,
+			m_texcoordBuffer.GetAddressOf(),
+			&texcoordStride,
+			&offset
+			);
+	}
+}
+
+void OBJMesh::BindMaterialTexture(ID3D11DeviceContext* context, UINT material, ID3D11ShaderResourceView** boundTexture) const
+{
+	ID3D11ShaderResourceView* texture = m_materialTextures[material]->GetShaderResourceView();
+	if (texture != *boundTexture)
+	{
+		context->PSSetShaderResources(0, 1, &texture);
+		*boundTexture = texture;
+	}
+}
+
+void OBJMesh::DrawLod(ID3D11DeviceContext* context, size_t lodIndex, UINT instanceCount, ID3D11ShaderResourceView** boundTexture) const
+{
+	// Meshes with more vertices than 16-bit indices can address are drawn in
+	// several subsets, and textured meshes in one or more per material.
+	const MeshLod& lod = m_lods[lodIndex];
+	for (UINT i = lod.firstSubset; i < lod.firstSubset + lod.subsetCount; ++i)
+	{
+		const MeshSubset& subset = m_subsets[i];
+		if (boundTexture != nullptr)
+		{
+			BindMaterialTexture(context, subset.material, boundTexture);
+		}
+		context->DrawIndexedInstanced(
+			subset.indexCount,	// Index count per instance
+			instanceCount,		// Instance count.
+			subset.indexStart,	// Start index location
+			subset.baseVertex,	// Base vertex location
+			0					// Start instance location.
+			);
+	}
+}
+
+size_t OBJMesh::SelectLod(float distance) const
+{
+	size_t lodIndex = 0;
+	while (lodIndex + 1 < m_lods.size() && distance >= m_lodSwitchDistances[lodIndex])
+	{
+		++lodIndex;
+	}
+	return lodIndex;
+}
+
+// parses the obj file and loads the vertices
+void OBJMesh::parseOBJ(std::ifstream& in, OBJProgressCallback progressCallback, OBJPreviewCallback previewCallback)
+{
+	// Check if the file was successfully opened
+	if (!in.is_open()) {
+		return;
+	}
+
+	// The file is read in large blocks and tokenized in place.
+	OBJParser parser(vertices, indices);
+	parser.SetProgressCallback(progressCallback);
+	parser.SetPreviewCallback(previewCallback);
+	if (UsesMaterials())
+	{
+		parser.SetMaterialOutputs(&texcoords, &m_materialRanges);
+	}
+	parser.ParseStream(in);
+
+	in.close();
+	m_materialLibraries = parser.GetMaterialLibraries();
+	m_materialNames = parser.GetMaterialNames();
+
+	CenterAndScale();
+}
+
+// parses obj text that is already in memory, such as a mapped file. The buffer
+// is only read from. The parallel parser gives the same result as the serial one.
+void OBJMesh::parseOBJ(const char* begin, const char* end, bool parallel, OBJProgressCallback progressCallback, OBJPreviewCallback previewCallback)
+{
+	OBJParser parser(vertices, indices);
+	parser.SetProgressCallback(progressCallback);
+	parser.SetPreviewCallback(previewCallback);
+	if (UsesMaterials())
+	{
+		parser.SetMaterialOutputs(&texcoords, &m_materialRanges);
+	}
+	if (parallel)
+	{
+		parser.ParseParallel(begin, end);
+	}
+	else
+	{
+		parser.Parse(begin, end);
+	}
+	m_materialLibraries = parser.GetMaterialLibraries();
+	m_materialNames = parser.GetMaterialNames();
+
+	CenterAndScale();
+}
+
+void OBJMesh::CenterAndScale()
+{
+	// Center and scale down obj to fit in a 0.2m x 0.2m x 0.2m cube, and keep the
+	// bounds of the transformed mesh.
+	SetBounds(PostProcessVertices(vertices.data(), vertices.size(), c_meshSize));
+}
+
+void OBJMesh::SetBounds(const MeshBounds& bounds)
+{
+	if (!m_boundsSet)
+	{
+		m_bounds = bounds;
+		m_boundsSet = true;
+	}
+}
+
+const MeshBounds& OBJMesh::GetBounds() const
+{
+	static const MeshBounds noBounds = {};
+	return m_boundsSet ? m_bounds : noBounds;
+}
+
+void OBJMesh::GenerateLods()
+{
+	// Each level is simplified from the one before, which is faster than starting
+	// from the full mesh every time and gives nearly the same result.
+	std::vector<UINT> previous(indices.begin(), indices.end());
+	std::vector<UINT> simplified;
+	std::vector<MeshMaterialRange> previousRanges = m_materialRanges;
+	std::vector<MeshMaterialRange> simplifiedRanges;
+
+	// Material ranges are simplified on their own, so that no triangle changes
+	// material; the vertices between two materials are on an open border of both,
+	// so they are kept. Each range is compacted to the vertices it uses first.
+	std::vector<UINT> remap(vertices.size(), ~0u);
+	std::vector<UINT> rangeIndices;
+	std::vector<UINT> rangeVertices;
+	std::vector<VertexPositionColor> rangeVertexData;
+	std::vector<UINT> rangeSimplified;
+
+	while (m_lodIndexCounts.size() < c_maxMeshLods)
+	{
+		if (previousRanges.size() < 2)
+		{
+			SimplifyMesh(vertices.data(), vertices.size(), previous, previous.size() / 2, simplified);
+
+			// Vertices are shared with the full mesh, so only the triangles are reordered.
+			if (m_options.optimize)
+			{
+				OptimizeVertexCache(simplified, vertices.size());
+			}
+			simplifiedRanges.clear();
+			if (!previousRanges.empty())
+			{
+				simplifiedRanges.push_back({ previousRanges[0].material, 0, static_cast<uint32>(simplified.size()) });
+			}
+		}
+		else
+		{
+			simplified.clear();
+			simplifiedRanges.clear();
+			for (const MeshMaterialRange& range : previousRanges)
+			{
+				CompactVertices(previous.data() + range.indexStart, range.indexCount, remap, rangeIndices, rangeVertices);
+				rangeVertexData.resize(rangeVertices.size());
+				std::transform(rangeVertices.begin(), rangeVertices.end(), rangeVertexData.begin(), [&](UINT vertex) { return vertices[vertex]; });
+
+				SimplifyMesh(rangeVertexData.data(), rangeVertexData.size(), rangeIndices, rangeIndices.size() / 2, rangeSimplified);
+				if (m_options.optimize)
+				{
+					OptimizeVertexCache(rangeSimplified, rangeVertexData.size());
+				}
+
+				simplifiedRanges.push_back({ range.material, static_cast<uint32>(simplified.size()), static_cast<uint32>(rangeSimplified.size()) });
+				for (const UINT index : rangeSimplified)
+				{
+					simplified.push_back(rangeVertices[index]);
+				}
+			}
+		}
+
+		// Stop once simplification no longer gets far enough to be worth the memory.
+		if (simplified.empty() || simplified.size() > previous.size() * 3 / 4)
+		{
+			break;
+		}
+
+		for (MeshMaterialRange range : simplifiedRanges)
+		{
+			range.indexStart += static_cast<uint32>(indices.size());
+			m_materialRanges.push_back(range);
+		}
+		indices.insert(indices.end(), simplified.begin(), simplified.end());
+		m_lodIndexCounts.push_back(static_cast<UINT>(simplified.size()));
+		previous.swap(simplified);
+		previousRanges.swap(simplifiedRanges);
+	}
+}
+
+void OBJMesh::PreviewCoarsestLod(const OBJPreviewCallback& previewCallback) const
+{
+	const uint32* lodIndexCounts = m_meshCache.GetLodIndexCounts();
+	const size_t lodCount = std::find(lodIndexCounts, lodIndexCounts + c_maxMeshLods, 0u) - lodIndexCounts;
+	if (lodCount < 2)
+	{
+		return;
+	}
+
+	// The levels of detail follow each other in the index stream, coarsest last.
+	size_t lodIndexStart = 0;
+	for (size_t lod = 0; lod + 1 < lodCount; ++lod)
+	{
+		lodIndexStart += lodIndexCounts[lod];
+	}
+	const UINT* lodIndices = m_meshCache.GetIndices() + lodIndexStart;
+	const size_t lodIndexCount = lodIndexCounts[lodCount - 1];
+
+	// Number the vertices of the level in order of first use. The vertex colors
+	// hold the normals, as nothing has been baked into them yet.
+	const VertexPositionColor* cachedVertices = m_meshCache.GetVertices();
+	std::vector<UINT> vertexRemap(m_meshCache.GetVertexCount(), UINT(-1));
+	std::vector<XMFLOAT3> positions;
+	std::vector<XMFLOAT3> normals;
+	std::vector<UINT> previewIndices(lodIndexCount);
+	for (size_t i = 0; i < lodIndexCount; ++i)
+	{
+		UINT& remapped = vertexRemap[lodIndices[i]];
+		if (remapped == UINT(-1))
+		{
+			remapped = static_cast<UINT>(positions.size());
+			positions.push_back(cachedVertices[lodIndices[i]].pos);
+			normals.push_back(cachedVertices[lodIndices[i]].color);
+		}
+		previewIndices[i] = remapped;
+	}
+
+	const OBJPreviewChunk chunk = { positions.data(), normals.data(), positions.size(), previewIndices.data(), previewIndices.size() };
+	previewCallback(chunk);
+}
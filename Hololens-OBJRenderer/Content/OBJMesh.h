@@ -0,0 +1,312 @@
+#pragma once
+
+#include "..\Common\DeviceResources.h"
+#include "..\Common\CameraResources.h"
+#include "ShaderStructures.h"
+#include "OBJParser.h"
+#include "OBJMaterial.h"
+#include "MeshCache.h"
+#include "VertexQuantization.h"
+#include "VertexLighting.h"
+#include "VertexPostProcess.h"
+#include "NormalGenerator.h"
+#include "MeshSplitter.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "MeshClusters.h"
+#include "TextureStreamer.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Hololens_OBJRenderer
+{
+	// How the OBJ file is brought into memory for parsing.
+	enum class OBJLoadMode
+	{
+		// Read through a std::ifstream in large blocks.
+		Stream,
+
+		// Map the whole file and parse it in place on the calling thread. This is
+		// the reference parser.
+		MemoryMapped,
+
+		// Map the whole file and parse it in chunks on all cores.
+		MemoryMappedParallel
+	};
+
+	// Processing applied to a mesh while it loads.
+	struct OBJMeshOptions
+	{
+		// Reuse a binary cache of the processed mesh if one is up to date, and write
+		// one after processing otherwise.
+		bool				useMeshCache = true;
+
+		// Generate smooth normals for the vertices the file gives none, with the
+		// compute shaders of normalGenerator when there is one, and on all cores
+		// otherwise.
+		bool				generateNormals = true;
+		std::shared_ptr<NormalGenerator>	normalGenerator;
+
+		// Reorder triangles and vertices for the vertex cache.
+		bool				optimize = true;
+
+		// Build simplified levels of detail, each with about half the triangles of
+		// the one before.
+		bool				generateLods = true;
+
+		// Split meshes with more than 65536 vertices into subsets that each use
+		// 16-bit indices. Otherwise they keep 32-bit indices.
+		bool				splitLargeMeshes = true;
+
+		// Split large levels of detail into clusters of about a hundred triangles
+		// that are culled on their own when they face away or are out of view.
+		bool				buildClusters = true;
+
+		// Free the CPU copy of the mesh once it is on the GPU. If the device resources
+		// have to be created again, the mesh is read back from the cache, or parsed
+		// again without one.
+		bool				releaseCpuData = true;
+
+		// Keep a copy of the buffers as they were uploaded, so that they can be made
+		// again on a new device without reading or processing the mesh. Costs as much
+		// memory as the buffers themselves. Meshes without a usable mesh cache are
+		// always retained, as they would have to be parsed again; with this set, the
+		// others are too, as long as they fit the retained budget of the
+		// ResourceCache.
+		bool				retainDeviceData = false;
+
+		// Read the MTL libraries the file names, and draw each material with its
+		// diffuse texture, or its diffuse color, streamed by textureStreamer. Without
+		// a streamer, materials are ignored.
+		bool				loadMaterials = true;
+		std::shared_ptr<TextureStreamer>	textureStreamer;
+	};
+
+	// The subsets drawn for one level of detail.
+	struct MeshLod
+	{
+		UINT	firstSubset;
+		UINT	subsetCount;
+	};
+
+	// The geometry of one OBJ file, on the CPU and on the GPU. Meshes are shared by
+	// every instance of the same file.
+	class OBJMesh
+	{
+	public:
+		OBJMesh(const std::string& fileName, const OBJMeshOptions& options);
+
+		// Reads, parses and processes LocalFolder\fileName on the calling thread.
+		// Unless previewCallback is nullptr, it is handed the geometry as it is
+		// parsed, or the coarsest level of detail of a cached mesh.
+		void Load(OBJLoadMode loadMode, OBJProgressCallback progressCallback, OBJPreviewCallback previewCallback = nullptr);
+
+		// Creates the vertex and index buffers from the loaded mesh, in the given
+		// vertex layout. Can be called again after the device was lost, in which case
+		// the retained copy of the buffers is uploaded again if there is one, and a
+		// released CPU copy is loaded again first otherwise. Unless bakedLighting is
+		// nullptr, the vertex colors are lit with it instead of holding the normals.
+		void CreateDeviceResources(ID3D11Device* device, OBJVertexFormat vertexFormat, const LightingConstantBuffer* bakedLighting = nullptr);
+		void ReleaseDeviceResources();
+
+		// Frees the retained copy of the buffers. The next CreateDeviceResources
+		// processes the mesh again.
+		void ReleaseRetainedData();
+		bool HasRetainedData() const								{ return m_retained.valid; }
+		uint64 GetRetainedBytes() const;
+
+		// True if the mesh was read from, or written to, a mesh cache by the last
+		// Load, so that it can be read back without parsing.
+		bool HasMeshCache() const									{ return m_hasMeshCache; }
+
+		// Binds the vertex and index buffers to the input assembler, and the texture
+		// coordinates to slot 2 if the mesh has materials.
+		void Attach(ID3D11DeviceContext* context) const;
+
+		// Draws a level of detail with the given number of instances. Unless
+		// boundTexture is nullptr, the texture of each material is bound to the pixel
+		// shader ahead of its triangles, unless *boundTexture already is that texture,
+		// and *boundTexture is updated.
+		void DrawLod(ID3D11DeviceContext* context, size_t lod, UINT instanceCount, ID3D11ShaderResourceView** boundTexture = nullptr) const;
+
+		// True if the level of detail was split into clusters. Its instances are then
+		// drawn one at a time with DrawVisibleClusters instead of DrawLod.
+		bool HasClusters(size_t lod) const;
+
+		// Draws the clusters of a level of detail that face either eye of the camera
+		// and are in its view, for one instance placed by meshToWorld. Consecutive
+		// visible clusters are drawn together.
+		void XM_CALLCONV DrawVisibleClusters(
+			ID3D11DeviceContext* context,
+			size_t lod,
+			DirectX::FXMMATRIX meshToWorld,
+			const DX::CameraResources& camera,
+			UINT instanceCount,
+			ID3D11ShaderResourceView** boundTexture = nullptr) const;
+
+		// Picks a level of detail from the distance to the viewer, in meters.
+		size_t SelectLod(float distance) const;
+
+		void parseOBJ(std::ifstream& in, OBJProgressCallback progressCallback = nullptr, OBJPreviewCallback previewCallback = nullptr);
+		void parseOBJ(const char* begin, const char* end, bool parallel = false, OBJProgressCallback progressCallback = nullptr, OBJPreviewCallback previewCallback = nullptr);
+
+		// Level of detail lod + 1 is drawn from distance meters onwards.
+		void SetLodSwitchDistance(size_t lod, float distance)		{ m_lodSwitchDistances[lod] = distance; }
+
+		// True once the device resources exist and there is something to draw. Set on
+		// the thread that creates them, and read by the rendering thread.
+		bool IsReady() const										{ return m_ready; }
+
+		// Size of the vertex, index and texture coordinate buffers. 0 while there are
+		// none.
+		uint64 GetDeviceBytes() const								{ return m_deviceBytes; }
+
+		// True if the mesh has materials and all of their textures can be drawn. Until
+		// then, the mesh is drawn with its vertex colors only.
+		bool IsTextured() const;
+
+		// Asks for enough texture detail to cover pixels on screen. Call for every
+		// instance drawn in a frame.
+		void RequestTextureDetail(float pixels) const;
+
+		const std::string& GetFileName() const						{ return m_fileName; }
+
+		// Bounds of the centered and scaled mesh. Empty until the mesh was first
+		// loaded.
+		const MeshBounds& GetBounds() const;
+
+		// Bounding volumes of the mesh in mesh space, for culling.
+		DirectX::BoundingBox GetBoundingBox() const;
+		DirectX::BoundingSphere GetBoundingSphere() const;
+		const MeshOptimizationStats& GetOptimizationStats() const	{ return m_optimizationStats; }
+		size_t GetLodCount() const									{ return m_lods.size(); }
+
+		// Vertices of the loaded mesh, whether they were parsed or read from the cache.
+		// 0 once the CPU copy is released.
+		size_t GetVertexCount() const								{ return m_meshCache.IsOpen() ? m_meshCache.GetVertexCount() : vertices.size(); }
+
+		// Maps positions as read by the vertex shader into mesh space. The identity
+		// unless the vertices are quantized, and until they were first uploaded.
+		DirectX::XMMATRIX XM_CALLCONV GetPositionTransform() const
+		{
+			return m_positionTransformSet ? DirectX::XMLoadFloat4x4(&m_positionDequantization) : DirectX::XMMatrixIdentity();
+		}
+
+	private:
+		// Centers the parsed vertices and scales them to fit a 0.2m cube.
+		void CenterAndScale();
+
+		// Keeps the bounds of the first load. Reloads find the same bounds, and the
+		// rendering thread may be reading them meanwhile.
+		void SetBounds(const MeshBounds& bounds);
+
+		// Appends simplified levels of detail to indices.
+		void GenerateLods();
+
+		// Hands the coarsest level of detail of the open mesh cache to previewCallback,
+		// with only the vertices it uses. Does nothing without levels of detail.
+		void PreviewCoarsestLod(const OBJPreviewCallback& previewCallback) const;
+
+		// Frees the parsed vectors and closes the mesh cache.
+		void ReleaseCpuData();
+
+		// Creates the buffers from the retained copy. Returns false if there is none,
+		// or if it was made for another vertex format or lighting.
+		bool RestoreDeviceResources(ID3D11Device* device, OBJVertexFormat vertexFormat, const LightingConstantBuffer* bakedLighting);
+
+		bool UsesMaterials() const									{ return m_options.loadMaterials && m_options.textureStreamer != nullptr; }
+
+		// Reads the material libraries from folder, and gets the texture of each
+		// material name from the streamer.
+		void LoadMaterials(const std::wstring& folder);
+
+		void BindMaterialTexture(ID3D11DeviceContext* context, UINT material, ID3D11ShaderResourceView** boundTexture) const;
+
+		std::string											m_fileName;
+		OBJMeshOptions										m_options;
+		OBJLoadMode											m_loadMode = OBJLoadMode::MemoryMappedParallel;
+		std::atomic<bool>									m_ready = { false };
+		bool												m_cpuDataReleased = false;
+		bool												m_hasMeshCache = false;
+
+		// Direct3D resources for the geometry.
+		Microsoft::WRL::ComPtr<ID3D11Buffer>				m_vertexBuffer;
+		Microsoft::WRL::ComPtr<ID3D11Buffer>				m_indexBuffer;
+		uint32												m_indexCount = 0;
+		DXGI_FORMAT											m_indexFormat = DXGI_FORMAT_R16_UINT;
+		std::vector<MeshSubset>								m_subsets;
+
+		// Clusters of each subset: those of subset i start at m_subsetClusters[i] and
+		// end at m_subsetClusters[i + 1].
+		std::vector<MeshCluster>							m_clusters;
+		std::vector<UINT>									m_subsetClusters;
+
+		// Texture coordinates, in a vertex buffer of their own so that untextured
+		// pipelines read the same layout as before. Only made for textured meshes.
+		Microsoft::WRL::ComPtr<ID3D11Buffer>				m_texcoordBuffer;
+		UINT												m_texcoordStride = sizeof(DirectX::XMFLOAT2);
+		uint64												m_deviceBytes = 0;
+
+		// What the buffers were last made from, when retainDeviceData is set.
+		struct RetainedBuffers
+		{
+			std::vector<byte>								vertices;
+			std::vector<byte>								indices;
+			std::vector<byte>								texcoords;
+			OBJVertexFormat									vertexFormat = OBJVertexFormat::Compact;
+			bool											bakedLighting = false;
+			LightingConstantBuffer							lighting;
+			bool											valid = false;
+		};
+		RetainedBuffers										m_retained;
+
+		// Layout of the vertex buffer. With compact vertices, positions are mapped back
+		// into mesh space by m_positionDequantization ahead of the model transform.
+		// Like the bounds, the transform is only written by the first upload: a mesh is
+		// always uploaded in the same vertex format.
+		UINT												m_vertexStride = sizeof(VertexPositionColor);
+		DirectX::XMFLOAT4X4									m_positionDequantization;
+		std::atomic<bool>									m_positionTransformSet = { false };
+
+		// Levels of detail, from the full mesh down.
+		std::vector<MeshLod>								m_lods;
+		std::array<float, c_maxMeshLods - 1>				m_lodSwitchDistances = {{ 3.f, 6.f, 12.f }};
+
+		// vectors for vertices and indices. Empty once the CPU copy is released.
+		std::vector<VertexPositionColor> vertices;
+		std::vector<UINT> indices;
+
+		// One per vertex if the file has vt records and materials are used; empty
+		// otherwise.
+		std::vector<DirectX::XMFLOAT2> texcoords;
+
+		// Material ranges of every level of detail, back to back like the indices.
+		// Empty without materials.
+		std::vector<MeshMaterialRange>						m_materialRanges;
+
+		// The libraries the file names, the materials its triangles use, and the
+		// texture of each. The mesh is textured if any library could be read.
+		std::vector<std::string>							m_materialLibraries;
+		std::vector<std::string>							m_materialNames;
+		std::vector<std::shared_ptr<StreamedTexture>>		m_materialTextures;
+		bool												m_textured = false;
+
+		// Number of indices of each level of detail in indices, back to back.
+		std::vector<UINT>									m_lodIndexCounts;
+
+		// Bounds of the centered and scaled mesh, read by the rendering thread once
+		// m_boundsSet is.
+		MeshBounds											m_bounds = {};
+		std::atomic<bool>									m_boundsSet = { false };
+
+		// Mapped binary cache. When open, the mesh is read from here instead of the vectors.
+		MeshCache											m_meshCache;
+		MeshOptimizationStats								m_optimizationStats;
+	};
+}
@@ -0,0 +1,1169 @@
+#include "pch.h"
+#include "OBJParser.h"
+
+#include <algorithm>
+#include <mutex>
+#include <ppl.h>
+#include <thread>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+using namespace Hololens_OBJRenderer;
+using namespace DirectX;
+
+namespace
+{
+	// Powers of ten that are exactly representable as a float.
+	constexpr float c_floatPowersOfTen[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+
+	// Largest integer below which every integer is exactly representable as a float.
+	constexpr unsigned long long c_maxExactFloatMantissa = 1ull << 24;
+
+	// Fields of a record are separated by spaces or tabs.
+	inline bool IsSeparator(char c)
+	{
+		return c == ' ' || c == '\t';
+	}
+
+	inline bool IsDigit(char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+
+	// Component bits of OBJParser::m_relativeCorners.
+	constexpr unsigned char c_relativePosition = 1;
+	constexpr unsigned char c_relativeTexcoord = 2;
+	constexpr unsigned char c_relativeNormal = 4;
+
+	// Material of the faces read before any 'usemtl' record.
+	constexpr UINT c_unsetMaterial = ~0u;
+
+	// Reads the next field of a record starting at p. Returns false at the end of the line.
+	inline bool NextToken(const char*& p, const char* end, OBJToken& token)
+	{
+		while (p != end && IsSeparator(*p)) { ++p; }
+		if (p == end) { return false; }
+
+		token.begin = p;
+		while (p != end && !IsSeparator(*p)) { ++p; }
+		token.end = p;
+		return true;
+	}
+
+	// Splits a line into at most MaxTokens fields and returns the number of fields
+	// found. When the line holds more, MaxTokens + 1 is returned so that a caller
+	// can reject records with the wrong number of elements.
+	template<size_t MaxTokens>
+	size_t Tokenize(const char* begin, const char* end, OBJToken (&tokens)[MaxTokens])
+	{
+		size_t count = 0;
+		const char* p = begin;
+		OBJToken token;
+		while (NextToken(p, end, token))
+		{
+			if (count == MaxTokens) { return MaxTokens + 1; }
+			tokens[count++] = token;
+		}
+		return count;
+	}
+
+	// Parses a whole token as a float. Fails if any characters are left over.
+	inline bool TokenToFloat(const OBJToken& token, float& value)
+	{
+		return !token.Empty() && ParseFloat(token.begin, token.end, value) == token.end;
+	}
+
+	// Splits a face corner such as "7", "7/3", "7//2" or "-1/-1/-1" into its three
+	// references. A reference of 0 is invalid; an empty one is absent.
+	inline bool ParseFaceCorner(const OBJToken& token, int (&references)[3], bool (&present)[3])
+	{
+		present[0] = present[1] = present[2] = false;
+
+		const char* p = token.begin;
+		for (int component = 0; component < 3; ++component)
+		{
+			if (component > 0)
+			{
+				if (p == token.end) { break; }
+				if (*p != '/') { return false; }
+				++p;
+			}
+
+			if (p != token.end && *p != '/')
+			{
+				const char* q = ParseInt(p, token.end, references[component]);
+				if (q == p || references[component] == 0) { return false; }
+				present[component] = true;
+				p = q;
+			}
+		}
+
+		// The position is required, and nothing may follow the normal.
+		return present[0] && p == token.end;
+	}
+
+	// Turns a 1-based or negative (relative) OBJ reference into a 0-based index, given
+	// the number of records of that kind read so far.
+	inline int ResolveReference(int reference, size_t count)
+	{
+		return reference > 0 ? reference - 1 : static_cast<int>(count) + reference;
+	}
+
+	inline bool IsValidIndex(int index, size_t count)
+	{
+		return index >= 0 && static_cast<size_t>(index) < count;
+	}
+
+	// Reads the count that follows label in a comment line such as "# Vertices: 34835".
+	// [begin, end) starts at the '#'.
+	bool ParseHeaderCount(const char* begin, const char* end, const char* label, size_t& count)
+	{
+		const size_t labelLength = strlen(label);
+		const char* p = begin + 1;
+		while (p != end && IsSeparator(*p)) { ++p; }
+		if (static_cast<size_t>(end - p) < labelLength || memcmp(p, label, labelLength) != 0)
+		{
+			return false;
+		}
+		p += labelLength;
+		while (p != end && IsSeparator(*p)) { ++p; }
+
+		int value;
+		if (ParseInt(p, end, value) == p || value < 0)
+		{
+			return false;
+		}
+		count = static_cast<size_t>(value);
+		return true;
+	}
+
+	// Ear clipping in the plane the polygon lies in. For convex polygons this yields a
+	// fan; concave polygons are split without producing triangles outside the outline.
+	// Emits triangles as polygon-local corner numbers in the polygon's winding order.
+	// Falls back to a fan for degenerate polygons where no ear can be found.
+	void TriangulatePolygon(const XMFLOAT3* const* corners, UINT count, std::vector<UINT>& triangles)
+	{
+		if (count == 3)
+		{
+			triangles.insert(triangles.end(), { 0, 1, 2 });
+			return;
+		}
+
+		// Newell's method gives a robust polygon normal; dropping its largest axis
+		// projects the polygon to 2D with the least distortion.
+		float nx = 0.f, ny = 0.f, nz = 0.f;
+		for (UINT i = 0; i < count; ++i)
+		{
+			const XMFLOAT3& a = *corners[i];
+			const XMFLOAT3& b = *corners[(i + 1) % count];
+			nx += (a.y - b.y) * (a.z + b.z);
+			ny += (a.z - b.z) * (a.x + b.x);
+			nz += (a.x - b.x) * (a.y + b.y);
+		}
+
+		const float ax = fabsf(nx), ay = fabsf(ny), az = fabsf(nz);
+		const int dropAxis = (ax >= ay && ax >= az) ? 0 : (ay >= az ? 1 : 2);
+		const float orientation = dropAxis == 0 ? nx : (dropAxis == 1 ? ny : nz);
+
+		auto u = [&](UINT i) { const XMFLOAT3& c = *corners[i]; return dropAxis == 0 ? c.y : c.x; };
+		auto v = [&](UINT i) { const XMFLOAT3& c = *corners[i]; return dropAxis == 2 ? c.y : c.z; };
+
+		// Twice the signed area of the projected triangle, positive for the polygon's winding.
+		auto area = [&](UINT a, UINT b, UINT c)
+		{
+			float cross = (u(b) - u(a)) * (v(c) - v(a)) - (v(b) - v(a)) * (u(c) - u(a));
+			// Dropping y flips the handedness of the (x, z) projection.
+			if (dropAxis == 1) { cross = -cross; }
+			return orientation >= 0.f ? cross : -cross;
+		};
+
+		UINT remaining[64];
+		std::vector<UINT> remainingLarge;
+		UINT* ring = remaining;
+		if (count > _countof(remaining))
+		{
+			remainingLarge.resize(count);
+			ring = remainingLarge.data();
+		}
+		for (UINT i = 0; i < count; ++i) { ring[i] = i; }
+
+		UINT left = count;
+		UINT i = 0;
+		UINT misses = 0;
+		while (left > 3 && misses < left)
+		{
+			const UINT a = ring[(i + left - 1) % left];
+			const UINT b = ring[i % left];
+			const UINT c = ring[(i + 1) % left];
+
+			bool isEar = area(a, b, c) > 0.f;
+			for (UINT j = 0; isEar && j < left; ++j)
+			{
+				const UINT p = ring[j];
+				if (p == a || p == b || p == c) { continue; }
+				isEar = !(area(a, b, p) >= 0.f && area(b, c, p) >= 0.f && area(c, a, p) >= 0.f);
+			}
+
+			if (isEar)
+			{
+				triangles.insert(triangles.end(), { a, b, c });
+				std::copy(ring + (i % left) + 1, ring + left, ring + (i % left));
+				--left;
+				misses = 0;
+			}
+			else
+			{
+				++i;
+				++misses;
+			}
+		}
+
+		// Whatever is left is either the final triangle or a degenerate remainder.
+		for (UINT k = 1; k + 1 < left; ++k)
+		{
+			triangles.insert(triangles.end(), { ring[0], ring[k], ring[k + 1] });
+		}
+	}
+}
+
+bool OBJToken::Is(const char* keyword) const
+{
+	const char* p = begin;
+	while (p != end && *keyword != '\0' && *p == *keyword)
+	{
+		++p;
+		++keyword;
+	}
+	return p == end && *keyword == '\0';
+}
+
+const char* Hololens_OBJRenderer::ParseFloat(const char* first, const char* last, float& value)
+{
+	const char* p = first;
+	bool negative = false;
+	if (p != last && (*p == '-' || *p == '+'))
+	{
+		negative = (*p == '-');
+		++p;
+	}
+
+	// Accumulate the significant digits as an integer mantissa and a power of ten.
+	unsigned long long mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+	bool sawDigit = false;
+
+	while (p != last && IsDigit(*p))
+	{
+		sawDigit = true;
+		if (mantissa != 0 || *p != '0') { ++digits; }
+		if (digits <= 19) { mantissa = mantissa * 10 + (*p - '0'); }
+		else { ++exponent; }
+		++p;
+	}
+	if (p != last && *p == '.')
+	{
+		++p;
+		while (p != last && IsDigit(*p))
+		{
+			sawDigit = true;
+			if (mantissa != 0 || *p != '0') { ++digits; }
+			if (digits <= 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				--exponent;
+			}
+			++p;
+		}
+	}
+
+	// A leading "0x" is a hexadecimal float, which only strtof understands.
+	const bool hexadecimal = (p != last && (*p == 'x' || *p == 'X'));
+
+	if (sawDigit && !hexadecimal)
+	{
+		if (p != last && (*p == 'e' || *p == 'E'))
+		{
+			const char* exponentStart = p + 1;
+			int explicitExponent = 0;
+			const char* q = ParseInt(exponentStart, last, explicitExponent);
+			if (q != exponentStart)
+			{
+				exponent += explicitExponent;
+				p = q;
+			}
+		}
+
+		// Fast path: when both the mantissa and the power of ten are exact floats,
+		// a single multiplication or division is correctly rounded and matches
+		// what strtof would return.
+		if (mantissa < c_maxExactFloatMantissa && exponent >= -10 && exponent <= 10)
+		{
+			float result = static_cast<float>(mantissa);
+			result = exponent < 0 ? result / c_floatPowersOfTen[-exponent] : result * c_floatPowersOfTen[exponent];
+			value = negative ? -result : result;
+			return p;
+		}
+	}
+
+	// Slow path for long mantissas, large exponents, and the special values strtof
+	// understands (inf, nan, hexadecimal). The token is copied onto the stack so that
+	// it can be null-terminated without touching the source buffer.
+	char scratch[64];
+	const size_t length = static_cast<size_t>(last - first) < sizeof(scratch) - 1 ? static_cast<size_t>(last - first) : sizeof(scratch) - 1;
+	memcpy(scratch, first, length);
+	scratch[length] = '\0';
+
+	char* scratchEnd = nullptr;
+	const float result = strtof(scratch, &scratchEnd);
+	if (scratchEnd == scratch)
+	{
+		return first;
+	}
+	value = result;
+	return first + (scratchEnd - scratch);
+}
+
+const char* Hololens_OBJRenderer::ParseInt(const char* first, const char* last, int& value)
+{
+	const char* p = first;
+	bool negative = false;
+	if (p != last && (*p == '-' || *p == '+'))
+	{
+		negative = (*p == '-');
+		++p;
+	}
+
+	const char* digitsStart = p;
+	long long result = 0;
+	while (p != last && IsDigit(*p))
+	{
+		result = result * 10 + (*p - '0');
+		if (result > 0x7fffffffll + 1) { return first; }
+		++p;
+	}
+
+	if (p == digitsStart) { return first; }
+
+	result = negative ? -result : result;
+	if (result > 0x7fffffffll) { return first; }
+
+	value = static_cast<int>(result);
+	return p;
+}
+
+size_t OBJParser::FaceVertexHash::operator()(const OBJFaceVertex& corner) const
+{
+	size_t hash = static_cast<size_t>(corner.position) * 73856093u;
+	hash ^= static_cast<size_t>(corner.texcoord) * 19349663u;
+	hash ^= static_cast<size_t>(corner.normal) * 83492791u;
+	return hash;
+}
+
+bool OBJParser::FaceVertexEqual::operator()(const OBJFaceVertex& a, const OBJFaceVertex& b) const
+{
+	return a.position == b.position && a.texcoord == b.texcoord && a.normal == b.normal;
+}
+
+OBJParser::OBJParser(std::vector<VertexPositionColor>& vertices, std::vector<UINT>& indices) :
+	m_vertices(vertices),
+	m_indices(indices),
+	m_currentMaterial(c_unsetMaterial)
+{
+}
+
+void OBJParser::SetMaterialOutputs(std::vector<XMFLOAT2>* texcoords, std::vector<MeshMaterialRange>* materialRanges)
+{
+	m_vertexTexcoords = texcoords;
+	m_materialRanges = materialRanges;
+}
+
+// Files name a handful of materials, so a linear search is fine.
+UINT OBJParser::FindMaterial(const std::string& name)
+{
+	const auto found = std::find(m_materialNames.begin(), m_materialNames.end(), name);
+	if (found != m_materialNames.end())
+	{
+		return static_cast<UINT>(found - m_materialNames.begin());
+	}
+	m_materialNames.push_back(name);
+	return static_cast<UINT>(m_materialNames.size() - 1);
+}
+
+void OBJParser::AddMaterialLibrary(const std::string& name)
+{
+	if (std::find(m_materialLibraries.begin(), m_materialLibraries.end(), name) == m_materialLibraries.end())
+	{
+		m_materialLibraries.push_back(name);
+	}
+}
+
+// Reads the stream in large blocks. Complete lines are parsed directly out of the
+// block; a trailing partial line is moved to the front and completed by the next read.
+void OBJParser::ParseStream(std::istream& in)
+{
+	// Measure the stream so that progress can be reported as a fraction, and the
+	// header counts checked against it.
+	const std::istream::pos_type start = in.tellg();
+	in.seekg(0, std::ios::end);
+	const std::istream::pos_type length = in.tellg() - start;
+	in.seekg(start);
+	const size_t streamSize = length > 0 ? static_cast<size_t>(length) : 0;
+	if (m_progressCallback && m_progressTotal == 0)
+	{
+		m_progressTotal = streamSize;
+	}
+
+	std::vector<char> block(BlockSize);
+	size_t carried = 0;
+
+	// Records are not counted ahead in a stream, as that would read it twice; only
+	// a header in the first block is used.
+	bool firstBlock = true;
+
+	while (in)
+	{
+		// A single line longer than the block is rare, but must still be handled.
+		if (carried == block.size())
+		{
+			block.resize(block.size() * 2);
+		}
+
+		in.read(block.data() + carried, block.size() - carried);
+		const size_t available = carried + static_cast<size_t>(in.gcount());
+		if (available == carried)
+		{
+			break;
+		}
+
+		const char* begin = block.data();
+		const char* end = begin + available;
+		if (firstBlock)
+		{
+			ReserveFromHeader(begin, end, streamSize);
+			firstBlock = false;
+		}
+
+		// Find the end of the last complete line in the block.
+		const char* lastLineEnd = end;
+		while (lastLineEnd != begin && *(lastLineEnd - 1) != '\n')
+		{
+			--lastLineEnd;
+		}
+
+		if (lastLineEnd == begin)
+		{
+			carried = available;
+			continue;
+		}
+
+		ParseLines(begin, lastLineEnd);
+		if (m_previewCallback)
+		{
+			EmitPreview(m_previewCallback, 0);
+		}
+
+		carried = static_cast<size_t>(end - lastLineEnd);
+		memmove(block.data(), lastLineEnd, carried);
+	}
+
+	// Whatever is left is the last line of the file, which has no newline.
+	if (carried > 0)
+	{
+		ParseLines(block.data(), block.data() + carried);
+	}
+
+	if (m_previewCallback)
+	{
+		EmitPreview(m_previewCallback, 0);
+	}
+	BuildMesh();
+}
+
+void OBJParser::Parse(const char* begin, const char* end)
+{
+	ReserveRecords(begin, end);
+	ParseLines(begin, end);
+	if (m_previewCallback)
+	{
+		EmitPreview(m_previewCallback, 0);
+	}
+	BuildMesh();
+}
+
+void OBJParser::ReserveRecords(const char* begin, const char* end)
+{
+	// The header describes the whole file, not the range of a chunk.
+	if (!m_isChunk && ReserveFromHeader(begin, end, static_cast<size_t>(end - begin)))
+	{
+		return;
+	}
+
+	size_t positions = 0;
+	size_t texcoords = 0;
+	size_t normals = 0;
+	size_t faces = 0;
+	const char* lineBegin = begin;
+	while (lineBegin != end)
+	{
+		const char* lineEnd = static_cast<const char*>(memchr(lineBegin, '\n', end - lineBegin));
+		if (!lineEnd)
+		{
+			lineEnd = end;
+		}
+
+		const char* p = lineBegin;
+		while (p != lineEnd && IsSeparator(*p)) { ++p; }
+		if (lineEnd - p >= 2)
+		{
+			if (p[0] == 'v')
+			{
+				if (IsSeparator(p[1])) { ++positions; }
+				else if (p[1] == 'n') { ++normals; }
+				else if (p[1] == 't') { ++texcoords; }
+			}
+			else if (p[0] == 'f' && IsSeparator(p[1]))
+			{
+				++faces;
+			}
+		}
+
+		lineBegin = lineEnd == end ? end : lineEnd + 1;
+	}
+
+	m_positions.reserve(m_positions.size() + positions);
+	m_texcoords.reserve(m_texcoords.size() + texcoords);
+	m_normals.reserve(m_normals.size() + normals);
+	m_faceSizes.reserve(m_faceSizes.size() + faces);
+	m_faceMaterials.reserve(m_faceMaterials.size() + faces);
+	m_faceVertices.reserve(m_faceVertices.size() + 3 * faces);
+	if (m_isChunk)
+	{
+		m_relativeCorners.reserve(m_relativeCorners.size() + 3 * faces);
+	}
+}
+
+bool OBJParser::ReserveFromHeader(const char* begin, const char* end, size_t inputSize)
+{
+	// The header is the comment block ahead of the first record.
+	size_t vertexCount = 0;
+	size_t faceCount = 0;
+	bool normalsFirst = false;
+	const char* lineBegin = begin;
+	while (lineBegin != end)
+	{
+		const char* lineEnd = static_cast<const char*>(memchr(lineBegin, '\n', end - lineBegin));
+		if (!lineEnd)
+		{
+			lineEnd = end;
+		}
+
+		const char* p = lineBegin;
+		while (p != lineEnd && IsSeparator(*p)) { ++p; }
+		if (p != lineEnd && *p == '#')
+		{
+			if (!ParseHeaderCount(p, lineEnd, "Vertices:", vertexCount))
+			{
+				ParseHeaderCount(p, lineEnd, "Faces:", faceCount);
+			}
+		}
+		else if (p != lineEnd && *p != '\r')
+		{
+			// Meshlab writes the normal of each vertex right before its position, so
+			// a first record that is a normal means there are as many normals.
+			normalsFirst = lineEnd - p >= 3 && p[0] == 'v' && p[1] == 'n' && IsSeparator(p[2]);
+			break;
+		}
+
+		lineBegin = lineEnd == end ? end : lineEnd + 1;
+	}
+
+	const size_t maxRecords = inputSize / MinRecordSize;
+	if (vertexCount == 0 || faceCount == 0 || vertexCount + faceCount > maxRecords)
+	{
+		return false;
+	}
+
+	m_positions.reserve(vertexCount);
+	if (normalsFirst)
+	{
+		m_normals.reserve(vertexCount);
+	}
+	m_faceSizes.reserve(faceCount);
+	m_faceMaterials.reserve(faceCount);
+	m_faceVertices.reserve(3 * faceCount);
+	return true;
+}
+
+void OBJParser::ParseLines(const char* begin, const char* end)
+{
+	if (m_progressCallback && m_progressTotal == 0)
+	{
+		m_progressTotal = static_cast<size_t>(end - begin);
+	}
+
+	const char* lineBegin = begin;
+	const char* lastReport = begin;
+	while (lineBegin != end)
+	{
+		const char* lineEnd = static_cast<const char*>(memchr(lineBegin, '\n', end - lineBegin));
+		const char* next = lineEnd ? lineEnd + 1 : end;
+		if (!lineEnd)
+		{
+			lineEnd = end;
+		}
+
+		ParseLine(lineBegin, lineEnd);
+		lineBegin = next;
+
+		if (static_cast<size_t>(lineBegin - lastReport) >= ProgressInterval)
+		{
+			ReportProgress(lineBegin - lastReport);
+			lastReport = lineBegin;
+
+			// Chunks are previewed in order by their parent once they are complete.
+			if (m_previewCallback && !m_isChunk)
+			{
+				EmitPreview(m_previewCallback, 0);
+			}
+		}
+	}
+
+	if (lastReport != end)
+	{
+		ReportProgress(end - lastReport);
+	}
+}
+
+void OBJParser::SetProgressCallback(OBJProgressCallback callback, size_t totalBytes)
+{
+	m_progressCallback = callback;
+	m_progressTotal = totalBytes;
+}
+
+void OBJParser::ReportProgress(size_t bytes)
+{
+	if (!m_progressCallback)
+	{
+		return;
+	}
+
+	const size_t parsed = (m_sharedBytesParsed ? *m_sharedBytesParsed : m_bytesParsed) += bytes;
+	const float fraction = m_progressTotal ? static_cast<float>(parsed) / static_cast<float>(m_progressTotal) : 1.f;
+	m_progressCallback((std::min)(fraction, 1.f));
+}
+
+// Each chunk is parsed by its own OBJParser into private record streams. A prefix
+// sum over the per-chunk v, vt, vn and face counts then gives every chunk its place
+// in the merged streams, and the chunks are copied there concurrently. Positive
+// references are global and need no adjustment; relative references are rebased
+// onto the number of records that precede the chunk.
+void OBJParser::ParseParallel(const char* begin, const char* end)
+{
+	const size_t size = static_cast<size_t>(end - begin);
+	if (m_progressCallback && m_progressTotal == 0)
+	{
+		m_progressTotal = size;
+	}
+
+	const size_t threads = (std::max)(1u, std::thread::hardware_concurrency());
+
+	// Use a few chunks per core so that uneven chunks still balance out.
+	size_t chunkCount = (std::min)(threads * 4, size / MinChunkSize);
+	if (chunkCount < 2)
+	{
+		Parse(begin, end);
+		return;
+	}
+
+	// Split at line boundaries. Empty chunks are possible with very long lines.
+	std::vector<const char*> bounds(chunkCount + 1);
+	bounds[0] = begin;
+	bounds[chunkCount] = end;
+	for (size_t i = 1; i < chunkCount; ++i)
+	{
+		const char* p = (std::max)(bounds[i - 1], begin + size / chunkCount * i);
+		const char* newline = p != end ? static_cast<const char*>(memchr(p, '\n', end - p)) : nullptr;
+		bounds[i] = newline ? newline + 1 : end;
+	}
+
+	struct Chunk
+	{
+		std::vector<VertexPositionColor>	unusedVertices;
+		std::vector<UINT>					unusedIndices;
+		std::unique_ptr<OBJParser>			parser;
+	};
+	std::vector<Chunk> chunks(chunkCount);
+
+	// Chunks finish in any order, but are previewed in file order: each finished
+	// chunk previews itself and the finished run after it, once the chunks before
+	// it are previewed.
+	std::mutex previewMutex;
+	std::vector<bool> chunkParsed(chunkCount, false);
+	size_t nextPreview = 0;
+	size_t previewedPositions = m_positions.size();
+	if (m_previewCallback)
+	{
+		EmitPreview(m_previewCallback, 0);
+	}
+
+	concurrency::parallel_for(size_t(0), chunkCount, [&](size_t i)
+	{
+		Chunk& chunk = chunks[i];
+		chunk.parser = std::make_unique<OBJParser>(chunk.unusedVertices, chunk.unusedIndices);
+		chunk.parser->m_isChunk = true;
+		if (m_progressCallback)
+		{
+			chunk.parser->m_progressCallback = m_progressCallback;
+			chunk.parser->m_progressTotal = m_progressTotal;
+			chunk.parser->m_sharedBytesParsed = m_sharedBytesParsed ? m_sharedBytesParsed : &m_bytesParsed;
+		}
+		chunk.parser->ReserveRecords(bounds[i], bounds[i + 1]);
+		chunk.parser->ParseLines(bounds[i], bounds[i + 1]);
+
+		if (m_previewCallback)
+		{
+			std::lock_guard<std::mutex> lock(previewMutex);
+			chunkParsed[i] = true;
+			while (nextPreview < chunkCount && chunkParsed[nextPreview])
+			{
+				OBJParser& parser = *chunks[nextPreview].parser;
+				parser.EmitPreview(m_previewCallback, previewedPositions);
+				previewedPositions += parser.m_positions.size();
+				++nextPreview;
+			}
+		}
+	});
+
+	// Prefix sums over the chunk sizes.
+	struct Offsets
+	{
+		size_t positions;
+		size_t texcoords;
+		size_t normals;
+		size_t faceVertices;
+		size_t faces;
+	};
+	std::vector<Offsets> offsets(chunkCount);
+	Offsets total = { m_positions.size(), m_texcoords.size(), m_normals.size(), m_faceVertices.size(), m_faceSizes.size() };
+
+	// Material names are merged in file order, so that they are numbered as by the
+	// serial parser. Faces of a chunk ahead of its first 'usemtl' take the material
+	// that the chunks before it left in effect.
+	std::vector<std::vector<UINT>> materialRemaps(chunkCount);
+	std::vector<UINT> inheritedMaterials(chunkCount);
+	for (size_t i = 0; i < chunkCount; ++i)
+	{
+		const OBJParser& parser = *chunks[i].parser;
+		for (const std::string& library : parser.m_materialLibraries)
+		{
+			AddMaterialLibrary(library);
+		}
+		for (const std::string& name : parser.m_materialNames)
+		{
+			materialRemaps[i].push_back(FindMaterial(name));
+		}
+		inheritedMaterials[i] = m_currentMaterial;
+		if (parser.m_currentMaterial != c_unsetMaterial)
+		{
+			m_currentMaterial = materialRemaps[i][parser.m_currentMaterial];
+		}
+	}
+
+	for (size_t i = 0; i < chunkCount; ++i)
+	{
+		const OBJParser& parser = *chunks[i].parser;
+		offsets[i] = total;
+		total.positions += parser.m_positions.size();
+		total.texcoords += parser.m_texcoords.size();
+		total.normals += parser.m_normals.size();
+		total.faceVertices += parser.m_faceVertices.size();
+		total.faces += parser.m_faceSizes.size();
+		m_lines += parser.m_lines;
+	}
+
+	m_positions.resize(total.positions);
+	m_texcoords.resize(total.texcoords);
+	m_normals.resize(total.normals);
+	m_faceVertices.resize(total.faceVertices);
+	m_faceSizes.resize(total.faces);
+	m_faceMaterials.resize(total.faces);
+
+	concurrency::parallel_for(size_t(0), chunkCount, [&](size_t i)
+	{
+		const OBJParser& parser = *chunks[i].parser;
+		const Offsets& offset = offsets[i];
+		std::copy(parser.m_positions.begin(), parser.m_positions.end(), m_positions.begin() + offset.positions);
+		std::copy(parser.m_texcoords.begin(), parser.m_texcoords.end(), m_texcoords.begin() + offset.texcoords);
+		std::copy(parser.m_normals.begin(), parser.m_normals.end(), m_normals.begin() + offset.normals);
+		std::copy(parser.m_faceSizes.begin(), parser.m_faceSizes.end(), m_faceSizes.begin() + offset.faces);
+		std::transform(parser.m_faceMaterials.begin(), parser.m_faceMaterials.end(), m_faceMaterials.begin() + offset.faces, [&](UINT material)
+		{
+			return material == c_unsetMaterial ? inheritedMaterials[i] : materialRemaps[i][material];
+		});
+
+		for (size_t j = 0; j < parser.m_faceVertices.size(); ++j)
+		{
+			OBJFaceVertex corner = parser.m_faceVertices[j];
+			const unsigned char relative = parser.m_relativeCorners[j];
+			if (relative & c_relativePosition) { corner.position += static_cast<int>(offset.positions); }
+			if (relative & c_relativeTexcoord) { corner.texcoord += static_cast<int>(offset.texcoords); }
+			if (relative & c_relativeNormal) { corner.normal += static_cast<int>(offset.normals); }
+			m_faceVertices[offset.faceVertices + j] = corner;
+		}
+	});
+
+	BuildMesh();
+}
+
+void OBJParser::ParseLine(const char* begin, const char* end)
+{
+	// Tolerate files with Windows line endings that were opened in binary mode.
+	if (begin != end && *(end - 1) == '\r')
+	{
+		--end;
+	}
+
+	m_lines++;
+
+	// Strip comments.
+	const char* comment = static_cast<const char*>(memchr(begin, '#', end - begin));
+	if (comment != nullptr)
+	{
+		end = comment;
+	}
+
+	const char* p = begin;
+	OBJToken keyword;
+	if (!NextToken(p, end, keyword))
+	{
+		return;
+	}
+
+	// check if the line contains a vertex, texture coordinate, vertex normal, or face
+	if (keyword.Is("f"))
+	{
+		ParseFace(p, end);
+	}
+	else if (keyword.Is("v"))
+	{
+		// A position, optionally followed by w or by a color, neither of which is used.
+		OBJToken rec[6];
+		float x, y, z, unused;
+		const size_t count = Tokenize(p, end, rec);
+		if (count != 3 && count != 4 && count != 6) { return; }
+		if (!TokenToFloat(rec[0], x) || !TokenToFloat(rec[1], y) || !TokenToFloat(rec[2], z)) { return; }
+		for (size_t i = 3; i < count; ++i)
+		{
+			if (!TokenToFloat(rec[i], unused)) { return; }
+		}
+		m_positions.push_back(XMFLOAT3(x, y, z));
+	}
+	else if (keyword.Is("vn"))
+	{
+		// If record has an incorrect number of elements for a vertex normal, skip it.
+		// Normals are kept as written; they are normalized with the finished vertices.
+		OBJToken rec[3];
+		float nx, ny, nz;
+		if (Tokenize(p, end, rec) != 3 || !TokenToFloat(rec[0], nx) || !TokenToFloat(rec[1], ny) || !TokenToFloat(rec[2], nz)) { return; }
+
+		m_normals.push_back(XMFLOAT3(nx, ny, nz));
+	}
+	else if (keyword.Is("usemtl"))
+	{
+		// The name is the rest of the line, which may hold spaces.
+		OBJToken name;
+		if (!NextToken(p, end, name)) { return; }
+		const char* nameEnd = end;
+		while (nameEnd != name.end && IsSeparator(*(nameEnd - 1))) { --nameEnd; }
+		m_currentMaterial = FindMaterial(std::string(name.begin, nameEnd));
+	}
+	else if (keyword.Is("mtllib"))
+	{
+		OBJToken library;
+		while (NextToken(p, end, library))
+		{
+			AddMaterialLibrary(std::string(library.begin, library.end));
+		}
+	}
+	else if (keyword.Is("vt"))
+	{
+		// u, with optional v and w.
+		OBJToken rec[3];
+		float tu, tv = 0.f, unused;
+		const size_t count = Tokenize(p, end, rec);
+		if (count < 1 || count > 3 || !TokenToFloat(rec[0], tu)) { return; }
+		if (count > 1 && !TokenToFloat(rec[1], tv)) { return; }
+		if (count > 2 && !TokenToFloat(rec[2], unused)) { return; }
+		m_texcoords.push_back(XMFLOAT2(tu, tv));
+	}
+}
+
+// Reads the corners of a face of any size. The whole face is skipped if any of its
+// corners is malformed.
+void OBJParser::ParseFace(const char* begin, const char* end)
+{
+	const size_t firstCorner = m_faceVertices.size();
+	const char* p = begin;
+	OBJToken token;
+	while (NextToken(p, end, token))
+	{
+		int references[3];
+		bool present[3];
+		if (!ParseFaceCorner(token, references, present))
+		{
+			m_faceVertices.resize(firstCorner);
+			m_relativeCorners.resize(m_isChunk ? firstCorner : 0);
+			return;
+		}
+
+		OBJFaceVertex corner;
+		corner.position = ResolveReference(references[0], m_positions.size());
+		corner.texcoord = present[1] ? ResolveReference(references[1], m_texcoords.size()) : -1;
+		corner.normal = present[2] ? ResolveReference(references[2], m_normals.size()) : -1;
+		m_faceVertices.push_back(corner);
+
+		// A chunk does not know how many records precede it, so relative references
+		// are marked to be rebased when the chunks are merged.
+		if (m_isChunk)
+		{
+			unsigned char relative = 0;
+			if (references[0] < 0) { relative |= c_relativePosition; }
+			if (present[1] && references[1] < 0) { relative |= c_relativeTexcoord; }
+			if (present[2] && references[2] < 0) { relative |= c_relativeNormal; }
+			m_relativeCorners.push_back(relative);
+		}
+	}
+
+	const size_t count = m_faceVertices.size() - firstCorner;
+	if (count < 3)
+	{
+		m_faceVertices.resize(firstCorner);
+		m_relativeCorners.resize(m_isChunk ? firstCorner : 0);
+		return;
+	}
+
+	m_faceSizes.push_back(static_cast<UINT>(count));
+	m_faceMaterials.push_back(m_currentMaterial);
+}
+
+UINT OBJParser::GetVertexIndex(const OBJFaceVertex& corner)
+{
+	auto inserted = m_vertexMap.insert(std::make_pair(corner, static_cast<UINT>(m_vertices.size())));
+	if (inserted.second)
+	{
+		VertexPositionColor vertex;
+		vertex.pos = m_positions[corner.position];
+		vertex.color = corner.normal >= 0 ? m_normals[corner.normal] : XMFLOAT3(0.f, 0.f, 0.f);
+		m_vertices.push_back(vertex);
+
+		// OBJ texture coordinates start at the bottom of the image, Direct3D ones at the top.
+		if (m_vertexTexcoords != nullptr && !m_texcoords.empty())
+		{
+			const XMFLOAT2 texcoord = corner.texcoord >= 0 ? m_texcoords[corner.texcoord] : XMFLOAT2(0.f, 0.f);
+			m_vertexTexcoords->push_back(XMFLOAT2(texcoord.x, 1.f - texcoord.y));
+		}
+	}
+	return inserted.first->second;
+}
+
+// Triangulates every face read so far. Corners whose references are out of range
+// lose that component; faces with an out of range position are dropped. Materials
+// are renumbered in the order the remaining faces first use them.
+void OBJParser::BuildMesh()
+{
+	// MeshLab and similar exporters write one 'vn' per 'v' and then reference only
+	// positions from the faces. Pair them up by index in that case.
+	const bool normalsPerPosition = !m_normals.empty() && m_normals.size() == m_positions.size();
+
+	m_vertexMap.reserve(m_vertexMap.size() + m_positions.size());
+
+	// Every face of n corners becomes n - 2 triangles. Most positions become a
+	// single vertex.
+	size_t triangleCount = 0;
+	for (const UINT count : m_faceSizes)
+	{
+		triangleCount += count - 2;
+	}
+	m_indices.reserve(m_indices.size() + 3 * triangleCount);
+	m_vertices.reserve(m_vertices.size() + m_positions.size());
+
+	std::vector<UINT> triangles;
+	const XMFLOAT3* cornerPositions[64];
+	std::vector<const XMFLOAT3*> cornerPositionsLarge;
+
+	// The used number of each material, with the unset material last, and the used
+	// material of each triangle when they are grouped.
+	const size_t firstIndex = m_indices.size();
+	std::vector<UINT> usedMaterials(m_materialNames.size() + 1, c_unsetMaterial);
+	std::vector<std::string> usedMaterialNames;
+	std::vector<UINT> triangleMaterials;
+	if (m_materialRanges != nullptr)
+	{
+		triangleMaterials.reserve(triangleCount);
+	}
+
+	size_t firstCorner = 0;
+	for (size_t face = 0; face < m_faceSizes.size(); ++face)
+	{
+		const UINT count = m_faceSizes[face];
+		OBJFaceVertex* corners = m_faceVertices.data() + firstCorner;
+		firstCorner += count;
+
+		bool valid = true;
+		for (UINT i = 0; i < count; ++i)
+		{
+			OBJFaceVertex& corner = corners[i];
+			if (!IsValidIndex(corner.position, m_positions.size()))
+			{
+				valid = false;
+				break;
+			}
+			if (!IsValidIndex(corner.texcoord, m_texcoords.size()))
+			{
+				corner.texcoord = -1;
+			}
+			if (!IsValidIndex(corner.normal, m_normals.size()))
+			{
+				corner.normal = normalsPerPosition ? corner.position : -1;
+			}
+		}
+		if (!valid)
+		{
+			continue;
+		}
+
+		const XMFLOAT3** positions = cornerPositions;
+		if (count > _countof(cornerPositions))
+		{
+			cornerPositionsLarge.resize(count);
+			positions = cornerPositionsLarge.data();
+		}
+		for (UINT i = 0; i < count; ++i)
+		{
+			positions[i] = &m_positions[corners[i].position];
+		}
+
+		triangles.clear();
+		TriangulatePolygon(positions, count, triangles);
+
+		// Triangles are stored in reverse order to flip the winding.
+		for (size_t t = 0; t < triangles.size(); t += 3)
+		{
+			m_indices.push_back(GetVertexIndex(corners[triangles[t + 2]]));
+			m_indices.push_back(GetVertexIndex(corners[triangles[t + 1]]));
+			m_indices.push_back(GetVertexIndex(corners[triangles[t]]));
+		}
+
+		const UINT material = m_faceMaterials[face] == c_unsetMaterial ? static_cast<UINT>(m_materialNames.size()) : m_faceMaterials[face];
+		UINT& usedMaterial = usedMaterials[material];
+		if (usedMaterial == c_unsetMaterial)
+		{
+			usedMaterial = static_cast<UINT>(usedMaterialNames.size());
+			usedMaterialNames.push_back(material < m_materialNames.size() ? m_materialNames[material] : std::string());
+		}
+		if (m_materialRanges != nullptr)
+		{
+			triangleMaterials.insert(triangleMaterials.end(), triangles.size() / 3, usedMaterial);
+		}
+	}
+	m_materialNames.swap(usedMaterialNames);
+
+	// Group the triangles by material with a stable counting sort, so that each
+	// material is drawn with one range.
+	if (m_materialRanges != nullptr && !triangleMaterials.empty())
+	{
+		std::vector<UINT> rangeStarts(m_materialNames.size() + 1, 0);
+		for (const UINT material : triangleMaterials)
+		{
+			++rangeStarts[material + 1];
+		}
+		for (size_t i = 1; i < rangeStarts.size(); ++i)
+		{
+			rangeStarts[i] += rangeStarts[i - 1];
+		}
+		for (UINT material = 0; material < m_materialNames.size(); ++material)
+		{
+			const UINT start = rangeStarts[material];
+			const UINT end = rangeStarts[material + 1];
+			m_materialRanges->push_back({ material, static_cast<uint32>(firstIndex + 3 * start), 3 * (end - start) });
+		}
+
+		if (m_materialNames.size() > 1)
+		{
+			std::vector<UINT> grouped(3 * triangleMaterials.size());
+			for (size_t t = 0; t < triangleMaterials.size(); ++t)
+			{
+				const UINT target = 3 * rangeStarts[triangleMaterials[t]]++;
+				std::copy_n(m_indices.begin() + firstIndex + 3 * t, 3, grouped.begin() + target);
+			}
+			std::copy(grouped.begin(), grouped.end(), m_indices.begin() + firstIndex);
+		}
+	}
+
+	m_faceVertices.clear();
+	m_faceSizes.clear();
+	m_faceMaterials.clear();
+	m_relativeCorners.clear();
+	m_previewedFaces = 0;
+	m_previewedCorners = 0;
+}
+
+// Previews skip what BuildMesh would take time over: faces are fanned rather than
+// triangulated, and positions are not paired with texture coordinates and normals.
+// Faces that refer to positions not read yet are left out.
+void OBJParser::EmitPreview(const OBJPreviewCallback& callback, size_t positionOffset)
+{
+	const size_t positionCount = positionOffset + m_positions.size();
+
+	m_previewIndices.clear();
+	size_t firstCorner = m_previewedCorners;
+	for (size_t face = m_previewedFaces; face < m_faceSizes.size(); ++face)
+	{
+		const size_t count = m_faceSizes[face];
+		const size_t cornerEnd = firstCorner + count;
+
+		bool valid = true;
+		for (size_t i = firstCorner; i < cornerEnd; ++i)
+		{
+			const bool relative = m_isChunk && (m_relativeCorners[i] & c_relativePosition);
+			const long long position = m_faceVertices[i].position + (relative ? static_cast<long long>(positionOffset) : 0);
+			valid = valid && position >= 0 && static_cast<size_t>(position) < positionCount;
+		}
+
+		if (valid)
+		{
+			const auto positionIndex = [&](size_t i)
+			{
+				const bool relative = m_isChunk && (m_relativeCorners[i] & c_relativePosition);
+				return static_cast<UINT>(m_faceVertices[i].position + (relative ? positionOffset : 0));
+			};
+
+			// Wound like the triangles of BuildMesh.
+			for (size_t i = firstCorner + 1; i + 1 < cornerEnd; ++i)
+			{
+				m_previewIndices.push_back(positionIndex(i + 1));
+				m_previewIndices.push_back(positionIndex(i));
+				m_previewIndices.push_back(positionIndex(firstCorner));
+			}
+		}
+		firstCorner = cornerEnd;
+	}
+
+	const bool normalsPerPosition = m_normals.size() >= m_positions.size();
+	OBJPreviewChunk chunk;
+	chunk.positions = m_positions.data() + m_previewedPositions;
+	chunk.normals = normalsPerPosition ? m_normals.data() + m_previewedPositions : nullptr;
+	chunk.positionCount = m_positions.size() - m_previewedPositions;
+	chunk.indices = m_previewIndices.data();
+	chunk.indexCount = m_previewIndices.size();
+	if (chunk.positionCount > 0 || chunk.indexCount > 0)
+	{
+		callback(chunk);
+	}
+
+	m_previewedPositions = m_positions.size();
+	m_previewedFaces = m_faceSizes.size();
+	m_previewedCorners = firstCorner;
+}
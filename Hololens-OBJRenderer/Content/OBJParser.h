@@ -0,0 +1,220 @@
+#pragma once
+
+#include "ShaderStructures.h"
+#include "MeshCache.h"
+
+#include <atomic>
+#include <functional>
+#include <istream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Hololens_OBJRenderer
+{
+	// A run of characters inside the buffer being parsed. The parser never copies
+	// source text; records and fields are handed out as spans into that buffer.
+	struct OBJToken
+	{
+		const char* begin = nullptr;
+		const char* end = nullptr;
+
+		bool	Empty() const	{ return begin == end; }
+		size_t	Length() const	{ return static_cast<size_t>(end - begin); }
+
+		// Compares the token against a null-terminated keyword such as "vn".
+		bool Is(const char* keyword) const;
+	};
+
+	// Allocation-free number scanners modelled on std::from_chars. They read as much
+	// of [first, last) as forms a number, store it in value and return a pointer one
+	// past the last character consumed. If no number could be read, first is returned
+	// and value is left untouched.
+	const char* ParseFloat(const char* first, const char* last, float& value);
+	const char* ParseInt(const char* first, const char* last, int& value);
+
+	// Receives the fraction of the input parsed so far, in the range [0, 1]. When the
+	// input is parsed in parallel this is called from worker threads.
+	typedef std::function<void(float)> OBJProgressCallback;
+
+	// The records and faces parsed since the previous preview, for drawing a mesh
+	// while it loads. Each position is one vertex, numbered in file order across all
+	// chunks, and the faces are fanned into triangles that index them. normals is
+	// nullptr unless the file gives one normal per position.
+	struct OBJPreviewChunk
+	{
+		const DirectX::XMFLOAT3*	positions;
+		const DirectX::XMFLOAT3*	normals;
+		size_t						positionCount;
+		const UINT*					indices;
+		size_t						indexCount;
+	};
+
+	// Receives preview chunks in file order. When the input is parsed in parallel
+	// this is called from worker threads, one at a time.
+	typedef std::function<void(const OBJPreviewChunk&)> OBJPreviewCallback;
+
+	// One corner of a face: indices into the position, texture coordinate and normal
+	// streams. Absent components are -1 once the face has been resolved.
+	struct OBJFaceVertex
+	{
+		int position;
+		int texcoord;
+		int normal;
+	};
+
+	// Streaming OBJ parser. Input is consumed in large blocks and tokenized in place,
+	// so no memory is allocated per line or per field; the only allocations are the
+	// block buffer and the growth of the record streams.
+	//
+	// 'v', 'vt' and 'vn' records are kept as separate streams, and face corners refer
+	// to them with v, v/vt, v//vn or v/vt/vn references, which may be negative to
+	// count back from the last record read. Once the input has been read, polygons are
+	// triangulated and every distinct combination of references becomes one vertex
+	// of a single indexed vertex buffer. 'usemtl' and 'mtllib' records are kept by
+	// name; the material libraries themselves are read by ParseMaterialLibrary.
+	class OBJParser
+	{
+	public:
+		OBJParser(std::vector<VertexPositionColor>& vertices, std::vector<UINT>& indices);
+
+		// Parses every complete line in [begin, end). A final line without a
+		// terminating newline is parsed as well.
+		void Parse(const char* begin, const char* end);
+
+		// Splits [begin, end) into chunks at line boundaries and parses the chunks
+		// concurrently. The result is identical to calling Parse on the same range.
+		void ParseParallel(const char* begin, const char* end);
+
+		// Reads the stream in blocks of BlockSize bytes and parses it.
+		void ParseStream(std::istream& in);
+
+		// Reports progress through callback as the input is consumed. totalBytes is the
+		// size of the whole input; ParseStream determines it itself when it is 0.
+		void SetProgressCallback(OBJProgressCallback callback, size_t totalBytes = 0);
+
+		// Hands out the geometry parsed so far through callback: every ProgressInterval
+		// bytes of input, every block of a stream, or every chunk in parallel. The mesh
+		// built at the end is the same with or without previews.
+		void SetPreviewCallback(OBJPreviewCallback callback)	{ m_previewCallback = callback; }
+
+		// Also builds the texture coordinates of each vertex into texcoords, if the
+		// input has any, and groups the triangles by the material 'usemtl' gives them,
+		// recording the index range of each material in materialRanges. Materials are
+		// numbered in the order they are first used; see GetMaterialNames. Without
+		// these outputs, texture coordinates only tell vertices apart.
+		void SetMaterialOutputs(std::vector<DirectX::XMFLOAT2>* texcoords, std::vector<MeshMaterialRange>* materialRanges);
+
+		long long GetLineCount() const { return m_lines; }
+
+		// The libraries named by 'mtllib', in the order they are first named, and once
+		// the mesh is built, the materials its triangles use. Faces before the first
+		// 'usemtl' use the material with the empty name.
+		const std::vector<std::string>& GetMaterialLibraries() const { return m_materialLibraries; }
+		const std::vector<std::string>& GetMaterialNames() const { return m_materialNames; }
+
+		// Parsed attribute streams. Normals are not normalized.
+		const std::vector<DirectX::XMFLOAT3>& GetPositions() const { return m_positions; }
+		const std::vector<DirectX::XMFLOAT2>& GetTexcoords() const { return m_texcoords; }
+		const std::vector<DirectX::XMFLOAT3>& GetNormals() const { return m_normals; }
+
+		static constexpr size_t BlockSize = 1 << 20;
+
+		// Chunks smaller than this are not worth handing to another thread.
+		static constexpr size_t MinChunkSize = 256 << 10;
+
+		// Progress is reported each time this many bytes have been parsed, so that the
+		// check stays out of the per-line path.
+		static constexpr size_t ProgressInterval = 1 << 20;
+
+		// A header count larger than a file of this many bytes per record could hold
+		// is not trusted.
+		static constexpr size_t MinRecordSize = 8;
+
+	private:
+		// Reserves the record streams for the records in [begin, end): from the counts
+		// of the header comment when there is one, and by counting the records
+		// otherwise. Counting lines costs a fraction of parsing them, and spares every
+		// stream its repeated growth.
+		void ReserveRecords(const char* begin, const char* end);
+
+		// Reserves the record streams from the "# Vertices: n" and "# Faces: n" lines
+		// that Meshlab writes ahead of the records. Returns false without a usable
+		// header. inputSize is the size of the whole input, of which [begin, end) is
+		// the start.
+		bool ReserveFromHeader(const char* begin, const char* end, size_t inputSize);
+
+		// Parses lines into the record streams without building the mesh.
+		void ParseLines(const char* begin, const char* end);
+		void ParseLine(const char* begin, const char* end);
+		void ParseFace(const char* begin, const char* end);
+
+		// Triangulates the faces read so far and appends them to the output.
+		void BuildMesh();
+		UINT GetVertexIndex(const OBJFaceVertex& corner);
+
+		// The number of a material or library name, which is added if it is new.
+		UINT FindMaterial(const std::string& name);
+		void AddMaterialLibrary(const std::string& name);
+
+		void ReportProgress(size_t bytes);
+
+		// Sends the positions and faces read since the last preview to callback.
+		// positionOffset is the number of positions ahead of this parser's own, which
+		// relative references of a chunk are rebased onto.
+		void EmitPreview(const OBJPreviewCallback& callback, size_t positionOffset);
+
+		std::vector<VertexPositionColor>&	m_vertices;
+		std::vector<UINT>&					m_indices;
+		std::vector<DirectX::XMFLOAT2>*		m_vertexTexcoords = nullptr;
+		std::vector<MeshMaterialRange>*		m_materialRanges = nullptr;
+
+		// Record streams.
+		std::vector<DirectX::XMFLOAT3>		m_positions;
+		std::vector<DirectX::XMFLOAT2>		m_texcoords;
+		std::vector<DirectX::XMFLOAT3>		m_normals;
+
+		// Corners of all faces waiting to be triangulated, and the corner count of
+		// each face. A chunk parser stores relative references unresolved, marked
+		// in m_relativeCorners, since it does not know how many records came before it.
+		std::vector<OBJFaceVertex>			m_faceVertices;
+		std::vector<UINT>					m_faceSizes;
+		std::vector<unsigned char>			m_relativeCorners;
+
+		// The material of each face waiting to be triangulated, numbered as in
+		// m_materialNames, and the material of the faces read next. Both are
+		// c_unsetMaterial before the first 'usemtl', as a chunk cannot know which
+		// material the chunks before it left in effect.
+		std::vector<UINT>					m_faceMaterials;
+		UINT								m_currentMaterial;
+		std::vector<std::string>			m_materialNames;
+		std::vector<std::string>			m_materialLibraries;
+
+		// Maps a position/texcoord/normal combination to its vertex in m_vertices.
+		struct FaceVertexHash
+		{
+			size_t operator()(const OBJFaceVertex& corner) const;
+		};
+		struct FaceVertexEqual
+		{
+			bool operator()(const OBJFaceVertex& a, const OBJFaceVertex& b) const;
+		};
+		std::unordered_map<OBJFaceVertex, UINT, FaceVertexHash, FaceVertexEqual> m_vertexMap;
+
+		long long							m_lines = 0;
+		bool								m_isChunk = false;
+
+		// Progress reporting. Chunk parsers share one counter with their parent.
+		OBJProgressCallback					m_progressCallback;
+		size_t								m_progressTotal = 0;
+		std::atomic<size_t>					m_bytesParsed{ 0 };
+		std::atomic<size_t>*				m_sharedBytesParsed = nullptr;
+
+		// Previews: what has been handed out so far, and the triangles of the next one.
+		OBJPreviewCallback					m_previewCallback;
+		size_t								m_previewedPositions = 0;
+		size_t								m_previewedFaces = 0;
+		size_t								m_previewedCorners = 0;
+		std::vector<UINT>					m_previewIndices;
+	};
+}
@@ -2,28 +2,150 @@
 #include "OBJRenderer.h"
 #include "Common\DirectXHelper.h"
 
+#include <algorithm>
+#include <ppl.h>
+#include <thread>
+
 using namespace Hololens_OBJRenderer;
 using namespace Concurrency;
 using namespace DirectX;
 using namespace Windows::Foundation::Numerics;
 using namespace Windows::UI::Input::Spatial;
 
-// Loads vertex and pixel shaders from files and instantiates the obj geometry.
-OBJRenderer::OBJRenderer(const std::shared_ptr<DX::DeviceResources>& deviceResources, std::string fileName) :
-	m_deviceResources(deviceResources)
+namespace
 {
-	Platform::String^ localfolder = Windows::Storage::ApplicationData::Current->LocalFolder->Path;	//for local saving for future
+	// Instances whose bounds come closer to the eyes than this, in meters, are not
+	// tested for occlusion: the near plane would clip their proxies.
+	constexpr float c_occlusionNearMargin = 0.1f;
+
+	// Triangles of the unit cube drawn as an occlusion proxy. Corner i is at
+	// (i & 1, (i >> 1) & 1, (i >> 2) & 1).
+	constexpr std::array<uint16, 36> c_boundsIndices =
+	{{
+		0, 2, 1,	1, 2, 3,	// -z
+		4, 5, 6,	5, 7, 6,	// +z
+		0, 1, 4,	1, 5, 4,	// -y
+		2, 6, 3,	3, 6, 7,	// +y
+		0, 4, 2,	2, 4, 6,	// -x
+		1, 3, 5,	3, 7, 5		// +x
+	}};
 
-	//convert folder name from wchar to ascii
-	std::wstring folderNameW(localfolder->Begin());
-	std::string folderNameA(folderNameW.begin(), folderNameW.end());
-	std::string name = folderNameA + "\\" + fileName;
+	// Fewest draw calls worth recording on a deferred context of their own.
+	constexpr size_t c_minBatchesPerCommandList = 32;
+}
 
-	std::ifstream in(name);
-	parseOBJ(in);
+// Loads the vertex and pixel shaders from files. Meshes are added with LoadAsync.
+OBJRenderer::OBJRenderer(const std::shared_ptr<DX::DeviceResources>& deviceResources, const std::shared_ptr<ResourceCache>& resourceCache) :
+	m_deviceResources(deviceResources),
+	m_resourceCache(resourceCache),
+	m_ownsResourceCache(resourceCache == nullptr)
+{
+	if (m_ownsResourceCache)
+	{
+		m_resourceCache = std::make_shared<ResourceCache>(deviceResources);
+	}
+	SetGpuNormalGenerationEnabled(true);
+	m_meshOptions.textureStreamer = m_resourceCache->GetTextureStreamer();
 	CreateDeviceDependentResources();
 }
 
+// Every mesh shares one generator, and with it one compute device.
+void OBJRenderer::SetGpuNormalGenerationEnabled(bool enabled)
+{
+	if (!enabled)
+	{
+		m_meshOptions.normalGenerator.reset();
+	}
+	else if (m_meshOptions.normalGenerator == nullptr)
+	{
+		m_meshOptions.normalGenerator = std::make_shared<NormalGenerator>();
+	}
+}
+
+// Loads the obj geometry on a worker thread, then creates its buffers.
+task<void> OBJRenderer::LoadAsync(std::string fileName, OBJLoadMode loadMode, OBJProgressCallback progressCallback, task<void> startTask)
+{
+	// Every instance of a file shares one mesh.
+	const auto existing = m_meshes.find(fileName);
+	if (existing != m_meshes.end())
+	{
+		return existing->second.readyTask;
+	}
+
+	MeshEntry entry;
+
+	// With streaming upload, the parser hands its progress to a preview that the
+	// rendering thread draws until the mesh is ready.
+	OBJPreviewCallback previewCallback;
+	if (m_streamingUpload)
+	{
+		const std::shared_ptr<MeshPreview> preview = std::make_shared<MeshPreview>();
+		entry.preview = preview;
+		previewCallback = [preview](const OBJPreviewChunk& chunk)
+		{
+			preview->Append(chunk);
+		};
+	}
+
+	// Renderers that load the same file with the same settings share its mesh. Only
+	// the first one to load it sees it being parsed.
+	const LightingConstantBuffer* bakedLighting = m_shadingMode == OBJShadingMode::BakedLighting ? &m_lighting : nullptr;
+	bool added = false;
+	entry.cached = m_resourceCache->LoadAsync(fileName, m_meshOptions, m_vertexFormat, bakedLighting, loadMode, progressCallback, previewCallback, startTask, added);
+	entry.mesh = entry.cached->mesh;
+	entry.readyTask = entry.cached->readyTask;
+	if (!added)
+	{
+		entry.preview.reset();
+	}
+
+	m_meshes[fileName] = entry;
+	return entry.readyTask;
+}
+
+size_t OBJRenderer::AddInstance(const std::string& fileName, float3 offset)
+{
+	const MeshEntry& entry = m_meshes.at(fileName);
+	MeshInstance instance;
+	instance.cached = entry.cached;
+	instance.mesh = entry.mesh;
+	instance.preview = entry.preview;
+	instance.offset = offset;
+	XMStoreFloat4x4(&instance.simulatedTransform, XMMatrixIdentity());
+	XMStoreFloat4x4(&instance.transform, XMMatrixIdentity());
+	m_instances.push_back(instance);
+	return m_instances.size() - 1;
+}
+
+void OBJRenderer::SetInstanceOffset(size_t instance, float3 offset)
+{
+	m_instances[instance].offset = offset;
+	m_instances[instance].moved = true;
+}
+
+void OBJRenderer::SetPosition(float3 pos)
+{
+	m_position = pos;
+	for (MeshInstance& instance : m_instances)
+	{
+		instance.moved = true;
+	}
+}
+
+void OBJRenderer::MarkAllInstancesDirty()
+{
+	for (MeshInstance& instance : m_instances)
+	{
+		instance.dirty = true;
+	}
+}
+
+const OBJMesh* OBJRenderer::GetMesh(const std::string& fileName) const
+{
+	const auto entry = m_meshes.find(fileName);
+	return entry != m_meshes.end() ? entry->second.mesh.get() : nullptr;
+}
+
 // This function uses a SpatialPointerPose to position the world-locked hologram
 // two meters in front of the user's heading
 void OBJRenderer::PositionHologram(SpatialPointerPose^ pointerPose)
@@ -44,49 +166,235 @@ void OBJRenderer::PositionHologram(SpatialPointerPose^ pointerPose)
 	}
 }
 
-// Called once per fram. Rotates the obj, and calculates and sets the model matrix
-// relative to the position transform indicated by hologramPositionTransform.
+// Called once per frame when the scene is simulated on the rendering thread. No
+// snapshot is needed: the instances that moved are written straight to the
+// transforms being drawn.
 void OBJRenderer::Update(const DX::StepTimer& timer)
 {
-	// Rotate the obj.
+	AdvanceScene(timer, true);
+	m_displayedPosition = m_position;
+	UploadScene();
+}
+
+// Rotates the instances, and calculates the model matrices of those that moved
+// relative to the scene position.
+void OBJRenderer::AdvanceScene(const DX::StepTimer& timer, bool applyDirectly)
+{
+	// Rotate the obj. A rotating scene moves every instance.
 	// Conver degrees to radians, then convert seconds to rotation angle.
-	const float radiansPerSecond = XMConvertToRadians(m_degreesPerSecond);
-	const double totalRotation = timer.GetTotalSeconds() * radiansPerSecond;
-	const float radians = static_cast<float>(fmod(totalRotation, XM_2PI));
-	const XMMATRIX modelRotation = XMMatrixRotationY(-radians);
-
-	// Position the obj
-	const XMMATRIX modelTranslation = XMMatrixTranslationFromVector(XMLoadFloat3(&m_position));
-
-	// Multiply to get the transform matrix.
-	// Note that this transform does not enforce a particular coordinate system. The calling
-	// class is responsible for rendering this content in a consistent manner.
-	const XMMATRIX modelTransform = XMMatrixMultiply(modelRotation, modelTranslation);
-
-	// The view and projection matrices are provided by the system; they are associated
-	// with holographic camera, and updated on a per-camera basis.
-	// Here, we provide the model transform for the smaple hologram. The model transform
-	// matrix is transposed to prepare it for the shader.
-	XMStoreFloat4x4(&m_modelConstantBufferData.model, XMMatrixTranspose(modelTransform));
-
-	// Loading is asynchronous. Resources must be created before they can be updated.
-	if (!m_loadingComplete) 
+	const bool rotating = m_degreesPerSecond != 0.f;
+	if (rotating)
+	{
+		const float radiansPerSecond = XMConvertToRadians(m_degreesPerSecond);
+		const double totalRotation = m_rotation + timer.GetElapsedSeconds() * radiansPerSecond;
+		m_rotation = static_cast<float>(fmod(totalRotation, XM_2PI));
+	}
+	const XMMATRIX modelRotation = XMMatrixRotationY(-m_rotation);
+
+	// Position each instance. Note that this transform does not enforce a particular
+	// coordinate system. The calling class is responsible for rendering this content
+	// in a consistent manner.
+	const XMVECTOR position = XMLoadFloat3(&m_position);
+	for (MeshInstance& instance : m_instances)
+	{
+		if (rotating || instance.moved)
+		{
+			const XMMATRIX modelTranslation = XMMatrixTranslationFromVector(XMVectorAdd(position, XMLoadFloat3(&instance.offset)));
+			const XMMATRIX model = XMMatrixMultiply(modelRotation, modelTranslation);
+			if (applyDirectly)
+			{
+				XMStoreFloat4x4(&instance.transform, model);
+				instance.dirty = true;
+			}
+			else
+			{
+				XMStoreFloat4x4(&instance.simulatedTransform, model);
+			}
+			instance.moved = false;
+		}
+	}
+}
+
+void OBJRenderer::Simulate(const DX::StepTimer& timer)
+{
+	AdvanceScene(timer, false);
+
+	// Publish the whole scene. The buffer written here was last read two snapshots
+	// ago, so the transforms that did not move are copied as well.
+	SceneSnapshot& snapshot = m_snapshots.GetWriteBuffer();
+	snapshot.position = m_position;
+	snapshot.transforms.resize(m_instances.size());
+	for (size_t i = 0; i < m_instances.size(); ++i)
+	{
+		snapshot.transforms[i] = m_instances[i].simulatedTransform;
+	}
+	m_snapshots.Publish();
+}
+
+void OBJRenderer::ApplySimulation()
+{
+	// Only the instances whose transform changed since the snapshot drawn last are
+	// uploaded again.
+	const SceneSnapshot* snapshot = m_snapshots.AcquireLatest();
+	if (snapshot != nullptr)
+	{
+		m_displayedPosition = snapshot->position;
+		const size_t count = (std::min)(snapshot->transforms.size(), m_instances.size());
+		for (size_t i = 0; i < count; ++i)
+		{
+			MeshInstance& instance = m_instances[i];
+			if (memcmp(&instance.transform, &snapshot->transforms[i], sizeof(XMFLOAT4X4)) != 0)
+			{
+				instance.transform = snapshot->transforms[i];
+				instance.dirty = true;
+			}
+		}
+	}
+
+	UploadScene();
+}
+
+void OBJRenderer::UploadScene()
+{
+	if (m_loadingComplete)
+	{
+		// Textures stream in the levels that the last frame asked for, and meshes
+		// are evicted ahead of drawing. A shared cache is updated by its owner.
+		if (m_ownsResourceCache)
+		{
+			m_resourceCache->Update();
+		}
+		CommitPreviews(m_deviceResources->GetD3DDevice(), m_deviceResources->GetD3DDeviceContext());
+		UploadInstanceTransforms(m_deviceResources->GetD3DDeviceContext());
+	}
+}
+
+void OBJRenderer::CommitPreviews(ID3D11Device* device, ID3D11DeviceContext* context)
+{
+	for (auto& entry : m_meshes)
+	{
+		MeshEntry& meshEntry = entry.second;
+		if (meshEntry.preview == nullptr)
+		{
+			continue;
+		}
+
+		// A ready mesh replaces its preview. Instances drawn with the preview keep it
+		// until their next upload, which is this frame.
+		const bool ready = meshEntry.mesh->IsReady();
+		if (!ready && !meshEntry.preview->Commit(device, context))
+		{
+			continue;
+		}
+
+		// The instances are uploaded again, either with the mesh or with the new
+		// transform and bounds of the grown preview.
+		for (MeshInstance& instance : m_instances)
+		{
+			if (instance.mesh == meshEntry.mesh)
+			{
+				instance.dirty = true;
+				if (ready)
+				{
+					instance.preview.reset();
+				}
+			}
+		}
+		if (ready)
+		{
+			meshEntry.preview.reset();
+		}
+	}
+}
+
+void OBJRenderer::UploadInstanceTransforms(ID3D11DeviceContext* context)
+{
+	EnsureInstanceBufferCapacity(m_instances.size());
+
+	// Meshes become ready on worker threads, so the instances to upload are picked
+	// once and the same list is used throughout. Those of meshes still loading are
+	// drawn with their preview, if there is anything to draw yet. Meshes that were
+	// evicted keep their bounds and transforms, so their instances are uploaded too.
+	m_uploadList.clear();
+	for (size_t i = 0; i < m_instances.size(); ++i)
+	{
+		MeshInstance& instance = m_instances[i];
+		if (!instance.dirty)
+		{
+			continue;
+		}
+		if (instance.cached->residency != MeshResidency::Loading)
+		{
+			instance.previewing = false;
+			m_uploadList.push_back(i);
+		}
+		else if (instance.preview != nullptr && instance.preview->IsDrawable())
+		{
+			instance.previewing = true;
+			m_uploadList.push_back(i);
+		}
+	}
+	if (m_uploadList.empty())
 	{
 		return;
 	}
 
-	// Use the D3D device context to update Direct3D device-based resources.
-	const auto context = m_deviceResources->GetD3DDeviceContext();
+	// Write the transforms of every dirty instance with a single map. The model
+	// transform matrices are transposed to prepare them for the shader; positions are
+	// dequantized first. The bounds transform maps the unit cube occlusion proxy onto
+	// the bounds of the mesh.
+	const UINT entrySize = 2 * sizeof(XMFLOAT4X4);
+	const UINT size = static_cast<UINT>(m_uploadList.size()) * entrySize;
+	EnsureFrameDataCapacity(size);
+	UINT offset = 0;
+	XMFLOAT4X4* transforms = static_cast<XMFLOAT4X4*>(m_frameData.Map(context, size, offset));
+	for (size_t i : m_uploadList)
+	{
+		const MeshInstance& instance = m_instances[i];
+		const XMMATRIX instanceTransform = XMLoadFloat4x4(&instance.transform);
+		const XMMATRIX positionTransform = instance.previewing ? instance.preview->GetPositionTransform() : instance.mesh->GetPositionTransform();
+		const MeshBounds& bounds = instance.previewing ? instance.preview->GetBounds() : instance.mesh->GetBounds();
+		const XMMATRIX modelTransform = XMMatrixMultiply(positionTransform, instanceTransform);
+		const XMMATRIX boundsTransform = XMMatrixMultiply(GetDequantizationTransform(bounds), instanceTransform);
+		XMStoreFloat4x4(transforms++, XMMatrixTranspose(modelTransform));
+		XMStoreFloat4x4(transforms++, XMMatrixTranspose(boundsTransform));
+	}
+	m_frameData.Unmap(context);
 
-	// Updated the model transform buffer for the hologram
-	context->UpdateSubresource(
-		m_modelConstantBuffer.Get(),
-		0,
-		nullptr,
-		&m_modelConstantBufferData,
-		0,
-		0
-		);
+	// Copy each run of consecutive instances with one copy, on the GPU.
+	for (size_t first = 0; first < m_uploadList.size();)
+	{
+		size_t last = first + 1;
+		while (last < m_uploadList.size() && m_uploadList[last] == m_uploadList[last - 1] + 1)
+		{
+			++last;
+		}
+
+		const CD3D11_BOX sourceBox(
+			static_cast<LONG>(offset + first * entrySize),
+			0,
+			0,
+			static_cast<LONG>(offset + last * entrySize),
+			1,
+			1
+			);
+		context->CopySubresourceRegion(
+			m_instanceBuffer.Get(),
+			0,
+			static_cast<UINT>(m_uploadList[first] * entrySize),
+			0,
+			0,
+			m_frameData.GetBuffer(),
+			0,
+			&sourceBox
+			);
+		first = last;
+	}
+
+	for (size_t i : m_uploadList)
+	{
+		m_instances[i].dirty = false;
+	}
 }
 
 // Renders one frame using the vertex and pixel shaders.
@@ -94,31 +402,288 @@ void OBJRenderer::Update(const DX::StepTimer& timer)
 // VPAndRTArrayIndexFromAnyShaderFeedingRasterizer optional feature,
 // a pass-through geometry shader is also used to set the render
 // target array index.
-void OBJRenderer::Render() 
+void OBJRenderer::Render(const DX::CameraResources* cameraResources) 
 {
+	PrepareCameras(&cameraResources, 1);
+	RenderCamera(0);
+}
+
+void OBJRenderer::PrepareCameras(const DX::CameraResources* const* cameras, size_t cameraCount)
+{
+	m_preparedCameraCount = 0;
+
 	// Loading is asynchronous. Resources must be created before drawing can occur.
 	if (!m_loadingComplete) 
 	{
 		return;
 	}
 
+	// Another stereo mode needs shaders of its own. Drawing resumes once they are
+	// loaded.
+	const OBJStereoMode stereoMode = IsStereoModeSupported(*m_deviceResources, m_requestedStereoMode) ? m_requestedStereoMode : OBJStereoMode::GeometryShader;
+	if (stereoMode != m_stereoMode)
+	{
+		m_loadingComplete = false;
+		ReleaseShaders();
+		CreateShadersAsync();
+		return;
+	}
+
+	if (m_cameraDraws.size() < cameraCount)
+	{
+		m_cameraDraws.resize(cameraCount);
+	}
+	size_t drawIndexCount = 0;
+	for (size_t c = 0; c < cameraCount; ++c)
+	{
+		CameraDraws& draws = m_cameraDraws[c];
+		draws.cameraResources = cameras[c];
+		draws.batches.clear();
+		draws.commandListCount = 0;
+		CullInstances(draws);
+		drawIndexCount += m_occlusionCulling ? 2 * draws.drawList.size() : draws.drawList.size();
+	}
+	m_preparedCameraCount = cameraCount;
+
+	// Write the instance buffer entry of each draw, in draw order, for every camera
+	// with a single map: a ring that wraps between two cameras would discard the
+	// entries of the first before its command lists are executed. The transforms
+	// themselves are already on the GPU. With occlusion culling, the entries of the
+	// bounding boxes follow those of each camera.
+	if (drawIndexCount == 0)
+	{
+		return;
+	}
 	const auto context = m_deviceResources->GetD3DDeviceContext();
+	const UINT drawIndexSize = static_cast<UINT>(drawIndexCount * sizeof(uint32));
+	EnsureFrameDataCapacity(drawIndexSize);
+	UINT drawIndexOffset = 0;
+	uint32* const firstDrawIndex = static_cast<uint32*>(m_frameData.Map(context, drawIndexSize, drawIndexOffset));
+	uint32* drawIndices = firstDrawIndex;
+	for (size_t c = 0; c < cameraCount; ++c)
+	{
+		CameraDraws& draws = m_cameraDraws[c];
+		draws.drawIndexOffset = drawIndexOffset + static_cast<UINT>((drawIndices - firstDrawIndex) * sizeof(uint32));
+		for (const InstanceDraw& draw : draws.drawList)
+		{
+			*drawIndices++ = static_cast<uint32>(2 * draw.instance);
+		}
+		if (m_occlusionCulling)
+		{
+			for (const InstanceDraw& draw : draws.drawList)
+			{
+				*drawIndices++ = static_cast<uint32>(2 * draw.instance + 1);
+			}
+		}
+	}
+	m_frameData.Unmap(context);
 
-	// Each vertex is one instance of the VertexPositionNormalColor struct.
-	const UINT stride = sizeof(VertexPositionColor);
-	const UINT offset = 0;
-	context->IASetVertexBuffers(
-		0,
-		1,
-		m_vertexBuffer.GetAddressOf(),
-		&stride,
-		&offset
-		);
-	context->IASetIndexBuffer(
-		m_indexBuffer.Get(),
-		DXGI_FORMAT_R32_UINT, // Each index is one 32-bit unsigned integer (short).
-		0
-		);
+	// Each camera gets predicates of its own, as all of them may be recorded before
+	// the first is executed. Recording only pays off once each command list gets a
+	// fair share of the draw calls.
+	size_t predicateCount = 0;
+	size_t commandListCount = 0;
+	for (size_t c = 0; c < cameraCount; ++c)
+	{
+		CameraDraws& draws = m_cameraDraws[c];
+		BuildBatches(draws, predicateCount);
+		const size_t cameraCommandLists = m_deferredRecording ?
+			(std::min)(static_cast<size_t>(std::thread::hardware_concurrency()), draws.batches.size() / c_minBatchesPerCommandList) :
+			0;
+		draws.firstCommandList = commandListCount;
+		draws.commandListCount = cameraCommandLists > 1 ? cameraCommandLists : 0;
+		commandListCount += draws.commandListCount;
+	}
+	if (commandListCount > 0)
+	{
+		RecordCommandLists(commandListCount);
+	}
+}
+
+void OBJRenderer::CullInstances(CameraDraws& draws)
+{
+	// Skip the instances that neither eye can see, pick the level of detail of the
+	// others from their distance to the camera, then group the instances that can
+	// share a draw call.
+	const DX::CameraResources* cameraResources = draws.cameraResources;
+	const XMFLOAT3 cameraPosition = cameraResources->GetViewPosition();
+	const XMVECTOR viewPosition = XMLoadFloat3(&cameraPosition);
+	std::vector<InstanceDraw>& drawList = draws.drawList;
+	drawList.clear();
+	for (size_t i = 0; i < m_instances.size(); ++i)
+	{
+		const MeshInstance& instance = m_instances[i];
+		const MeshPreview* preview = instance.previewing ? instance.preview.get() : nullptr;
+		if (instance.dirty)
+		{
+			continue;
+		}
+
+		// The bounding sphere is a cheap first test; the box is tighter.
+		const XMMATRIX instanceTransform = XMLoadFloat4x4(&instance.transform);
+		BoundingSphere sphere = preview != nullptr ? preview->GetBoundingSphere() : instance.mesh->GetBoundingSphere();
+		sphere.Transform(sphere, instanceTransform);
+		if (!cameraResources->IsInView(sphere))
+		{
+			continue;
+		}
+		BoundingOrientedBox box;
+		BoundingOrientedBox::CreateFromBoundingBox(box, preview != nullptr ? preview->GetBoundingBox() : instance.mesh->GetBoundingBox());
+		box.Transform(box, instanceTransform);
+		if (!cameraResources->IsInView(box))
+		{
+			continue;
+		}
+
+		// Evicted meshes in view are created again, and drawn once they are ready.
+		if (preview == nullptr)
+		{
+			m_resourceCache->MarkUsed(instance.cached);
+			if (!instance.mesh->IsReady())
+			{
+				continue;
+			}
+		}
+
+		// Instances the viewer is at or in are always drawn.
+		BoundingOrientedBox nearBox = box;
+		const XMVECTOR nearMargin = XMVectorReplicate(c_occlusionNearMargin + cameraResources->GetViewRadius());
+		XMStoreFloat3(&nearBox.Extents, XMVectorAdd(XMLoadFloat3(&box.Extents), nearMargin));
+		const bool nearViewer = nearBox.Contains(viewPosition) != DISJOINT;
+
+		const XMVECTOR instancePosition = instanceTransform.r[3];
+		const float distance = XMVectorGetX(XMVector3Length(XMVectorSubtract(instancePosition, viewPosition)));
+		const size_t lod = preview != nullptr ? 0 : instance.mesh->SelectLod(distance);
+
+		// The textures need about as many texels across as the instance covers
+		// pixels on screen.
+		if (preview == nullptr)
+		{
+			const float angle = 2.f * sphere.Radius / (std::max)(distance, sphere.Radius);
+			instance.mesh->RequestTextureDetail(angle * cameraResources->GetPixelsPerRadian());
+		}
+		const bool textured = preview == nullptr && instance.mesh->IsTextured();
+		drawList.push_back({ instance.mesh.get(), preview, lod, i, nearViewer, textured });
+	}
+
+	// Textured meshes are drawn last, so that the pipeline only switches once.
+	std::sort(drawList.begin(), drawList.end(), [](const InstanceDraw& a, const InstanceDraw& b)
+	{
+		return a.textured != b.textured ? b.textured :
+			a.mesh != b.mesh ? a.mesh < b.mesh : a.preview != b.preview ? a.preview < b.preview : a.lod < b.lod;
+	});
+}
+
+void OBJRenderer::BuildBatches(CameraDraws& draws, size_t& predicateCount)
+{
+	// Split the runs of instances of the same mesh, preview and level of detail into
+	// draw calls. Clustered meshes are culled per instance, so their instances are
+	// drawn one at a time.
+	const std::vector<InstanceDraw>& drawList = draws.drawList;
+	draws.batches.clear();
+	for (size_t first = 0; first < drawList.size();)
+	{
+		const InstanceDraw& draw = drawList[first];
+		size_t last = first + 1;
+		while (last < drawList.size() && drawList[last].mesh == draw.mesh && drawList[last].preview == draw.preview && drawList[last].lod == draw.lod)
+		{
+			++last;
+		}
+
+		const bool clustered = draw.preview == nullptr && draw.mesh->HasClusters(draw.lod);
+		const size_t step = clustered ? 1 : last - first;
+		for (size_t i = first; i < last; i += step)
+		{
+			// With occlusion culling, the draw only happens if some part of the
+			// bounding boxes passes the depth test. The GPU decides; nothing is read back.
+			const bool occlusionTest = m_occlusionCulling && std::none_of(
+				drawList.begin() + i,
+				drawList.begin() + i + step,
+				[](const InstanceDraw& d) { return d.nearViewer; });
+			draws.batches.push_back({ i, step, clustered, occlusionTest ? GetOcclusionPredicate(predicateCount++) : nullptr });
+		}
+		first = last;
+	}
+}
+
+void OBJRenderer::RenderCamera(size_t camera)
+{
+	if (camera >= m_preparedCameraCount || m_cameraDraws[camera].batches.empty())
+	{
+		return;
+	}
+
+	const auto context = m_deviceResources->GetD3DDeviceContext();
+	const CameraDraws& draws = m_cameraDraws[camera];
+	if (draws.commandListCount == 0)
+	{
+		SetPipelineState(context);
+		DrawStereo(context, draws, 0, draws.batches.size());
+		return;
+	}
+
+	// Play the command lists back in draw order. Executing a command list leaves the
+	// immediate context in the default state; the camera is set up again afterwards
+	// for whatever the caller draws next.
+	for (size_t k = draws.firstCommandList; k < draws.firstCommandList + draws.commandListCount; ++k)
+	{
+		context->ExecuteCommandList(m_commandLists[k].Get(), FALSE);
+		m_commandLists[k].Reset();
+	}
+	ID3D11RenderTargetView* const targets[1] = { draws.cameraResources->GetBackBufferRenderTargetView() };
+	context->OMSetRenderTargets(1, targets, draws.cameraResources->GetDepthStencilView());
+	draws.cameraResources->BindViewProjectionBuffer(context);
+}
+
+void OBJRenderer::RecordCommandLists(size_t commandListCount)
+{
+	while (m_deferredContexts.size() < commandListCount)
+	{
+		Microsoft::WRL::ComPtr<ID3D11DeviceContext> deferredContext;
+		DX::ThrowIfFailed(
+			m_deviceResources->GetD3DDevice()->CreateDeferredContext(
+				0,
+				&deferredContext
+				)
+			);
+		m_deferredContexts.push_back(deferredContext);
+	}
+	m_commandLists.resize(commandListCount);
+
+	// The command lists of every camera are recorded together on the thread pool;
+	// each one holds a contiguous share of the draw calls of its camera. Deferred
+	// contexts start from the default state, so each one also sets up the camera
+	// and the pipeline. Everything they read was written on the immediate context
+	// before recording started, and is not rewritten until the command lists have
+	// been executed.
+	parallel_for(static_cast<size_t>(0), commandListCount, [&](size_t k)
+	{
+		size_t camera = 0;
+		while (k >= m_cameraDraws[camera].firstCommandList + m_cameraDraws[camera].commandListCount)
+		{
+			++camera;
+		}
+		const CameraDraws& draws = m_cameraDraws[camera];
+		const size_t share = k - draws.firstCommandList;
+
+		ID3D11DeviceContext* deferredContext = m_deferredContexts[k].Get();
+		ID3D11RenderTargetView* const targets[1] = { draws.cameraResources->GetBackBufferRenderTargetView() };
+		deferredContext->OMSetRenderTargets(1, targets, draws.cameraResources->GetDepthStencilView());
+		draws.cameraResources->BindViewProjectionBuffer(deferredContext);
+		SetPipelineState(deferredContext);
+		DrawStereo(
+			deferredContext,
+			draws,
+			draws.batches.size() * share / draws.commandListCount,
+			draws.batches.size() * (share + 1) / draws.commandListCount);
+		DX::ThrowIfFailed(
+			deferredContext->FinishCommandList(FALSE, &m_commandLists[k])
+			);
+	});
+}
+
+void OBJRenderer::SetPipelineState(ID3D11DeviceContext* context) const
+{
 	context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 	context->IASetInputLayout(m_inputLayout.Get());
 
@@ -128,25 +693,28 @@ void OBJRenderer::Render()
 		nullptr,
 		0
 		);
-	// Apply the model constant buffer to the vertex shader.
-	context->VSSetConstantBuffers(
+	// Apply the model transforms to the vertex shader.
+	context->VSSetShaderResources(
 		0,
 		1,
-		m_modelConstantBuffer.GetAddressOf()
+		m_instanceBufferView.GetAddressOf()
+		);
+	context->VSSetConstantBuffers(
+		2,
+		1,
+		m_lightingConstantBuffer.GetAddressOf()
 		);
 
-	if (!m_usingVprtShaders)
-	{
-		// On devices that do not support the D3D11_FEATURE_D3D11_OPTIONS3::
-		// VPAndRTArrayIndexFromAnyShaderFeedingRasterizer optional feature,
-		// a pass-through geometry shader is used ton set the render target
-		// array index.
-		context->GSSetShader(
-			m_geometryShader.Get(),
-			nullptr,
-			0
-			);
-	}
+	// On devices that do not support the D3D11_FEATURE_D3D11_OPTIONS3::
+	// VPAndRTArrayIndexFromAnyShaderFeedingRasterizer optional feature,
+	// a pass-through geometry shader can be used to set the render target
+	// array index. The other modes clear whatever geometry shader other
+	// content left bound.
+	context->GSSetShader(
+		m_stereoMode == OBJStereoMode::GeometryShader ? m_geometryShader.Get() : nullptr,
+		nullptr,
+		0
+		);
 
 	// Attach the pixel shader.
 	context->PSSetShader(
@@ -154,41 +722,362 @@ void OBJRenderer::Render()
 		nullptr,
 		0
 		);
+}
+
+void OBJRenderer::SetTexturedPipeline(ID3D11DeviceContext* context, bool textured) const
+{
+	context->IASetInputLayout(textured ? m_texturedInputLayout.Get() : m_inputLayout.Get());
+	context->VSSetShader(textured ? m_texturedVertexShader.Get() : m_vertexShader.Get(), nullptr, 0);
+	if (m_stereoMode == OBJStereoMode::GeometryShader)
+	{
+		context->GSSetShader(textured ? m_texturedGeometryShader.Get() : m_geometryShader.Get(), nullptr, 0);
+	}
+	context->PSSetShader(textured ? m_texturedPixelShader.Get() : m_pixelShader.Get(), nullptr, 0);
+	if (textured)
+	{
+		context->PSSetSamplers(0, 1, m_textureSampler.GetAddressOf());
+	}
+}
+
+void OBJRenderer::DrawBatches(ID3D11DeviceContext* context, const CameraDraws& draws, size_t firstBatch, size_t lastBatch) const
+{
+	// The per-instance stream of transform indices is bound at the start of each batch.
+	// Textured batches come last; the texture bound to the pixel shader is tracked,
+	// so that materials that share it do not bind it again.
+	const OBJMesh* attachedMesh = nullptr;
+	bool texturedPipeline = false;
+	ID3D11ShaderResourceView* boundTexture = nullptr;
+	for (size_t b = firstBatch; b < lastBatch; ++b)
+	{
+		const DrawBatch& batch = draws.batches[b];
+		const InstanceDraw& draw = draws.drawList[batch.first];
+		if (batch.predicate != nullptr)
+		{
+			// The proxies are drawn with the untextured input layout.
+			if (texturedPipeline)
+			{
+				SetTexturedPipeline(context, false);
+				texturedPipeline = false;
+			}
+			DrawOcclusionProxies(context, draws, batch.predicate, draws.drawList.size() + batch.first, batch.count);
+			context->SetPredication(batch.predicate, FALSE);
+			attachedMesh = nullptr;
+		}
+		if (draw.textured != texturedPipeline)
+		{
+			SetTexturedPipeline(context, draw.textured);
+			texturedPipeline = draw.textured;
+		}
+
+		SetFirstInstance(context, draws, batch.first);
+		if (draw.preview != nullptr)
+		{
+			// Previews are in the full precision layout, whatever the meshes use.
+			if (m_previewInputLayout != nullptr)
+			{
+				context->IASetInputLayout(m_previewInputLayout.Get());
+			}
+			draw.preview->Attach(context);
+			attachedMesh = nullptr;
+		}
+		else if (draw.mesh != attachedMesh)
+		{
+			draw.mesh->Attach(context);
+			attachedMesh = draw.mesh;
+		}
+
+		// Each instance is drawn once per eye, or once for the eye being drawn.
+		const UINT copies = GetCopiesPerInstance();
+		if (draw.preview != nullptr)
+		{
+			draw.preview->Draw(context, static_cast<UINT>(copies * batch.count));
+			if (m_previewInputLayout != nullptr)
+			{
+				context->IASetInputLayout(m_inputLayout.Get());
+			}
+		}
+		else if (batch.clustered)
+		{
+			draw.mesh->DrawVisibleClusters(context, draw.lod, XMLoadFloat4x4(&m_instances[draw.instance].transform), *draws.cameraResources, copies, draw.textured ? &boundTexture : nullptr);
+		}
+		else
+		{
+			draw.mesh->DrawLod(context, draw.lod, static_cast<UINT>(copies * batch.count), draw.textured ? &boundTexture : nullptr);
+		}
+
+		if (batch.predicate != nullptr)
+		{
+			context->SetPredication(nullptr, FALSE);
+		}
+	}
+}
+
+void OBJRenderer::DrawStereo(ID3D11DeviceContext* context, const CameraDraws& draws, size_t firstBatch, size_t lastBatch) const
+{
+	if (m_stereoMode != OBJStereoMode::DrawPerEye)
+	{
+		DrawBatches(context, draws, firstBatch, lastBatch);
+		return;
+	}
+	const DX::CameraResources* cameraResources = draws.cameraResources;
+
+	// Each eye draws into its own slice, which SV_RenderTargetArrayIndex does not
+	// have to pick. The predicates are issued again for each eye, so each eye is
+	// culled with its own occlusion results.
+	const size_t eyeCount = cameraResources->IsRenderingStereoscopic() ? 2 : 1;
+	for (size_t eye = 0; eye < eyeCount; ++eye)
+	{
+		ID3D11RenderTargetView* const eyeTargets[1] = { cameraResources->GetEyeRenderTargetView(eye) };
+		context->OMSetRenderTargets(1, eyeTargets, cameraResources->GetEyeDepthStencilView(eye));
+		context->VSSetConstantBuffers(3, 1, m_eyeConstantBuffers[eye].GetAddressOf());
+
+		// DrawBatches starts from the untextured pipeline.
+		if (eye > 0)
+		{
+			SetTexturedPipeline(context, false);
+		}
+		DrawBatches(context, draws, firstBatch, lastBatch);
+	}
+
+	ID3D11RenderTargetView* const targets[1] = { cameraResources->GetBackBufferRenderTargetView() };
+	context->OMSetRenderTargets(1, targets, cameraResources->GetDepthStencilView());
+}
+
+void OBJRenderer::SetFirstInstance(ID3D11DeviceContext* context, const CameraDraws& draws, size_t first) const
+{
+	// Each entry steps once per pair of instances, so both eyes share it.
+	const UINT stride = sizeof(uint32);
+	const UINT offset = draws.drawIndexOffset + static_cast<UINT>(first * sizeof(uint32));
+	context->IASetVertexBuffers(
+		1,
+		1,
+		m_frameData.GetAddressOf(),
+		&stride,
+		&offset
+		);
+}
+
+void OBJRenderer::DrawOcclusionProxies(ID3D11DeviceContext* context, const CameraDraws& draws, ID3D11Predicate* predicate, size_t firstInstance, size_t instanceCount) const
+{
+	// Depth-tested bounding boxes, with no depth or color writes: no pixel shader is
+	// bound, and the predicate counts the samples that pass.
+	context->Begin(predicate);
+
+	SetFirstInstance(context, draws, firstInstance);
+	const UINT stride = m_vertexFormat == OBJVertexFormat::Compact ? sizeof(VertexPositionColorCompact) : sizeof(VertexPositionColor);
+	const UINT offset = 0;
+	context->IASetVertexBuffers(
+		0,
+		1,
+		m_boundsVertexBuffer.GetAddressOf(),
+		&stride,
+		&offset
+		);
+	context->IASetIndexBuffer(
+		m_boundsIndexBuffer.Get(),
+		DXGI_FORMAT_R16_UINT,
+		0
+		);
+	context->PSSetShader(nullptr, nullptr, 0);
+	context->OMSetDepthStencilState(m_occlusionDepthStencilState.Get(), 0);
+	context->RSSetState(m_occlusionRasterizerState.Get());
 
-	// Draw the objects.
+	// Each box is drawn once per eye, or once for the eye being drawn.
 	context->DrawIndexedInstanced(
-		m_indexCount,	// Index count per instance
-		2,				// Instance count.
-		0,				// Start index location
-		0,				// Base vertex location
-		0				// Start instance location.
+		static_cast<UINT>(c_boundsIndices.size()),
+		static_cast<UINT>(GetCopiesPerInstance() * instanceCount),
+		0,
+		0,
+		0
+		);
+
+	context->End(predicate);
+
+	context->PSSetShader(
+		m_pixelShader.Get(),
+		nullptr,
+		0
 		);
+	context->OMSetDepthStencilState(nullptr, 0);
+	context->RSSetState(nullptr);
 }
 
-void OBJRenderer::CreateDeviceDependentResources()
+ID3D11Predicate* OBJRenderer::GetOcclusionPredicate(size_t index)
 {
-	m_usingVprtShaders = m_deviceResources->GetDeviceSupportsVprt();
+	// Predicates are reused from frame to frame; the GPU resolves each one before
+	// it starts the next query on it.
+	while (m_occlusionPredicates.size() <= index)
+	{
+		const CD3D11_QUERY_DESC predicateDesc(D3D11_QUERY_OCCLUSION_PREDICATE);
+		Microsoft::WRL::ComPtr<ID3D11Predicate> predicate;
+		DX::ThrowIfFailed(
+			m_deviceResources->GetD3DDevice()->CreatePredicate(
+				&predicateDesc,
+				&predicate
+				)
+			);
+		m_occlusionPredicates.push_back(predicate);
+	}
+	return m_occlusionPredicates[index].Get();
+}
 
+void OBJRenderer::EnsureInstanceBufferCapacity(size_t instanceCount)
+{
+	if (instanceCount <= m_instanceBufferCapacity)
+	{
+		return;
+	}
+
+	// Grow geometrically so that adding instances one by one does not re-create
+	// the buffer every frame. The new buffer holds nothing yet.
+	size_t capacity = (std::max)(m_instanceBufferCapacity, static_cast<size_t>(16));
+	while (capacity < instanceCount)
+	{
+		capacity *= 2;
+	}
+
+	m_instanceBufferView.Reset();
+	m_instanceBuffer.Reset();
+
+	MarkAllInstancesDirty();
+
+	// Two transforms per instance. The buffer is only written by copies on the GPU.
+	const CD3D11_BUFFER_DESC instanceBufferDesc(
+		static_cast<UINT>(2 * capacity * sizeof(XMFLOAT4X4)),
+		D3D11_BIND_SHADER_RESOURCE,
+		D3D11_USAGE_DEFAULT,
+		0,
+		D3D11_RESOURCE_MISC_BUFFER_STRUCTURED,
+		sizeof(XMFLOAT4X4)
+		);
+	DX::ThrowIfFailed(
+		m_deviceResources->GetD3DDevice()->CreateBuffer(
+			&instanceBufferDesc,
+			nullptr,
+			&m_instanceBuffer
+			)
+		);
+
+	const CD3D11_SHADER_RESOURCE_VIEW_DESC instanceBufferViewDesc(
+		m_instanceBuffer.Get(),
+		DXGI_FORMAT_UNKNOWN,
+		0,
+		static_cast<UINT>(2 * capacity)
+		);
+	DX::ThrowIfFailed(
+		m_deviceResources->GetD3DDevice()->CreateShaderResourceView(
+			m_instanceBuffer.Get(),
+			&instanceBufferViewDesc,
+			&m_instanceBufferView
+			)
+		);
+
+	m_instanceBufferCapacity = capacity;
+}
+
+void OBJRenderer::EnsureFrameDataCapacity(UINT size)
+{
+	// The ring only has to discard, and so rename the buffer, once it wraps around.
+	// Room for a few frames worth of allocations keeps that rare.
+	constexpr UINT allocationsPerRing = 8;
+	if (size * allocationsPerRing <= m_frameData.GetCapacity())
+	{
+		return;
+	}
+
+	UINT capacity = (std::max)(m_frameData.GetCapacity(), 4096u);
+	while (capacity < size * allocationsPerRing)
+	{
+		capacity *= 2;
+	}
+	m_frameData.Create(m_deviceResources->GetD3DDevice(), capacity, D3D11_BIND_VERTEX_BUFFER);
+}
+
+bool OBJRenderer::IsStereoModeSupported(const DX::DeviceResources& deviceResources, OBJStereoMode mode)
+{
+	return mode != OBJStereoMode::Vprt || deviceResources.GetDeviceSupportsVprt();
+}
+
+task<void> OBJRenderer::CreateDeviceDependentResources()
+{
+	// The lighting for the per-vertex lit shaders. Unused by the others.
+	const CD3D11_BUFFER_DESC lightingBufferDesc(sizeof(LightingConstantBuffer), D3D11_BIND_CONSTANT_BUFFER);
+	D3D11_SUBRESOURCE_DATA lightingBufferData = { &m_lighting, 0, 0 };
+	DX::ThrowIfFailed(
+		m_deviceResources->GetD3DDevice()->CreateBuffer(
+			&lightingBufferDesc,
+			&lightingBufferData,
+			&m_lightingConstantBuffer
+			)
+		);
+
+	// The eye of each pass, when each eye is drawn on its own.
+	for (size_t eye = 0; eye < m_eyeConstantBuffers.size(); ++eye)
+	{
+		const EyeConstantBuffer eyeData = { static_cast<uint32>(eye) };
+		const CD3D11_BUFFER_DESC eyeBufferDesc(sizeof(EyeConstantBuffer), D3D11_BIND_CONSTANT_BUFFER, D3D11_USAGE_IMMUTABLE);
+		D3D11_SUBRESOURCE_DATA eyeBufferData = { &eyeData, 0, 0 };
+		DX::ThrowIfFailed(
+			m_deviceResources->GetD3DDevice()->CreateBuffer(
+				&eyeBufferDesc,
+				&eyeBufferData,
+				&m_eyeConstantBuffers[eye]
+				)
+			);
+	}
+
+	// Meshes that were loaded before the device was lost were evicted with it. The
+	// resource cache uploads their retained buffers again, or rebuilds them from
+	// their mesh cache or source file. The shaders were read into memory the first
+	// time, so the new device has them right away.
+	if (m_ownsResourceCache)
+	{
+		m_resourceCache->CreateDeviceDependentResources();
+	}
+
+	return CreateShadersAsync();
+}
+
+task<void> OBJRenderer::CreateShadersAsync()
+{
 	// On devices that do support the D3D11_FEATURE_D3D11_OPTIONS3::
 	// VPAndRTArrayIndexFromAnyShaderFeedingRasterizer optional feature
 	// we can avoid using a pass-throguh geometry shader to set the render
 	// target array index, thus avoiding any overhead that would be
-	// incurred by setting the geometry shader stage.
-	std::wstring vertexShaderFileName = m_usingVprtShaders ? L"ms-appx:///VprtVertexShader.cso" : L"ms-appx:///VertexShader.cso";
+	// incurred by setting the geometry shader stage. Drawing each eye on its
+	// own avoids it on any device.
+	m_stereoMode = IsStereoModeSupported(*m_deviceResources, m_requestedStereoMode) ? m_requestedStereoMode : OBJStereoMode::GeometryShader;
+	const bool usingGeometryShader = m_stereoMode == OBJStereoMode::GeometryShader;
+
+	// Each shading mode and stereo mode has a permutation of the vertex shader, and
+	// meshes with materials have textured permutations of each. The pixel shader
+	// only passes the color through in every mode.
+	const wchar_t* const lit = m_shadingMode == OBJShadingMode::VertexLighting ? L"Lit" : L"";
+	const wchar_t* const stereo = m_stereoMode == OBJStereoMode::Vprt ? L"Vprt" : m_stereoMode == OBJStereoMode::DrawPerEye ? L"PerEye" : L"";
+	const std::wstring vertexShaderFileName = std::wstring(L"ms-appx:///Instanced") + lit + stereo + L"VertexShader.cso";
+	const std::wstring texturedVertexShaderFileName = std::wstring(L"ms-appx:///InstancedTextured") + lit + stereo + L"VertexShader.cso";
 
 	// Load shaders asynchronously.
-	task<std::vector<byte>> loadVSTask = DX::ReadDataAsync(vertexShaderFileName);
-	task<std::vector<byte>> loadPSTask = DX::ReadDataAsync(L"ms-appx:///PixelShader.cso");
+	task<std::vector<byte>> loadVSTask = DX::ReadCachedDataAsync(vertexShaderFileName);
+	task<std::vector<byte>> loadPSTask = DX::ReadCachedDataAsync(L"ms-appx:///PixelShader.cso");
+	task<std::vector<byte>> loadTexturedVSTask = DX::ReadCachedDataAsync(texturedVertexShaderFileName);
+	task<std::vector<byte>> loadTexturedPSTask = DX::ReadCachedDataAsync(L"ms-appx:///TexturedPixelShader.cso");
 
 	task<std::vector<byte>> loadGSTask;
-	if (!m_usingVprtShaders)
+	task<std::vector<byte>> loadTexturedGSTask;
+	if (usingGeometryShader)
 	{
 		// Load the pass-through geometry shader.
-		loadGSTask = DX::ReadDataAsync(L"ms-appx:///GeometryShader.cso");
+		loadGSTask = DX::ReadCachedDataAsync(L"ms-appx:///GeometryShader.cso");
+		loadTexturedGSTask = DX::ReadCachedDataAsync(L"ms-appx:///TexturedGeometryShader.cso");
 	}
 
 	// After the vertex shade file is loaded, create the shader and input layout.
-	task<void> createVSTask = loadVSTask.then([this](const std::vector<byte>& fileData)
+	// When each eye is drawn on its own, the instance buffer entries step once per
+	// instance.
+	const OBJVertexFormat vertexFormat = m_vertexFormat;
+	const UINT instanceStepRate = GetCopiesPerInstance();
+	task<void> createVSTask = loadVSTask.then([this, vertexFormat, instanceStepRate](const std::vector<byte>& fileData)
 	{	
 		DX::ThrowIfFailed(
 			m_deviceResources->GetD3DDevice()->CreateVertexShader(
@@ -199,24 +1088,53 @@ void OBJRenderer::CreateDeviceDependentResources()
 				)
 			);
 
-		constexpr std::array<D3D11_INPUT_ELEMENT_DESC, 2> vertexDesc = 
+		// The instance buffer entry of each pair of instances, one per eye, comes
+		// from a second vertex stream.
+		const std::array<D3D11_INPUT_ELEMENT_DESC, 3> vertexDesc = 
 		{{
 			{"POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0},
-			{"COLOR", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0}
+			{"COLOR", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0},
+			{"INSTANCE", 0, DXGI_FORMAT_R32_UINT, 1, 0, D3D11_INPUT_PER_INSTANCE_DATA, instanceStepRate}
+		} };
+
+		// The compact layout is expanded to floats by the input assembler, so the same
+		// shader reads either layout.
+		const std::array<D3D11_INPUT_ELEMENT_DESC, 3> compactVertexDesc =
+		{{
+			{"POSITION", 0, DXGI_FORMAT_R16G16B16A16_UNORM, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0},
+			{"COLOR", 0, DXGI_FORMAT_R8G8B8A8_SNORM, 0, 8, D3D11_INPUT_PER_VERTEX_DATA, 0},
+			{"INSTANCE", 0, DXGI_FORMAT_R32_UINT, 1, 0, D3D11_INPUT_PER_INSTANCE_DATA, instanceStepRate}
 		} };
 
+		const auto& layout = vertexFormat == OBJVertexFormat::Compact ? compactVertexDesc : vertexDesc;
 		DX::ThrowIfFailed(
 			m_deviceResources->GetD3DDevice()->CreateInputLayout(
-				vertexDesc.data(),
-				vertexDesc.size(),
+				layout.data(),
+				layout.size(),
 				fileData.data(),
 				fileData.size(),
 				&m_inputLayout
 				)
 			);
+
+		// Previews are always in the full precision layout.
+		if (vertexFormat == OBJVertexFormat::Compact)
+		{
+			DX::ThrowIfFailed(
+				m_deviceResources->GetD3DDevice()->CreateInputLayout(
+					vertexDesc.data(),
+					vertexDesc.size(),
+					fileData.data(),
+					fileData.size(),
+					&m_previewInputLayout
+					)
+				);
+		}
+
+		CreateOcclusionResources(vertexFormat);
 	});
 
-	// After the pixel shader file is loaded, create the shader and constant buffer.
+	// After the pixel shader file is loaded, create the shader.
 	task<void> createPSTask = loadPSTask.then([this](const std::vector<byte>& fileData) {
 		DX::ThrowIfFailed(
 			m_deviceResources->GetD3DDevice()->CreatePixelShader(
@@ -226,19 +1144,10 @@ void OBJRenderer::CreateDeviceDependentResources()
 				&m_pixelShader
 				)
 			);
-
-		const CD3D11_BUFFER_DESC constantBufferDesc(sizeof(ModelConstantBuffer), D3D11_BIND_CONSTANT_BUFFER);
-		DX::ThrowIfFailed(
-			m_deviceResources->GetD3DDevice()->CreateBuffer(
-				&constantBufferDesc,
-				nullptr,
-				&m_modelConstantBuffer
-				)
-			);
 	});
 
 	task<void> createGSTask;
-	if (!m_usingVprtShaders) 
+	if (usingGeometryShader) 
 	{
 		// After the pass-through geometry shader file is loaded, create the shader
 		createGSTask = loadGSTask.then([this](const std::vector<byte>& fileData)
@@ -254,187 +1163,217 @@ void OBJRenderer::CreateDeviceDependentResources()
 		});
 	}
 
-	// Once all the shaders are loaded, create the mesh.
-	task<void> shaderTaskGroup = m_usingVprtShaders ? (createPSTask && createVSTask) : (createPSTask && createVSTask && createGSTask);
-	task<void> createOBJTask = shaderTaskGroup.then([this]()
+	// The textured vertex shader reads texture coordinates from a third vertex
+	// stream, in the precision of the vertex format.
+	task<void> createTexturedVSTask = loadTexturedVSTask.then([this, vertexFormat, instanceStepRate](const std::vector<byte>& fileData)
 	{
-		// Load mesh vertices. Each vertex has a positiin and a color.
-		// Note that the obj size has changed from the default DirectX app
-		// template. Windows Holographic is scaled in meteres, so to draw the 
-		// obj at a comfortable size we made the cube width 0.2 m (20 cm).
-		D3D11_SUBRESOURCE_DATA vertexBufferData = { 0 };
-		vertexBufferData.pSysMem = vertices.data();
-		vertexBufferData.SysMemPitch = 0;
-		vertexBufferData.SysMemSlicePitch = 0;
-		const CD3D11_BUFFER_DESC vertexBufferDesc(sizeof(VertexPositionColor) * vertices.size(), D3D11_BIND_VERTEX_BUFFER);
 		DX::ThrowIfFailed(
-			m_deviceResources->GetD3DDevice()->CreateBuffer(
-				&vertexBufferDesc,
-				&vertexBufferData,
-				&m_vertexBuffer
+			m_deviceResources->GetD3DDevice()->CreateVertexShader(
+				fileData.data(),
+				fileData.size(),
+				nullptr,
+				&m_texturedVertexShader
 				)
 			);
 
-		// Load mesh indices. Each trio of indices represents
-		// a triangle to be rendered on the screen.
-		// For example: 2,1,0 means that the vertices with indexes
-		// 2, 1, and 0 from the vertex buffer compose the first traingle of this mesh.
-		// Note that the winding order is clockwise by default
-		m_indexCount = indices.size();
-		D3D11_SUBRESOURCE_DATA indexBufferData = { 0 };
-		indexBufferData.pSysMem = indices.data();
-		indexBufferData.SysMemPitch = 0;
-		indexBufferData.SysMemSlicePitch = 0;
-		CD3D11_BUFFER_DESC indexBufferDesc(sizeof(UINT) * indices.size(), D3D11_BIND_INDEX_BUFFER);
+		const std::array<D3D11_INPUT_ELEMENT_DESC, 4> vertexDesc =
+		{{
+			{"POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0},
+			{"COLOR", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0},
+			{"TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 2, 0, D3D11_INPUT_PER_VERTEX_DATA, 0},
+			{"INSTANCE", 0, DXGI_FORMAT_R32_UINT, 1, 0, D3D11_INPUT_PER_INSTANCE_DATA, instanceStepRate}
+		} };
+
+		const std::array<D3D11_INPUT_ELEMENT_DESC, 4> compactVertexDesc =
+		{{
+			{"POSITION", 0, DXGI_FORMAT_R16G16B16A16_UNORM, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0},
+			{"COLOR", 0, DXGI_FORMAT_R8G8B8A8_SNORM, 0, 8, D3D11_INPUT_PER_VERTEX_DATA, 0},
+			{"TEXCOORD", 0, DXGI_FORMAT_R16G16_FLOAT, 2, 0, D3D11_INPUT_PER_VERTEX_DATA, 0},
+			{"INSTANCE", 0, DXGI_FORMAT_R32_UINT, 1, 0, D3D11_INPUT_PER_INSTANCE_DATA, instanceStepRate}
+		} };
+
+		const auto& layout = vertexFormat == OBJVertexFormat::Compact ? compactVertexDesc : vertexDesc;
 		DX::ThrowIfFailed(
-			m_deviceResources->GetD3DDevice()->CreateBuffer(
-				&indexBufferDesc,
-				&indexBufferData,
-				&m_indexBuffer
+			m_deviceResources->GetD3DDevice()->CreateInputLayout(
+				layout.data(),
+				layout.size(),
+				fileData.data(),
+				fileData.size(),
+				&m_texturedInputLayout
+				)
+			);
+
+		// Texture coordinates outside of [0, 1] repeat the texture, as in most OBJ
+		// exporters.
+		const CD3D11_SAMPLER_DESC samplerDesc(
+			D3D11_FILTER_MIN_MAG_MIP_LINEAR,
+			D3D11_TEXTURE_ADDRESS_WRAP,
+			D3D11_TEXTURE_ADDRESS_WRAP,
+			D3D11_TEXTURE_ADDRESS_WRAP,
+			0.f,
+			1,
+			D3D11_COMPARISON_NEVER,
+			nullptr,
+			0.f,
+			D3D11_FLOAT32_MAX
+			);
+		DX::ThrowIfFailed(
+			m_deviceResources->GetD3DDevice()->CreateSamplerState(
+				&samplerDesc,
+				&m_textureSampler
 				)
 			);
 	});
 
-	// Once the obj is loaded, the object is ready to be rendered
-	createOBJTask.then([this]() 
+	task<void> createTexturedPSTask = loadTexturedPSTask.then([this](const std::vector<byte>& fileData) {
+		DX::ThrowIfFailed(
+			m_deviceResources->GetD3DDevice()->CreatePixelShader(
+				fileData.data(),
+				fileData.size(),
+				nullptr,
+				&m_texturedPixelShader
+				)
+			);
+	});
+
+	task<void> createTexturedGSTask;
+	if (usingGeometryShader)
+	{
+		createTexturedGSTask = loadTexturedGSTask.then([this](const std::vector<byte>& fileData)
+		{
+			DX::ThrowIfFailed(
+				m_deviceResources->GetD3DDevice()->CreateGeometryShader(
+					fileData.data(),
+					fileData.size(),
+					nullptr,
+					&m_texturedGeometryShader
+					)
+				);
+		});
+	}
+
+	// Once the shaders are loaded, instances can be rendered as their meshes become ready.
+	task<void> texturedTaskGroup = usingGeometryShader ? (createTexturedPSTask && createTexturedVSTask && createTexturedGSTask) : (createTexturedPSTask && createTexturedVSTask);
+	task<void> shaderTaskGroup = usingGeometryShader ? (createPSTask && createVSTask && createGSTask && texturedTaskGroup) : (createPSTask && createVSTask && texturedTaskGroup);
+	return shaderTaskGroup.then([this]() 
 	{
 		m_loadingComplete = true;
 	});
 }
 
-void OBJRenderer::ReleaseDeviceDependentResources() {
-	m_loadingComplete = false;
-	m_usingVprtShaders = false;
+void OBJRenderer::ReleaseShaders()
+{
 	m_vertexShader.Reset();
 	m_inputLayout.Reset();
+	m_previewInputLayout.Reset();
 	m_pixelShader.Reset();
 	m_geometryShader.Reset();
-	m_modelConstantBuffer.Reset();
-	m_vertexBuffer.Reset();
-	m_indexBuffer.Reset();
+	m_texturedInputLayout.Reset();
+	m_texturedVertexShader.Reset();
+	m_texturedGeometryShader.Reset();
+	m_texturedPixelShader.Reset();
+	m_textureSampler.Reset();
 }
 
-// parses the obj file and loads the vertices
-void OBJRenderer::parseOBJ(std::ifstream& in)
-{
-	// Check if the file was successfully opened
-	if (!in.is_open()) {
-		return;
+void OBJRenderer::ReleaseDeviceDependentResources() {
+	m_loadingComplete = false;
+	ReleaseShaders();
+	m_lightingConstantBuffer.Reset();
+	for (auto& buffer : m_eyeConstantBuffers)
+	{
+		buffer.Reset();
+	}
+	m_instanceBufferView.Reset();
+	m_instanceBuffer.Reset();
+	m_instanceBufferCapacity = 0;
+	m_frameData.Release();
+	MarkAllInstancesDirty();
+	m_boundsVertexBuffer.Reset();
+	m_boundsIndexBuffer.Reset();
+	m_occlusionDepthStencilState.Reset();
+	m_occlusionRasterizerState.Reset();
+	m_occlusionPredicates.clear();
+	m_cameraDraws.clear();
+	m_preparedCameraCount = 0;
+	m_commandLists.clear();
+	m_deferredContexts.clear();
+	for (auto& entry : m_meshes)
+	{
+		entry.second.preview.reset();
+	}
+	if (m_ownsResourceCache)
+	{
+		m_resourceCache->ReleaseDeviceDependentResources();
 	}
 
-	std::string vn("vn");
-	std::string v("v");
-	std::string f("f");
-
-	long long lines = 0;
-
-	while (in) {
-		std::string line;
-
-		// get a line:
-		if (!getline(in, line)) { break; }
-
-		lines++;
-		if (lines % 1000 == 0) { std::cout << lines << " lines parsed.\n";  }
-
-		// continue if there is something wrong with this line or if it is a comment
-		if (line.empty() || line.find_first_of("#") != std::string::npos) { continue; }
-
-		// parse the line
-		std::stringstream ss(line);
-		std::vector<std::string> rec;
-		while (ss) 
-		{
-			std::string data;
-			if (!getline(ss, data, ' ')) { break; }
-			rec.push_back(data);
-		}
-
-		// skip empty records
-		if (rec.empty()) 
-		{
-			continue;
-		}
-
-		// check if the line contains a vertex, vertex normal, or face indices
-		if (rec[0] == vn)
-		{
-			// If record has an incorrect number of elements for a vertex normal, skip it
-			if (rec.size() != 4) { continue; }
-			FLOAT nx = std::stof(rec[1]);
-			FLOAT ny = std::stof(rec[2]);
-			FLOAT nz = std::stof(rec[3]);
-
-			FLOAT length = sqrt(nx * nx + ny * ny + nz * nz);
-
-			VertexPositionColor v;
-			v.color = XMFLOAT3(nx / length, ny / length, nz / length);
-			vertices.push_back(v);
-		}
-		else if (rec[0] == v)
-		{
-			// If a record has an incorrect number of elements for a vertex, skip it
-			if (rec.size() != 4 && rec.size() != 7) { continue; }
+	// Meshes still loading are drawn once they are ready on the new device.
+	for (MeshInstance& instance : m_instances)
+	{
+		instance.preview.reset();
+		instance.previewing = false;
+	}
+}
 
-			if (rec.size() == 7) 
-			{
-				FLOAT x = std::stof(rec[1]);
-				FLOAT y = std::stof(rec[2]);
-				FLOAT z = std::stof(rec[3]);
-				FLOAT r = std::stof(rec[4]);
-				FLOAT g = std::stof(rec[5]);
-				FLOAT b = std::stof(rec[6]);
-				vertices.back().pos = XMFLOAT3(x, y, z);
-				//vertices.back().color = XMFLOAT3(r, g, b);
-			}
-			else 
-			{
-				FLOAT x = std::stof(rec[1]);
-				FLOAT y = std::stof(rec[2]);
-				FLOAT z = std::stof(rec[3]);
-				vertices.back().pos = XMFLOAT3(x, y, z);
-			}
-		}
-		else if (rec[0] == f) 
-		{
-			// If a record has an incorrect number of elements for a set of face indices, skip it
-			if (rec.size() != 4) { continue; }
-
-			// subtract 1 from each face index because they are in the range of 1 to n, when
-			// it should be from 0 to n - 1
-			UINT v1 = (UINT)std::stoi(rec[1].substr(0, rec[1].find_first_of('/'))) - 1;
-			UINT v2 = (UINT)std::stoi(rec[2].substr(0, rec[2].find_first_of('/'))) - 1;
-			UINT v3 = (UINT)std::stoi(rec[3].substr(0, rec[3].find_first_of('/'))) - 1;
-			indices.push_back(v3);
-			indices.push_back(v2);
-			indices.push_back(v1);
-		}
+void OBJRenderer::CreateOcclusionResources(OBJVertexFormat vertexFormat)
+{
+	// A unit cube, in the vertex layout the input layout expects.
+	std::vector<VertexPositionColor> corners(8);
+	for (size_t i = 0; i < corners.size(); ++i)
+	{
+		corners[i].pos = XMFLOAT3(static_cast<float>(i & 1), static_cast<float>((i >> 1) & 1), static_cast<float>((i >> 2) & 1));
+		corners[i].color = XMFLOAT3(0.f, 0.f, 0.f);
 	}
 
-	in.close();
+	const MeshBounds unitBounds = { XMFLOAT3(0.f, 0.f, 0.f), XMFLOAT3(1.f, 1.f, 1.f) };
+	std::vector<VertexPositionColorCompact> compactCorners;
+	if (vertexFormat == OBJVertexFormat::Compact)
+	{
+		QuantizeVertices(corners.data(), corners.size(), unitBounds, compactCorners);
+	}
 
-	// Center and scale down obj to fit in a 0.2m x 0.2m x 0.2m cube
-	FLOAT maxX = (std::max_element(vertices.begin(), vertices.end(), [](VertexPositionColor v1, VertexPositionColor v2)->bool {return v1.pos.x < v2.pos.x; }))->pos.x;
-	FLOAT maxY = (std::max_element(vertices.begin(), vertices.end(), [](VertexPositionColor v1, VertexPositionColor v2)->bool {return v1.pos.y < v2.pos.y; }))->pos.y;
-	FLOAT maxZ = (std::max_element(vertices.begin(), vertices.end(), [](VertexPositionColor v1, VertexPositionColor v2)->bool {return v1.pos.z < v2.pos.z; }))->pos.z;
+	D3D11_SUBRESOURCE_DATA vertexBufferData = { 0 };
+	vertexBufferData.pSysMem = compactCorners.empty() ? static_cast<const void*>(corners.data()) : compactCorners.data();
+	const CD3D11_BUFFER_DESC vertexBufferDesc(
+		static_cast<UINT>(compactCorners.empty() ? sizeof(VertexPositionColor) * corners.size() : sizeof(VertexPositionColorCompact) * compactCorners.size()),
+		D3D11_BIND_VERTEX_BUFFER,
+		D3D11_USAGE_IMMUTABLE);
+	DX::ThrowIfFailed(
+		m_deviceResources->GetD3DDevice()->CreateBuffer(
+			&vertexBufferDesc,
+			&vertexBufferData,
+			&m_boundsVertexBuffer
+			)
+		);
 
-	FLOAT minX = (std::min_element(vertices.begin(), vertices.end(), [](VertexPositionColor v1, VertexPositionColor v2)->bool {return v1.pos.x < v2.pos.x; }))->pos.x;
-	FLOAT minY = (std::min_element(vertices.begin(), vertices.end(), [](VertexPositionColor v1, VertexPositionColor v2)->bool {return v1.pos.y < v2.pos.y; }))->pos.y;
-	FLOAT minZ = (std::min_element(vertices.begin(), vertices.end(), [](VertexPositionColor v1, VertexPositionColor v2)->bool {return v1.pos.z < v2.pos.z; }))->pos.z;
+	D3D11_SUBRESOURCE_DATA indexBufferData = { 0 };
+	indexBufferData.pSysMem = c_boundsIndices.data();
+	const CD3D11_BUFFER_DESC indexBufferDesc(static_cast<UINT>(sizeof(uint16) * c_boundsIndices.size()), D3D11_BIND_INDEX_BUFFER, D3D11_USAGE_IMMUTABLE);
+	DX::ThrowIfFailed(
+		m_deviceResources->GetD3DDevice()->CreateBuffer(
+			&indexBufferDesc,
+			&indexBufferData,
+			&m_boundsIndexBuffer
+			)
+		);
 
-	FLOAT delX = fabs(maxX - minX);
-	FLOAT delY = fabs(maxY - minY);
-	FLOAT delZ = fabs(maxZ - minZ);
-	FLOAT avgX = (maxX + minX) / 2.0f;
-	FLOAT avgY = (maxY + minY) / 2.0f;
-	FLOAT avgZ = (maxZ + minZ) / 2.0f;
+	// Test against the depth buffer without writing to it.
+	CD3D11_DEPTH_STENCIL_DESC depthStencilDesc(D3D11_DEFAULT);
+	depthStencilDesc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ZERO;
+	depthStencilDesc.DepthFunc = D3D11_COMPARISON_LESS_EQUAL;
+	DX::ThrowIfFailed(
+		m_deviceResources->GetD3DDevice()->CreateDepthStencilState(
+			&depthStencilDesc,
+			&m_occlusionDepthStencilState
+			)
+		);
 
-	for (uint32 i = 0; i < vertices.size(); i++) {
-		vertices[i].pos.x -= avgX;
-		vertices[i].pos.x /= 5.0f * delX;
-		vertices[i].pos.y -= avgY;
-		vertices[i].pos.y /= 5.0f * delY;
-		vertices[i].pos.z -= avgZ;
-		vertices[i].pos.z /= 5.0f * delZ;
-	}
-}
\ No newline at end of file
+	// Both sides of the box count, so its winding does not matter.
+	CD3D11_RASTERIZER_DESC rasterizerDesc(D3D11_DEFAULT);
+	rasterizerDesc.CullMode = D3D11_CULL_NONE;
+	DX::ThrowIfFailed(
+		m_deviceResources->GetD3DDevice()->CreateRasterizerState(
+			&rasterizerDesc,
+			&m_occlusionRasterizerState
+			)
+		);
+}
@@ -1,65 +1,401 @@
 #pragma once
 
 #include "..\Common\DeviceResources.h"
+#include "..\Common\CameraResources.h"
+#include "..\Common\DynamicRingBuffer.h"
 #include "..\Common\StepTimer.h"
+#include "..\Common\TripleBuffer.h"
 #include "ShaderStructures.h"
+#include "OBJMesh.h"
+#include "MeshPreview.h"
+#include "ResourceCache.h"
 
-#include <iostream>
+#include <ppltasks.h>
+#include <atomic>
+#include <map>
+#include <memory>
 #include <string>
 #include <vector>
-#include <fstream>
-#include <sstream>
-#include <algorithm>
 #include <math.h>
 
 namespace Hololens_OBJRenderer
 {
-	// This sample renderer instantiates a basic rnedering pipeline.
-	class OBJRenderer 
+	// How both eyes of a stereo camera are drawn into the slices of its target.
+	enum class OBJStereoMode
+	{
+		// Each instance is drawn twice in one draw call, and the vertex shader picks
+		// the slice of each copy. Needs VPAndRTArrayIndexFromAnyShaderFeedingRasterizer.
+		Vprt,
+
+		// Each instance is drawn twice in one draw call, and a pass-through geometry
+		// shader picks the slice of each copy. Works on any device.
+		GeometryShader,
+
+		// Every draw call is made once per eye, into a view of that eye's slice, with
+		// the eye in a constant buffer. Twice the draw calls, but no geometry shader.
+		DrawPerEye
+	};
+
+	// This sample renderer instantiates a basic rendering pipeline and draws any
+	// number of instances of any number of OBJ meshes. Instances of the same mesh
+	// and level of detail are drawn together with a single instanced draw call.
+	class OBJRenderer
 	{
 	public:
-		OBJRenderer(const std::shared_ptr<DX::DeviceResources>& deviceResources, std::string fileName);
-		void CreateDeviceDependentResources();
-		void parseOBJ(std::ifstream& in);
+		// Meshes and textures come from resourceCache, which is shared with other
+		// renderers; its owner updates it and releases its device resources. Without
+		// one, the renderer has a cache of its own.
+		OBJRenderer(const std::shared_ptr<DX::DeviceResources>& deviceResources, const std::shared_ptr<ResourceCache>& resourceCache = nullptr);
+
+		// Reads and parses LocalFolder\fileName on a worker thread, then creates the
+		// device resources for the mesh. The returned task completes once the mesh
+		// is ready to be drawn; Update and Render can be called at any time before that,
+		// and with streaming upload they draw what has been parsed so far.
+		// Loading a file that is already loaded, or loading, returns the same task.
+		// The file is only read once startTask completes, so that instances can be
+		// added up front and their meshes loaded later, in any order.
+		concurrency::task<void> LoadAsync(
+			std::string fileName,
+			OBJLoadMode loadMode = OBJLoadMode::MemoryMappedParallel,
+			OBJProgressCallback progressCallback = nullptr,
+			concurrency::task<void> startTask = concurrency::task_from_result());
+
+		// Adds an instance of a mesh passed to LoadAsync, at offset meters from the
+		// scene position. Instances are drawn once their mesh is ready. Returns the
+		// index of the instance.
+		size_t AddInstance(const std::string& fileName, Windows::Foundation::Numerics::float3 offset);
+		void SetInstanceOffset(size_t instance, Windows::Foundation::Numerics::float3 offset);
+		size_t GetInstanceCount() const								{ return m_instances.size(); }
+		const std::string& GetInstanceFileName(size_t instance) const	{ return m_instances[instance].mesh->GetFileName(); }
+		Windows::Foundation::Numerics::float3 GetInstanceOffset(size_t instance) const	{ return m_instances[instance].offset; }
+
+		// The mesh loaded from fileName, or nullptr if LoadAsync was not called for it.
+		const OBJMesh* GetMesh(const std::string& fileName) const;
+
+		const std::shared_ptr<ResourceCache>& GetResourceCache() const	{ return m_resourceCache; }
+
+		concurrency::task<void> CreateDeviceDependentResources();
 		void ReleaseDeviceDependentResources();
+		// Recomputes the transforms of the instances that moved, and uploads them in a
+		// single batch. Nothing is uploaded for a static scene. Draws the same as
+		// Simulate followed by ApplySimulation, without the snapshot of every
+		// instance.
 		void Update(const DX::StepTimer& timer);
-		void Render();
+
+		// The scene can also be simulated on a thread of its own. Simulate advances it
+		// and publishes a snapshot of every instance transform; ApplySimulation takes
+		// the newest snapshot on the rendering thread and uploads what changed. Neither
+		// waits for the other. Once a thread calls Simulate, only that thread may call
+		// PositionHologram, SetPosition, GetPosition, SetInstanceOffset and
+		// SetRotationSpeed, and instances must no longer be added.
+		void Simulate(const DX::StepTimer& timer);
+		void ApplySimulation();
+		// Draws every instance for one holographic camera. The level of detail of
+		// each instance is picked from its distance to the camera. Same as
+		// PrepareCameras for that camera followed by RenderCamera.
+		void Render(const DX::CameraResources* cameraResources);
+
+		// Culls the instances for each of cameraCount cameras and writes what they draw.
+		// With deferred recording, the command lists of every camera are recorded
+		// together, in parallel. RenderCamera then draws camera, or executes its command
+		// lists, on the immediate context with the camera's targets bound. The view/
+		// projection buffer of every camera must be up to date for this frame.
+		void PrepareCameras(const DX::CameraResources* const* cameras, size_t cameraCount);
+		void RenderCamera(size_t camera);
 
 		// Repositions the sample hologram
 		void PositionHologram(Windows::UI::Input::Spatial::SpatialPointerPose^ pointerPose);
 
-		// Property accesors.
-		void SetPosition(Windows::Foundation::Numerics::float3 pos) { m_position = pos; }
+		// Property accesors. The position is the origin of the instance offsets. The
+		// displayed position is the one of the snapshot being drawn.
+		void SetPosition(Windows::Foundation::Numerics::float3 pos);
 		Windows::Foundation::Numerics::float3 GetPosition()			{ return m_position; }
+		Windows::Foundation::Numerics::float3 GetDisplayedPosition() const { return m_displayedPosition; }
+
+		// Speed at which the instances spin around the vertical axis. At zero, they keep
+		// their current orientation.
+		void SetRotationSpeed(float degreesPerSecond)				{ m_degreesPerSecond = degreesPerSecond; }
+		float GetRotationSpeed() const								{ return m_degreesPerSecond; }
+
+		// Processing applied to meshes loaded from now on. See OBJMeshOptions.
+		void SetMeshCacheEnabled(bool enabled)						{ m_meshOptions.useMeshCache = enabled; }
+		void SetMeshSplittingEnabled(bool enabled)					{ m_meshOptions.splitLargeMeshes = enabled; }
+		void SetMeshOptimizationEnabled(bool enabled)				{ m_meshOptions.optimize = enabled; }
+		void SetLodGenerationEnabled(bool enabled)					{ m_meshOptions.generateLods = enabled; }
+		void SetClusterCullingEnabled(bool enabled)					{ m_meshOptions.buildClusters = enabled; }
+		void SetCpuDataReleaseEnabled(bool enabled)					{ m_meshOptions.releaseCpuData = enabled; }
+		void SetNormalGenerationEnabled(bool enabled)				{ m_meshOptions.generateNormals = enabled; }
+		void SetMaterialsEnabled(bool enabled)						{ m_meshOptions.loadMaterials = enabled; }
+
+		// When enabled, textures only keep the mip levels their meshes cover on screen
+		// on the GPU. Otherwise every level is loaded. On by default.
+		void SetTextureStreamingEnabled(bool enabled)				{ m_meshOptions.textureStreamer->SetStreamingEnabled(enabled); }
+
+		// When enabled, meshes loaded from now on are drawn while they load: first
+		// the coarsest level of detail of a cached mesh, or the faces parsed so far
+		// of any other, then the mesh itself once it is ready. On by default.
+		void SetStreamingUploadEnabled(bool enabled)				{ m_streamingUpload = enabled; }
+
+		// Generates missing normals with compute shaders rather than on the CPU. On by
+		// default; the CPU still takes over if the GPU cannot do it.
+		void SetGpuNormalGenerationEnabled(bool enabled);
+
+		// Selects the vertex layout used on the GPU. Takes effect the next time device
+		// resources are created.
+		void SetVertexFormat(OBJVertexFormat format)				{ m_vertexFormat = format; }
+		OBJVertexFormat GetVertexFormat() const						{ return m_vertexFormat; }
+
+		// Selects how meshes are shaded, and the lighting they are shaded with. Both
+		// take effect the next time device resources are created; baked lighting is
+		// applied as each mesh's buffers are made.
+		void SetShadingMode(OBJShadingMode mode)					{ m_shadingMode = mode; }
+		OBJShadingMode GetShadingMode() const						{ return m_shadingMode; }
+		void SetLighting(const LightingConstantBuffer& lighting)	{ m_lighting = lighting; }
+
+		// Selects how both eyes are drawn. Takes effect with the next Render, which
+		// reloads the shaders and draws nothing until they are ready. Vprt falls back
+		// to GeometryShader on devices without VPRT. Vprt by default.
+		void SetStereoMode(OBJStereoMode mode)						{ m_requestedStereoMode = mode; }
+		OBJStereoMode GetStereoMode() const							{ return m_stereoMode; }
+		static bool IsStereoModeSupported(const DX::DeviceResources& deviceResources, OBJStereoMode mode);
+
+		// True once the shaders are loaded and instances can be drawn.
+		bool IsLoadingComplete() const								{ return m_loadingComplete; }
+
+		// When enabled, each batch of instances is only drawn if its bounding boxes pass
+		// the depth test, so hidden holograms are not shaded. Only worth it once the
+		// depth buffer holds occluders, such as the spatial mapping surfaces.
+		void SetOcclusionCullingEnabled(bool enabled)				{ m_occlusionCulling = enabled; }
+
+		// When enabled, the draw calls of the cameras are recorded into command lists
+		// on the thread pool, then executed on the immediate context. Cameras with few
+		// draw calls are still drawn directly.
+		void SetDeferredRecordingEnabled(bool enabled)				{ m_deferredRecording = enabled; }
 
 	private:
+		// A mesh and the task that completes once it can be drawn, and what is drawn
+		// until then, if anything.
+		struct MeshEntry
+		{
+			std::shared_ptr<CachedMesh>		cached;
+			std::shared_ptr<OBJMesh>		mesh;
+			concurrency::task<void>			readyTask;
+			std::shared_ptr<MeshPreview>	preview;
+		};
+
+		// One placement of a mesh in the scene. The simulation owns the offset and the
+		// simulated transform, and marks the instance as moved until it has recomputed
+		// it. The rendering thread owns the transform being drawn, which is dirty until
+		// the GPU has it; that cannot happen before the mesh or its preview is ready to
+		// be drawn. An instance uploaded before its mesh was ready is previewing, and is
+		// drawn with the preview, which it keeps alive until it is uploaded again.
+		struct MeshInstance
+		{
+			std::shared_ptr<CachedMesh>					cached;
+			std::shared_ptr<OBJMesh>					mesh;
+			std::shared_ptr<MeshPreview>				preview;
+			bool										previewing = false;
+			Windows::Foundation::Numerics::float3		offset;
+			DirectX::XMFLOAT4X4							simulatedTransform;
+			bool										moved = true;
+			DirectX::XMFLOAT4X4							transform;
+			bool										dirty = true;
+		};
+
+		// The simulated scene, as handed to the rendering thread.
+		struct SceneSnapshot
+		{
+			Windows::Foundation::Numerics::float3		position;
+			std::vector<DirectX::XMFLOAT4X4>			transforms;
+		};
+
+		// One instance as drawn for a camera.
+		struct InstanceDraw
+		{
+			const OBJMesh*		mesh;
+			const MeshPreview*	preview;	// Drawn instead of the mesh unless nullptr.
+			size_t				lod;
+			size_t				instance;
+			bool				nearViewer;
+			bool				textured;	// Drawn with the textured pipeline.
+		};
+
+		// One draw call for a camera: count instances starting at first in the draw
+		// list, predicated on the occlusion query of their bounding boxes unless
+		// predicate is nullptr.
+		struct DrawBatch
+		{
+			size_t				first;
+			size_t				count;
+			bool				clustered;
+			ID3D11Predicate*	predicate;
+		};
+
+		// What one camera draws this frame. Its transform indices are read from the
+		// frame data starting at drawIndexOffset. Unless commandListCount is zero, its
+		// batches are recorded into that many command lists, starting at
+		// firstCommandList in m_commandLists.
+		struct CameraDraws
+		{
+			const DX::CameraResources*	cameraResources = nullptr;
+			std::vector<InstanceDraw>	drawList;
+			std::vector<DrawBatch>		batches;
+			UINT						drawIndexOffset = 0;
+			size_t						firstCommandList = 0;
+			size_t						commandListCount = 0;
+		};
+
+		// Fills the sorted draw list of a camera.
+		void CullInstances(CameraDraws& draws);
+
+		// Splits the draw list of a camera into batches. Predicates are taken from
+		// predicateCount on.
+		void BuildBatches(CameraDraws& draws, size_t& predicateCount);
+
+		// Binds the shaders and instance transforms shared by every draw call.
+		void SetPipelineState(ID3D11DeviceContext* context) const;
+
+		// Switches between the shaders and input layouts of textured and untextured
+		// meshes.
+		void SetTexturedPipeline(ID3D11DeviceContext* context, bool textured) const;
+
+		// Draws batches [firstBatch, lastBatch). Only reads the renderer, so several
+		// contexts can draw their own range at the same time.
+		void DrawBatches(ID3D11DeviceContext* context, const CameraDraws& draws, size_t firstBatch, size_t lastBatch) const;
+
+		// Draws the batches for both eyes: with one call to DrawBatches, or with one per
+		// eye into its slice when drawing each eye on its own. Leaves the whole target
+		// of the camera bound.
+		void DrawStereo(ID3D11DeviceContext* context, const CameraDraws& draws, size_t firstBatch, size_t lastBatch) const;
+
+		// Records the batches of the prepared cameras into commandListCount command
+		// lists in parallel.
+		void RecordCommandLists(size_t commandListCount);
+
+		// Binds the transform indices of a camera, starting at entry first, to the
+		// per-instance input of the instanced vertex shader.
+		void SetFirstInstance(ID3D11DeviceContext* context, const CameraDraws& draws, size_t first) const;
+
+		// Recomputes the transforms of the instances that moved: into the transforms
+		// being drawn, marking them dirty, if applyDirectly is set, or else into the
+		// simulated transforms that Simulate publishes.
+		void AdvanceScene(const DX::StepTimer& timer, bool applyDirectly);
+
+		// Updates the resource cache, then uploads the previews and the transforms of
+		// the dirty instances, once the shaders are loaded.
+		void UploadScene();
+
+		// Uploads what was parsed since the last frame of every mesh still loading,
+		// and drops the previews of the meshes that became ready. The instances of
+		// either are marked dirty.
+		void CommitPreviews(ID3D11Device* device, ID3D11DeviceContext* context);
+
+		// Copies the transforms of the dirty instances into the instance buffer.
+		void UploadInstanceTransforms(ID3D11DeviceContext* context);
+		void MarkAllInstancesDirty();
+
+		// Creates the bounding box proxies and states used for occlusion culling.
+		void CreateOcclusionResources(OBJVertexFormat vertexFormat);
+
+		// Draws the bounding boxes of instanceCount instances, whose transform indices
+		// start at entry firstInstance of the camera, inside an occlusion query on
+		// predicate.
+		void DrawOcclusionProxies(ID3D11DeviceContext* context, const CameraDraws& draws, ID3D11Predicate* predicate, size_t firstInstance, size_t instanceCount) const;
+		ID3D11Predicate* GetOcclusionPredicate(size_t index);
+
+		// Grows the instance buffer to hold the transforms of at least instanceCount
+		// instances. All instances become dirty when it is re-created.
+		void EnsureInstanceBufferCapacity(size_t instanceCount);
+
+		// Grows the frame data ring so that it holds several allocations of size bytes.
+		void EnsureFrameDataCapacity(UINT size);
+
+		// Loads the shaders of the shading mode and stereo mode, and creates the input
+		// layouts and occlusion resources that go with them. Sets m_loadingComplete
+		// once done.
+		concurrency::task<void> CreateShadersAsync();
+		void ReleaseShaders();
+
+		// Each instance is drawn once per eye, in one draw call unless each eye is
+		// drawn on its own.
+		UINT GetCopiesPerInstance() const							{ return m_stereoMode == OBJStereoMode::DrawPerEye ? 1 : 2; }
+
 		// Cached pointer to device resources.
 		std::shared_ptr<DX::DeviceResources> m_deviceResources;
 
-		// Direct3D resources for cube geometry
+		// Where the meshes and textures come from.
+		std::shared_ptr<ResourceCache>						m_resourceCache;
+		bool												m_ownsResourceCache;
+
+		// Direct3D resources shared by every mesh.
 		Microsoft::WRL::ComPtr<ID3D11InputLayout>			m_inputLayout;
-		Microsoft::WRL::ComPtr<ID3D11Buffer>				m_vertexBuffer;
-		Microsoft::WRL::ComPtr<ID3D11Buffer>				m_indexBuffer;
+		Microsoft::WRL::ComPtr<ID3D11InputLayout>			m_previewInputLayout;	// Only with compact vertices.
 		Microsoft::WRL::ComPtr<ID3D11VertexShader>			m_vertexShader;
 		Microsoft::WRL::ComPtr<ID3D11GeometryShader>		m_geometryShader;
 		Microsoft::WRL::ComPtr<ID3D11PixelShader>			m_pixelShader;
-		Microsoft::WRL::ComPtr<ID3D11Buffer>				m_modelConstantBuffer;
+		Microsoft::WRL::ComPtr<ID3D11Buffer>				m_lightingConstantBuffer;
 
-		// System resources for cube geometry
-		ModelConstantBuffer									m_modelConstantBufferData;
-		uint32												m_indexCount = 0;
+		// The same pipeline for meshes with materials, which also reads texture
+		// coordinates and samples the texture of each material.
+		Microsoft::WRL::ComPtr<ID3D11InputLayout>			m_texturedInputLayout;
+		Microsoft::WRL::ComPtr<ID3D11VertexShader>			m_texturedVertexShader;
+		Microsoft::WRL::ComPtr<ID3D11GeometryShader>		m_texturedGeometryShader;
+		Microsoft::WRL::ComPtr<ID3D11PixelShader>			m_texturedPixelShader;
+		Microsoft::WRL::ComPtr<ID3D11SamplerState>			m_textureSampler;
+
+		// Model and bounds transforms of every instance, indexed by instance. Entries
+		// are only rewritten when their instance changes.
+		Microsoft::WRL::ComPtr<ID3D11Buffer>				m_instanceBuffer;
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>	m_instanceBufferView;
+		size_t												m_instanceBufferCapacity = 0;
+
+		// Data written every frame: the transforms being uploaded, then for each camera
+		// the instance buffer entries it draws, sorted by mesh and level of detail. The
+		// latter are read by the vertex shader as a per-instance vertex stream, starting
+		// at the drawIndexOffset of the camera.
+		DX::DynamicRingBuffer								m_frameData;
+		std::vector<size_t>									m_uploadList;
+
+		// Occlusion culling: a unit cube drawn over the bounds of each instance.
+		Microsoft::WRL::ComPtr<ID3D11Buffer>				m_boundsVertexBuffer;
+		Microsoft::WRL::ComPtr<ID3D11Buffer>				m_boundsIndexBuffer;
+		Microsoft::WRL::ComPtr<ID3D11DepthStencilState>		m_occlusionDepthStencilState;
+		Microsoft::WRL::ComPtr<ID3D11RasterizerState>		m_occlusionRasterizerState;
+		std::vector<Microsoft::WRL::ComPtr<ID3D11Predicate>>	m_occlusionPredicates;
+		bool												m_occlusionCulling = false;
+
+		// Deferred recording: one deferred context per command list of the frame, and
+		// the command list each one last recorded.
+		std::vector<Microsoft::WRL::ComPtr<ID3D11DeviceContext>>	m_deferredContexts;
+		std::vector<Microsoft::WRL::ComPtr<ID3D11CommandList>>	m_commandLists;
+		bool												m_deferredRecording = false;
+
+		// Meshes by file name, and the instances drawn from them.
+		std::map<std::string, MeshEntry>					m_meshes;
+		std::vector<MeshInstance>							m_instances;
+		std::vector<CameraDraws>							m_cameraDraws;
+		size_t												m_preparedCameraCount = 0;
+		OBJMeshOptions										m_meshOptions;
+		OBJVertexFormat										m_vertexFormat = OBJVertexFormat::Compact;
+		OBJShadingMode										m_shadingMode = OBJShadingMode::VertexLighting;
+		LightingConstantBuffer								m_lighting = GetDefaultLighting();
+		bool												m_streamingUpload = true;
 
 		// Variables used with the rendering loop.
-		bool												m_loadingComplete = false;
+		std::atomic<bool>									m_loadingComplete = { false };
 		float												m_degreesPerSecond = 45.f;
+		float												m_rotation = 0.f;
 		Windows::Foundation::Numerics::float3				m_position = { 0.f, 0.f, -2.f };
+		Windows::Foundation::Numerics::float3				m_displayedPosition = { 0.f, 0.f, -2.f };
+		DX::TripleBuffer<SceneSnapshot>						m_snapshots;
+
+		// The stereo mode the shaders were loaded for, and the one to switch to. If the
+		// current D3D Device supports VPRT, we can avoid using a geometry shader just
+		// to set the render target array index.
+		OBJStereoMode										m_stereoMode = OBJStereoMode::GeometryShader;
+		OBJStereoMode										m_requestedStereoMode = OBJStereoMode::Vprt;
 
-		// If the current D3D Device supports VPRT, we can avoid using a geometry
-		// shader just to set the render target array index.
-		bool												m_usingVprtShaders = false;
-	
-		// vectors for vertices and indices
-		std::vector<VertexPositionColor> vertices;
-		std::vector<UINT> indices;
+		// The eye index of each eye, for drawing each eye on its own.
+		std::array<Microsoft::WRL::ComPtr<ID3D11Buffer>, 2>	m_eyeConstantBuffers;
 	};
-}
\ No newline at end of file
+}
@@ -1,13 +1,28 @@
+#ifdef TEXTURED
+// The diffuse texture of the material being drawn.
+Texture2D       diffuseTexture : register(t0);
+SamplerState    diffuseSampler : register(s0);
+#endif
+
 // Per-pixel color data passed through the pixel shader.
 struct PixelShaderInput
 {
     min16float4 pos   : SV_POSITION;
     min16float3 color : COLOR0;
+#ifdef TEXTURED
+    min16float2 uv    : TEXCOORD1;
+#endif
 };
 
 // The pixel shader passes through the color data. The color data from 
 // is interpolated and assigned to a pixel at the rasterization step.
 min16float4 main(PixelShaderInput input) : SV_TARGET
 {
+#ifdef TEXTURED
+    // The vertex color holds the lighting, which modulates the texture.
+    min16float3 diffuse = (min16float3)diffuseTexture.Sample(diffuseSampler, (float2)input.uv).rgb;
+    return min16float4(input.color * diffuse, 1.0f);
+#else
     return min16float4(input.color, 1.0f);
+#endif
 }
@@ -0,0 +1,402 @@
+#include "pch.h"
+#include "ResourceCache.h"
+#include "MeshCache.h"
+#include "Common\StepTimer.h"
+
+#include <algorithm>
+#include <ppl.h>
+
+using namespace Hololens_OBJRenderer;
+using namespace concurrency;
+
+namespace
+{
+	// 64-bit FNV-1a.
+	constexpr uint64 c_hashBasis = 14695981039346656037ull;
+	constexpr uint64 c_hashPrime = 1099511628211ull;
+
+	uint64 HashBytes(uint64 hash, const void* data, size_t size)
+	{
+		const byte* bytes = static_cast<const byte*>(data);
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash = (hash ^ bytes[i]) * c_hashPrime;
+		}
+		return hash;
+	}
+
+	template <typename T>
+	uint64 HashValue(uint64 hash, const T& value)
+	{
+		return HashBytes(hash, &value, sizeof(value));
+	}
+}
+
+ResourceCache::ResourceCache(const std::shared_ptr<DX::DeviceResources>& deviceResources) :
+	m_deviceResources(deviceResources),
+	m_textureStreamer(std::make_shared<TextureStreamer>(deviceResources))
+{
+}
+
+std::shared_ptr<CachedMesh> ResourceCache::LoadAsync(
+	const std::string& fileName,
+	const OBJMeshOptions& options,
+	OBJVertexFormat vertexFormat,
+	const LightingConstantBuffer* bakedLighting,
+	OBJLoadMode loadMode,
+	OBJProgressCallback progressCallback,
+	OBJPreviewCallback previewCallback,
+	const task<void>& startTask,
+	bool& added)
+{
+	// An edited file gets a key of its own, so meshes of the old file are not drawn
+	// in its place.
+	Platform::String^ localFolder = Windows::Storage::ApplicationData::Current->LocalFolder->Path;
+	const std::wstring nameW = std::wstring(localFolder->Begin()) + L"\\" + std::wstring(fileName.begin(), fileName.end());
+	MeshCacheSource source;
+	source.Query(nameW);
+
+	uint64 hash = c_hashBasis;
+	hash = HashValue(hash, source.size);
+	hash = HashValue(hash, source.lastWriteTime);
+	hash = HashValue(hash, vertexFormat);
+	for (bool option : { options.generateNormals, options.optimize, options.generateLods, options.splitLargeMeshes, options.buildClusters, options.loadMaterials && options.textureStreamer != nullptr })
+	{
+		hash = HashValue(hash, option);
+	}
+	if (bakedLighting != nullptr)
+	{
+		hash = HashValue(hash, *bakedLighting);
+	}
+
+	char hashText[24];
+	sprintf_s(hashText, "|%016llx", hash);
+	const std::string key = fileName + hashText;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	const auto found = m_meshes.find(key);
+	if (found != m_meshes.end())
+	{
+		std::shared_ptr<CachedMesh> entry = found->second.lock();
+		if (entry)
+		{
+			added = false;
+			return entry;
+		}
+	}
+
+	std::shared_ptr<CachedMesh> entry = std::make_shared<CachedMesh>();
+	entry->key = key;
+	entry->mesh = std::make_shared<OBJMesh>(fileName, options);
+	entry->vertexFormat = vertexFormat;
+	entry->bakeLighting = bakedLighting != nullptr;
+	if (bakedLighting != nullptr)
+	{
+		entry->lighting = *bakedLighting;
+	}
+
+	// The file is read and parsed on the thread pool, so the holographic frame
+	// loop keeps presenting while the model loads. Buffer creation does not need
+	// the UI thread either.
+	entry->readyTask = startTask.then([entry, loadMode, progressCallback, previewCallback]()
+	{
+		entry->mesh->Load(loadMode, progressCallback, previewCallback);
+	}, task_continuation_context::use_arbitrary()).then([this, entry]()
+	{
+		CreateDeviceResources(*entry);
+	}, task_continuation_context::use_arbitrary());
+
+	m_meshes[key] = entry;
+	added = true;
+	return entry;
+}
+
+void ResourceCache::CreateDeviceResources(CachedMesh& entry)
+{
+	for (;;)
+	{
+		const uint32 generation = m_deviceGeneration;
+		entry.mesh->CreateDeviceResources(m_deviceResources->GetD3DDevice(), entry.vertexFormat, entry.bakeLighting ? &entry.lighting : nullptr);
+
+		std::lock_guard<std::mutex> lock(m_deviceMutex);
+		if (generation == m_deviceGeneration)
+		{
+			entry.bytes = entry.mesh->GetDeviceBytes();
+			entry.residency = MeshResidency::Resident;
+			return;
+		}
+
+		// Made on the device that was lost meanwhile, and put on m_lostMeshes by the
+		// release. Until the new device is there, CreateDeviceDependentResources is
+		// left to rebuild the entry; once it is, it has skipped the entry, which is
+		// then built again here.
+		entry.mesh->ReleaseDeviceResources();
+		if (m_deviceLost)
+		{
+			entry.residency = MeshResidency::Evicted;
+			return;
+		}
+	}
+}
+
+void ResourceCache::Evict(CachedMesh& entry, bool keepRetainedData)
+{
+	// Meshes without a mesh cache keep their copy, or they would be parsed again.
+	entry.mesh->ReleaseDeviceResources();
+	if (!keepRetainedData && entry.mesh->HasMeshCache())
+	{
+		entry.mesh->ReleaseRetainedData();
+	}
+	entry.bytes = 0;
+	entry.residency = MeshResidency::Evicted;
+	++m_stats.evictions;
+}
+
+void ResourceCache::MarkUsed(const std::shared_ptr<CachedMesh>& entry)
+{
+	entry->lastUsedFrame = m_frame;
+	if (entry->residency != MeshResidency::Evicted)
+	{
+		return;
+	}
+
+	// Without its CPU copy, the mesh is read back from its retained copy or its
+	// mesh cache first.
+	entry->residency = MeshResidency::Reloading;
+	ReloadAsync(entry, false);
+}
+
+void ResourceCache::ReloadAsync(const std::shared_ptr<CachedMesh>& entry, bool recovering)
+{
+	++m_stats.reloads;
+	create_task([this, entry, recovering]()
+	{
+		try
+		{
+			CreateDeviceResources(*entry);
+		}
+		catch (Platform::Exception^)
+		{
+			// Tried again the next time the mesh is drawn.
+			entry->mesh->ReleaseDeviceResources();
+			entry->residency = MeshResidency::Evicted;
+		}
+		if (recovering && --m_pendingRecoveries == 0)
+		{
+			ReportRecovery();
+		}
+	});
+}
+
+void ResourceCache::ReportRecovery() const
+{
+	const double milliseconds = 1000.0 * (DX::StepTimer::GetTicks() - m_recoveryStart) / DX::StepTimer::GetPerformanceFrequency();
+	wchar_t message[128];
+	swprintf_s(message, L"Meshes restored %.1f ms after the device was recreated%s.\n", milliseconds, milliseconds > c_recoveryTargetMs ? L", over target" : L"");
+	OutputDebugStringW(message);
+}
+
+void ResourceCache::CollectLiveMeshes()
+{
+	m_liveMeshes.clear();
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (auto it = m_meshes.begin(); it != m_meshes.end();)
+	{
+		std::shared_ptr<CachedMesh> entry = it->second.lock();
+		if (entry)
+		{
+			m_liveMeshes.push_back(std::move(entry));
+			++it;
+		}
+		else
+		{
+			it = m_meshes.erase(it);
+		}
+	}
+}
+
+void ResourceCache::Update()
+{
+	++m_frame;
+	m_textureStreamer->Update();
+
+	CollectLiveMeshes();
+	m_stats.budget = m_budget;
+	m_stats.retainedBudget = m_retainedBudget;
+	m_stats.meshBytes = 0;
+	m_stats.retainedBytes = 0;
+	m_stats.residentMeshes = 0;
+	m_stats.evictedMeshes = 0;
+	for (const std::shared_ptr<CachedMesh>& entry : m_liveMeshes)
+	{
+		const MeshResidency residency = entry->residency;
+		if (residency == MeshResidency::Resident)
+		{
+			m_stats.meshBytes += entry->bytes;
+			m_stats.retainedBytes += entry->mesh->GetRetainedBytes();
+			++m_stats.residentMeshes;
+		}
+		else if (residency == MeshResidency::Evicted)
+		{
+			++m_stats.evictedMeshes;
+		}
+	}
+	m_stats.textureBytes = m_textureStreamer->GetResidentBytes();
+
+	// Both budgets free the meshes drawn the longest time ago first. Only resident
+	// meshes are touched, as the others may be in use on the thread pool.
+	const bool overBudget = m_stats.meshBytes + m_stats.textureBytes > m_budget;
+	const bool overRetainedBudget = m_stats.retainedBytes > m_retainedBudget;
+	if (overBudget || overRetainedBudget)
+	{
+		std::sort(m_liveMeshes.begin(), m_liveMeshes.end(), [](const std::shared_ptr<CachedMesh>& a, const std::shared_ptr<CachedMesh>& b)
+		{
+			return a->lastUsedFrame < b->lastUsedFrame;
+		});
+	}
+
+	// Retained copies of meshes with a mesh cache only make a lost device come
+	// back faster; the others would have to be parsed again, so they are kept.
+	if (overRetainedBudget)
+	{
+		for (const std::shared_ptr<CachedMesh>& entry : m_liveMeshes)
+		{
+			if (m_stats.retainedBytes <= m_retainedBudget)
+			{
+				break;
+			}
+			if (entry->residency == MeshResidency::Resident && entry->mesh->HasMeshCache() && entry->mesh->HasRetainedData())
+			{
+				m_stats.retainedBytes -= entry->mesh->GetRetainedBytes();
+				entry->mesh->ReleaseRetainedData();
+			}
+		}
+	}
+
+	// The meshes drawn the longest time ago go first, as long as they were not
+	// drawn in the last frames.
+	if (overBudget)
+	{
+		for (const std::shared_ptr<CachedMesh>& entry : m_liveMeshes)
+		{
+			if (m_stats.meshBytes + m_stats.textureBytes <= m_budget || entry->lastUsedFrame + c_minIdleFrames > m_frame)
+			{
+				break;
+			}
+			if (entry->residency == MeshResidency::Resident)
+			{
+				m_stats.meshBytes -= entry->bytes;
+				m_stats.retainedBytes -= entry->mesh->GetRetainedBytes();
+				--m_stats.residentMeshes;
+				++m_stats.evictedMeshes;
+				Evict(*entry, false);
+			}
+		}
+
+		// What is left over budget is drawn; its textures can still drop the
+		// levels they no longer need without waiting.
+		if (m_stats.meshBytes + m_stats.textureBytes > m_budget)
+		{
+			m_textureStreamer->Shrink();
+		}
+	}
+	m_liveMeshes.clear();
+}
+
+void ResourceCache::Trim()
+{
+	CollectLiveMeshes();
+	for (const std::shared_ptr<CachedMesh>& entry : m_liveMeshes)
+	{
+		if (entry->residency == MeshResidency::Resident && entry->lastUsedFrame < m_frame)
+		{
+			Evict(*entry, false);
+		}
+	}
+	m_liveMeshes.clear();
+	m_textureStreamer->ReleaseDeviceDependentResources();
+}
+
+void ResourceCache::ReleaseDeviceDependentResources()
+{
+	// Meshes being created on the thread pool see the new generation once they
+	// are done, and are built again on the new device.
+	{
+		std::lock_guard<std::mutex> lock(m_deviceMutex);
+		++m_deviceGeneration;
+		m_deviceLost = true;
+		CollectLiveMeshes();
+		m_lostMeshes.clear();
+		for (const std::shared_ptr<CachedMesh>& entry : m_liveMeshes)
+		{
+			const MeshResidency residency = entry->residency;
+			if (residency == MeshResidency::Resident)
+			{
+				Evict(*entry, true);
+			}
+			if (residency != MeshResidency::Evicted)
+			{
+				m_lostMeshes.push_back(entry);
+			}
+		}
+	}
+	m_liveMeshes.clear();
+	m_textureStreamer->ReleaseDeviceDependentResources();
+}
+
+void ResourceCache::CreateDeviceDependentResources()
+{
+	// Meshes whose creation on the thread pool has not noticed the loss yet build
+	// themselves again once it does; the others are rebuilt here.
+	std::vector<std::shared_ptr<CachedMesh>> retained;
+	std::vector<std::shared_ptr<CachedMesh>> rebuilt;
+	{
+		std::lock_guard<std::mutex> lock(m_deviceMutex);
+		m_deviceLost = false;
+		for (const std::weak_ptr<CachedMesh>& lost : m_lostMeshes)
+		{
+			std::shared_ptr<CachedMesh> entry = lost.lock();
+			if (!entry || entry->residency != MeshResidency::Evicted)
+			{
+				continue;
+			}
+			entry->residency = MeshResidency::Reloading;
+			(entry->mesh->HasRetainedData() ? retained : rebuilt).push_back(std::move(entry));
+		}
+		m_lostMeshes.clear();
+	}
+
+	// Meshes with a retained copy only need their buffers created, which the
+	// device does on any thread. They are all back before this returns, so they
+	// are drawn in the next frame.
+	parallel_for_each(retained.begin(), retained.end(), [this](const std::shared_ptr<CachedMesh>& entry)
+	{
+		try
+		{
+			CreateDeviceResources(*entry);
+		}
+		catch (Platform::Exception^)
+		{
+			entry->mesh->ReleaseDeviceResources();
+			entry->residency = MeshResidency::Evicted;
+		}
+	});
+	m_stats.reloads += static_cast<uint32>(retained.size());
+
+	// The others are processed again on the thread pool, all at once, starting
+	// with those drawn last.
+	if (rebuilt.empty())
+	{
+		return;
+	}
+	std::sort(rebuilt.begin(), rebuilt.end(), [](const std::shared_ptr<CachedMesh>& a, const std::shared_ptr<CachedMesh>& b)
+	{
+		return a->lastUsedFrame > b->lastUsedFrame;
+	});
+	m_recoveryStart = DX::StepTimer::GetTicks();
+	m_pendingRecoveries = static_cast<uint32>(rebuilt.size());
+	for (const std::shared_ptr<CachedMesh>& entry : rebuilt)
+	{
+		ReloadAsync(entry, true);
+	}
+}
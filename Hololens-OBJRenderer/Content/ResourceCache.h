@@ -0,0 +1,193 @@
+#pragma once
+
+#include "..\Common\DeviceResources.h"
+#include "ShaderStructures.h"
+#include "OBJMesh.h"
+#include "TextureStreamer.h"
+
+#include <ppltasks.h>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Hololens_OBJRenderer
+{
+	// Where the device resources of a cached mesh are.
+	enum class MeshResidency
+	{
+		Loading,	// Being read and uploaded for the first time.
+		Resident,
+		Evicted,	// Released to stay within the budget, or with the device.
+		Reloading	// Being created again after an eviction.
+	};
+
+	// One mesh of the cache: an OBJ file, processed with one set of options into one
+	// vertex layout. Shared by every renderer that loads it with those settings.
+	struct CachedMesh
+	{
+		std::string									key;
+		std::shared_ptr<OBJMesh>					mesh;
+
+		// Completes once the mesh was loaded for the first time.
+		concurrency::task<void>						readyTask;
+
+		// How the device resources are made, for reloads.
+		OBJVertexFormat								vertexFormat = OBJVertexFormat::Compact;
+		bool										bakeLighting = false;
+		LightingConstantBuffer						lighting;
+
+		// Set by the thread that creates the device resources. bytes is valid while
+		// the mesh is resident.
+		std::atomic<MeshResidency>					residency = { MeshResidency::Loading };
+		uint64										bytes = 0;
+
+		// Frame of the cache it was last drawn in. Only used on the rendering thread.
+		uint64										lastUsedFrame = 0;
+	};
+
+	struct ResourceCacheStats
+	{
+		uint64		budget = 0;
+		uint64		meshBytes = 0;
+		uint64		textureBytes = 0;
+		uint64		retainedBudget = 0;
+		uint64		retainedBytes = 0;
+		uint32		residentMeshes = 0;
+		uint32		evictedMeshes = 0;
+
+		// Since the cache was created.
+		uint32		evictions = 0;
+		uint32		reloads = 0;
+	};
+
+	// Shares meshes and textures between renderers, and keeps the GPU memory they
+	// use within a budget. Meshes are keyed by file name and a hash of the file's
+	// size and time stamp and of everything that shapes their buffers, and live as
+	// long as a renderer holds them. When they use more than the budget, the meshes
+	// drawn the longest time ago are evicted, and created again on the thread pool
+	// as soon as they are drawn again: from their mesh cache, or from the copy
+	// they retain if they have none. Until then their instances are skipped.
+	// Textures of evicted meshes fall back to their mip tail as they go unused.
+	class ResourceCache
+	{
+	public:
+		ResourceCache(const std::shared_ptr<DX::DeviceResources>& deviceResources);
+
+		// Returns the mesh of LocalFolder\fileName processed with options into
+		// vertexFormat, with its vertex colors lit by bakedLighting unless nullptr.
+		// The first call for a key loads the mesh on the thread pool once startTask
+		// completes, and sets added; later calls return the same mesh while a
+		// renderer holds it, and do not use the callbacks or startTask.
+		std::shared_ptr<CachedMesh> LoadAsync(
+			const std::string& fileName,
+			const OBJMeshOptions& options,
+			OBJVertexFormat vertexFormat,
+			const LightingConstantBuffer* bakedLighting,
+			OBJLoadMode loadMode,
+			OBJProgressCallback progressCallback,
+			OBJPreviewCallback previewCallback,
+			const concurrency::task<void>& startTask,
+			bool& added);
+
+		// Records that the mesh is drawn this frame, and starts reloading it if it was
+		// evicted. Call on the rendering thread.
+		void MarkUsed(const std::shared_ptr<CachedMesh>& entry);
+
+		// Streams the textures, then evicts the least recently drawn meshes until
+		// the cache is within budget. Call once per frame on the rendering thread,
+		// before drawing.
+		void Update();
+
+		// Evicts every mesh not drawn in the last frame, and every texture level but
+		// the mip tail, which comes back with the next Update. Call on the rendering
+		// thread, or while it does not render, such as when the app suspends.
+		void Trim();
+
+		// Evicts every mesh, but keeps their retained copies. After that,
+		// CreateDeviceDependentResources brings back the meshes that were resident:
+		// those with a retained copy before it returns, the others on the thread
+		// pool, most recently drawn first. Meshes still being loaded or reloaded are
+		// built again on the new device once their task notices the loss.
+		void ReleaseDeviceDependentResources();
+		void CreateDeviceDependentResources();
+
+		// GPU memory the meshes and textures may use, in bytes. Meshes drawn in the
+		// last frame are never evicted, so the cache can go over budget.
+		void SetBudget(uint64 bytes)										{ m_budget = bytes; }
+		uint64 GetBudget() const											{ return m_budget; }
+
+		// Memory the retained copies of resident meshes may use, in bytes. Over it,
+		// the copies of the meshes drawn the longest time ago are freed, if those
+		// meshes can be read back from their mesh cache.
+		void SetRetainedBudget(uint64 bytes)								{ m_retainedBudget = bytes; }
+		uint64 GetRetainedBudget() const									{ return m_retainedBudget; }
+
+		const std::shared_ptr<TextureStreamer>& GetTextureStreamer() const	{ return m_textureStreamer; }
+
+		// Updated by Update.
+		const ResourceCacheStats& GetStats() const							{ return m_stats; }
+
+	private:
+		// Default budget, in bytes.
+		static constexpr uint64 c_defaultBudget = 256ull * 1024 * 1024;
+		static constexpr uint64 c_defaultRetainedBudget = 64ull * 1024 * 1024;
+
+		// Frames a mesh is kept after it was last drawn, whatever the budget: the
+		// frame being drawn and the one before.
+		static constexpr uint64 c_minIdleFrames = 2;
+
+		// Time in which meshes without a retained copy should be back after the
+		// device was lost, about six frames. Slower recoveries are reported.
+		static constexpr double c_recoveryTargetMs = 100.0;
+
+		// Creates the device resources of entry on the calling thread, then marks it
+		// resident. If the device was lost meanwhile, the resources are created again
+		// once the new device is there, or the entry is left evicted for
+		// CreateDeviceDependentResources to rebuild.
+		void CreateDeviceResources(CachedMesh& entry);
+
+		// Creates the device resources of a reloading entry on the thread pool.
+		void ReloadAsync(const std::shared_ptr<CachedMesh>& entry, bool recovering);
+		void ReportRecovery() const;
+
+		// Evictions to stay within the budget also free the retained copy, unless the
+		// mesh has no mesh cache to be read back from; those of a lost device keep it
+		// to restore the mesh quickly.
+		void Evict(CachedMesh& entry, bool keepRetainedData);
+
+		// The entries still held by a renderer, in m_liveMeshes. Others are dropped.
+		void CollectLiveMeshes();
+
+		// Cached pointer to device resources.
+		std::shared_ptr<DX::DeviceResources>				m_deviceResources;
+		std::shared_ptr<TextureStreamer>					m_textureStreamer;
+
+		// Meshes by key. Meshes are owned by the renderers that draw them.
+		std::mutex											m_mutex;
+		std::map<std::string, std::weak_ptr<CachedMesh>>	m_meshes;
+		std::vector<std::shared_ptr<CachedMesh>>			m_liveMeshes;
+
+		// Changes when the device resources are released, so that resources created
+		// on the old device are not mistaken for resident ones. A mesh checks the
+		// generation and becomes resident under m_deviceMutex, which the release and
+		// creation of the device resources also hold, so a mesh cannot become
+		// resident on a lost device after its release has walked the meshes.
+		std::mutex											m_deviceMutex;
+		std::atomic<uint32>									m_deviceGeneration = { 0 };
+		bool												m_deviceLost = false;
+
+		// Meshes that were resident or being created when the device was lost, and
+		// how many of those being rebuilt on the thread pool are not back yet.
+		std::vector<std::weak_ptr<CachedMesh>>				m_lostMeshes;
+		std::atomic<uint32>									m_pendingRecoveries = { 0 };
+		int64												m_recoveryStart = 0;
+
+		uint64												m_budget = c_defaultBudget;
+		uint64												m_retainedBudget = c_defaultRetainedBudget;
+		uint64												m_frame = c_minIdleFrames;
+		ResourceCacheStats									m_stats;
+	};
+}
@@ -0,0 +1,381 @@
+#include "pch.h"
+#include "ScenePersistence.h"
+#include "Common\DirectXHelper.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <fstream>
+#include <sstream>
+
+using namespace Hololens_OBJRenderer;
+using namespace concurrency;
+using namespace Platform;
+using namespace Windows::Foundation;
+using namespace Windows::Foundation::Collections;
+using namespace Windows::Foundation::Numerics;
+using namespace Windows::Perception;
+using namespace Windows::Perception::Spatial;
+using namespace Windows::Storage;
+using namespace Windows::UI::Input::Spatial;
+
+namespace
+{
+	constexpr wchar_t c_manifestFileName[] = L"scene.txt";
+
+	// The manifest names no anchor with this.
+	const std::string c_noAnchor = "-";
+
+	std::wstring GetManifestPath()
+	{
+		return std::wstring(ApplicationData::Current->LocalFolder->Path->Data()) + L"\\" + c_manifestFileName;
+	}
+
+	// Anchor ids are plain ASCII.
+	String^ ToAnchorId(const std::string& id)
+	{
+		return id == c_noAnchor ? nullptr : ref new String(std::wstring(id.begin(), id.end()).c_str());
+	}
+
+	// Saves an anchor at position in coordinateSystem, and returns its id, or
+	// c_noAnchor if it could not be created.
+	std::string SaveAnchor(SpatialAnchorStore^ store, const std::string& id, SpatialCoordinateSystem^ coordinateSystem, float3 position)
+	{
+		if (store == nullptr)
+		{
+			return c_noAnchor;
+		}
+		SpatialAnchor^ anchor = SpatialAnchor::TryCreateRelativeTo(coordinateSystem, position);
+		return anchor != nullptr && store->TrySave(ToAnchorId(id), anchor) ? id : c_noAnchor;
+	}
+
+	// The time now, for locating the head outside of a holographic frame.
+	PerceptionTimestamp^ GetCurrentTimestamp()
+	{
+		FILETIME fileTime;
+		GetSystemTimePreciseAsFileTime(&fileTime);
+		DateTime now;
+		now.UniversalTime = (static_cast<int64>(fileTime.dwHighDateTime) << 32) | fileTime.dwLowDateTime;
+		return PerceptionTimestampHelper::FromHistoricalTargetTime(now);
+	}
+}
+
+ScenePersistence::ScenePersistence()
+{
+	create_task(SpatialAnchorManager::RequestStoreAsync()).then([this](task<SpatialAnchorStore^> storeTask)
+	{
+		try
+		{
+			SpatialAnchorStore^ store = storeTask.get();
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_anchorStore = store;
+		}
+		catch (Exception^ exception)
+		{
+			OutputDebugStringW((L"The spatial anchor store could not be opened: " + exception->Message + L"\n")->Data());
+		}
+		m_storeOpened = true;
+	}, task_continuation_context::use_arbitrary());
+}
+
+// The manifest has one record per line:
+//     scene <anchor id> <x> <y> <z>
+//     model <anchor id> <x> <y> <z> <file name>
+// with the scene position in the reference frame it was saved in, the offset
+// of each instance from it, and "-" for anchors that could not be saved.
+bool ScenePersistence::Restore(OBJRenderer& renderer)
+{
+	std::ifstream in(GetManifestPath());
+	if (!in)
+	{
+		return false;
+	}
+
+	std::vector<ModelFile> files;
+	std::vector<PlacedModel> models;
+	std::vector<float3> offsets;
+	std::map<std::string, size_t> fileIndices;
+	String^ sceneAnchorId = nullptr;
+	float3 scenePosition = renderer.GetPosition();
+	std::string line;
+	while (std::getline(in, line))
+	{
+		std::istringstream record(line);
+		std::string type;
+		std::string anchorId;
+		float3 position;
+		record >> type >> anchorId >> position.x >> position.y >> position.z;
+		if (!record)
+		{
+			// Comments, and whatever a newer version of the app added.
+			continue;
+		}
+
+		if (type == "scene")
+		{
+			sceneAnchorId = ToAnchorId(anchorId);
+			scenePosition = position;
+		}
+		else if (type == "model")
+		{
+			std::string fileName;
+			std::getline(record >> std::ws, fileName);
+			if (fileName.empty())
+			{
+				continue;
+			}
+
+			const auto found = fileIndices.emplace(fileName, files.size());
+			if (found.second)
+			{
+				files.emplace_back();
+				files.back().fileName = fileName;
+			}
+			++files[found.first->second].modelCount;
+
+			PlacedModel model = {};
+			model.file = found.first->second;
+			model.anchorId = ToAnchorId(anchorId);
+			models.push_back(model);
+			offsets.push_back(position);
+		}
+	}
+	if (models.empty())
+	{
+		return false;
+	}
+
+	// Every instance is added now, while the renderer is not simulated yet; their
+	// meshes only load once Update starts them.
+	renderer.SetPosition(scenePosition);
+	for (ModelFile& file : files)
+	{
+		file.readyTask = renderer.LoadAsync(file.fileName, OBJLoadMode::MemoryMappedParallel, nullptr, create_task(file.start));
+	}
+	for (size_t i = 0; i < models.size(); ++i)
+	{
+		models[i].instance = renderer.AddInstance(files[models[i].file].fileName, offsets[i]);
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_files = std::move(files);
+	m_models = std::move(models);
+	m_sceneAnchorId = sceneAnchorId;
+	m_pendingModels = m_models.size();
+	m_placed = false;
+	m_restoreTicks = DX::StepTimer::GetTicks();
+	return true;
+}
+
+void ScenePersistence::FindAnchors()
+{
+	m_anchorsFound = true;
+	if (m_anchorStore == nullptr)
+	{
+		return;
+	}
+
+	IMapView<String^, SpatialAnchor^>^ savedAnchors = m_anchorStore->GetAllSavedAnchors();
+	const auto find = [savedAnchors](String^ id) -> SpatialAnchor^
+	{
+		return id != nullptr && savedAnchors->HasKey(id) ? savedAnchors->Lookup(id) : nullptr;
+	};
+	m_sceneAnchor = find(m_sceneAnchorId);
+	for (PlacedModel& model : m_models)
+	{
+		model.anchor = find(model.anchorId);
+	}
+}
+
+bool ScenePersistence::LocateAnchor(SpatialAnchor^ anchor, SpatialCoordinateSystem^ coordinateSystem, float3& position)
+{
+	IBox<float4x4>^ anchorToCoordinateSystem = anchor->CoordinateSystem->TryGetTransformTo(coordinateSystem);
+	if (anchorToCoordinateSystem == nullptr)
+	{
+		return false;
+	}
+	position = transform(float3::zero(), anchorToCoordinateSystem->Value);
+	return true;
+}
+
+void ScenePersistence::Update(OBJRenderer& renderer, SpatialCoordinateSystem^ coordinateSystem)
+{
+	// Only restored scenes are followed; m_files does not change after Restore.
+	if (m_files.empty())
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_anchorsFound)
+		{
+			if (!m_storeOpened)
+			{
+				return;
+			}
+			FindAnchors();
+		}
+
+		// Nothing is loaded until the scene is in place, so that models do not
+		// show up in one place and jump to another.
+		float3 scenePosition;
+		if (m_sceneAnchor != nullptr && LocateAnchor(m_sceneAnchor, coordinateSystem, scenePosition))
+		{
+			if (!m_placed || distance(scenePosition, renderer.GetPosition()) > c_relocateThreshold)
+			{
+				renderer.SetPosition(scenePosition);
+			}
+			m_placed = true;
+		}
+		else if (!m_placed)
+		{
+			const double waitedSeconds = static_cast<double>(DX::StepTimer::GetTicks() - m_restoreTicks) / DX::StepTimer::GetPerformanceFrequency();
+			if (m_sceneAnchor != nullptr && waitedSeconds < c_locateTimeoutSeconds)
+			{
+				return;
+			}
+			m_placed = true;
+		}
+
+		// Instances with an anchor of their own follow it, relative to the scene,
+		// a few of them each frame.
+		const float3 position = renderer.GetPosition();
+		const size_t locatedModels = (std::min)(c_anchorsLocatedPerFrame, m_models.size());
+		for (size_t i = 0; i < locatedModels; ++i)
+		{
+			const PlacedModel& model = m_models[m_nextLocatedModel];
+			m_nextLocatedModel = (m_nextLocatedModel + 1) % m_models.size();
+
+			float3 modelPosition;
+			if (model.anchor != nullptr && LocateAnchor(model.anchor, coordinateSystem, modelPosition))
+			{
+				const float3 offset = modelPosition - position;
+				if (distance(offset, renderer.GetInstanceOffset(model.instance)) > c_relocateThreshold)
+				{
+					renderer.SetInstanceOffset(model.instance, offset);
+				}
+			}
+		}
+	}
+
+	if (m_startedFiles == m_files.size() || m_loadsInFlight >= c_maxConcurrentLoads)
+	{
+		return;
+	}
+
+	// Without a head pose, the models nearest the scene position go first.
+	float3 headPosition = renderer.GetPosition();
+	PerceptionTimestamp^ timestamp = GetCurrentTimestamp();
+	SpatialPointerPose^ pointerPose = timestamp != nullptr ? SpatialPointerPose::TryGetAtTimestamp(coordinateSystem, timestamp) : nullptr;
+	if (pointerPose != nullptr)
+	{
+		headPosition = pointerPose->Head->Position;
+	}
+	StartLoads(renderer, headPosition);
+}
+
+void ScenePersistence::StartLoads(OBJRenderer& renderer, float3 headPosition)
+{
+	const float3 position = renderer.GetPosition();
+	while (m_startedFiles < m_files.size() && m_loadsInFlight < c_maxConcurrentLoads)
+	{
+		// A file goes with its nearest instance.
+		size_t nearestFile = m_files.size();
+		float nearestDistance = FLT_MAX;
+		for (const PlacedModel& model : m_models)
+		{
+			if (m_files[model.file].started)
+			{
+				continue;
+			}
+			const float modelDistance = distance_squared(position + renderer.GetInstanceOffset(model.instance), headPosition);
+			if (modelDistance < nearestDistance)
+			{
+				nearestFile = model.file;
+				nearestDistance = modelDistance;
+			}
+		}
+
+		ModelFile& file = m_files[nearestFile];
+		file.started = true;
+		++m_startedFiles;
+		++m_loadsInFlight;
+
+		const std::string fileName = file.fileName;
+		const size_t modelCount = file.modelCount;
+		file.readyTask.then([this, fileName, modelCount](task<void> loadTask)
+		{
+			try
+			{
+				loadTask.get();
+			}
+			catch (Exception^ exception)
+			{
+				OutputDebugStringW((ref new String(std::wstring(fileName.begin(), fileName.end()).c_str()) + L" failed to load: " + exception->Message + L"\n")->Data());
+			}
+			m_pendingModels -= modelCount;
+			--m_loadsInFlight;
+		}, task_continuation_context::use_arbitrary());
+		file.start.set();
+	}
+}
+
+void ScenePersistence::OnScenePlaced()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_sceneAnchor = nullptr;
+	for (PlacedModel& model : m_models)
+	{
+		model.anchor = nullptr;
+	}
+	m_anchorsFound = true;
+	m_placed = true;
+}
+
+void ScenePersistence::OnResuming()
+{
+	// The anchors saved on suspending have the ids of the restored ones.
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_anchorsFound = false;
+}
+
+void ScenePersistence::Save(OBJRenderer& renderer, SpatialCoordinateSystem^ coordinateSystem)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!m_placed)
+	{
+		return;
+	}
+
+	// The anchors of the last save are replaced. The app shares its store with
+	// nobody else.
+	if (m_anchorStore != nullptr)
+	{
+		m_anchorStore->Clear();
+	}
+
+	const float3 position = renderer.GetPosition();
+	std::string text = "# OBJRenderer scene\n";
+	char record[128];
+	sprintf_s(record, "scene %s %.6f %.6f %.6f\n", SaveAnchor(m_anchorStore, "scene", coordinateSystem, position).c_str(), position.x, position.y, position.z);
+	text += record;
+	for (size_t i = 0; i < renderer.GetInstanceCount(); ++i)
+	{
+		const float3 offset = renderer.GetInstanceOffset(i);
+		const std::string anchorId = SaveAnchor(m_anchorStore, "model" + std::to_string(i), coordinateSystem, position + offset);
+		sprintf_s(record, "model %s %.6f %.6f %.6f ", anchorId.c_str(), offset.x, offset.y, offset.z);
+		text += record + renderer.GetInstanceFileName(i) + "\n";
+	}
+
+	// Written under a temporary name first, so that a suspension cut short does
+	// not leave a truncated manifest behind.
+	const std::wstring fileName = GetManifestPath();
+	const std::wstring temporaryFileName = fileName + L".tmp";
+	std::ofstream out(temporaryFileName, std::ios::binary | std::ios::trunc);
+	out.write(text.data(), text.size());
+	out.close();
+	if (!out || !MoveFileExW(temporaryFileName.c_str(), fileName.c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		OutputDebugStringW(L"The scene manifest could not be written.\n");
+	}
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "OBJRenderer.h"
+
+#include <ppltasks.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Hololens_OBJRenderer
+{
+	// Keeps the placed models of an OBJRenderer across runs of the app. Save writes
+	// LocalFolder\scene.txt, a manifest of the file and offset of every instance,
+	// and saves a spatial anchor at the scene position and at each instance in the
+	// SpatialAnchorStore. Restore adds the instances of the manifest to a renderer
+	// without loading anything; Update then locates the anchors, and starts the
+	// loads of the models nearest the user first, a few at a time, so that what is
+	// close is drawn while the rest streams in behind it. Meshes that were loaded
+	// before are read back from their mesh cache.
+	class ScenePersistence
+	{
+	public:
+		// Starts opening the anchor store. Until it is open, a restored scene waits
+		// for its anchors.
+		ScenePersistence();
+
+		// Adds the instances of the saved manifest to renderer, whose loads wait for
+		// Update. Returns false, and adds nothing, if there is no manifest. Call before
+		// the renderer is simulated.
+		bool Restore(OBJRenderer& renderer);
+
+		// Moves the restored scene and its instances to their anchors once they are
+		// located, and starts loading the pending models nearest the head. Call once
+		// per frame on the thread that simulates renderer.
+		void Update(OBJRenderer& renderer, Windows::Perception::Spatial::SpatialCoordinateSystem^ coordinateSystem);
+
+		// The user placed the scene somewhere else: its anchors no longer hold it, and
+		// are replaced with the next Save. Call on the thread that simulates renderer.
+		void OnScenePlaced();
+
+		// Anchors the scene at its position and every instance at its own, in
+		// coordinateSystem, and writes the manifest. Does nothing while a restored
+		// scene is still waiting for its anchors, so that it is not saved in the
+		// wrong place. Call while nothing simulates renderer.
+		void Save(OBJRenderer& renderer, Windows::Perception::Spatial::SpatialCoordinateSystem^ coordinateSystem);
+
+		// Anchors may have been corrected while the app was suspended; they are
+		// located again and the scene follows them.
+		void OnResuming();
+
+		// Models of the restored scene whose loads have not started, or not finished.
+		size_t GetPendingModelCount() const							{ return m_pendingModels; }
+
+	private:
+		// Loads running at once. Each one already parses on all cores; more would
+		// only delay the nearest models.
+		static constexpr uint32 c_maxConcurrentLoads = 2;
+
+		// Anchors located per frame, after the one of the scene.
+		static constexpr size_t c_anchorsLocatedPerFrame = 8;
+
+		// Anchors that moved by less than this, in meters, leave their instance where
+		// it is.
+		static constexpr float c_relocateThreshold = 0.01f;
+
+		// A restored scene whose anchor cannot be found within this many seconds is
+		// shown where it was saved, relative to the new reference frame.
+		static constexpr double c_locateTimeoutSeconds = 3.0;
+
+		// One instance of the manifest.
+		struct PlacedModel
+		{
+			size_t										file;
+			size_t										instance;
+			Platform::String^							anchorId;
+			Windows::Perception::Spatial::SpatialAnchor^	anchor;
+		};
+
+		// A file of the manifest, loaded once for all of its instances. Its load waits
+		// for start to be set, and readyTask completes once the mesh can be drawn.
+		struct ModelFile
+		{
+			std::string									fileName;
+			size_t										modelCount = 0;
+			concurrency::task_completion_event<void>	start;
+			concurrency::task<void>						readyTask;
+			bool										started = false;
+		};
+
+		// Looks up the saved anchors of the restored scene. Call with m_mutex held.
+		void FindAnchors();
+
+		// The position of anchor in coordinateSystem, or false if it cannot be located.
+		static bool LocateAnchor(
+			Windows::Perception::Spatial::SpatialAnchor^ anchor,
+			Windows::Perception::Spatial::SpatialCoordinateSystem^ coordinateSystem,
+			Windows::Foundation::Numerics::float3& position);
+
+		// Starts the loads of the pending files nearest headPosition, in the
+		// coordinate system of the renderer.
+		void StartLoads(OBJRenderer& renderer, Windows::Foundation::Numerics::float3 headPosition);
+
+		// Opened on the thread pool. Guarded by m_mutex, as are the anchors.
+		std::mutex											m_mutex;
+		Windows::Perception::Spatial::SpatialAnchorStore^	m_anchorStore;
+		std::atomic<bool>									m_storeOpened = { false };
+		bool												m_anchorsFound = false;
+
+		// The restored scene.
+		std::vector<ModelFile>								m_files;
+		std::vector<PlacedModel>							m_models;
+		size_t												m_startedFiles = 0;
+		Platform::String^									m_sceneAnchorId;
+		Windows::Perception::Spatial::SpatialAnchor^		m_sceneAnchor;
+		size_t												m_nextLocatedModel = 0;
+
+		// False until the scene is at its anchor, or given up waiting for it.
+		bool												m_placed = true;
+		int64												m_restoreTicks = 0;
+
+		std::atomic<uint32>									m_loadsInFlight = { 0 };
+		std::atomic<size_t>									m_pendingModels = { 0 };
+	};
+}
@@ -12,10 +12,59 @@ namespace Hololens_OBJRenderer
     static_assert((sizeof(ModelConstantBuffer) % (sizeof(float) * 4)) == 0, "Model constant buffer size must be 16-byte aligned (16 bytes is the length of four floats).");
 
 
+    // Constant buffer used to send the lighting of the scene to the per-vertex lit
+    // shaders, and used on the CPU when lighting is baked. The ambient term is a first
+    // order spherical harmonic: for a unit normal n, channel c of the irradiance is
+    // dot(ambient[c], (1, n.y, n.z, n.x)).
+    struct LightingConstantBuffer
+    {
+        DirectX::XMFLOAT4 lightDirection;   // Unit vector towards the light. w is unused.
+        DirectX::XMFLOAT4 lightColor;
+        DirectX::XMFLOAT4 ambient[3];
+        DirectX::XMFLOAT4 albedo;
+    };
+
+    static_assert((sizeof(LightingConstantBuffer) % (sizeof(float) * 4)) == 0, "Lighting constant buffer size must be 16-byte aligned (16 bytes is the length of four floats).");
+
+    // Constant buffer of the normal generation compute shaders. Large dispatches
+    // spread their thread groups over two dimensions, groupCountX wide.
+    struct NormalGenerationConstantBuffer
+    {
+        uint32 elementCount;    // Triangles or vertices, depending on the pass.
+        uint32 groupCountX;
+        uint32 padding[2];
+    };
+
+    static_assert((sizeof(NormalGenerationConstantBuffer) % (sizeof(float) * 4)) == 0, "Normal generation constant buffer size must be 16-byte aligned (16 bytes is the length of four floats).");
+
+    // Constant buffer of the vertex shaders that draw one eye per draw call: the
+    // index of the eye being drawn, 0 for the left and 1 for the right. It picks
+    // the matrix of that eye in the ViewProjectionConstantBuffer.
+    struct EyeConstantBuffer
+    {
+        uint32 eye;
+        uint32 padding[3];
+    };
+
+    static_assert((sizeof(EyeConstantBuffer) % (sizeof(float) * 4)) == 0, "Eye constant buffer size must be 16-byte aligned (16 bytes is the length of four floats).");
+
     // Used to send per-vertex data to the vertex shader.
     struct VertexPositionColor
     {
         DirectX::XMFLOAT3 pos;
         DirectX::XMFLOAT3 color;
     };
-}
\ No newline at end of file
+
+    // Compact alternative to VertexPositionColor, 12 bytes instead of 24. The position
+    // is quantized to 16 bits per axis within the mesh bounds, and read through a
+    // DXGI_FORMAT_R16G16B16A16_UNORM element; the model transform maps it back into
+    // mesh space. The normal is stored in the color slot as DXGI_FORMAT_R8G8B8A8_SNORM,
+    // so the shaders read both layouts unchanged.
+    struct VertexPositionColorCompact
+    {
+        uint16 pos[4];
+        uint32 color;
+    };
+
+    static_assert(sizeof(VertexPositionColorCompact) == 12, "The compact vertex layout must match its input layout.");
+}
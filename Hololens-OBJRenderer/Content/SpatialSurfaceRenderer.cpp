@@ -0,0 +1,406 @@
+#include "pch.h"
+#include "SpatialSurfaceRenderer.h"
+#include "Common\DirectXHelper.h"
+
+#include <robuffer.h>
+
+using namespace Hololens_OBJRenderer;
+using namespace Concurrency;
+using namespace DirectX;
+using namespace Microsoft::WRL;
+using namespace Platform;
+using namespace Windows::Foundation;
+using namespace Windows::Foundation::Collections;
+using namespace Windows::Foundation::Numerics;
+using namespace Windows::Graphics::DirectX;
+using namespace Windows::Perception::Spatial;
+using namespace Windows::Perception::Spatial::Surfaces;
+using namespace std::placeholders;
+
+namespace
+{
+	// The bytes behind a buffer returned by a WinRT API.
+	byte* GetBufferData(Windows::Storage::Streams::IBuffer^ buffer)
+	{
+		ComPtr<IUnknown> unknown = reinterpret_cast<IUnknown*>(buffer);
+		ComPtr<Windows::Storage::Streams::IBufferByteAccess> byteAccess;
+		DX::ThrowIfFailed(unknown.As(&byteAccess));
+
+		byte* data = nullptr;
+		DX::ThrowIfFailed(byteAccess->Buffer(&data));
+		return data;
+	}
+}
+
+SpatialSurfaceRenderer::SpatialSurfaceRenderer(const std::shared_ptr<DX::DeviceResources>& deviceResources) :
+	m_deviceResources(deviceResources)
+{
+	CreateDeviceDependentResources();
+}
+
+SpatialSurfaceRenderer::~SpatialSurfaceRenderer()
+{
+	if (m_surfaceObserver != nullptr)
+	{
+		m_surfaceObserver->ObservedSurfacesChanged -= m_surfacesChangedToken;
+	}
+}
+
+task<bool> SpatialSurfaceRenderer::StartObserving(SpatialCoordinateSystem^ coordinateSystem)
+{
+	return create_task(SpatialSurfaceObserver::RequestAccessAsync()).then([this, coordinateSystem](SpatialPerceptionAccessStatus status)
+	{
+		// Without access there is nothing to occlude with; holograms are drawn as before.
+		if (status != SpatialPerceptionAccessStatus::Allowed)
+		{
+			return false;
+		}
+
+		// Positions come as 16-bit normalized integers, scaled by each mesh's
+		// VertexPositionScale. Normals are not needed for depth.
+		m_meshOptions = ref new SpatialSurfaceMeshOptions();
+		m_meshOptions->VertexPositionFormat = DirectXPixelFormat::R16G16B16A16IntNormalized;
+		m_meshOptions->TriangleIndexFormat = DirectXPixelFormat::R16UInt;
+		m_meshOptions->IncludeVertexNormals = false;
+
+		// Observe a room-sized box around the origin, in meters.
+		const SpatialBoundingBox boundingBox = { { 0.f, 0.f, 0.f }, { 20.f, 20.f, 5.f } };
+		m_surfaceObserver = ref new SpatialSurfaceObserver();
+		m_surfaceObserver->SetBoundingVolume(SpatialBoundingVolume::FromBox(coordinateSystem, boundingBox));
+		m_surfacesChangedToken = m_surfaceObserver->ObservedSurfacesChanged +=
+			ref new TypedEventHandler<SpatialSurfaceObserver^, Object^>(
+				std::bind(&SpatialSurfaceRenderer::OnSurfacesChanged, this, _1, _2)
+				);
+
+		// Pick up the surfaces that are already known.
+		OnSurfacesChanged(m_surfaceObserver, nullptr);
+		return true;
+	});
+}
+
+void SpatialSurfaceRenderer::OnSurfacesChanged(SpatialSurfaceObserver^ sender, Object^ args)
+{
+	IMapView<Guid, SpatialSurfaceInfo^>^ observedSurfaces = sender->GetObservedSurfaces();
+
+	{
+		std::lock_guard<std::mutex> lock(m_surfacesMutex);
+		for (auto surface = m_surfaces.begin(); surface != m_surfaces.end();)
+		{
+			surface = observedSurfaces->HasKey(surface->first) ? std::next(surface) : m_surfaces.erase(surface);
+		}
+	}
+
+	for (const auto& pair : observedSurfaces)
+	{
+		const Guid id = pair->Key;
+		SpatialSurfaceInfo^ surfaceInfo = pair->Value;
+		{
+			std::lock_guard<std::mutex> lock(m_surfacesMutex);
+			const auto existing = m_surfaces.find(id);
+			if (existing != m_surfaces.end() && existing->second.updateTime.UniversalTime >= surfaceInfo->UpdateTime.UniversalTime)
+			{
+				continue;
+			}
+		}
+
+		// The mesh is computed and copied into buffers on the thread pool.
+		create_task(surfaceInfo->TryComputeLatestMeshAsync(m_trianglesPerCubicMeter, m_meshOptions)).then([this, id](SpatialSurfaceMesh^ mesh)
+		{
+			if (mesh == nullptr)
+			{
+				return;
+			}
+
+			SurfaceMesh surface;
+			surface.mesh = mesh;
+			surface.updateTime = mesh->SurfaceInfo->UpdateTime;
+			CreateBuffers(surface);
+
+			// Keep the newest mesh, unless the surface went away in the meantime.
+			std::lock_guard<std::mutex> lock(m_surfacesMutex);
+			const auto existing = m_surfaces.find(id);
+			if ((existing == m_surfaces.end() || existing->second.updateTime.UniversalTime < surface.updateTime.UniversalTime) &&
+				m_surfaceObserver->GetObservedSurfaces()->HasKey(id))
+			{
+				m_surfaces[id] = surface;
+			}
+		}).then([](task<void> previousTask)
+		{
+			// A surface that could not be copied, for instance because the device was
+			// lost, is requested again the next time the observer reports it.
+			try
+			{
+				previousTask.get();
+			}
+			catch (Exception^)
+			{
+			}
+		});
+	}
+}
+
+void SpatialSurfaceRenderer::CreateBuffers(SurfaceMesh& surface)
+{
+	const auto device = m_deviceResources->GetD3DDevice();
+
+	SpatialSurfaceMeshBuffer^ positions = surface.mesh->VertexPositions;
+	const CD3D11_BUFFER_DESC vertexBufferDesc(positions->Data->Length, D3D11_BIND_VERTEX_BUFFER, D3D11_USAGE_IMMUTABLE);
+	D3D11_SUBRESOURCE_DATA vertexBufferData = { 0 };
+	vertexBufferData.pSysMem = GetBufferData(positions->Data);
+	DX::ThrowIfFailed(
+		device->CreateBuffer(
+			&vertexBufferDesc,
+			&vertexBufferData,
+			&surface.vertexBuffer
+			)
+		);
+
+	SpatialSurfaceMeshBuffer^ indices = surface.mesh->TriangleIndices;
+	const CD3D11_BUFFER_DESC indexBufferDesc(indices->Data->Length, D3D11_BIND_INDEX_BUFFER, D3D11_USAGE_IMMUTABLE);
+	D3D11_SUBRESOURCE_DATA indexBufferData = { 0 };
+	indexBufferData.pSysMem = GetBufferData(indices->Data);
+	DX::ThrowIfFailed(
+		device->CreateBuffer(
+			&indexBufferDesc,
+			&indexBufferData,
+			&surface.indexBuffer
+			)
+		);
+
+	surface.vertexStride = positions->Stride;
+	surface.indexCount = indices->ElementCount;
+	surface.indexFormat = static_cast<DXGI_FORMAT>(indices->Format);
+}
+
+// Called once per frame. Surfaces move relative to the rendering coordinate system
+// as tracking improves, so they are located every frame.
+void SpatialSurfaceRenderer::Update(SpatialCoordinateSystem^ coordinateSystem)
+{
+	std::lock_guard<std::mutex> lock(m_surfacesMutex);
+	for (auto& pair : m_surfaces)
+	{
+		SurfaceMesh& surface = pair.second;
+		IBox<float4x4>^ transform = surface.mesh->CoordinateSystem->TryGetTransformTo(coordinateSystem);
+		surface.located = transform != nullptr;
+		if (!surface.located)
+		{
+			continue;
+		}
+
+		const float3 scale = surface.mesh->VertexPositionScale;
+		const float4x4 surfaceToRendering = transform->Value;
+		const XMMATRIX modelTransform = XMMatrixMultiply(
+			XMMatrixScaling(scale.x, scale.y, scale.z),
+			XMLoadFloat4x4(&surfaceToRendering));
+		XMStoreFloat4x4(&surface.model.model, XMMatrixTranspose(modelTransform));
+	}
+}
+
+// Renders the surfaces into the depth buffer only. No pixel shader is bound, so the
+// render target is left as it is.
+void SpatialSurfaceRenderer::RenderDepth()
+{
+	if (!m_loadingComplete)
+	{
+		return;
+	}
+
+	const auto context = m_deviceResources->GetD3DDeviceContext();
+	context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	context->IASetInputLayout(m_inputLayout.Get());
+	context->VSSetShader(
+		m_vertexShader.Get(),
+		nullptr,
+		0
+		);
+	context->VSSetConstantBuffers(
+		0,
+		1,
+		m_modelConstantBuffer.GetAddressOf()
+		);
+	if (!m_usingVprtShaders)
+	{
+		// On devices that do not support the D3D11_FEATURE_D3D11_OPTIONS3::
+		// VPAndRTArrayIndexFromAnyShaderFeedingRasterizer optional feature,
+		// a pass-through geometry shader is used to set the render target
+		// array index.
+		context->GSSetShader(
+			m_geometryShader.Get(),
+			nullptr,
+			0
+			);
+	}
+	context->PSSetShader(nullptr, nullptr, 0);
+
+	// The user can be on either side of a surface triangle.
+	context->RSSetState(m_rasterizerState.Get());
+
+	std::lock_guard<std::mutex> lock(m_surfacesMutex);
+	for (const auto& pair : m_surfaces)
+	{
+		const SurfaceMesh& surface = pair.second;
+		if (!surface.located || surface.indexCount == 0)
+		{
+			continue;
+		}
+
+		context->UpdateSubresource(
+			m_modelConstantBuffer.Get(),
+			0,
+			nullptr,
+			&surface.model,
+			0,
+			0
+			);
+
+		const UINT stride = surface.vertexStride;
+		const UINT offset = 0;
+		context->IASetVertexBuffers(
+			0,
+			1,
+			surface.vertexBuffer.GetAddressOf(),
+			&stride,
+			&offset
+			);
+		context->IASetIndexBuffer(
+			surface.indexBuffer.Get(),
+			surface.indexFormat,
+			0
+			);
+
+		// Draw once per eye.
+		context->DrawIndexedInstanced(
+			surface.indexCount,	// Index count per instance.
+			2,					// Instance count.
+			0,					// Start index location.
+			0,					// Base vertex location.
+			0					// Start instance location.
+			);
+	}
+
+	context->RSSetState(nullptr);
+}
+
+bool SpatialSurfaceRenderer::HasSurfaces() const
+{
+	std::lock_guard<std::mutex> lock(m_surfacesMutex);
+	for (const auto& pair : m_surfaces)
+	{
+		if (pair.second.indexCount > 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+task<void> SpatialSurfaceRenderer::CreateDeviceDependentResources()
+{
+	m_usingVprtShaders = m_deviceResources->GetDeviceSupportsVprt();
+
+	// The sample vertex shaders already transform by a model matrix; no other
+	// shader is needed for a depth-only pass.
+	std::wstring vertexShaderFileName = m_usingVprtShaders ? L"ms-appx:///VprtVertexShader.cso" : L"ms-appx:///VertexShader.cso";
+
+	// Load shaders asynchronously.
+	task<std::vector<byte>> loadVSTask = DX::ReadCachedDataAsync(vertexShaderFileName);
+
+	task<std::vector<byte>> loadGSTask;
+	if (!m_usingVprtShaders)
+	{
+		// Load the pass-through geometry shader.
+		loadGSTask = DX::ReadCachedDataAsync(L"ms-appx:///GeometryShader.cso");
+	}
+
+	// After the vertex shader file is loaded, create the shader and input layout.
+	task<void> createVSTask = loadVSTask.then([this](const std::vector<byte>& fileData)
+	{
+		DX::ThrowIfFailed(
+			m_deviceResources->GetD3DDevice()->CreateVertexShader(
+				fileData.data(),
+				fileData.size(),
+				nullptr,
+				&m_vertexShader
+				)
+			);
+
+		// The shader also reads a color, which nothing uses here; the position
+		// stands in for it.
+		constexpr std::array<D3D11_INPUT_ELEMENT_DESC, 2> vertexDesc =
+		{{
+			{"POSITION", 0, DXGI_FORMAT_R16G16B16A16_SNORM, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0},
+			{"COLOR", 0, DXGI_FORMAT_R16G16B16A16_SNORM, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0}
+		} };
+
+		DX::ThrowIfFailed(
+			m_deviceResources->GetD3DDevice()->CreateInputLayout(
+				vertexDesc.data(),
+				vertexDesc.size(),
+				fileData.data(),
+				fileData.size(),
+				&m_inputLayout
+				)
+			);
+
+		const CD3D11_BUFFER_DESC constantBufferDesc(sizeof(ModelConstantBuffer), D3D11_BIND_CONSTANT_BUFFER);
+		DX::ThrowIfFailed(
+			m_deviceResources->GetD3DDevice()->CreateBuffer(
+				&constantBufferDesc,
+				nullptr,
+				&m_modelConstantBuffer
+				)
+			);
+
+		CD3D11_RASTERIZER_DESC rasterizerDesc(D3D11_DEFAULT);
+		rasterizerDesc.CullMode = D3D11_CULL_NONE;
+		DX::ThrowIfFailed(
+			m_deviceResources->GetD3DDevice()->CreateRasterizerState(
+				&rasterizerDesc,
+				&m_rasterizerState
+				)
+			);
+	});
+
+	task<void> createGSTask;
+	if (!m_usingVprtShaders)
+	{
+		// After the pass-through geometry shader file is loaded, create the shader.
+		createGSTask = loadGSTask.then([this](const std::vector<byte>& fileData)
+		{
+			DX::ThrowIfFailed(
+				m_deviceResources->GetD3DDevice()->CreateGeometryShader(
+					fileData.data(),
+					fileData.size(),
+					nullptr,
+					&m_geometryShader
+					)
+				);
+		});
+	}
+
+	task<void> shaderTaskGroup = m_usingVprtShaders ? createVSTask : (createVSTask && createGSTask);
+	return shaderTaskGroup.then([this]()
+	{
+		m_loadingComplete = true;
+
+		// Surface buffers are dropped with the device; request them all again.
+		if (m_surfaceObserver != nullptr)
+		{
+			OnSurfacesChanged(m_surfaceObserver, nullptr);
+		}
+	});
+}
+
+void SpatialSurfaceRenderer::ReleaseDeviceDependentResources()
+{
+	m_loadingComplete = false;
+	m_usingVprtShaders = false;
+	m_vertexShader.Reset();
+	m_inputLayout.Reset();
+	m_geometryShader.Reset();
+	m_modelConstantBuffer.Reset();
+	m_rasterizerState.Reset();
+
+	std::lock_guard<std::mutex> lock(m_surfacesMutex);
+	m_surfaces.clear();
+}
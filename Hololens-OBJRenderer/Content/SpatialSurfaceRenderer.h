@@ -0,0 +1,92 @@
+#pragma once
+
+#include "..\Common\DeviceResources.h"
+#include "..\Common\CameraResources.h"
+#include "ShaderStructures.h"
+
+#include <ppltasks.h>
+#include <map>
+#include <mutex>
+
+namespace Hololens_OBJRenderer
+{
+	// Observes the spatial mapping surfaces around the user and draws them into the
+	// depth buffer of each holographic camera, before the holograms are drawn. Depth
+	// tests then hide holograms behind real walls and furniture, and the holograms
+	// can be tested for occlusion before they are shaded.
+	class SpatialSurfaceRenderer
+	{
+	public:
+		SpatialSurfaceRenderer(const std::shared_ptr<DX::DeviceResources>& deviceResources);
+		~SpatialSurfaceRenderer();
+
+		// Asks for access to spatial mapping, then starts observing the surfaces within
+		// a box around the origin of coordinateSystem. Requires the spatialPerception
+		// capability. The task returns false if access was not granted.
+		concurrency::task<bool> StartObserving(Windows::Perception::Spatial::SpatialCoordinateSystem^ coordinateSystem);
+
+		concurrency::task<void> CreateDeviceDependentResources();
+		void ReleaseDeviceDependentResources();
+
+		// Locates the surfaces in the coordinate system used for rendering this frame.
+		void Update(Windows::Perception::Spatial::SpatialCoordinateSystem^ coordinateSystem);
+
+		// Draws the surfaces into the depth buffer bound for the current camera. Writes no color.
+		void RenderDepth();
+
+		// True once at least one surface can be drawn.
+		bool HasSurfaces() const;
+
+	private:
+		// A surface mesh and the buffers it was copied into.
+		struct SurfaceMesh
+		{
+			Windows::Perception::Spatial::Surfaces::SpatialSurfaceMesh^		mesh;
+			Windows::Foundation::DateTime									updateTime;
+			Microsoft::WRL::ComPtr<ID3D11Buffer>							vertexBuffer;
+			Microsoft::WRL::ComPtr<ID3D11Buffer>							indexBuffer;
+			UINT															vertexStride = 0;
+			UINT															indexCount = 0;
+			DXGI_FORMAT														indexFormat = DXGI_FORMAT_R16_UINT;
+
+			// Model transform into the rendering coordinate system, transposed for the
+			// shader. Not valid while the surface cannot be located.
+			ModelConstantBuffer												model;
+			bool															located = false;
+		};
+
+		// Requests meshes for new and updated surfaces, and drops the removed ones.
+		void OnSurfacesChanged(Windows::Perception::Spatial::Surfaces::SpatialSurfaceObserver^ sender, Platform::Object^ args);
+
+		// Copies a computed mesh into vertex and index buffers.
+		void CreateBuffers(SurfaceMesh& surface);
+
+		// Cached pointer to device resources.
+		std::shared_ptr<DX::DeviceResources>								m_deviceResources;
+
+		// Direct3D resources for the depth-only pass.
+		Microsoft::WRL::ComPtr<ID3D11InputLayout>							m_inputLayout;
+		Microsoft::WRL::ComPtr<ID3D11VertexShader>							m_vertexShader;
+		Microsoft::WRL::ComPtr<ID3D11GeometryShader>						m_geometryShader;
+		Microsoft::WRL::ComPtr<ID3D11Buffer>								m_modelConstantBuffer;
+		Microsoft::WRL::ComPtr<ID3D11RasterizerState>						m_rasterizerState;
+
+		// Surface observation. The observer raises its events on worker threads, so
+		// m_surfaces is guarded by m_surfacesMutex.
+		Windows::Perception::Spatial::Surfaces::SpatialSurfaceObserver^	m_surfaceObserver;
+		Windows::Perception::Spatial::Surfaces::SpatialSurfaceMeshOptions^	m_meshOptions;
+		Windows::Foundation::EventRegistrationToken							m_surfacesChangedToken;
+		std::map<Platform::Guid, SurfaceMesh>								m_surfaces;
+		mutable std::mutex													m_surfacesMutex;
+
+		// Mesh density requested from the system. The surfaces only need to be good
+		// enough for occlusion.
+		double																m_trianglesPerCubicMeter = 500.0;
+
+		bool																m_loadingComplete = false;
+
+		// If the current D3D Device supports VPRT, we can avoid using a geometry
+		// shader just to set the render target array index.
+		bool																m_usingVprtShaders = false;
+	};
+}
@@ -168,14 +168,14 @@ void SpinningCubeRenderer::CreateDeviceDependentResources()
     std::wstring vertexShaderFileName = m_usingVprtShaders ? L"ms-appx:///VprtVertexShader.cso" : L"ms-appx:///VertexShader.cso";
 
     // Load shaders asynchronously.
-    task<std::vector<byte>> loadVSTask = DX::ReadDataAsync(vertexShaderFileName);
-    task<std::vector<byte>> loadPSTask = DX::ReadDataAsync(L"ms-appx:///PixelShader.cso");
+    task<std::vector<byte>> loadVSTask = DX::ReadCachedDataAsync(vertexShaderFileName);
+    task<std::vector<byte>> loadPSTask = DX::ReadCachedDataAsync(L"ms-appx:///PixelShader.cso");
 
     task<std::vector<byte>> loadGSTask;
     if (!m_usingVprtShaders)
     {
         // Load the pass-through geometry shader.
-        loadGSTask = DX::ReadDataAsync(L"ms-appx:///GeometryShader.cso");
+        loadGSTask = DX::ReadCachedDataAsync(L"ms-appx:///GeometryShader.cso");
     }
 
     // After the vertex shader file is loaded, create the shader and input layout.
@@ -0,0 +1,289 @@
+#include "pch.h"
+#include "StereoModeBenchmark.h"
+#include "Common\DirectXHelper.h"
+
+#include <algorithm>
+#include <cfloat>
+
+using namespace Hololens_OBJRenderer;
+using namespace concurrency;
+using namespace DirectX;
+using namespace Windows::Foundation::Numerics;
+using namespace Windows::Graphics::Holographic;
+
+namespace
+{
+	// A square of instances, c_gridSide on a side and c_spacing meters apart, seen
+	// from c_cameraDistance meters. Enough vertices that the cost of the geometry
+	// shader shows, in a target small enough that pixels do not hide it.
+	constexpr uint32 c_gridSide = 5;
+	constexpr float c_spacing = 0.25f;
+	constexpr float c_cameraDistance = 1.5f;
+	constexpr float c_renderTargetWidth = 640.f;
+	constexpr float c_renderTargetHeight = 360.f;
+	constexpr float c_verticalFieldOfViewDegrees = 17.5f;
+	constexpr float c_eyeSeparation = 0.064f;
+
+	// Frames drawn before timing starts, while the driver settles, then frames timed.
+	constexpr uint32 c_warmupFrames = 4;
+	constexpr uint32 c_timedFrames = 24;
+
+	const wchar_t* GetModeName(OBJStereoMode mode)
+	{
+		switch (mode)
+		{
+		case OBJStereoMode::Vprt:			return L"VPRT";
+		case OBJStereoMode::GeometryShader:	return L"geometry shader";
+		default:							return L"draw per eye";
+		}
+	}
+}
+
+StereoModeBenchmark::StereoModeBenchmark(
+	const std::shared_ptr<DX::DeviceResources>& deviceResources,
+	const std::shared_ptr<ResourceCache>& resourceCache,
+	const std::string& fileName) :
+	m_deviceResources(deviceResources)
+{
+	// Every renderer draws the same static scene.
+	std::vector<task<void>> loadTasks;
+	for (OBJStereoMode mode : { OBJStereoMode::Vprt, OBJStereoMode::GeometryShader, OBJStereoMode::DrawPerEye })
+	{
+		if (!OBJRenderer::IsStereoModeSupported(*m_deviceResources, mode))
+		{
+			continue;
+		}
+
+		Candidate candidate;
+		candidate.mode = mode;
+		candidate.renderer = std::make_unique<OBJRenderer>(m_deviceResources, resourceCache);
+		candidate.renderer->SetStereoMode(mode);
+		candidate.renderer->SetPosition({ 0.f, 0.f, 0.f });
+		candidate.renderer->SetRotationSpeed(0.f);
+		loadTasks.push_back(candidate.renderer->LoadAsync(fileName));
+
+		const float center = 0.5f * static_cast<float>(c_gridSide - 1);
+		for (uint32 row = 0; row < c_gridSide; ++row)
+		{
+			for (uint32 column = 0; column < c_gridSide; ++column)
+			{
+				candidate.renderer->AddInstance(fileName, { c_spacing * (static_cast<float>(column) - center), c_spacing * (static_cast<float>(row) - center), 0.f });
+			}
+		}
+		m_candidates.push_back(std::move(candidate));
+	}
+
+	// A mesh that fails to load leaves nothing to time, and the benchmark never
+	// completes.
+	when_all(loadTasks.begin(), loadTasks.end()).then([this](task<void> loadTask)
+	{
+		try
+		{
+			loadTask.get();
+			m_sceneReady = true;
+		}
+		catch (Platform::Exception^)
+		{
+			OutputDebugStringW(L"The stereo mode benchmark could not load its mesh.\n");
+		}
+	});
+
+	m_cameraResources = std::make_unique<DX::CameraResources>(Windows::Foundation::Size(c_renderTargetWidth, c_renderTargetHeight));
+	CreateOffscreenResources();
+}
+
+void StereoModeBenchmark::CreateDeviceDependentResources()
+{
+	for (Candidate& candidate : m_candidates)
+	{
+		candidate.renderer->CreateDeviceDependentResources();
+	}
+	CreateOffscreenResources();
+}
+
+void StereoModeBenchmark::ReleaseDeviceDependentResources()
+{
+	for (Candidate& candidate : m_candidates)
+	{
+		candidate.renderer->ReleaseDeviceDependentResources();
+	}
+	m_cameraResources->ReleaseResourcesForBackBuffer(m_deviceResources.get());
+	m_frameQueries.clear();
+}
+
+void StereoModeBenchmark::CreateOffscreenResources()
+{
+	const auto device = m_deviceResources->GetD3DDevice();
+	m_cameraResources->CreateOffscreenResources(m_deviceResources.get());
+
+	// Every timed frame keeps queries of its own, so that none is reused before it
+	// was read back.
+	const CD3D11_QUERY_DESC disjointDesc(D3D11_QUERY_TIMESTAMP_DISJOINT);
+	const CD3D11_QUERY_DESC timestampDesc(D3D11_QUERY_TIMESTAMP);
+	m_frameQueries.resize(c_timedFrames);
+	for (FrameQueries& queries : m_frameQueries)
+	{
+		DX::ThrowIfFailed(
+			device->CreateQuery(&disjointDesc, &queries.disjoint)
+			);
+		queries.timestamps.resize(2 * m_candidates.size());
+		for (auto& timestamp : queries.timestamps)
+		{
+			DX::ThrowIfFailed(
+				device->CreateQuery(&timestampDesc, &timestamp)
+				);
+		}
+	}
+
+	// Times from a lost device cannot be compared with the others.
+	m_renderedFrames = 0;
+	m_collectedFrames = 0;
+	for (Candidate& candidate : m_candidates)
+	{
+		candidate.gpuTimes.clear();
+	}
+}
+
+void StereoModeBenchmark::Render()
+{
+	if (m_complete || !m_sceneReady || m_frameQueries.empty())
+	{
+		return;
+	}
+	if (std::any_of(m_candidates.begin(), m_candidates.end(), [](const Candidate& candidate) { return !candidate.renderer->IsLoadingComplete(); }))
+	{
+		return;
+	}
+
+	CollectQueries();
+	if (m_collectedFrames == c_timedFrames)
+	{
+		Complete();
+		return;
+	}
+	if (m_renderedFrames == c_warmupFrames + c_timedFrames)
+	{
+		return;
+	}
+
+	// Both eyes look the same way, like the displays of the device.
+	const XMVECTOR forward = XMVectorSet(0.f, 0.f, -1.f, 0.f);
+	const XMVECTOR up = XMVectorSet(0.f, 1.f, 0.f, 0.f);
+	const XMVECTOR position = XMVectorSet(0.f, 0.f, c_cameraDistance, 1.f);
+	const XMVECTOR halfSeparation = XMVectorSet(0.5f * c_eyeSeparation, 0.f, 0.f, 0.f);
+	HolographicStereoTransform viewTransform;
+	XMStoreFloat4x4(&viewTransform.Left, XMMatrixLookToRH(XMVectorSubtract(position, halfSeparation), forward, up));
+	XMStoreFloat4x4(&viewTransform.Right, XMMatrixLookToRH(XMVectorAdd(position, halfSeparation), forward, up));
+	HolographicStereoTransform projectionTransform;
+	XMStoreFloat4x4(
+		&projectionTransform.Left,
+		XMMatrixPerspectiveFovRH(XMConvertToRadians(c_verticalFieldOfViewDegrees), c_renderTargetWidth / c_renderTargetHeight, 0.1f, 20.f));
+	projectionTransform.Right = projectionTransform.Left;
+
+	const auto context = m_deviceResources->GetD3DDeviceContext();
+	const bool timed = m_renderedFrames >= c_warmupFrames;
+	const FrameQueries* queries = timed ? &m_frameQueries[m_renderedFrames - c_warmupFrames] : nullptr;
+	if (timed)
+	{
+		context->Begin(queries->disjoint.Get());
+	}
+
+	m_timer.Tick([]() {});
+	ID3D11RenderTargetView* const targets[1] = { m_cameraResources->GetBackBufferRenderTargetView() };
+	ID3D11DepthStencilView* const depthStencilView = m_cameraResources->GetDepthStencilView();
+	for (size_t i = 0; i < m_candidates.size(); ++i)
+	{
+		OBJRenderer& renderer = *m_candidates[i].renderer;
+		renderer.Update(m_timer);
+		m_cameraResources->UpdateViewProjectionBuffer(m_deviceResources, viewTransform, projectionTransform);
+
+		context->OMSetRenderTargets(1, targets, depthStencilView);
+		context->ClearRenderTargetView(targets[0], DirectX::Colors::Transparent);
+		context->ClearDepthStencilView(depthStencilView, D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1.0f, 0);
+		if (timed)
+		{
+			context->End(queries->timestamps[2 * i].Get());
+		}
+		if (m_cameraResources->AttachViewProjectionBuffer(m_deviceResources))
+		{
+			renderer.Render(m_cameraResources.get());
+		}
+		if (timed)
+		{
+			context->End(queries->timestamps[2 * i + 1].Get());
+		}
+	}
+
+	if (timed)
+	{
+		context->End(queries->disjoint.Get());
+	}
+	++m_renderedFrames;
+}
+
+void StereoModeBenchmark::CollectQueries()
+{
+	const auto context = m_deviceResources->GetD3DDeviceContext();
+	while (m_collectedFrames + c_warmupFrames < m_renderedFrames)
+	{
+		const FrameQueries& queries = m_frameQueries[m_collectedFrames];
+		D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+		if (context->GetData(queries.disjoint.Get(), &disjoint, sizeof(disjoint), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+		{
+			return;
+		}
+		++m_collectedFrames;
+		if (disjoint.Disjoint)
+		{
+			continue;
+		}
+
+		// The timestamps are done once the disjoint query is.
+		for (size_t i = 0; i < m_candidates.size(); ++i)
+		{
+			UINT64 begin;
+			UINT64 end;
+			if (context->GetData(queries.timestamps[2 * i].Get(), &begin, sizeof(begin), D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK &&
+				context->GetData(queries.timestamps[2 * i + 1].Get(), &end, sizeof(end), D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK)
+			{
+				m_candidates[i].gpuTimes.push_back(static_cast<float>(1000.0 * static_cast<double>(end - begin) / static_cast<double>(disjoint.Frequency)));
+			}
+		}
+	}
+}
+
+void StereoModeBenchmark::Complete()
+{
+	// Without any time, the first mode, which renderers use by default, is kept.
+	m_fastestMode = m_candidates.front().mode;
+	float fastestTime = FLT_MAX;
+	for (Candidate& candidate : m_candidates)
+	{
+		if (candidate.gpuTimes.empty())
+		{
+			continue;
+		}
+		std::sort(candidate.gpuTimes.begin(), candidate.gpuTimes.end());
+		const float median = candidate.gpuTimes[candidate.gpuTimes.size() / 2];
+		m_medianGpuTimes[static_cast<size_t>(candidate.mode)] = median;
+		if (median < fastestTime)
+		{
+			fastestTime = median;
+			m_fastestMode = candidate.mode;
+		}
+
+		wchar_t message[128];
+		swprintf_s(message, L"Stereo mode %s: %.3f ms median over %zu frames.\n", GetModeName(candidate.mode), median, candidate.gpuTimes.size());
+		OutputDebugStringW(message);
+	}
+
+	wchar_t message[128];
+	swprintf_s(message, L"Stereo mode %s is the fastest.\n", GetModeName(m_fastestMode));
+	OutputDebugStringW(message);
+
+	// The renderers are no longer needed; they let go of their meshes.
+	m_candidates.clear();
+	m_frameQueries.clear();
+	m_cameraResources->ReleaseResourcesForBackBuffer(m_deviceResources.get());
+	m_complete = true;
+}
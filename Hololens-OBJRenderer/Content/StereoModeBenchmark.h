@@ -0,0 +1,94 @@
+#pragma once
+
+#include "..\Common\DeviceResources.h"
+#include "..\Common\CameraResources.h"
+#include "..\Common\StepTimer.h"
+#include "OBJRenderer.h"
+#include "ResourceCache.h"
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Hololens_OBJRenderer
+{
+	// Picks the fastest OBJStereoMode of this device. A renderer per supported mode
+	// draws the same grid of instances of a mesh into a small offscreen stereo
+	// target, once each per frame, and each draw is timed with timestamp queries.
+	// The queries are read back frames later without stalling. Once every frame is
+	// timed, the mode with the lowest median GPU time is reported with
+	// OutputDebugString. Meant to run once at startup, for a few dozen frames.
+	class StereoModeBenchmark
+	{
+	public:
+		// Draws LocalFolder\fileName, from resourceCache, whose owner updates it.
+		StereoModeBenchmark(
+			const std::shared_ptr<DX::DeviceResources>& deviceResources,
+			const std::shared_ptr<ResourceCache>& resourceCache,
+			const std::string& fileName);
+
+		// A lost device starts the benchmark over.
+		void CreateDeviceDependentResources();
+		void ReleaseDeviceDependentResources();
+
+		// Draws the next frame of the benchmark with every mode, and collects the
+		// times of earlier frames. Call once per frame on the rendering thread, ahead
+		// of the cameras; does nothing once the benchmark is complete.
+		void Render();
+
+		bool IsComplete() const										{ return m_complete; }
+
+		// Valid once the benchmark is complete.
+		OBJStereoMode GetFastestMode() const						{ return m_fastestMode; }
+
+		// Median GPU time of each mode, in milliseconds, or 0 for modes the device
+		// does not support. Valid once the benchmark is complete.
+		float GetGpuTime(OBJStereoMode mode) const					{ return m_medianGpuTimes[static_cast<size_t>(mode)]; }
+
+	private:
+		static constexpr size_t c_modeCount = 3;
+
+		// One mode, drawn by a renderer of its own.
+		struct Candidate
+		{
+			OBJStereoMode						mode;
+			std::unique_ptr<OBJRenderer>		renderer;
+			std::vector<float>					gpuTimes;
+		};
+
+		// The queries that time one frame: the draws of each candidate, in the order of
+		// m_candidates.
+		struct FrameQueries
+		{
+			Microsoft::WRL::ComPtr<ID3D11Query>							disjoint;
+			std::vector<Microsoft::WRL::ComPtr<ID3D11Query>>			timestamps;
+		};
+
+		void CreateOffscreenResources();
+
+		// Reads back the queries of the frames the GPU is done with, oldest first.
+		void CollectQueries();
+
+		// Picks the fastest mode and reports the times of all of them.
+		void Complete();
+
+		// Cached pointer to device resources.
+		std::shared_ptr<DX::DeviceResources>				m_deviceResources;
+
+		std::vector<Candidate>								m_candidates;
+		std::unique_ptr<DX::CameraResources>				m_cameraResources;
+		std::vector<FrameQueries>							m_frameQueries;
+		DX::StepTimer										m_timer;
+		std::atomic<bool>									m_sceneReady = { false };
+
+		// Frames drawn, including the warm-up frames, and frames read back.
+		uint32												m_renderedFrames = 0;
+		uint32												m_collectedFrames = 0;
+
+		bool												m_complete = false;
+		OBJStereoMode										m_fastestMode = OBJStereoMode::GeometryShader;
+		std::array<float, c_modeCount>						m_medianGpuTimes = {};
+	};
+}
@@ -0,0 +1,358 @@
+#include "pch.h"
+#include "TextureCompressor.h"
+
+#include <algorithm>
+#include <ppl.h>
+
+using namespace Hololens_OBJRenderer;
+using namespace Microsoft::WRL;
+
+namespace
+{
+	inline uint32 Channel(uint32 pixel, int channel)
+	{
+		return (pixel >> (8 * channel)) & 0xff;
+	}
+
+	// Averages each 2x2 square of pixels. Odd rows and columns are folded into the
+	// last pixel of the smaller level, which then averages up to 3x3 pixels.
+	void DownsampleImage(const uint32* source, UINT width, UINT height, std::vector<uint32>& target)
+	{
+		const UINT targetWidth = (std::max)(1u, width / 2);
+		const UINT targetHeight = (std::max)(1u, height / 2);
+		target.resize(static_cast<size_t>(targetWidth) * targetHeight);
+
+		for (UINT y = 0; y < targetHeight; ++y)
+		{
+			const UINT y0 = 2 * y;
+			const UINT y1 = y + 1 == targetHeight ? height : (std::min)(2 * y + 2, height);
+			for (UINT x = 0; x < targetWidth; ++x)
+			{
+				const UINT x0 = 2 * x;
+				const UINT x1 = x + 1 == targetWidth ? width : (std::min)(2 * x + 2, width);
+
+				uint32 sums[4] = {};
+				for (UINT sourceY = y0; sourceY < y1; ++sourceY)
+				{
+					for (UINT sourceX = x0; sourceX < x1; ++sourceX)
+					{
+						const uint32 sourcePixel = source[sourceY * width + sourceX];
+						for (int channel = 0; channel < 4; ++channel)
+						{
+							sums[channel] += Channel(sourcePixel, channel);
+						}
+					}
+				}
+
+				const uint32 count = (y1 - y0) * (x1 - x0);
+				uint32 pixel = 0;
+				for (int channel = 0; channel < 4; ++channel)
+				{
+					pixel |= ((sums[channel] + count / 2) / count) << (8 * channel);
+				}
+				target[y * targetWidth + x] = pixel;
+			}
+		}
+	}
+
+	inline uint16 ToRGB565(const int (&color)[3])
+	{
+		return static_cast<uint16>(((color[0] >> 3) << 11) | ((color[1] >> 2) << 5) | (color[2] >> 3));
+	}
+
+	inline void FromRGB565(uint16 packed, int (&color)[3])
+	{
+		const int r = (packed >> 11) & 0x1f;
+		const int g = (packed >> 5) & 0x3f;
+		const int b = packed & 0x1f;
+		color[0] = (r << 3) | (r >> 2);
+		color[1] = (g << 2) | (g >> 4);
+		color[2] = (b << 3) | (b >> 2);
+	}
+
+	// Writes the 8 byte color block of 16 pixels. The end points are opposite
+	// corners of the colors' bounding box, inset by a sixteenth to make up for the
+	// extremes being rare, on the diagonal that follows how the channels vary
+	// together. Each pixel takes the nearest of the four palette colors.
+	void CompressColorBlock(const uint32 (&block)[16], byte* output)
+	{
+		int minColor[3] = { 255, 255, 255 };
+		int maxColor[3] = { 0, 0, 0 };
+		int sum[3] = { 0, 0, 0 };
+		for (const uint32 pixel : block)
+		{
+			for (int channel = 0; channel < 3; ++channel)
+			{
+				const int value = static_cast<int>(Channel(pixel, channel));
+				minColor[channel] = (std::min)(minColor[channel], value);
+				maxColor[channel] = (std::max)(maxColor[channel], value);
+				sum[channel] += value;
+			}
+		}
+		for (int channel = 0; channel < 3; ++channel)
+		{
+			const int inset = (maxColor[channel] - minColor[channel]) >> 4;
+			minColor[channel] = (std::min)(255, minColor[channel] + inset);
+			maxColor[channel] = (std::max)(0, maxColor[channel] - inset);
+		}
+
+		// The channel with the widest range leads; a channel that falls as it rises
+		// has its end points swapped.
+		int lead = 0;
+		for (int channel = 1; channel < 3; ++channel)
+		{
+			if (maxColor[channel] - minColor[channel] > maxColor[lead] - minColor[lead])
+			{
+				lead = channel;
+			}
+		}
+		int covariance[3] = { 0, 0, 0 };
+		for (const uint32 pixel : block)
+		{
+			const int leadOffset = 16 * static_cast<int>(Channel(pixel, lead)) - sum[lead];
+			for (int channel = 0; channel < 3; ++channel)
+			{
+				covariance[channel] += leadOffset * (16 * static_cast<int>(Channel(pixel, channel)) - sum[channel]);
+			}
+		}
+		for (int channel = 0; channel < 3; ++channel)
+		{
+			if (covariance[channel] < 0)
+			{
+				std::swap(minColor[channel], maxColor[channel]);
+			}
+		}
+
+		// The first end point must be the larger for BC1 to use four colors.
+		uint16 color0 = ToRGB565(maxColor);
+		uint16 color1 = ToRGB565(minColor);
+		if (color0 < color1)
+		{
+			std::swap(color0, color1);
+		}
+
+		int palette[4][3];
+		FromRGB565(color0, palette[0]);
+		FromRGB565(color1, palette[1]);
+		for (int channel = 0; channel < 3; ++channel)
+		{
+			palette[2][channel] = (2 * palette[0][channel] + palette[1][channel]) / 3;
+			palette[3][channel] = (palette[0][channel] + 2 * palette[1][channel]) / 3;
+		}
+
+		uint32 indices = 0;
+		if (color0 != color1)
+		{
+			for (int i = 0; i < 16; ++i)
+			{
+				int best = 0;
+				int bestDistance = INT_MAX;
+				for (int candidate = 0; candidate < 4; ++candidate)
+				{
+					int distance = 0;
+					for (int channel = 0; channel < 3; ++channel)
+					{
+						const int difference = static_cast<int>(Channel(block[i], channel)) - palette[candidate][channel];
+						distance += difference * difference;
+					}
+					if (distance < bestDistance)
+					{
+						bestDistance = distance;
+						best = candidate;
+					}
+				}
+				indices |= static_cast<uint32>(best) << (2 * i);
+			}
+		}
+
+		memcpy(output, &color0, 2);
+		memcpy(output + 2, &color1, 2);
+		memcpy(output + 4, &indices, 4);
+	}
+
+	// Writes the 8 byte alpha block of BC3 in its eight value mode, with end points
+	// fitted the same way as the colors.
+	void CompressAlphaBlock(const uint32 (&block)[16], byte* output)
+	{
+		int minAlpha = 255;
+		int maxAlpha = 0;
+		for (const uint32 pixel : block)
+		{
+			const int alpha = static_cast<int>(Channel(pixel, 3));
+			minAlpha = (std::min)(minAlpha, alpha);
+			maxAlpha = (std::max)(maxAlpha, alpha);
+		}
+		const int inset = (maxAlpha - minAlpha) >> 5;
+		minAlpha += inset;
+		maxAlpha -= inset;
+
+		int palette[8] = { maxAlpha, minAlpha };
+		for (int i = 1; i < 7; ++i)
+		{
+			palette[i + 1] = ((7 - i) * maxAlpha + i * minAlpha) / 7;
+		}
+
+		uint64 indices = 0;
+		if (maxAlpha != minAlpha)
+		{
+			for (int i = 0; i < 16; ++i)
+			{
+				const int alpha = static_cast<int>(Channel(block[i], 3));
+				int best = 0;
+				for (int candidate = 1; candidate < 8; ++candidate)
+				{
+					if (abs(alpha - palette[candidate]) < abs(alpha - palette[best]))
+					{
+						best = candidate;
+					}
+				}
+				indices |= static_cast<uint64>(best) << (3 * i);
+			}
+		}
+
+		output[0] = static_cast<byte>(maxAlpha);
+		output[1] = static_cast<byte>(minAlpha);
+		for (int i = 0; i < 6; ++i)
+		{
+			output[2 + i] = static_cast<byte>(indices >> (8 * i));
+		}
+	}
+
+	void CompressLevel(const uint32* pixels, UINT width, UINT height, DXGI_FORMAT format, std::vector<byte>& level)
+	{
+		UINT rowPitch, rowCount;
+		DDSTexture::GetLevelPitch(format, width, height, rowPitch, rowCount);
+		level.resize(static_cast<size_t>(rowPitch) * rowCount);
+
+		const bool hasAlpha = format == DXGI_FORMAT_BC3_UNORM;
+		const UINT blockBytes = hasAlpha ? 16 : 8;
+		concurrency::parallel_for(0u, rowCount, [&](UINT blockRow)
+		{
+			byte* output = level.data() + static_cast<size_t>(blockRow) * rowPitch;
+			for (UINT blockX = 0; blockX < rowPitch / blockBytes; ++blockX)
+			{
+				// Blocks that stick out of the image repeat its last row and column.
+				uint32 block[16];
+				for (UINT i = 0; i < 16; ++i)
+				{
+					const UINT x = (std::min)(4 * blockX + i % 4, width - 1);
+					const UINT y = (std::min)(4 * blockRow + i / 4, height - 1);
+					block[i] = pixels[y * width + x];
+				}
+
+				if (hasAlpha)
+				{
+					CompressAlphaBlock(block, output);
+					output += 8;
+				}
+				CompressColorBlock(block, output);
+				output += 8;
+			}
+		});
+	}
+
+	// Decodes the first frame of an image file to 32-bit RGBA.
+	bool DecodeImage(IWICImagingFactory2* wicFactory, const std::wstring& fileName, UINT& width, UINT& height, std::vector<uint32>& pixels)
+	{
+		ComPtr<IWICBitmapDecoder> decoder;
+		ComPtr<IWICBitmapFrameDecode> frame;
+		if (FAILED(wicFactory->CreateDecoderFromFilename(fileName.c_str(), nullptr, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &decoder)) ||
+			FAILED(decoder->GetFrame(0, &frame)) ||
+			FAILED(frame->GetSize(&width, &height)) ||
+			width == 0 || height == 0 || width > D3D11_REQ_TEXTURE2D_U_OR_V_DIMENSION || height > D3D11_REQ_TEXTURE2D_U_OR_V_DIMENSION)
+		{
+			return false;
+		}
+
+		// The top level of a block compressed texture is made of whole blocks, so
+		// other sizes are stretched to the next multiple of the block size.
+		ComPtr<IWICBitmapSource> source = frame;
+		const UINT blockWidth = (width + 3) & ~3u;
+		const UINT blockHeight = (height + 3) & ~3u;
+		if (blockWidth != width || blockHeight != height)
+		{
+			ComPtr<IWICBitmapScaler> scaler;
+			if (FAILED(wicFactory->CreateBitmapScaler(&scaler)) ||
+				FAILED(scaler->Initialize(frame.Get(), blockWidth, blockHeight, WICBitmapInterpolationModeFant)))
+			{
+				return false;
+			}
+			source = scaler;
+			width = blockWidth;
+			height = blockHeight;
+		}
+
+		ComPtr<IWICFormatConverter> converter;
+		if (FAILED(wicFactory->CreateFormatConverter(&converter)) ||
+			FAILED(converter->Initialize(source.Get(), GUID_WICPixelFormat32bppRGBA, WICBitmapDitherTypeNone, nullptr, 0.0, WICBitmapPaletteTypeCustom)))
+		{
+			return false;
+		}
+
+		pixels.resize(static_cast<size_t>(width) * height);
+		return SUCCEEDED(converter->CopyPixels(nullptr, width * 4, static_cast<UINT>(pixels.size() * 4), reinterpret_cast<BYTE*>(pixels.data())));
+	}
+}
+
+void Hololens_OBJRenderer::CompressImage(const uint32* pixels, UINT width, UINT height, DXGI_FORMAT format, std::vector<std::vector<byte>>& levels)
+{
+	levels.clear();
+	std::vector<uint32> current;
+	std::vector<uint32> next;
+	for (;;)
+	{
+		levels.emplace_back();
+		CompressLevel(pixels, width, height, format, levels.back());
+		if (width == 1 && height == 1)
+		{
+			break;
+		}
+
+		DownsampleImage(pixels, width, height, next);
+		current.swap(next);
+		pixels = current.data();
+		width = (std::max)(1u, width / 2);
+		height = (std::max)(1u, height / 2);
+	}
+}
+
+bool Hololens_OBJRenderer::OpenCompressedTexture(IWICImagingFactory2* wicFactory, const std::wstring& imageFileName, DDSTexture& texture)
+{
+	const size_t nameStart = imageFileName.find_last_of(L"\\/") + 1;
+	const size_t extension = imageFileName.find_last_of(L'.');
+	const std::wstring baseName = extension != std::wstring::npos && extension >= nameStart ? imageFileName.substr(0, extension) : imageFileName;
+	if (texture.Open(baseName + L".dds"))
+	{
+		return true;
+	}
+
+	MeshCacheSource source;
+	if (!source.Query(imageFileName))
+	{
+		return false;
+	}
+
+	const std::wstring cacheFileName = imageFileName + L".texcache";
+	if (texture.Open(cacheFileName))
+	{
+		if (texture.IsFrom(source))
+		{
+			return true;
+		}
+		texture.Close();
+	}
+
+	UINT width, height;
+	std::vector<uint32> pixels;
+	if (!DecodeImage(wicFactory, imageFileName, width, height, pixels))
+	{
+		return false;
+	}
+
+	const bool transparent = std::any_of(pixels.begin(), pixels.end(), [](uint32 pixel) { return Channel(pixel, 3) != 0xff; });
+	const DXGI_FORMAT format = transparent ? DXGI_FORMAT_BC3_UNORM : DXGI_FORMAT_BC1_UNORM;
+	std::vector<std::vector<byte>> levels;
+	CompressImage(pixels.data(), width, height, format, levels);
+
+	return DDSTexture::Write(cacheFileName, format, width, height, levels, source) && texture.Open(cacheFileName);
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "DDSTexture.h"
+
+#include <string>
+#include <vector>
+
+namespace Hololens_OBJRenderer
+{
+	// Opens the block compressed form of an image in texture. A DDS file with the
+	// same base name next to the image, such as wood.dds for wood.png, is used as it
+	// is. Otherwise the image is decoded with WIC, box filtered into a full mip chain
+	// and compressed to BC1, or to BC3 if any pixel is transparent, and the result is
+	// kept in imageFileName + ".texcache" for later loads. Returns false if no form of
+	// the image could be read.
+	bool OpenCompressedTexture(IWICImagingFactory2* wicFactory, const std::wstring& imageFileName, DDSTexture& texture);
+
+	// Compresses a 32-bit RGBA image, with red in the lowest byte, and every mip level
+	// filtered from it, to BC1 or BC3. Colors are fitted to the bounding box of each
+	// block, which is fast enough to run on load and close to the quality of an
+	// exhaustive search for photographic textures.
+	void CompressImage(const uint32* pixels, UINT width, UINT height, DXGI_FORMAT format, std::vector<std::vector<byte>>& levels);
+}
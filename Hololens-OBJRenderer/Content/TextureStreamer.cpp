@@ -0,0 +1,336 @@
+#include "pch.h"
+#include "TextureStreamer.h"
+#include "TextureCompressor.h"
+#include "Common\DirectXHelper.h"
+
+#include <algorithm>
+
+using namespace Hololens_OBJRenderer;
+using namespace DirectX;
+using namespace Microsoft::WRL;
+using namespace concurrency;
+
+StreamedTexture::StreamedTexture(std::unique_ptr<DDSTexture> file) :
+	m_file(std::move(file)),
+	m_color(1.f, 1.f, 1.f, 1.f)
+{
+	// The tail starts at the coarsest level that is small enough, or at the
+	// coarsest level a texture can start at if no such level can.
+	const UINT mipCount = m_file->GetMipCount();
+	for (UINT level = 0; level < mipCount; ++level)
+	{
+		if (!IsValidFirstLevel(level))
+		{
+			continue;
+		}
+		m_tailLevel = level;
+		const DDSLevel& data = m_file->GetLevel(level);
+		if ((std::max)(data.width, data.height) <= c_mipTailSize)
+		{
+			break;
+		}
+	}
+	m_residentLevel = m_tailLevel;
+}
+
+StreamedTexture::StreamedTexture(const XMFLOAT4& color) :
+	m_color(color)
+{
+}
+
+bool StreamedTexture::IsValidFirstLevel(UINT level) const
+{
+	const DDSLevel& data = m_file->GetLevel(level);
+	return level == 0 || !DDSTexture::IsBlockCompressed(m_file->GetFormat()) || (data.width % 4 == 0 && data.height % 4 == 0);
+}
+
+UINT StreamedTexture::SelectLevel(float pixels) const
+{
+	// Each level halves the size, so the coarsest level that still has a texel per
+	// pixel is log2(size / pixels) levels down.
+	const UINT size = (std::max)(m_file->GetWidth(), m_file->GetHeight());
+	UINT level = 0;
+	while (level < m_tailLevel && static_cast<float>(size >> (level + 1)) >= pixels)
+	{
+		++level;
+	}
+	while (!IsValidFirstLevel(level))
+	{
+		--level;
+	}
+	return level;
+}
+
+ComPtr<ID3D11ShaderResourceView> StreamedTexture::CreateView(ID3D11Device* device, UINT firstLevel) const
+{
+	std::vector<D3D11_SUBRESOURCE_DATA> levelData;
+	UINT width = 1;
+	UINT height = 1;
+	DXGI_FORMAT format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	uint32 texel = 0;
+	if (m_file)
+	{
+		const DDSLevel& first = m_file->GetLevel(firstLevel);
+		width = first.width;
+		height = first.height;
+		format = m_file->GetFormat();
+		for (UINT level = firstLevel; level < m_file->GetMipCount(); ++level)
+		{
+			const DDSLevel& data = m_file->GetLevel(level);
+			levelData.push_back({ data.data, data.rowPitch, data.size });
+		}
+	}
+	else
+	{
+		const float channels[] = { m_color.x, m_color.y, m_color.z, m_color.w };
+		for (int channel = 0; channel < 4; ++channel)
+		{
+			const float value = (std::min)((std::max)(channels[channel], 0.f), 1.f);
+			texel |= static_cast<uint32>(value * 255.f + 0.5f) << (8 * channel);
+		}
+		levelData.push_back({ &texel, sizeof(texel), sizeof(texel) });
+	}
+
+	const CD3D11_TEXTURE2D_DESC textureDesc(
+		format,
+		width,
+		height,
+		1,
+		static_cast<UINT>(levelData.size()),
+		D3D11_BIND_SHADER_RESOURCE,
+		D3D11_USAGE_IMMUTABLE);
+
+	ComPtr<ID3D11Texture2D> texture;
+	DX::ThrowIfFailed(device->CreateTexture2D(&textureDesc, levelData.data(), &texture));
+
+	ComPtr<ID3D11ShaderResourceView> view;
+	DX::ThrowIfFailed(device->CreateShaderResourceView(texture.Get(), nullptr, &view));
+	return view;
+}
+
+uint64 StreamedTexture::GetLevelBytes(UINT firstLevel) const
+{
+	if (!m_file)
+	{
+		return sizeof(uint32);
+	}
+
+	uint64 bytes = 0;
+	for (UINT level = firstLevel; level < m_file->GetMipCount(); ++level)
+	{
+		bytes += m_file->GetLevel(level).size;
+	}
+	return bytes;
+}
+
+uint64 StreamedTexture::GetResidentBytes() const
+{
+	return m_shaderResourceView ? GetLevelBytes(m_residentLevel) : 0;
+}
+
+void StreamedTexture::CreateDeviceDependentResources(ID3D11Device* device)
+{
+	if (m_shaderResourceView)
+	{
+		return;
+	}
+
+	m_residentLevel = m_tailLevel;
+	m_framesOverDetailed = 0;
+	m_shaderResourceView = CreateView(device, m_residentLevel);
+}
+
+void StreamedTexture::ReleaseDeviceDependentResources()
+{
+	m_shaderResourceView.Reset();
+
+	std::lock_guard<std::mutex> lock(m_loadMutex);
+	m_loadedView.Reset();
+	++m_deviceGeneration;
+}
+
+void StreamedTexture::Update(ID3D11Device* device, bool streaming)
+{
+	const float requestedPixels = m_requestedPixels;
+	m_requestedPixels = 0.f;
+	if (!m_file || !m_shaderResourceView)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(m_loadMutex);
+	if (m_loadedView)
+	{
+		m_shaderResourceView.Swap(m_loadedView);
+		m_residentLevel = m_loadedLevel;
+		m_loadedView.Reset();
+	}
+	if (m_loading)
+	{
+		return;
+	}
+
+	// Finer levels are loaded right away; coarser ones only once the finer levels
+	// have gone unused for a while.
+	UINT level = streaming ? SelectLevel(requestedPixels) : 0;
+	if (level <= m_residentLevel)
+	{
+		m_framesOverDetailed = 0;
+	}
+	else if (++m_framesOverDetailed < c_evictionDelayFrames)
+	{
+		level = m_residentLevel;
+	}
+	if (level == m_residentLevel)
+	{
+		return;
+	}
+
+	// The device is free threaded, so the texture is created, and its levels read
+	// out of the mapped file, on a worker thread.
+	m_loading = true;
+	const uint32 generation = m_deviceGeneration;
+	std::shared_ptr<StreamedTexture> self = shared_from_this();
+	ComPtr<ID3D11Device> loadDevice = device;
+	create_task([self, loadDevice, level, generation]()
+	{
+		ComPtr<ID3D11ShaderResourceView> view;
+		try
+		{
+			view = self->CreateView(loadDevice.Get(), level);
+		}
+		catch (Platform::Exception^)
+		{
+			// The device was lost meanwhile; the texture is created again with the
+			// new device.
+		}
+
+		std::lock_guard<std::mutex> lock(self->m_loadMutex);
+		if (view && generation == self->m_deviceGeneration)
+		{
+			self->m_loadedView = view;
+			self->m_loadedLevel = level;
+		}
+		self->m_loading = false;
+	});
+}
+
+TextureStreamer::TextureStreamer(const std::shared_ptr<DX::DeviceResources>& deviceResources) :
+	m_deviceResources(deviceResources)
+{
+}
+
+std::shared_ptr<StreamedTexture> TextureStreamer::FindOrAdd(const std::wstring& key, const std::function<std::shared_ptr<StreamedTexture>()>& create)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const auto found = m_textures.find(key);
+		if (found != m_textures.end())
+		{
+			std::shared_ptr<StreamedTexture> texture = found->second.lock();
+			if (texture)
+			{
+				return texture;
+			}
+		}
+	}
+
+	std::shared_ptr<StreamedTexture> texture = create();
+	if (texture)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_textures[key] = texture;
+	}
+	return texture;
+}
+
+std::shared_ptr<StreamedTexture> TextureStreamer::GetTexture(const std::wstring& fileName)
+{
+	std::lock_guard<std::mutex> lock(m_conversionMutex);
+	return FindOrAdd(fileName, [&]() -> std::shared_ptr<StreamedTexture>
+	{
+		std::unique_ptr<DDSTexture> file = std::make_unique<DDSTexture>();
+		if (!OpenCompressedTexture(m_deviceResources->GetWicImagingFactory(), fileName, *file))
+		{
+			return nullptr;
+		}
+		return std::make_shared<StreamedTexture>(std::move(file));
+	});
+}
+
+std::shared_ptr<StreamedTexture> TextureStreamer::GetSolidTexture(const XMFLOAT4& color)
+{
+	// The key cannot be mistaken for a file name.
+	wchar_t key[64];
+	swprintf_s(key, L"|%g %g %g %g", color.x, color.y, color.z, color.w);
+	return FindOrAdd(key, [&]() { return std::make_shared<StreamedTexture>(color); });
+}
+
+void TextureStreamer::Update()
+{
+	std::vector<std::shared_ptr<StreamedTexture>> textures;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (auto it = m_textures.begin(); it != m_textures.end();)
+		{
+			std::shared_ptr<StreamedTexture> texture = it->second.lock();
+			if (texture)
+			{
+				textures.push_back(std::move(texture));
+				++it;
+			}
+			else
+			{
+				it = m_textures.erase(it);
+			}
+		}
+	}
+
+	ID3D11Device* device = m_deviceResources->GetD3DDevice();
+	for (const std::shared_ptr<StreamedTexture>& texture : textures)
+	{
+		texture->CreateDeviceDependentResources(device);
+		texture->Update(device, m_streamingEnabled);
+	}
+}
+
+uint64 TextureStreamer::GetResidentBytes()
+{
+	uint64 bytes = 0;
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (const auto& entry : m_textures)
+	{
+		std::shared_ptr<StreamedTexture> texture = entry.second.lock();
+		if (texture)
+		{
+			bytes += texture->GetResidentBytes();
+		}
+	}
+	return bytes;
+}
+
+void TextureStreamer::Shrink()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (const auto& entry : m_textures)
+	{
+		std::shared_ptr<StreamedTexture> texture = entry.second.lock();
+		if (texture)
+		{
+			texture->Shrink();
+		}
+	}
+}
+
+void TextureStreamer::ReleaseDeviceDependentResources()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (const auto& entry : m_textures)
+	{
+		std::shared_ptr<StreamedTexture> texture = entry.second.lock();
+		if (texture)
+		{
+			texture->ReleaseDeviceDependentResources();
+		}
+	}
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include "..\Common\DeviceResources.h"
+#include "DDSTexture.h"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Hololens_OBJRenderer
+{
+	// A texture of a material, with only as many mip levels on the GPU as it is seen
+	// to need. The DDS file stays mapped, and a texture made of the levels from the
+	// finest one needed down to 1x1 is created from it directly, on a worker thread,
+	// whenever the need changes. Until a finer texture is ready, the current one
+	// keeps being drawn; levels that are no longer needed are dropped after a delay,
+	// so that a texture does not flicker between two levels.
+	//
+	// Textures without a file hold a single texel of a solid color.
+	class StreamedTexture : public std::enable_shared_from_this<StreamedTexture>
+	{
+	public:
+		explicit StreamedTexture(std::unique_ptr<DDSTexture> file);
+		explicit StreamedTexture(const DirectX::XMFLOAT4& color);
+
+		// Creates the mip tail, the levels of at most c_mipTailSize texels across, on
+		// the calling thread. Does nothing if the texture already exists.
+		void CreateDeviceDependentResources(ID3D11Device* device);
+		void ReleaseDeviceDependentResources();
+
+		// nullptr until CreateDeviceDependentResources was called.
+		ID3D11ShaderResourceView* GetShaderResourceView() const				{ return m_shaderResourceView.Get(); }
+
+		// Asks for enough detail to cover pixels on screen. The largest request of a
+		// frame wins.
+		void RequestDetail(float pixels)										{ m_requestedPixels = (std::max)(m_requestedPixels, pixels); }
+
+		// Starts loading the levels requested this frame, and swaps in a texture that
+		// finished loading. Without streaming, every level is loaded. Call once per
+		// frame on the rendering thread.
+		void Update(ID3D11Device* device, bool streaming);
+
+		// Finest level on the GPU. Every coarser level is there as well.
+		UINT GetResidentLevel() const											{ return m_residentLevel; }
+
+		// Size of the levels on the GPU; 0 without a texture.
+		uint64 GetResidentBytes() const;
+
+		// Drops the levels that were not requested at the next Update, without
+		// waiting for them to go unused for a while. Can be called from any thread.
+		void Shrink()															{ m_framesOverDetailed = c_evictionDelayFrames; }
+
+	private:
+		// Textures of at most this many texels across are always resident.
+		static constexpr UINT c_mipTailSize = 64;
+
+		// Frames a texture keeps levels it no longer needs.
+		static constexpr UINT c_evictionDelayFrames = 90;
+
+		// Whether the texture can start at level: block compressed textures must
+		// be a multiple of four texels across at their first level.
+		bool IsValidFirstLevel(UINT level) const;
+
+		// The level that covers pixels on screen with at least one texel per pixel.
+		UINT SelectLevel(float pixels) const;
+
+		// Creates a texture of the levels from firstLevel down.
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> CreateView(ID3D11Device* device, UINT firstLevel) const;
+		uint64 GetLevelBytes(UINT firstLevel) const;
+
+		std::unique_ptr<DDSTexture>							m_file;
+		DirectX::XMFLOAT4									m_color;
+
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>	m_shaderResourceView;
+		UINT												m_residentLevel = 0;
+		UINT												m_tailLevel = 0;
+		float												m_requestedPixels = 0.f;
+
+		// Frames in a row the texture had finer levels than requested. Set by Shrink
+		// from any thread.
+		std::atomic<UINT>									m_framesOverDetailed = { 0 };
+
+		// A texture being created on a worker thread. Textures created before the
+		// device resources were released are thrown away.
+		std::mutex											m_loadMutex;
+		Microsoft::WRL::ComPtr<ID3D11ShaderResourceView>	m_loadedView;
+		UINT												m_loadedLevel = 0;
+		bool												m_loading = false;
+		uint32												m_deviceGeneration = 0;
+	};
+
+	// Keeps one StreamedTexture per image file, shared by every material that uses
+	// it, and streams their mip levels once per frame.
+	class TextureStreamer
+	{
+	public:
+		TextureStreamer(const std::shared_ptr<DX::DeviceResources>& deviceResources);
+
+		// Returns the texture of an image file, converting it to a block compressed
+		// DDS file first if there is none yet; see OpenCompressedTexture. That can take
+		// a while, so call it from a loading thread. Returns nullptr if the image
+		// could not be read.
+		std::shared_ptr<StreamedTexture> GetTexture(const std::wstring& fileName);
+
+		// Returns a texture of one texel of a solid color, for materials without a
+		// diffuse map.
+		std::shared_ptr<StreamedTexture> GetSolidTexture(const DirectX::XMFLOAT4& color);
+
+		// Creates the textures that are new or were released, then streams every
+		// texture that is still in use. Call once per frame on the rendering thread.
+		void Update();
+		void ReleaseDeviceDependentResources();
+
+		// GPU memory used by every texture in use.
+		uint64 GetResidentBytes();
+
+		// Makes every texture drop the levels it was not asked for at the next Update.
+		void Shrink();
+
+		// Without streaming, every texture has all of its levels on the GPU.
+		void SetStreamingEnabled(bool enabled)					{ m_streamingEnabled = enabled; }
+
+	private:
+		std::shared_ptr<StreamedTexture> FindOrAdd(const std::wstring& key, const std::function<std::shared_ptr<StreamedTexture>()>& create);
+
+		// Cached pointer to device resources.
+		std::shared_ptr<DX::DeviceResources>					m_deviceResources;
+
+		// Textures by file name, or by color for solid textures. Textures are owned by
+		// the meshes that use them.
+		std::mutex												m_mutex;
+		std::map<std::wstring, std::weak_ptr<StreamedTexture>>	m_textures;
+
+		// Images are converted one at a time, so that two meshes that load the same
+		// image do not both write its cache file.
+		std::mutex												m_conversionMutex;
+
+		bool													m_streamingEnabled = true;
+	};
+}
@@ -0,0 +1,3 @@
+// Permutation of GeometryShader.hlsl that passes texture coordinates on.
+#define TEXTURED
+#include "GeometryShader.hlsl"
@@ -0,0 +1,3 @@
+// Permutation of PixelShader.hlsl that modulates the color with a texture.
+#define TEXTURED
+#include "PixelShader.hlsl"
@@ -0,0 +1,86 @@
+#include "pch.h"
+#include "VertexLighting.h"
+
+#include <algorithm>
+
+using namespace Hololens_OBJRenderer;
+using namespace DirectX;
+
+LightingConstantBuffer Hololens_OBJRenderer::GetDefaultLighting()
+{
+	LightingConstantBuffer lighting;
+	XMStoreFloat4(&lighting.lightDirection, XMVector3Normalize(XMVectorSet(0.3f, 0.8f, 0.5f, 0.f)));
+	lighting.lightColor = XMFLOAT4(0.8f, 0.78f, 0.72f, 0.f);
+
+	// A hemisphere light: the sky color straight up, the floor color straight down.
+	const XMFLOAT3 sky(0.25f, 0.28f, 0.35f);
+	const XMFLOAT3 floor(0.12f, 0.1f, 0.08f);
+	lighting.ambient[0] = XMFLOAT4(0.5f * (sky.x + floor.x), 0.5f * (sky.x - floor.x), 0.f, 0.f);
+	lighting.ambient[1] = XMFLOAT4(0.5f * (sky.y + floor.y), 0.5f * (sky.y - floor.y), 0.f, 0.f);
+	lighting.ambient[2] = XMFLOAT4(0.5f * (sky.z + floor.z), 0.5f * (sky.z - floor.z), 0.f, 0.f);
+
+	lighting.albedo = XMFLOAT4(0.8f, 0.8f, 0.8f, 1.f);
+	return lighting;
+}
+
+// Same lighting as the per-vertex lit vertex shader, in structure of arrays form: each
+// SIMD lane holds one vertex.
+void Hololens_OBJRenderer::BakeVertexLighting(
+	const VertexPositionColor* vertices,
+	size_t vertexCount,
+	const LightingConstantBuffer& lighting,
+	std::vector<VertexPositionColor>& litVertices)
+{
+	litVertices.assign(vertices, vertices + vertexCount);
+
+	const XMVECTOR lightX = XMVectorReplicate(lighting.lightDirection.x);
+	const XMVECTOR lightY = XMVectorReplicate(lighting.lightDirection.y);
+	const XMVECTOR lightZ = XMVectorReplicate(lighting.lightDirection.z);
+
+	// The terms of each color channel, replicated across the lanes.
+	XMVECTOR ambient[3][4];
+	XMVECTOR lightColor[3];
+	XMVECTOR albedo[3];
+	for (size_t c = 0; c < 3; ++c)
+	{
+		ambient[c][0] = XMVectorReplicate(lighting.ambient[c].x);
+		ambient[c][1] = XMVectorReplicate(lighting.ambient[c].y);
+		ambient[c][2] = XMVectorReplicate(lighting.ambient[c].z);
+		ambient[c][3] = XMVectorReplicate(lighting.ambient[c].w);
+		lightColor[c] = XMVectorReplicate((&lighting.lightColor.x)[c]);
+		albedo[c] = XMVectorReplicate((&lighting.albedo.x)[c]);
+	}
+
+	for (size_t first = 0; first < vertexCount; first += 4)
+	{
+		// Lanes past the end repeat the last vertex, and are not written back.
+		const size_t laneCount = (std::min)(vertexCount - first, size_t(4));
+		const XMFLOAT3& n0 = vertices[first].color;
+		const XMFLOAT3& n1 = vertices[first + (std::min)(size_t(1), laneCount - 1)].color;
+		const XMFLOAT3& n2 = vertices[first + (std::min)(size_t(2), laneCount - 1)].color;
+		const XMFLOAT3& n3 = vertices[first + (std::min)(size_t(3), laneCount - 1)].color;
+		const XMVECTOR x = XMVectorSet(n0.x, n1.x, n2.x, n3.x);
+		const XMVECTOR y = XMVectorSet(n0.y, n1.y, n2.y, n3.y);
+		const XMVECTOR z = XMVectorSet(n0.z, n1.z, n2.z, n3.z);
+
+		const XMVECTOR nDotL = XMVectorSaturate(XMVectorMultiplyAdd(x, lightX, XMVectorMultiplyAdd(y, lightY, XMVectorMultiply(z, lightZ))));
+
+		XMFLOAT4A channels[3];
+		for (size_t c = 0; c < 3; ++c)
+		{
+			XMVECTOR irradiance = XMVectorMultiplyAdd(y, ambient[c][1], ambient[c][0]);
+			irradiance = XMVectorMultiplyAdd(z, ambient[c][2], irradiance);
+			irradiance = XMVectorMultiplyAdd(x, ambient[c][3], irradiance);
+			irradiance = XMVectorMultiplyAdd(nDotL, lightColor[c], irradiance);
+			XMStoreFloat4A(&channels[c], XMVectorSaturate(XMVectorMultiply(irradiance, albedo[c])));
+		}
+
+		for (size_t lane = 0; lane < laneCount; ++lane)
+		{
+			litVertices[first + lane].color = XMFLOAT3(
+				(&channels[0].x)[lane],
+				(&channels[1].x)[lane],
+				(&channels[2].x)[lane]);
+		}
+	}
+}
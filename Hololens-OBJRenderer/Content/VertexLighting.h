@@ -0,0 +1,36 @@
+#pragma once
+
+#include "ShaderStructures.h"
+
+#include <vector>
+
+namespace Hololens_OBJRenderer
+{
+	// How the renderer shades meshes. Each mode uses its own permutation of the
+	// instanced vertex shader; none lights per pixel.
+	enum class OBJShadingMode
+	{
+		// The vertex normals, shown as colors.
+		Normals,
+
+		// The lighting is computed once per vertex when the mesh is uploaded, and
+		// drawn as a plain color. Free at draw time, but the lighting turns with the
+		// mesh.
+		BakedLighting,
+
+		// The vertex shader lights each vertex in world space.
+		VertexLighting
+	};
+
+	// A light from above and in front, and a bluish sky over a dark floor.
+	LightingConstantBuffer GetDefaultLighting();
+
+	// Copies the vertices, with the color of each replaced by its lit color. The
+	// color of the source vertices must hold their normal, in mesh space. Vertices
+	// are lit four at a time, one in each SIMD lane.
+	void BakeVertexLighting(
+		const VertexPositionColor* vertices,
+		size_t vertexCount,
+		const LightingConstantBuffer& lighting,
+		std::vector<VertexPositionColor>& litVertices);
+}
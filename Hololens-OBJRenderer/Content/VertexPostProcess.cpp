@@ -0,0 +1,163 @@
+#include "pch.h"
+#include "VertexPostProcess.h"
+
+#include <float.h>
+
+using namespace Hololens_OBJRenderer;
+using namespace DirectX;
+
+namespace
+{
+	static_assert(sizeof(VertexPositionColor) == 6 * sizeof(float), "A block of four vertices must load as six vectors.");
+
+	// Four vertices, as six unaligned vectors. With p for the position and n for
+	// the normal in the color, the lanes hold:
+	//     v[0] = p0.x p0.y p0.z n0.x      v[3] = p2.x p2.y p2.z n2.x
+	//     v[1] = n0.y n0.z p1.x p1.y      v[4] = n2.y n2.z p3.x p3.y
+	//     v[2] = p1.z n1.x n1.y n1.z      v[5] = p3.z n3.x n3.y n3.z
+	struct VertexBlock
+	{
+		XMVECTOR v[6];
+
+		void Load(const VertexPositionColor* vertices)
+		{
+			const XMFLOAT4* source = reinterpret_cast<const XMFLOAT4*>(vertices);
+			for (size_t i = 0; i < 6; ++i)
+			{
+				v[i] = XMLoadFloat4(source + i);
+			}
+		}
+
+		void Store(VertexPositionColor* vertices) const
+		{
+			XMFLOAT4* destination = reinterpret_cast<XMFLOAT4*>(vertices);
+			for (size_t i = 0; i < 6; ++i)
+			{
+				XMStoreFloat4(destination + i, v[i]);
+			}
+		}
+	};
+
+	// Zero length normals stay zero.
+	inline XMVECTOR XM_CALLCONV ReciprocalLength(FXMVECTOR lengthSq)
+	{
+		return XMVectorSelect(XMVectorZero(), XMVectorReciprocalSqrt(lengthSq), XMVectorGreater(lengthSq, XMVectorZero()));
+	}
+
+	// Renormalizes the normals of a block, and widens the bounds by its positions.
+	// The fourth lane of the bounds is meaningless.
+	void NormalizeAndMeasure(VertexBlock& block, XMVECTOR& minimum, XMVECTOR& maximum)
+	{
+		XMVECTOR* v = block.v;
+
+		const XMVECTOR p1 = XMVectorPermute<2, 3, 4, 5>(v[1], v[2]);
+		const XMVECTOR p3 = XMVectorPermute<2, 3, 4, 5>(v[4], v[5]);
+		minimum = XMVectorMin(XMVectorMin(minimum, XMVectorMin(v[0], p1)), XMVectorMin(v[3], p3));
+		maximum = XMVectorMax(XMVectorMax(maximum, XMVectorMax(v[0], p1)), XMVectorMax(v[3], p3));
+
+		// Gather the normals into one vector per component.
+		const XMVECTOR n1 = XMVectorPermute<3, 5, 6, 7>(v[0], v[2]);	// n0.x n1.x n1.y n1.z
+		const XMVECTOR n3 = XMVectorPermute<3, 5, 6, 7>(v[3], v[5]);	// n2.x n3.x n3.y n3.z
+		const XMVECTOR n02 = XMVectorPermute<0, 1, 4, 5>(v[1], v[4]);	// n0.y n0.z n2.y n2.z
+		const XMVECTOR n13 = XMVectorPermute<2, 6, 3, 7>(n1, n3);		// n1.y n3.y n1.z n3.z
+		XMVECTOR x = XMVectorPermute<0, 1, 4, 5>(n1, n3);
+		XMVECTOR y = XMVectorPermute<0, 4, 2, 5>(n02, n13);
+		XMVECTOR z = XMVectorPermute<1, 6, 3, 7>(n02, n13);
+
+		const XMVECTOR scale = ReciprocalLength(XMVectorMultiplyAdd(x, x, XMVectorMultiplyAdd(y, y, XMVectorMultiply(z, z))));
+		x = XMVectorMultiply(x, scale);
+		y = XMVectorMultiply(y, scale);
+		z = XMVectorMultiply(z, scale);
+
+		// Scatter them back.
+		const XMVECTOR yz02 = XMVectorPermute<0, 4, 2, 6>(y, z);		// n0.y n0.z n2.y n2.z
+		const XMVECTOR xy13 = XMVectorPermute<1, 5, 3, 7>(x, y);		// n1.x n1.y n3.x n3.y
+		v[0] = XMVectorPermute<0, 1, 2, 4>(v[0], x);
+		v[1] = XMVectorPermute<4, 5, 2, 3>(v[1], yz02);
+		v[2] = XMVectorPermute<0, 1, 2, 5>(XMVectorPermute<0, 4, 5, 3>(v[2], xy13), z);
+		v[3] = XMVectorPermute<0, 1, 2, 6>(v[3], x);
+		v[4] = XMVectorPermute<6, 7, 2, 3>(v[4], yz02);
+		v[5] = XMVectorPermute<0, 1, 2, 7>(XMVectorPermute<0, 6, 7, 3>(v[5], xy13), z);
+	}
+
+	void NormalizeAndMeasure(VertexPositionColor& vertex, XMVECTOR& minimum, XMVECTOR& maximum)
+	{
+		const XMVECTOR position = XMLoadFloat3(&vertex.pos);
+		minimum = XMVectorMin(minimum, position);
+		maximum = XMVectorMax(maximum, position);
+
+		const XMVECTOR normal = XMLoadFloat3(&vertex.color);
+		XMStoreFloat3(&vertex.color, XMVectorMultiply(normal, ReciprocalLength(XMVector3LengthSq(normal))));
+	}
+}
+
+MeshBounds Hololens_OBJRenderer::PostProcessVertices(VertexPositionColor* vertices, size_t vertexCount, float size)
+{
+	MeshBounds bounds = {};
+	if (vertexCount == 0)
+	{
+		return bounds;
+	}
+
+	const size_t blockEnd = vertexCount & ~size_t(3);
+
+	XMVECTOR minimum = XMVectorReplicate(FLT_MAX);
+	XMVECTOR maximum = XMVectorReplicate(-FLT_MAX);
+	VertexBlock block;
+	for (size_t first = 0; first < blockEnd; first += 4)
+	{
+		block.Load(vertices + first);
+		NormalizeAndMeasure(block, minimum, maximum);
+		block.Store(vertices + first);
+	}
+	for (size_t i = blockEnd; i < vertexCount; ++i)
+	{
+		NormalizeAndMeasure(vertices[i], minimum, maximum);
+	}
+
+	// Each axis is scaled on its own. A flat axis is collapsed onto the center
+	// rather than divided by zero.
+	const XMVECTOR extent = XMVectorSubtract(maximum, minimum);
+	const XMVECTOR center = XMVectorScale(XMVectorAdd(maximum, minimum), 0.5f);
+	const XMVECTOR scale = XMVectorSelect(
+		XMVectorZero(),
+		XMVectorDivide(XMVectorReplicate(size), extent),
+		XMVectorGreater(extent, XMVectorZero()));
+	const XMVECTOR offset = XMVectorNegate(XMVectorMultiply(center, scale));
+
+	XMStoreFloat3(&bounds.min, XMVectorMultiplyAdd(minimum, scale, offset));
+	XMStoreFloat3(&bounds.max, XMVectorMultiplyAdd(maximum, scale, offset));
+
+	// The transform spread over the lanes of a block, leaving the normals as they
+	// are. Blocks repeat every three vectors.
+	const XMVECTOR one = XMVectorSplatOne();
+	const XMVECTOR blockScale[3] =
+	{
+		XMVectorPermute<0, 1, 2, 4>(scale, one),
+		XMVectorPermute<4, 5, 0, 1>(scale, one),
+		XMVectorPermute<2, 4, 5, 6>(scale, one)
+	};
+	const XMVECTOR zero = XMVectorZero();
+	const XMVECTOR blockOffset[3] =
+	{
+		XMVectorPermute<0, 1, 2, 4>(offset, zero),
+		XMVectorPermute<4, 5, 0, 1>(offset, zero),
+		XMVectorPermute<2, 4, 5, 6>(offset, zero)
+	};
+
+	for (size_t first = 0; first < blockEnd; first += 4)
+	{
+		block.Load(vertices + first);
+		for (size_t i = 0; i < 6; ++i)
+		{
+			block.v[i] = XMVectorMultiplyAdd(block.v[i], blockScale[i % 3], blockOffset[i % 3]);
+		}
+		block.Store(vertices + first);
+	}
+	for (size_t i = blockEnd; i < vertexCount; ++i)
+	{
+		XMStoreFloat3(&vertices[i].pos, XMVectorMultiplyAdd(XMLoadFloat3(&vertices[i].pos), scale, offset));
+	}
+
+	return bounds;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "ShaderStructures.h"
+#include "MeshCache.h"
+
+namespace Hololens_OBJRenderer
+{
+	// Meshes are centered and scaled to fit in a cube this many meters across.
+	constexpr float c_meshSize = 0.2f;
+
+	// Prepares freshly parsed vertices for drawing, in two passes over the vertex
+	// array. The first renormalizes the normals held in the vertex colors and
+	// measures the bounds of the positions; the second centers the positions and
+	// scales each axis to span size. Returns the bounds of the transformed vertices.
+	//
+	// Vertices are processed in blocks of four, loaded as six vectors. Positions are
+	// measured and transformed without leaving that layout, and normals are shuffled
+	// into one vector per component, so that four are normalized at once.
+	MeshBounds PostProcessVertices(VertexPositionColor* vertices, size_t vertexCount, float size);
+}
@@ -0,0 +1,60 @@
+#include "pch.h"
+#include "VertexQuantization.h"
+
+#include <algorithm>
+#include <math.h>
+
+using namespace Hololens_OBJRenderer;
+using namespace DirectX;
+
+namespace
+{
+	constexpr float c_maxUnorm16 = 65535.f;
+	constexpr float c_maxSnorm8 = 127.f;
+
+	inline uint16 QuantizeUnorm16(float value, float minimum, float extent)
+	{
+		const float normalized = extent > 0.f ? (value - minimum) / extent : 0.f;
+		return static_cast<uint16>((std::min)((std::max)(normalized, 0.f), 1.f) * c_maxUnorm16 + 0.5f);
+	}
+
+	inline uint32 QuantizeSnorm8(float value)
+	{
+		const float scaled = (std::min)((std::max)(value, -1.f), 1.f) * c_maxSnorm8;
+		return static_cast<uint32>(static_cast<int>(floorf(scaled + 0.5f)) & 0xff);
+	}
+}
+
+void Hololens_OBJRenderer::QuantizeVertices(
+	const VertexPositionColor* vertices,
+	size_t vertexCount,
+	const MeshBounds& bounds,
+	std::vector<VertexPositionColorCompact>& compactVertices)
+{
+	const XMFLOAT3 extent(bounds.max.x - bounds.min.x, bounds.max.y - bounds.min.y, bounds.max.z - bounds.min.z);
+
+	compactVertices.resize(vertexCount);
+	for (size_t i = 0; i < vertexCount; ++i)
+	{
+		const VertexPositionColor& vertex = vertices[i];
+		VertexPositionColorCompact& compact = compactVertices[i];
+
+		compact.pos[0] = QuantizeUnorm16(vertex.pos.x, bounds.min.x, extent.x);
+		compact.pos[1] = QuantizeUnorm16(vertex.pos.y, bounds.min.y, extent.y);
+		compact.pos[2] = QuantizeUnorm16(vertex.pos.z, bounds.min.z, extent.z);
+		compact.pos[3] = 0;
+
+		// R8G8B8A8: red is the lowest byte.
+		compact.color =
+			QuantizeSnorm8(vertex.color.x) |
+			(QuantizeSnorm8(vertex.color.y) << 8) |
+			(QuantizeSnorm8(vertex.color.z) << 16);
+	}
+}
+
+XMMATRIX XM_CALLCONV Hololens_OBJRenderer::GetDequantizationTransform(const MeshBounds& bounds)
+{
+	return XMMatrixMultiply(
+		XMMatrixScaling(bounds.max.x - bounds.min.x, bounds.max.y - bounds.min.y, bounds.max.z - bounds.min.z),
+		XMMatrixTranslation(bounds.min.x, bounds.min.y, bounds.min.z));
+}
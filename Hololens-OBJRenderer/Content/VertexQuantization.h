@@ -0,0 +1,31 @@
+#pragma once
+
+#include "ShaderStructures.h"
+#include "MeshCache.h"
+
+#include <vector>
+
+namespace Hololens_OBJRenderer
+{
+	// Which vertex layout the renderer uploads to the GPU.
+	enum class OBJVertexFormat
+	{
+		// VertexPositionColor: full precision floats.
+		Full,
+
+		// VertexPositionColorCompact: half the size, for half the vertex fetch bandwidth.
+		Compact
+	};
+
+	// Converts vertices to the compact layout. Positions are quantized within bounds,
+	// which must enclose every vertex.
+	void QuantizeVertices(
+		const VertexPositionColor* vertices,
+		size_t vertexCount,
+		const MeshBounds& bounds,
+		std::vector<VertexPositionColorCompact>& compactVertices);
+
+	// The transform that takes a quantized position, as read by the input assembler
+	// in the range [0, 1], back into mesh space. Prepend it to the model transform.
+	DirectX::XMMATRIX XM_CALLCONV GetDequantizationTransform(const MeshBounds& bounds);
+}
@@ -27,6 +27,11 @@ Hololens_OBJRendererMain::Hololens_OBJRendererMain(const std::shared_ptr<DX::Dev
 
 void Hololens_OBJRendererMain::SetHolographicSpace(HolographicSpace^ holographicSpace)
 {
+#ifdef PIPELINE_UPDATE_AND_RENDER
+    // The scene is rebuilt for the new space.
+    StopUpdateThread();
+#endif
+
     UnregisterHolographicEventHandlers();
 
     m_holographicSpace = holographicSpace;
@@ -38,11 +43,71 @@ void Hololens_OBJRendererMain::SetHolographicSpace(HolographicSpace^ holographic
 #ifdef DRAW_SAMPLE_CONTENT
     // Initialize the sample hologram.
     //m_spinningCubeRenderer = std::make_unique<SpinningCubeRenderer>(m_deviceResources);
-	m_objRenderer = std::make_unique<OBJRenderer>(m_deviceResources, "bunny.obj");
+    m_resourceCache = std::make_shared<ResourceCache>(m_deviceResources);
+    m_objRenderer = std::make_unique<OBJRenderer>(m_deviceResources, m_resourceCache);
+#ifdef RECORD_WITH_DEFERRED_CONTEXTS
+    m_objRenderer->SetDeferredRecordingEnabled(true);
+#endif
+
+#ifdef PERSIST_SCENE
+    // The saved scene takes the place of the sample model. Its models are loaded
+    // as UpdateScene finds them near the user.
+    m_scenePersistence = std::make_unique<ScenePersistence>();
+    if (!m_scenePersistence->Restore(*m_objRenderer))
+#endif
+    {
+        // The model is parsed off the UI thread; frames keep being presented until it
+        // is ready to be drawn. The instance is drawn as soon as its mesh is ready.
+        m_objRenderer->LoadAsync(
+            "bunny.obj",
+            OBJLoadMode::MemoryMappedParallel,
+            [](float progress)
+            {
+                wchar_t message[64];
+                swprintf_s(message, L"bunny.obj: %.0f%% parsed.\n", progress * 100.f);
+                OutputDebugStringW(message);
+            }).then([this](task<void> loadTask)
+            {
+                try
+                {
+                    loadTask.get();
+
+                    wchar_t message[96];
+                    const MeshOptimizationStats& stats = m_objRenderer->GetMesh("bunny.obj")->GetOptimizationStats();
+                    swprintf_s(message, L"bunny.obj is ready. ACMR %.3f (was %.3f).\n", stats.acmrAfter, stats.acmrBefore);
+                    OutputDebugStringW(message);
+                }
+                catch (Exception^ exception)
+                {
+                    OutputDebugStringW((L"bunny.obj failed to load: " + exception->Message + L"\n")->Data());
+                }
+            });
+        m_objRenderer->AddInstance("bunny.obj", { 0.f, 0.f, 0.f });
+    }
+
+#ifdef SELECT_STEREO_MODE_AT_STARTUP
+    // Shares the model with the sample hologram through the resource cache.
+    m_stereoModeBenchmark = std::make_unique<StereoModeBenchmark>(m_deviceResources, m_resourceCache, "bunny.obj");
+#endif
 
     m_spatialInputHandler = std::make_unique<SpatialInputHandler>();
 #endif
 
+#ifdef RUN_BENCHMARKS
+    m_benchmark = std::make_unique<OBJBenchmark>(m_deviceResources);
+    m_benchmark->RunAsync().then([](task<void> benchmarkTask)
+    {
+        try
+        {
+            benchmarkTask.get();
+        }
+        catch (Exception^ exception)
+        {
+            OutputDebugStringW((L"The benchmark failed: " + exception->Message + L"\n")->Data());
+        }
+    });
+#endif
+
     // Use the default SpatialLocator to track the motion of the device.
     m_locator = SpatialLocator::GetDefault();
 
@@ -84,6 +149,32 @@ void Hololens_OBJRendererMain::SetHolographicSpace(HolographicSpace^ holographic
     // with the origin placed at the device's position as the app is launched.
     m_referenceFrame = m_locator->CreateStationaryFrameOfReferenceAtCurrentLocation();
 
+#if defined(DRAW_SAMPLE_CONTENT) && defined(OCCLUDE_WITH_SPATIAL_SURFACES)
+    // Observe the surfaces around the place the app was launched from.
+    m_spatialSurfaceRenderer = std::make_unique<SpatialSurfaceRenderer>(m_deviceResources);
+    m_spatialSurfaceRenderer->StartObserving(m_referenceFrame->CoordinateSystem).then([this](task<bool> observeTask)
+    {
+        // Without spatial mapping, holograms are drawn without occlusion.
+        try
+        {
+            if (observeTask.get())
+            {
+                return;
+            }
+            OutputDebugStringW(L"Spatial mapping access was denied; occlusion is off.\n");
+        }
+        catch (Exception^ exception)
+        {
+            OutputDebugStringW((L"Spatial mapping failed to start; occlusion is off: " + exception->Message + L"\n")->Data());
+        }
+        m_occludeWithSpatialSurfaces = false;
+    });
+#endif
+
+#ifdef PIPELINE_UPDATE_AND_RENDER
+    StartUpdateThread();
+#endif
+
     // Notes on spatial tracking APIs:
     // * Stationary reference frames are designed to provide a best-fit position relative to the
     //   overall space. Individual positions within that reference frame are allowed to drift slightly
@@ -122,6 +213,10 @@ void Hololens_OBJRendererMain::UnregisterHolographicEventHandlers()
 
 Hololens_OBJRendererMain::~Hololens_OBJRendererMain()
 {
+#ifdef PIPELINE_UPDATE_AND_RENDER
+    StopUpdateThread();
+#endif
+
     // Deregister device notification.
     m_deviceResources->RegisterDeviceNotify(nullptr);
 
@@ -131,6 +226,9 @@ Hololens_OBJRendererMain::~Hololens_OBJRendererMain()
 // Updates the application state once per frame.
 HolographicFrame^ Hololens_OBJRendererMain::Update()
 {
+    DX::FrameProfiler& profiler = m_deviceResources->GetFrameProfiler();
+    DX::FrameProfiler::ScopedCpuTimer updateTimer(profiler, DX::FrameProfiler::CpuScope::Update);
+
     // Before doing the timer update, there is some work to do per-frame
     // to maintain holographic rendering. First, we will get information
     // about the current frame.
@@ -144,6 +242,18 @@ HolographicFrame^ Hololens_OBJRendererMain::Update()
     // is presented.
     HolographicFramePrediction^ prediction = holographicFrame->CurrentPrediction;
 
+#ifdef SCALE_RESOLUTION_WITH_GPU_TIME
+    // Give the scaler the GPU times that arrived since the last frame; they are a
+    // few frames old. The viewport of each camera follows its scale before the
+    // camera resources are updated.
+    if (profiler.GetGpuFrameCount() != m_gpuTimesScaled)
+    {
+        m_gpuTimesScaled = profiler.GetGpuFrameCount();
+        m_resolutionScaler.AddGpuTime(profiler.GetLatestGpuTime());
+    }
+    m_resolutionScaler.ApplyTo(prediction);
+#endif
+
     // Back buffers can change from frame to frame. Validate each buffer, and recreate
     // resource views and depth buffers as needed.
     m_deviceResources->EnsureCameraResources(holographicFrame, prediction);
@@ -154,36 +264,30 @@ HolographicFrame^ Hololens_OBJRendererMain::Update()
     SpatialCoordinateSystem^ currentCoordinateSystem = m_referenceFrame->CoordinateSystem;
 
 #ifdef DRAW_SAMPLE_CONTENT
-    // Check for new input state since the last frame.
-    SpatialInteractionSourceState^ pointerState = m_spatialInputHandler->CheckForInput();
-    if (pointerState != nullptr)
-    {
-        // When a Pressed gesture is detected, the sample hologram will be repositioned
-        // two meters in front of the user.
-        //m_spinningCubeRenderer->PositionHologram(
-        //    pointerState->TryGetPointerPose(currentCoordinateSystem)
-        //    );
-		m_objRenderer->PositionHologram(
-			pointerState->TryGetPointerPose(currentCoordinateSystem)
-			);
-    }
+    // Meshes over the memory budget are evicted before the scene is drawn.
+    m_resourceCache->Update();
 #endif
 
-    m_timer.Tick([&] ()
+#ifdef PIPELINE_UPDATE_AND_RENDER
+    // Let the update thread simulate the next frame while this one is rendered, and
+    // draw the newest scene it has finished. A slow update only makes the scene
+    // lag; it does not hold up the frame.
     {
-        //
-        // TODO: Update scene objects.
-        //
-        // Put time-based updates here. By default this code will run once per frame,
-        // but if you change the StepTimer to use a fixed time step this code will
-        // run as many times as needed to get to the current step.
-        //
+        std::lock_guard<std::mutex> lock(m_updateMutex);
+        ++m_frameNumber;
+    }
+    m_updateCondition.notify_one();
 
 #ifdef DRAW_SAMPLE_CONTENT
-        //m_spinningCubeRenderer->Update(m_timer);
-		m_objRenderer->Update(m_timer);
+    m_objRenderer->ApplySimulation();
+#endif
+#else
+    UpdateScene(currentCoordinateSystem);
+#endif
+
+#if defined(DRAW_SAMPLE_CONTENT) && defined(OCCLUDE_WITH_SPATIAL_SURFACES)
+    m_spatialSurfaceRenderer->Update(currentCoordinateSystem);
 #endif
-    });
 
     // We complete the frame update by using information about our content positioning
     // to set the focus point.
@@ -209,7 +313,7 @@ HolographicFrame^ Hololens_OBJRendererMain::Update()
         //    );
 		renderingParameters->SetFocusPoint(
 			currentCoordinateSystem,
-			m_objRenderer->GetPosition()
+			m_objRenderer->GetDisplayedPosition()
 			);
 #endif
     }
@@ -219,16 +323,114 @@ HolographicFrame^ Hololens_OBJRendererMain::Update()
     return holographicFrame;
 }
 
+// Handles input and advances the scene. Runs on the update thread when updates are
+// pipelined, and as part of Update otherwise.
+void Hololens_OBJRendererMain::UpdateScene(SpatialCoordinateSystem^ coordinateSystem)
+{
+#ifdef DRAW_SAMPLE_CONTENT
+    // Check for new input state since the last frame.
+    SpatialInteractionSourceState^ pointerState = m_spatialInputHandler->CheckForInput();
+    if (pointerState != nullptr)
+    {
+        // When a Pressed gesture is detected, the sample hologram will be repositioned
+        // two meters in front of the user.
+        //m_spinningCubeRenderer->PositionHologram(
+        //    pointerState->TryGetPointerPose(coordinateSystem)
+        //    );
+		m_objRenderer->PositionHologram(
+			pointerState->TryGetPointerPose(coordinateSystem)
+			);
+#ifdef PERSIST_SCENE
+        m_scenePersistence->OnScenePlaced();
+#endif
+    }
+
+#ifdef PERSIST_SCENE
+    // Restored models follow their anchors, and start loading nearest the user.
+    m_scenePersistence->Update(*m_objRenderer, coordinateSystem);
+#endif
+#endif
+
+    m_timer.Tick([&] ()
+    {
+        //
+        // TODO: Update scene objects.
+        //
+        // Put time-based updates here. By default this code will run once per frame,
+        // but if you change the StepTimer to use a fixed time step this code will
+        // run as many times as needed to get to the current step.
+        //
+
+#ifdef DRAW_SAMPLE_CONTENT
+        //m_spinningCubeRenderer->Update(m_timer);
+#ifdef PIPELINE_UPDATE_AND_RENDER
+		m_objRenderer->Simulate(m_timer);
+#else
+		m_objRenderer->Update(m_timer);
+#endif
+#endif
+    });
+}
+
+#ifdef PIPELINE_UPDATE_AND_RENDER
+void Hololens_OBJRendererMain::StartUpdateThread()
+{
+    m_stopUpdating = false;
+    m_updateThread = std::thread([this]()
+    {
+        // Simulate once for every frame the rendering thread starts. Frames that
+        // start while a simulation is running are caught up with a single one.
+        uint64 simulatedFrame = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_updateMutex);
+                m_updateCondition.wait(lock, [this, &simulatedFrame]() { return m_stopUpdating || m_frameNumber != simulatedFrame; });
+                if (m_stopUpdating)
+                {
+                    return;
+                }
+                simulatedFrame = m_frameNumber;
+            }
+
+            UpdateScene(m_referenceFrame->CoordinateSystem);
+        }
+    });
+}
+
+void Hololens_OBJRendererMain::StopUpdateThread()
+{
+    if (!m_updateThread.joinable())
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_updateMutex);
+        m_stopUpdating = true;
+    }
+    m_updateCondition.notify_all();
+    m_updateThread.join();
+}
+#endif
+
 // Renders the current frame to each holographic camera, according to the
 // current application and spatial positioning state. Returns true if the
 // frame was rendered to at least one camera.
 bool Hololens_OBJRendererMain::Render(Windows::Graphics::Holographic::HolographicFrame^ holographicFrame)
 {
-    // Don't try to render anything before the first Update.
+    DX::FrameProfiler& profiler = m_deviceResources->GetFrameProfiler();
+    DX::FrameProfiler::ScopedCpuTimer renderTimer(profiler, DX::FrameProfiler::CpuScope::Render);
+
+#ifndef PIPELINE_UPDATE_AND_RENDER
+    // Don't try to render anything before the first Update. With pipelined updates,
+    // the timer belongs to the update thread, and the sample content simply appears
+    // with the first snapshot.
     if (m_timer.GetFrameCount() == 0)
     {
         return false;
     }
+#endif
 
     //
     // TODO: Add code for pre-pass rendering here.
@@ -238,26 +440,84 @@ bool Hololens_OBJRendererMain::Render(Windows::Graphics::Holographic::Holographi
     // matrix, such as lighting maps.
     //
 
+#ifdef RUN_BENCHMARKS
+    // The render benchmark draws offscreen, ahead of the cameras.
+    m_benchmark->Render();
+#endif
+
+#if defined(DRAW_SAMPLE_CONTENT) && defined(SELECT_STEREO_MODE_AT_STARTUP)
+    // So does the stereo mode benchmark, until it has picked a mode.
+    if (m_stereoModeBenchmark != nullptr)
+    {
+        m_stereoModeBenchmark->Render();
+        if (m_stereoModeBenchmark->IsComplete())
+        {
+            m_objRenderer->SetStereoMode(m_stereoModeBenchmark->GetFastestMode());
+            m_stereoModeBenchmark.reset();
+        }
+    }
+#endif
+
     // Lock the set of holographic camera resources, then draw to each camera
     // in this frame.
     return m_deviceResources->UseHolographicCameraResources<bool>(
-        [this, holographicFrame](std::map<UINT32, std::unique_ptr<DX::CameraResources>>& cameraResourceMap)
+        [this, holographicFrame, &profiler](std::map<UINT32, std::unique_ptr<DX::CameraResources>>& cameraResourceMap)
     {
+        DX::FrameProfiler::ScopedCpuTimer camerasTimer(profiler, DX::FrameProfiler::CpuScope::RenderCameras);
+
         // Up-to-date frame predictions enhance the effectiveness of image stablization and
-        // allow more accurate positioning of holograms.
+        // allow more accurate positioning of holograms. Everything that does not depend
+        // on the camera pose is done by now, so the pose used for the view/projection
+        // upload is as recent as it gets.
         holographicFrame->UpdateCurrentPrediction();
         HolographicFramePrediction^ prediction = holographicFrame->CurrentPrediction;
 
-        bool atLeastOneCameraRendered = false;
+        // The view and projection matrices for each holographic camera will change
+        // every frame. Every camera is brought up to date first, so that the draw
+        // calls of all of them can be recorded at once.
+        m_frameCameras.clear();
         for (auto cameraPose : prediction->CameraPoses)
         {
             // This represents the device-based resources for a HolographicCamera.
             DX::CameraResources* pCameraResources = cameraResourceMap[cameraPose->HolographicCamera->Id].get();
+            pCameraResources->UpdateViewProjectionBuffer(m_deviceResources, cameraPose, m_referenceFrame->CoordinateSystem);
+
+            // Only render world-locked content when positional tracking is active.
+            const bool cameraActive = pCameraResources->AttachViewProjectionBuffer(m_deviceResources);
+            m_frameCameras.push_back({ pCameraResources, cameraActive });
+        }
+
+#ifdef DRAW_SAMPLE_CONTENT
+        // Cull the sample hologram for every active camera, and, with deferred
+        // recording, record the command lists of all of them in parallel. They are
+        // executed in camera order below.
+        m_activeCameras.clear();
+        for (const auto& frameCamera : m_frameCameras)
+        {
+            if (frameCamera.second)
+            {
+                m_activeCameras.push_back(frameCamera.first);
+            }
+        }
+#ifdef OCCLUDE_WITH_SPATIAL_SURFACES
+        m_objRenderer->SetOcclusionCullingEnabled(m_occludeWithSpatialSurfaces && m_spatialSurfaceRenderer->HasSurfaces());
+#endif
+        m_objRenderer->PrepareCameras(m_activeCameras.data(), m_activeCameras.size());
+        size_t activeCamera = 0;
+#endif
+
+        bool atLeastOneCameraRendered = false;
+        for (const auto& frameCamera : m_frameCameras)
+        {
+            DX::CameraResources* pCameraResources = frameCamera.first;
 
             // Get the device context.
             const auto context = m_deviceResources->GetD3DDeviceContext();
             const auto depthStencilView = pCameraResources->GetDepthStencilView();
 
+            // Time everything the GPU does for this camera.
+            profiler.BeginGpuScope(context);
+
             // Set render targets to the current holographic camera.
             ID3D11RenderTargetView *const targets[1] = { pCameraResources->GetBackBufferRenderTargetView() };
             context->OMSetRenderTargets(1, targets, depthStencilView);
@@ -283,24 +543,29 @@ bool Hololens_OBJRendererMain::Render(Windows::Graphics::Holographic::Holographi
             //      also clear the screen to Transparent as shown above.
             //
 
-
-            // The view and projection matrices for each holographic camera will change
-            // every frame. This function refreshes the data in the constant buffer for
-            // the holographic camera indicated by cameraPose.
-            pCameraResources->UpdateViewProjectionBuffer(m_deviceResources, cameraPose, m_referenceFrame->CoordinateSystem);
-
-            // Attach the view/projection constant buffer for this camera to the graphics pipeline.
-            bool cameraActive = pCameraResources->AttachViewProjectionBuffer(m_deviceResources);
-
 #ifdef DRAW_SAMPLE_CONTENT
-            // Only render world-locked content when positional tracking is active.
-            if (cameraActive)
+            if (frameCamera.second)
             {
+                // The view/projection buffer of the last camera attached is bound; bind
+                // the one of this camera.
+                pCameraResources->BindViewProjectionBuffer(context);
+
+#ifdef OCCLUDE_WITH_SPATIAL_SURFACES
+                // Lay down the depth of the real world first. Holograms behind it then
+                // fail the depth test, and whole batches of them are skipped before
+                // they are shaded.
+                if (m_occludeWithSpatialSurfaces)
+                {
+                    m_spatialSurfaceRenderer->RenderDepth();
+                }
+#endif
+
                 // Draw the sample hologram.
                 //m_spinningCubeRenderer->Render();
-				m_objRenderer->Render();
+                m_objRenderer->RenderCamera(activeCamera++);
             }
 #endif
+            profiler.EndGpuScope(context);
             atLeastOneCameraRendered = true;
         }
 
@@ -310,22 +575,38 @@ bool Hololens_OBJRendererMain::Render(Windows::Graphics::Holographic::Holographi
 
 void Hololens_OBJRendererMain::SaveAppState()
 {
-    //
-    // TODO: Insert code here to save your app state.
-    //       This method is called when the app is about to suspend.
-    //
-    //       For example, store information in the SpatialAnchorStore.
-    //
+#ifdef PIPELINE_UPDATE_AND_RENDER
+    // The update thread moves the scene that is saved below. It stays stopped
+    // until the app resumes.
+    StopUpdateThread();
+#endif
+
+#ifdef DRAW_SAMPLE_CONTENT
+    // Give back the memory of everything that is not in view, so that the
+    // suspended app is less likely to be terminated to make room for others.
+    m_resourceCache->Trim();
+#endif
+
+#if defined(DRAW_SAMPLE_CONTENT) && defined(PERSIST_SCENE)
+    // The app may not be resumed, so the scene is anchored where it is now.
+    m_scenePersistence->Save(*m_objRenderer, m_referenceFrame->CoordinateSystem);
+#endif
 }
 
 void Hololens_OBJRendererMain::LoadAppState()
 {
-    //
-    // TODO: Insert code here to load your app state.
-    //       This method is called when the app resumes.
-    //
-    //       For example, load information from the SpatialAnchorStore.
-    //
+#if defined(DRAW_SAMPLE_CONTENT) && defined(PERSIST_SCENE)
+    // Whatever is loaded stays loaded; the scene only moves to where its anchors
+    // are now.
+    m_scenePersistence->OnResuming();
+#endif
+
+#ifdef PIPELINE_UPDATE_AND_RENDER
+    if (m_referenceFrame != nullptr)
+    {
+        StartUpdateThread();
+    }
+#endif
 }
 
 // Notifies classes that use Direct3D device resources that the device resources
@@ -335,6 +616,20 @@ void Hololens_OBJRendererMain::OnDeviceLost()
 #ifdef DRAW_SAMPLE_CONTENT
     //m_spinningCubeRenderer->ReleaseDeviceDependentResources();
 	m_objRenderer->ReleaseDeviceDependentResources();
+    m_resourceCache->ReleaseDeviceDependentResources();
+#ifdef OCCLUDE_WITH_SPATIAL_SURFACES
+    m_spatialSurfaceRenderer->ReleaseDeviceDependentResources();
+#endif
+#ifdef SELECT_STEREO_MODE_AT_STARTUP
+    if (m_stereoModeBenchmark != nullptr)
+    {
+        m_stereoModeBenchmark->ReleaseDeviceDependentResources();
+    }
+#endif
+#endif
+
+#ifdef RUN_BENCHMARKS
+    m_benchmark->ReleaseDeviceDependentResources();
 #endif
 }
 
@@ -345,6 +640,20 @@ void Hololens_OBJRendererMain::OnDeviceRestored()
 #ifdef DRAW_SAMPLE_CONTENT
     //m_spinningCubeRenderer->CreateDeviceDependentResources();
 	m_objRenderer->CreateDeviceDependentResources();
+    m_resourceCache->CreateDeviceDependentResources();
+#ifdef OCCLUDE_WITH_SPATIAL_SURFACES
+    m_spatialSurfaceRenderer->CreateDeviceDependentResources();
+#endif
+#ifdef SELECT_STEREO_MODE_AT_STARTUP
+    if (m_stereoModeBenchmark != nullptr)
+    {
+        m_stereoModeBenchmark->CreateDeviceDependentResources();
+    }
+#endif
+#endif
+
+#ifdef RUN_BENCHMARKS
+    m_benchmark->CreateDeviceDependentResources();
 #endif
 }
 
@@ -10,13 +10,84 @@
 //
 #define DRAW_SAMPLE_CONTENT
 
+//
+// Comment out this preprocessor definition to draw the sample content without
+// occlusion by the spatial mapping surfaces. Requires the spatialPerception
+// capability.
+//
+#define OCCLUDE_WITH_SPATIAL_SURFACES
+
+//
+// Comment out this preprocessor definition to record the draw calls of the sample
+// content on the immediate context only. When defined, the cameras with many draw
+// calls are recorded into deferred contexts on the thread pool, all at once, and
+// then executed camera by camera.
+//
+#define RECORD_WITH_DEFERRED_CONTEXTS
+
+//
+// Comment out this preprocessor definition to always draw both eyes of the sample
+// content the way the device supports best on paper: VPRT, or else a geometry
+// shader. When defined, every supported way is timed for a few frames at
+// startup, and the fastest one is kept.
+//
+#define SELECT_STEREO_MODE_AT_STARTUP
+
+//
+// Uncomment this preprocessor definition to simulate the scene on a thread of its
+// own, one frame ahead of rendering. The rendering thread draws the newest finished
+// snapshot of the scene, so slow updates no longer delay frames.
+//
+//#define PIPELINE_UPDATE_AND_RENDER
+
+//
+// Comment out this preprocessor definition to always render at the full resolution
+// of the back buffers. When defined, the viewport of each camera shrinks while
+// the GPU time of the frames is over budget, and grows back once there is
+// headroom again.
+//
+#define SCALE_RESOLUTION_WITH_GPU_TIME
+
+//
+// Comment out this preprocessor definition to start from the sample model every
+// time. When defined, the placed models are saved with spatial anchors when the
+// app suspends, and restored at the next launch, nearest the user first.
+// Requires the spatialPerception capability.
+//
+#define PERSIST_SCENE
+
+//
+// Uncomment this preprocessor definition to run the load and render benchmarks in
+// place of the sample content. Results are written to the debugger output and to
+// LocalFolder\benchmark\results.csv.
+//
+//#define RUN_BENCHMARKS
+
+#ifdef RUN_BENCHMARKS
+// Nothing else competes with the benchmarks for the CPU and the GPU.
+#undef DRAW_SAMPLE_CONTENT
+#endif
+
 #include "Common\DeviceResources.h"
+#include "Common\ResolutionScaler.h"
 #include "Common\StepTimer.h"
 
+#ifdef PIPELINE_UPDATE_AND_RENDER
+#include <condition_variable>
+#include <thread>
+#endif
+
 #ifdef DRAW_SAMPLE_CONTENT
 #include "Content\SpinningCubeRenderer.h"
 #include "Content\OBJRenderer.h"
 #include "Content\SpatialInputHandler.h"
+#include "Content\SpatialSurfaceRenderer.h"
+#include "Content\StereoModeBenchmark.h"
+#include "Content\ScenePersistence.h"
+#endif
+
+#ifdef RUN_BENCHMARKS
+#include "Content\OBJBenchmark.h"
 #endif
 
 // Updates, renders, and presents holographic content using Direct3D.
@@ -42,6 +113,10 @@ namespace Hololens_OBJRenderer
         void SaveAppState();
         void LoadAppState();
 
+        // Current viewport scale and GPU headroom.
+        const DX::ResolutionScaler& GetResolutionScaler() const         { return m_resolutionScaler; }
+        DX::ResolutionScaler& GetResolutionScaler()                     { return m_resolutionScaler; }
+
         // IDeviceNotify
         virtual void OnDeviceLost();
         virtual void OnDeviceRestored();
@@ -67,24 +142,81 @@ namespace Hololens_OBJRenderer
         // and when tearing down AppMain.
         void UnregisterHolographicEventHandlers();
 
+        // Handles input and advances the scene by one timer tick.
+        void UpdateScene(Windows::Perception::Spatial::SpatialCoordinateSystem^ coordinateSystem);
+
+#ifdef PIPELINE_UPDATE_AND_RENDER
+        // Runs UpdateScene on the update thread, once per frame started by Update.
+        void StartUpdateThread();
+        void StopUpdateThread();
+#endif
+
 #ifdef DRAW_SAMPLE_CONTENT
         // Renders a colorful holographic cube that's 20 centimeters wide. This sample content
         // is used to demonstrate world-locked rendering.
         std::unique_ptr<SpinningCubeRenderer>                           m_spinningCubeRenderer;
 
+        // Meshes and textures of the sample content, within a memory budget.
+        std::shared_ptr<ResourceCache>                                  m_resourceCache;
+
 		// Pointer to the OBJRenderer object
 		std::unique_ptr<OBJRenderer>									m_objRenderer;
 
+        // The cameras of the frame being rendered that are tracked, in camera order.
+        std::vector<const DX::CameraResources*>                         m_activeCameras;
+
+#ifdef OCCLUDE_WITH_SPATIAL_SURFACES
+        // Draws the real world into the depth buffer, so that it hides the holograms
+        // behind it.
+        std::unique_ptr<SpatialSurfaceRenderer>                         m_spatialSurfaceRenderer;
+
+        // Cleared if spatial mapping could not be started, which turns occlusion off.
+        std::atomic<bool>                                               m_occludeWithSpatialSurfaces = { true };
+#endif
+
+#ifdef SELECT_STEREO_MODE_AT_STARTUP
+        // Times each stereo mode of the OBJ renderer on the sample model. Released
+        // once the fastest is picked.
+        std::unique_ptr<StereoModeBenchmark>                            m_stereoModeBenchmark;
+#endif
+
+#ifdef PERSIST_SCENE
+        // Saves the placed models on suspending, and brings them back at launch.
+        std::unique_ptr<ScenePersistence>                               m_scenePersistence;
+#endif
+
         // Listens for the Pressed spatial input event.
         std::shared_ptr<SpatialInputHandler>                            m_spatialInputHandler;
 #endif
 
+#ifdef RUN_BENCHMARKS
+        // Loads the benchmark corpus, then draws it offscreen.
+        std::unique_ptr<OBJBenchmark>                                   m_benchmark;
+#endif
+
         // Cached pointer to device resources.
         std::shared_ptr<DX::DeviceResources>                            m_deviceResources;
 
-        // Render loop timer.
+        // Render loop timer. Ticked by the update thread when updates are pipelined.
         DX::StepTimer                                                   m_timer;
 
+        // Picks the viewport scale from the GPU times of the profiler, and the number
+        // of GPU times it was given.
+        DX::ResolutionScaler                                            m_resolutionScaler;
+        size_t                                                          m_gpuTimesScaled = 0;
+
+        // The cameras of the frame being rendered, and whether each one is tracked.
+        std::vector<std::pair<DX::CameraResources*, bool>>              m_frameCameras;
+
+#ifdef PIPELINE_UPDATE_AND_RENDER
+        // The update thread, and the count of frames started, which wakes it up.
+        std::thread                                                     m_updateThread;
+        std::mutex                                                      m_updateMutex;
+        std::condition_variable                                         m_updateCondition;
+        uint64                                                          m_frameNumber = 0;
+        bool                                                            m_stopUpdating = false;
+#endif
+
         // Represents the holographic space around the user.
         Windows::Graphics::Holographic::HolographicSpace^               m_holographicSpace;
 
@@ -4,6 +4,7 @@
 #include <array>
 #include <d2d1_2.h>
 #include <d3d11_4.h>
+#include <DirectXCollision.h>
 #include <DirectXColors.h>
 #include <dwrite_2.h>
 #include <map>